@@ -0,0 +1,135 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation subset of TinyUSB's class/video/video.h
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+    VIDEO_SUBCLASS_UNDEFINED = 0x00,
+    VIDEO_SUBCLASS_CONTROL,
+    VIDEO_SUBCLASS_STREAMING,
+    VIDEO_SUBCLASS_INTERFACE_COLLECTION,
+  } video_subclass_type_t;
+
+  typedef enum
+  {
+    VIDEO_ITF_PROTOCOL_UNDEFINED = 0x00,
+    VIDEO_ITF_PROTOCOL_15,
+  } video_interface_protocol_code_t;
+
+  typedef enum
+  {
+    VIDEO_CS_ITF_VC_UNDEFINED = 0x00,
+    VIDEO_CS_ITF_VC_HEADER,
+    VIDEO_CS_ITF_VC_INPUT_TERMINAL,
+    VIDEO_CS_ITF_VC_OUTPUT_TERMINAL,
+    VIDEO_CS_ITF_VC_SELECTOR_UNIT,
+    VIDEO_CS_ITF_VC_PROCESSING_UNIT,
+    VIDEO_CS_ITF_VC_EXTENSION_UNIT,
+    VIDEO_CS_ITF_VC_ENCODING_UNIT,
+    VIDEO_CS_ITF_VC_MAX,
+  } video_cs_vc_interface_subtype_t;
+
+  typedef enum
+  {
+    VIDEO_CS_ITF_VS_UNDEFINED = 0x00,
+    VIDEO_CS_ITF_VS_INPUT_HEADER = 0x01,
+    VIDEO_CS_ITF_VS_OUTPUT_HEADER = 0x02,
+    VIDEO_CS_ITF_VS_STILL_IMAGE_FRAME = 0x03,
+    VIDEO_CS_ITF_VS_FORMAT_UNCOMPRESSED = 0x04,
+    VIDEO_CS_ITF_VS_FRAME_UNCOMPRESSED = 0x05,
+    VIDEO_CS_ITF_VS_FORMAT_MJPEG = 0x06,
+    VIDEO_CS_ITF_VS_FRAME_MJPEG = 0x07,
+    VIDEO_CS_ITF_VS_FORMAT_MPEG2TS = 0x0A,
+    VIDEO_CS_ITF_VS_FORMAT_DV = 0x0C,
+    VIDEO_CS_ITF_VS_COLORFORMAT = 0x0D,
+    VIDEO_CS_ITF_VS_FORMAT_FRAME_BASED = 0x10,
+    VIDEO_CS_ITF_VS_FRAME_FRAME_BASED = 0x11,
+    VIDEO_CS_ITF_VS_FORMAT_STREAM_BASED = 0x12,
+  } video_cs_vs_interface_subtype_t;
+
+  typedef enum
+  {
+    VIDEO_TT_VENDOR_SPECIFIC = 0x0100u,
+    VIDEO_TT_STREAMING = 0x0101u,
+    VIDEO_ITT_VENDOR_SPECIFIC = 0x0200u,
+    VIDEO_ITT_CAMERA = 0x0201u,
+    VIDEO_ITT_MEDIA_TRANSPORT_INPUT = 0x0202u,
+  } video_terminal_type_t;
+
+  typedef enum
+  {
+    VIDEO_ERROR_NONE = 0,
+    VIDEO_ERROR_NOT_READY,
+    VIDEO_ERROR_WRONG_STATE,
+    VIDEO_ERROR_POWER,
+    VIDEO_ERROR_OUT_OF_RANGE,
+    VIDEO_ERROR_INVALID_UNIT,
+    VIDEO_ERROR_INVALID_CONTROL,
+    VIDEO_ERROR_INVALID_REQUEST,
+    VIDEO_ERROR_INVALID_VALUE_WITHIN_RANGE,
+    VIDEO_ERROR_UNKNOWN = 0xFF,
+  } video_error_code_t;
+
+  typedef enum
+  {
+    VIDEO_REQUEST_UNDEFINED = 0x00,
+    VIDEO_REQUEST_SET_CUR = 0x01,
+    VIDEO_REQUEST_SET_CUR_ALL = 0x11,
+    VIDEO_REQUEST_GET_CUR = 0x81,
+    VIDEO_REQUEST_GET_MIN = 0x82,
+    VIDEO_REQUEST_GET_MAX = 0x83,
+    VIDEO_REQUEST_GET_RES = 0x84,
+    VIDEO_REQUEST_GET_LEN = 0x85,
+    VIDEO_REQUEST_GET_INFO = 0x86,
+    VIDEO_REQUEST_GET_DEF = 0x87,
+  } video_control_request_t;
+
+  typedef enum
+  {
+    VIDEO_VS_CTL_UNDEFINED = 0x00,
+    VIDEO_VS_CTL_PROBE,
+    VIDEO_VS_CTL_COMMIT,
+    VIDEO_VS_CTL_STILL_PROBE,
+    VIDEO_VS_CTL_STILL_COMMIT,
+    VIDEO_VS_CTL_STILL_IMAGE_TRIGGER,
+    VIDEO_VS_CTL_STREAM_ERROR_CODE,
+    VIDEO_VS_CTL_GENERATE_KEY_FRAME,
+    VIDEO_VS_CTL_UPDATE_FRAME_SEGMENT,
+    VIDEO_VS_CTL_SYNCH_DELAY_CONTROL,
+  } video_vs_control_selector_t;
+
+  typedef struct __attribute__((packed))
+  {
+    uint16_t bmHint;
+    uint8_t bFormatIndex;
+    uint8_t bFrameIndex;
+    uint32_t dwFrameInterval;
+    uint16_t wKeyFrameRate;
+    uint16_t wPFrameRate;
+    uint16_t wCompQuality;
+    uint16_t wCompWindowSize;
+    uint16_t wDelay;
+    uint32_t dwMaxVideoFrameSize;
+    uint32_t dwMaxPayloadTransferSize;
+    uint32_t dwClockFrequency;
+    uint8_t bmFramingInfo;
+    uint8_t bPreferedVersion;
+    uint8_t bMinVersion;
+    uint8_t bMaxVersion;
+  } video_probe_and_commit_control_t;
+
+#ifdef __cplusplus
+}
+#endif
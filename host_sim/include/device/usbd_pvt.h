@@ -0,0 +1,43 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation subset of TinyUSB's device/usbd_pvt.h: class driver
+// interface, used by the firmware to add an application driver
+#pragma once
+
+#include "tusb.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct
+  {
+#if CFG_TUSB_DEBUG >= 2
+    char const *name;
+#endif
+    void (*init)(void);
+    void (*reset)(uint8_t rhport);
+    uint16_t (*open)(uint8_t rhport, tusb_desc_interface_t const *desc_intf, uint16_t max_len);
+    bool (*control_xfer_cb)(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request);
+    bool (*xfer_cb)(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes);
+    void (*sof)(uint8_t rhport, uint32_t frame_count);
+  } usbd_class_driver_t;
+
+  // Application drivers are offered each interface before the built-in ones
+  usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count);
+
+  // Queue a transfer on an endpoint
+  bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes);
+
+  // Run func(param) in the USB device task, e.g. from an interrupt
+  typedef void (*osal_task_func_t)(void *param);
+  void usbd_defer_func(osal_task_func_t func, void *param, bool in_isr);
+
+#ifdef __cplusplus
+}
+#endif
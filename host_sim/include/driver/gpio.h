@@ -0,0 +1,8 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in: the firmware only needs the GPIO types via esp_camera.h
+#pragma once
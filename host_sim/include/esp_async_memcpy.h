@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in for the GDMA-backed async memcpy driver
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct async_memcpy_context_t *async_memcpy_handle_t;
+
+  typedef struct
+  {
+    void *data;
+  } async_memcpy_event_t;
+
+  typedef bool (*async_memcpy_isr_cb_t)(async_memcpy_handle_t mcp_hdl, async_memcpy_event_t *event, void *cb_args);
+
+  typedef struct
+  {
+    uint32_t backlog;
+    size_t sram_trans_align;
+    size_t psram_trans_align;
+    uint32_t flags;
+  } async_memcpy_config_t;
+
+#define ASYNC_MEMCPY_DEFAULT_CONFIG() \
+  {                                   \
+      .backlog = 8,                   \
+      .sram_trans_align = 0,          \
+      .psram_trans_align = 0,         \
+      .flags = 0,                     \
+  }
+
+  esp_err_t esp_async_memcpy_install(const async_memcpy_config_t *config, async_memcpy_handle_t *mcp);
+  esp_err_t esp_async_memcpy_uninstall(async_memcpy_handle_t mcp);
+  // Copies n bytes in the background; cb_isr runs once they have landed
+  esp_err_t esp_async_memcpy(async_memcpy_handle_t mcp, void *dst, void *src, size_t n,
+                             async_memcpy_isr_cb_t cb_isr, void *cb_args);
+
+#ifdef __cplusplus
+}
+#endif
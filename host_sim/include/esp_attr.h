@@ -0,0 +1,11 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in for esp_attr.h: everything runs from one memory
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
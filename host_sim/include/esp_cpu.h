@@ -0,0 +1,25 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in for the CPU cycle counter
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Nanoseconds of CLOCK_MONOTONIC, truncated like the 32-bit CCOUNT register
+  uint32_t esp_cpu_get_cycle_count(void);
+
+  // Planned core of the calling task, 0 outside tasks or for unpinned ones
+  int esp_cpu_get_core_id(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,56 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in for esp_intr_alloc.h. The mocks allocate their
+// modelled interrupts through it and raise them with mock_intr_raise.
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+#define ESP_INTR_FLAG_LEVEL2 (1 << 2)
+#define ESP_INTR_FLAG_LEVEL3 (1 << 3)
+#define ESP_INTR_FLAG_LEVEL4 (1 << 4)
+#define ESP_INTR_FLAG_LEVEL5 (1 << 5)
+#define ESP_INTR_FLAG_LEVEL6 (1 << 6)
+#define ESP_INTR_FLAG_NMI (1 << 7)
+#define ESP_INTR_FLAG_SHARED (1 << 8)
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+#define ESP_INTR_FLAG_LOWMED (ESP_INTR_FLAG_LEVEL1 | ESP_INTR_FLAG_LEVEL2 | ESP_INTR_FLAG_LEVEL3)
+#define ESP_INTR_FLAG_HIGH (ESP_INTR_FLAG_LEVEL4 | ESP_INTR_FLAG_LEVEL5 | ESP_INTR_FLAG_LEVEL6 | ESP_INTR_FLAG_NMI)
+
+// Interrupt sources of the modelled peripherals (ESP32-S3 numbering)
+#define ETS_USB_INTR_SOURCE 38
+#define ETS_LCD_CAM_INTR_SOURCE 24
+#define ETS_DMA_IN_CH0_INTR_SOURCE 66
+
+  typedef void (*intr_handler_t)(void *arg);
+  typedef struct mock_intr *intr_handle_t;
+
+  esp_err_t esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *ret_handle);
+  esp_err_t esp_intr_alloc_intrstatus(int source, int flags, uint32_t intrstatusreg, uint32_t intrstatusmask,
+                                      intr_handler_t handler, void *arg, intr_handle_t *ret_handle);
+  esp_err_t esp_intr_alloc_bind(int source, int flags, intr_handler_t handler, void *arg,
+                                intr_handle_t shared_handle, intr_handle_t *ret_handle);
+  esp_err_t esp_intr_alloc_intrstatus_bind(int source, int flags, uint32_t intrstatusreg, uint32_t intrstatusmask,
+                                           intr_handler_t handler, void *arg, intr_handle_t shared_handle,
+                                           intr_handle_t *ret_handle);
+  esp_err_t esp_intr_free(intr_handle_t handle);
+  int esp_intr_get_cpu(intr_handle_t handle);
+
+  // Run the handler of an allocated interrupt in the calling thread
+  void mock_intr_raise(intr_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,20 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in for esp_system.h
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // unsigned long keeps the firmware's "%lu" formats valid on 64-bit hosts
+  unsigned long esp_get_free_heap_size(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,10 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in: the firmware includes event groups but does not use them
+#pragma once
+
+#include "freertos/FreeRTOS.h"
@@ -0,0 +1,28 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation semaphores: counting semaphore on a mutex and condition variable
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct mock_semaphore *SemaphoreHandle_t;
+
+  SemaphoreHandle_t xSemaphoreCreateBinary(void);
+  SemaphoreHandle_t xSemaphoreCreateMutex(void);
+  SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+  BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+  BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+  void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#ifdef __cplusplus
+}
+#endif
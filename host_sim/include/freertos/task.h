@@ -0,0 +1,79 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation task API: every task is a detached POSIX thread
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+
+  typedef struct mock_task *TaskHandle_t;
+  typedef void (*TaskFunction_t)(void *);
+
+  typedef enum
+  {
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite,
+  } eNotifyAction;
+
+  typedef uint8_t StackType_t;
+
+  typedef enum
+  {
+    eRunning = 0,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted,
+    eInvalid,
+  } eTaskState;
+
+  // Run time counters are the thread's CPU time in microseconds, the total is
+  // the time since start; stack high-water marks are not modelled (0)
+  typedef struct
+  {
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    uint32_t ulRunTimeCounter;
+    StackType_t *pxStackBase;
+    uint32_t usStackHighWaterMark;
+    BaseType_t xCoreID;
+  } TaskStatus_t;
+
+  // Core and priority are recorded but not enforced on the host
+  BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                     void *arg, UBaseType_t priority, TaskHandle_t *handle,
+                                     BaseType_t core_id);
+  void vTaskDelete(TaskHandle_t task);
+  void vTaskDelay(TickType_t ticks);
+  TickType_t xTaskGetTickCount(void);
+  TaskHandle_t xTaskGetCurrentTaskHandle(void);
+  UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+  UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+  UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t count, uint32_t *total_run_time);
+
+  BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+  BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value,
+                             TickType_t ticks);
+  BaseType_t xTaskNotifyGive(TaskHandle_t task);
+  uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
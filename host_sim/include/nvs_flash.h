@@ -0,0 +1,22 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in for nvs_flash.h
+#pragma once
+
+#include "nvs.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  esp_err_t nvs_flash_init(void);
+  esp_err_t nvs_flash_erase(void);
+
+#ifdef __cplusplus
+}
+#endif
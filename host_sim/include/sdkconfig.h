@@ -0,0 +1,135 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation build configuration, mirrors the defaults in main/Kconfig.projbuild
+#pragma once
+
+#define CONFIG_UVC_FRAME_RING_DEPTH 3
+#define CONFIG_UVC_TIMING_WINDOW 256
+#define CONFIG_UVC_STATS_INTERVAL_MS 5000
+#define CONFIG_UVC_FRAME_TRACE 0
+#define CONFIG_UVC_YUY2_SWAP_BYTES 1
+#define CONFIG_UVC_FRAME_PACING 1
+#define CONFIG_UVC_FRAME_PACING_GRACE_PCT 25
+#define CONFIG_UVC_FRAME_PACING_REPEAT 1
+#define CONFIG_UVC_RATE_CTRL 1
+#define CONFIG_UVC_RATE_CTRL_BITRATE_KBPS 0
+#define CONFIG_UVC_RATE_CTRL_MAX_FRAME_KB 0
+#define CONFIG_UVC_RATE_CTRL_QUALITY_BEST 10
+#define CONFIG_UVC_RATE_CTRL_QUALITY_WORST 40
+#define CONFIG_UVC_RATE_CTRL_HEADROOM_PCT 90
+#define CONFIG_UVC_RATE_CTRL_HYSTERESIS_PCT 15
+#define CONFIG_UVC_SENSOR_SETTLE_FRAMES 3
+#define CONFIG_UVC_SENSOR_SETTLE_TIMEOUT_MS 1500
+#define CONFIG_UVC_SENSOR_STATE_NVS 1
+#define CONFIG_UVC_CAMERA_FAULT_BAD_FRAMES 5
+#define CONFIG_UVC_CAMERA_RECOVERY_RETRIES 2
+#define CONFIG_UVC_CAMERA_RECOVERY_BACKOFF_MS 20
+#define CONFIG_UVC_CAMERA_RECOVERY_BACKOFF_MAX_MS 2000
+#define CONFIG_UVC_STILL_CAPTURE 1
+#define CONFIG_UVC_STILL_BUFFER_KB 384
+#define CONFIG_UVC_STILL_JPEG_QUALITY 12
+#define CONFIG_UVC_STILL_MAX_FRAMES 3
+// Off by default on the device; the simulation serves on the host's loopback
+#define CONFIG_UVC_HTTP_STREAM 1
+#define CONFIG_UVC_HTTP_WIFI_SSID ""
+#define CONFIG_UVC_HTTP_WIFI_PASSWORD ""
+#define CONFIG_UVC_HTTP_PORT 8080
+#define CONFIG_UVC_HTTP_MAX_CLIENTS 3
+#define CONFIG_UVC_HTTP_SHARED_FRAMES 2
+#define CONFIG_UVC_HTTP_SEND_TIMEOUT_MS 1000
+// Streaming endpoint type, isochronous with cmake -DUVC_SIM_ISO=ON
+#if UVC_SIM_ISO
+#define CONFIG_UVC_USB_ISO 1
+#define CONFIG_UVC_ISO_MJPEG_RESERVE_PCT 5
+#else
+#define CONFIG_UVC_USB_BULK 1
+#define CONFIG_UVC_USB_EP_BUFSIZE 256
+// GDMA bounce stage, off with cmake -DUVC_SIM_BOUNCE=OFF for comparison
+#if UVC_SIM_BOUNCE
+#define CONFIG_UVC_USB_BOUNCE 1
+#define CONFIG_UVC_USB_BOUNCE_CHUNK 4096
+#define CONFIG_UVC_USB_BOUNCE_BUFFERS 3
+// Off by default on the device, on with cmake -DUVC_SIM_SUBFRAME=ON
+#if UVC_SIM_SUBFRAME
+#define CONFIG_UVC_SUBFRAME_STREAM 1
+#endif
+#endif
+#endif
+// Off by default on the device, on with cmake -DUVC_SIM_BENCH=ON; shorter
+// steps keep a sweep within a simulation run
+#if UVC_SIM_BENCH
+#define CONFIG_UVC_USB_BENCHMARK 1
+#define CONFIG_UVC_USB_BENCH_EMBEDDED 1
+#define CONFIG_UVC_USB_BENCH_FRAME_KB "16,32,64"
+#define CONFIG_UVC_USB_BENCH_PAYLOADS "1024,4096"
+#define CONFIG_UVC_USB_BENCH_FPS "0,30"
+#define CONFIG_UVC_USB_BENCH_STEP_MS 1000
+#endif
+#define CONFIG_UVC_CDC_TELEMETRY 1
+#define CONFIG_UVC_CDC_TELEMETRY_PERIOD_MS 1000
+// Compiled in but off; the simulation turns streams on with --cdc-cmd "gate usb on"
+#define CONFIG_UVC_CHANGE_GATE 1
+#define CONFIG_UVC_CHANGE_GATE_SIZE_PERMILLE 5
+#define CONFIG_UVC_CHANGE_GATE_LUMA_THRESHOLD 3
+#define CONFIG_UVC_CHANGE_GATE_KEEPALIVE_MS 1000
+#define CONFIG_UVC_IDLE_POWER_SAVE 1
+#define CONFIG_UVC_IDLE_DELAY_MS 2000
+#define CONFIG_UVC_IDLE_CPU_FREQ_80 1
+#define CONFIG_UVC_IDLE_CPU_FREQ_MHZ 80
+#define CONFIG_UVC_IDLE_RESUME_BUDGET_MS 250
+// Off by default on the device, on with cmake -DUVC_SIM_RECORDER=ON
+#if UVC_SIM_RECORDER
+#define CONFIG_UVC_EVENT_RECORDER 1
+#define CONFIG_UVC_EVENT_RECORDER_BUFFER_KB 2048
+#define CONFIG_UVC_EVENT_RECORDER_INTERVAL_MS 0
+#define CONFIG_UVC_EVENT_RECORDER_POST_MS 2000
+#endif
+// Task plan presets as Kconfig resolves them; cmake -DUVC_SIM_TASK_PLAN=latency
+// or throughput picks another. Placement only shows in the reports, host
+// threads run on any CPU.
+#if UVC_SIM_TASK_PLAN_LATENCY
+#define CONFIG_UVC_TASK_PLAN_LOW_LATENCY 1
+#define CONFIG_UVC_TASK_USB_PRIORITY 8
+#define CONFIG_UVC_TASK_UVC_CORE 0
+#define CONFIG_UVC_TASK_UVC_PRIORITY 7
+#define CONFIG_UVC_TASK_CAMERA_CORE 1
+#define CONFIG_UVC_TASK_CAMERA_PRIORITY 7
+#define CONFIG_UVC_ISR_CAMERA_CORE 1
+#define CONFIG_CAMERA_CORE1 1
+#elif UVC_SIM_TASK_PLAN_THROUGHPUT
+#define CONFIG_UVC_TASK_PLAN_THROUGHPUT 1
+#define CONFIG_UVC_TASK_USB_PRIORITY 6
+#define CONFIG_UVC_TASK_UVC_CORE -1
+#define CONFIG_UVC_TASK_UVC_PRIORITY 5
+#define CONFIG_UVC_TASK_CAMERA_CORE -1
+#define CONFIG_UVC_TASK_CAMERA_PRIORITY 5
+#define CONFIG_UVC_ISR_CAMERA_CORE 1
+#define CONFIG_CAMERA_NO_AFFINITY 1
+#else
+#define CONFIG_UVC_TASK_PLAN_BALANCED 1
+#define CONFIG_UVC_TASK_USB_PRIORITY 6
+#define CONFIG_UVC_TASK_UVC_CORE 0
+#define CONFIG_UVC_TASK_UVC_PRIORITY 5
+#define CONFIG_UVC_TASK_CAMERA_CORE 1
+#define CONFIG_UVC_TASK_CAMERA_PRIORITY 5
+#define CONFIG_UVC_ISR_CAMERA_CORE -1
+#define CONFIG_CAMERA_CORE0 1
+#endif
+#define CONFIG_UVC_TASK_USB_CORE 0
+#define CONFIG_UVC_TASK_USB_STACK 4096
+#define CONFIG_UVC_TASK_UVC_STACK 4096
+#define CONFIG_UVC_TASK_CAMERA_STACK 4096
+#define CONFIG_UVC_ISR_USB_CORE -1
+// Off by default in Kconfig; on here so the report shows the interrupt load
+#define CONFIG_UVC_TASK_PLAN_ISR_TIMING 1
+#define CONFIG_PM_ENABLE 1
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 240
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_FREERTOS_USE_TRACE_FACILITY 1
+#define CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS 1
+#define CONFIG_FREERTOS_USE_STATS_FORMATTING_FUNCTIONS 1
+#define CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID 1
@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation stand-in for the register access of soc/soc.h: the only
+// register read is the USB controller's device status, modelled by the bus
+#pragma once
+
+#include <stdint.h>
+
+#define DR_REG_USB_BASE 0x60080000
+
+#define REG_READ(reg) mock_reg_read(reg)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  uint32_t mock_reg_read(uint32_t reg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,344 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation subset of TinyUSB: descriptor helpers with the same byte
+// layout as TinyUSB's usbd.h, and the device/video entry points implemented
+// by mock_tinyusb.cpp on top of a modelled full-speed bus
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define OPT_MCU_ESP32S3 901
+#define OPT_OS_FREERTOS 2
+#define OPT_MODE_DEFAULT_SPEED 0
+#define OPT_MODE_FULL_SPEED 0x0200
+#include "tusb_config.h"
+#include "class/video/video.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  //--------------------------------------------------------------------+
+  // Descriptor types
+  //--------------------------------------------------------------------+
+  typedef enum
+  {
+    TUSB_DESC_DEVICE = 0x01,
+    TUSB_DESC_CONFIGURATION = 0x02,
+    TUSB_DESC_STRING = 0x03,
+    TUSB_DESC_INTERFACE = 0x04,
+    TUSB_DESC_ENDPOINT = 0x05,
+    TUSB_DESC_INTERFACE_ASSOCIATION = 0x0B,
+    TUSB_DESC_CS_INTERFACE = 0x24,
+    TUSB_DESC_CS_ENDPOINT = 0x25,
+  } tusb_desc_type_t;
+
+  typedef enum
+  {
+    TUSB_CLASS_CDC = 2,
+    TUSB_CLASS_VIDEO = 14,
+    TUSB_CLASS_MISC = 0xEF,
+    TUSB_CLASS_CDC_DATA = 10,
+  } tusb_class_code_t;
+
+  typedef enum
+  {
+    TUSB_XFER_CONTROL = 0,
+    TUSB_XFER_ISOCHRONOUS,
+    TUSB_XFER_BULK,
+    TUSB_XFER_INTERRUPT,
+  } tusb_xfer_type_t;
+
+#define TUSB_ISO_EP_ATT_ASYNCHRONOUS 0x04
+#define MISC_SUBCLASS_COMMON 2
+#define MISC_PROTOCOL_IAD 1
+#define TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP (1 << 5)
+
+  typedef struct __attribute__((packed))
+  {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass;
+    uint8_t bDeviceSubClass;
+    uint8_t bDeviceProtocol;
+    uint8_t bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t iManufacturer;
+    uint8_t iProduct;
+    uint8_t iSerialNumber;
+    uint8_t bNumConfigurations;
+  } tusb_desc_device_t;
+
+  typedef struct __attribute__((packed))
+  {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bInterfaceNumber;
+    uint8_t bAlternateSetting;
+    uint8_t bNumEndpoints;
+    uint8_t bInterfaceClass;
+    uint8_t bInterfaceSubClass;
+    uint8_t bInterfaceProtocol;
+    uint8_t iInterface;
+  } tusb_desc_interface_t;
+
+  //--------------------------------------------------------------------+
+  // Control requests
+  //--------------------------------------------------------------------+
+  typedef enum
+  {
+    TUSB_DIR_OUT = 0,
+    TUSB_DIR_IN = 1,
+  } tusb_dir_t;
+
+  typedef enum
+  {
+    TUSB_REQ_TYPE_STANDARD = 0,
+    TUSB_REQ_TYPE_CLASS,
+    TUSB_REQ_TYPE_VENDOR,
+    TUSB_REQ_TYPE_INVALID,
+  } tusb_request_type_t;
+
+  typedef enum
+  {
+    TUSB_REQ_RCPT_DEVICE = 0,
+    TUSB_REQ_RCPT_INTERFACE,
+    TUSB_REQ_RCPT_ENDPOINT,
+    TUSB_REQ_RCPT_OTHER,
+  } tusb_request_recipient_t;
+
+  typedef enum
+  {
+    TUSB_REQ_CLEAR_FEATURE = 0x01,
+    TUSB_REQ_GET_INTERFACE = 0x0A,
+    TUSB_REQ_SET_INTERFACE = 0x0B,
+  } tusb_request_code_t;
+
+  typedef enum
+  {
+    TUSB_REQ_FEATURE_EDPT_HALT = 0,
+  } tusb_request_feature_selector_t;
+
+  typedef struct __attribute__((packed))
+  {
+    union
+    {
+      struct __attribute__((packed))
+      {
+        uint8_t recipient : 5;
+        uint8_t type : 2;
+        uint8_t direction : 1;
+      } bmRequestType_bit;
+      uint8_t bmRequestType;
+    };
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+  } tusb_control_request_t;
+
+  typedef enum
+  {
+    XFER_RESULT_SUCCESS = 0,
+    XFER_RESULT_FAILED,
+    XFER_RESULT_STALLED,
+    XFER_RESULT_TIMEOUT,
+    XFER_RESULT_INVALID,
+  } xfer_result_t;
+
+  enum
+  {
+    CONTROL_STAGE_IDLE,
+    CONTROL_STAGE_SETUP,
+    CONTROL_STAGE_DATA,
+    CONTROL_STAGE_ACK,
+  };
+
+  //--------------------------------------------------------------------+
+  // Byte helpers
+  //--------------------------------------------------------------------+
+#define TU_U16_HIGH(u16) ((uint8_t)(((u16) >> 8) & 0x00ff))
+#define TU_U16_LOW(u16) ((uint8_t)((u16) & 0x00ff))
+#define U16_TO_U8S_LE(u16) TU_U16_LOW(u16), TU_U16_HIGH(u16)
+#define TU_U32_BYTE3(u32) ((uint8_t)((((uint32_t)u32) >> 24) & 0x000000ff))
+#define TU_U32_BYTE2(u32) ((uint8_t)((((uint32_t)u32) >> 16) & 0x000000ff))
+#define TU_U32_BYTE1(u32) ((uint8_t)((((uint32_t)u32) >> 8) & 0x000000ff))
+#define TU_U32_BYTE0(u32) ((uint8_t)(((uint32_t)u32) & 0x000000ff))
+#define U32_TO_U8S_LE(u32) TU_U32_BYTE0(u32), TU_U32_BYTE1(u32), TU_U32_BYTE2(u32), TU_U32_BYTE3(u32)
+#define TU_U24_TO_U8S_LE(u24) TU_U32_BYTE0(u24), TU_U32_BYTE1(u24), TU_U32_BYTE2(u24)
+
+#define TU_ARGS_NUM(...) _TU_NARG(_0, ##__VA_ARGS__, _TU_RSEQ_N())
+#define _TU_NARG(...) _TU_GET_NTH_ARG(__VA_ARGS__)
+#define _TU_GET_NTH_ARG(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+                        _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30,    \
+                        _31, _32, N, ...) N
+#define _TU_RSEQ_N() 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, \
+                     15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+
+  //--------------------------------------------------------------------+
+  // Video descriptor templates (usbd.h)
+  //--------------------------------------------------------------------+
+#define TUD_VIDEO_DESC_IAD_LEN 8
+#define TUD_VIDEO_DESC_STD_VC_LEN 9
+#define TUD_VIDEO_DESC_CS_VC_LEN 12
+#define TUD_VIDEO_DESC_INPUT_TERM_LEN 8
+#define TUD_VIDEO_DESC_OUTPUT_TERM_LEN 9
+#define TUD_VIDEO_DESC_CAMERA_TERM_LEN 18
+#define TUD_VIDEO_DESC_STD_VS_LEN 9
+#define TUD_VIDEO_DESC_CS_VS_IN_LEN 13
+#define TUD_VIDEO_DESC_CS_VS_OUT_LEN 9
+#define TUD_VIDEO_DESC_CS_VS_FMT_UNCOMPR_LEN 27
+#define TUD_VIDEO_DESC_CS_VS_FMT_MJPEG_LEN 11
+#define TUD_VIDEO_DESC_CS_VS_FRM_UNCOMPR_CONT_LEN 38
+#define TUD_VIDEO_DESC_CS_VS_FRM_MJPEG_CONT_LEN 38
+#define TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING_LEN 6
+
+#define TUD_VIDEO_GUID_YUY2 0x59, 0x55, 0x59, 0x32, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+
+#define TUD_VIDEO_DESC_IAD(_firstitf, _nitfs, _stridx)                                                  \
+  TUD_VIDEO_DESC_IAD_LEN, TUSB_DESC_INTERFACE_ASSOCIATION, _firstitf, _nitfs, TUSB_CLASS_VIDEO,         \
+      VIDEO_SUBCLASS_INTERFACE_COLLECTION, VIDEO_ITF_PROTOCOL_UNDEFINED, _stridx
+
+#define TUD_VIDEO_DESC_STD_VC(_itfnum, _nEPs, _stridx)                                                  \
+  TUD_VIDEO_DESC_STD_VC_LEN, TUSB_DESC_INTERFACE, _itfnum, 0, _nEPs, TUSB_CLASS_VIDEO,                  \
+      VIDEO_SUBCLASS_CONTROL, VIDEO_ITF_PROTOCOL_15, _stridx
+
+#define TUD_VIDEO_DESC_CS_VC(_bcdUVC, _totallen, _clkfreq, ...)                                         \
+  TUD_VIDEO_DESC_CS_VC_LEN + (TU_ARGS_NUM(__VA_ARGS__)), TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VC_HEADER, \
+      U16_TO_U8S_LE(_bcdUVC), U16_TO_U8S_LE((_totallen) + TUD_VIDEO_DESC_CS_VC_LEN + (TU_ARGS_NUM(__VA_ARGS__))), \
+      U32_TO_U8S_LE(_clkfreq), TU_ARGS_NUM(__VA_ARGS__), __VA_ARGS__
+
+#define TUD_VIDEO_DESC_CAMERA_TERM(_tid, _at, _stridx, _focal_min, _focal_max, _focal, _ctls)           \
+  TUD_VIDEO_DESC_CAMERA_TERM_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VC_INPUT_TERMINAL, _tid,         \
+      U16_TO_U8S_LE(VIDEO_ITT_CAMERA), _at, _stridx, U16_TO_U8S_LE(_focal_min), U16_TO_U8S_LE(_focal_max), \
+      U16_TO_U8S_LE(_focal), 3, TU_U24_TO_U8S_LE(_ctls)
+
+#define TUD_VIDEO_DESC_OUTPUT_TERM(_tid, _tt, _at, _srcid, _stridx)                                     \
+  TUD_VIDEO_DESC_OUTPUT_TERM_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VC_OUTPUT_TERMINAL, _tid,        \
+      U16_TO_U8S_LE(_tt), _at, _srcid, _stridx
+
+#define TUD_VIDEO_DESC_STD_VS(_itfnum, _alt, _epn, _stridx)                                             \
+  TUD_VIDEO_DESC_STD_VS_LEN, TUSB_DESC_INTERFACE, _itfnum, _alt, _epn, TUSB_CLASS_VIDEO,                \
+      VIDEO_SUBCLASS_STREAMING, VIDEO_ITF_PROTOCOL_15, _stridx
+
+#define TUD_VIDEO_DESC_CS_VS_INPUT(_numfmt, _len, _epin, _info, _trmlnk, _stim, _trig, _trigusg, ...)   \
+  TUD_VIDEO_DESC_CS_VS_IN_LEN + (_numfmt), TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VS_INPUT_HEADER,       \
+      _numfmt, U16_TO_U8S_LE((_len) + TUD_VIDEO_DESC_CS_VS_IN_LEN + (_numfmt)), _epin, _info, _trmlnk,  \
+      _stim, _trig, _trigusg, 1, __VA_ARGS__
+
+#define TUD_VIDEO_DESC_CS_VS_FMT_UNCOMPR(_fmtidx, _numfmtdesc, _fmt, _nbpp, _frmidx, _asrx, _asry, _interlace, _cp) \
+  TUD_VIDEO_DESC_CS_VS_FMT_UNCOMPR_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VS_FORMAT_UNCOMPRESSED,    \
+      _fmtidx, _numfmtdesc, _fmt, _nbpp, _frmidx, _asrx, _asry, _interlace, _cp
+
+#define TUD_VIDEO_DESC_CS_VS_FMT_YUY2(_fmtidx, _numfmtdesc, _frmidx, _asrx, _asry, _interlace, _cp)     \
+  TUD_VIDEO_DESC_CS_VS_FMT_UNCOMPR(_fmtidx, _numfmtdesc, TUD_VIDEO_GUID_YUY2, 16, _frmidx, _asrx, _asry, _interlace, _cp)
+
+#define TUD_VIDEO_DESC_CS_VS_FMT_MJPEG(_fmtidx, _numfmtdesc, _fixed_sz, _frmidx, _asrx, _asry, _interlace, _cp) \
+  TUD_VIDEO_DESC_CS_VS_FMT_MJPEG_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VS_FORMAT_MJPEG,             \
+      _fmtidx, _numfmtdesc, _fixed_sz, _frmidx, _asrx, _asry, _interlace, _cp
+
+#define TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING(_color, _trns, _mat)                                        \
+  TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VS_COLORFORMAT,         \
+      _color, _trns, _mat
+
+#define TUD_VIDEO_DESC_EP_ISO(_ep, _epsize, _ep_interval)                                               \
+  7, TUSB_DESC_ENDPOINT, _ep, TUSB_XFER_ISOCHRONOUS | TUSB_ISO_EP_ATT_ASYNCHRONOUS,                     \
+      U16_TO_U8S_LE(_epsize), _ep_interval
+
+#define TUD_VIDEO_DESC_EP_BULK(_ep, _epsize, _ep_interval)                                              \
+  7, TUSB_DESC_ENDPOINT, _ep, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), _ep_interval
+
+  //--------------------------------------------------------------------+
+  // CDC-ACM descriptor template (class/cdc/cdc.h, usbd.h)
+  //--------------------------------------------------------------------+
+#define CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL 0x02
+#define CDC_COMM_PROTOCOL_NONE 0x00
+#define CDC_FUNC_DESC_HEADER 0x00
+#define CDC_FUNC_DESC_CALL_MANAGEMENT 0x01
+#define CDC_FUNC_DESC_ABSTRACT_CONTROL_MANAGEMENT 0x02
+#define CDC_FUNC_DESC_UNION 0x06
+
+#define TUD_CDC_DESC_LEN (8 + 9 + 5 + 5 + 4 + 5 + 7 + 9 + 7 + 7)
+
+#define TUD_CDC_DESCRIPTOR(_itfnum, _stridx, _ep_notif, _ep_notif_size, _epout, _epin, _epsize)          \
+  8, TUSB_DESC_INTERFACE_ASSOCIATION, _itfnum, 2, TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL, \
+      CDC_COMM_PROTOCOL_NONE, 0,                                                                          \
+      9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL,    \
+      CDC_COMM_PROTOCOL_NONE, _stridx,                                                                    \
+      5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_HEADER, U16_TO_U8S_LE(0x0120),                             \
+      5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_CALL_MANAGEMENT, 0, (uint8_t)((_itfnum) + 1),              \
+      4, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_ABSTRACT_CONTROL_MANAGEMENT, 6,                            \
+      5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_UNION, _itfnum, (uint8_t)((_itfnum) + 1),                  \
+      7, TUSB_DESC_ENDPOINT, _ep_notif, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_ep_notif_size), 16,           \
+      9, TUSB_DESC_INTERFACE, (uint8_t)((_itfnum) + 1), 0, 2, TUSB_CLASS_CDC_DATA, 0, 0, 0,               \
+      7, TUSB_DESC_ENDPOINT, _epout, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,                           \
+      7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0
+
+  //--------------------------------------------------------------------+
+  // Device stack API
+  //--------------------------------------------------------------------+
+  bool tud_init(uint8_t rhport);
+  void tud_task(void);
+  bool tud_mounted(void);
+  bool tud_ready(void);
+
+  // Data stage of the control request being handled: IN sends len bytes of
+  // buffer, OUT receives them into it
+  bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const *request, void *buffer, uint16_t len);
+
+  bool tud_video_n_streaming(uint_fast8_t ctl_idx, uint_fast8_t stm_idx);
+  bool tud_video_n_frame_xfer(uint_fast8_t ctl_idx, uint_fast8_t stm_idx, void *buffer, size_t bufsize);
+
+#if CFG_TUD_CDC
+  // CDC-ACM class driver (class/cdc/cdc_device.h), implemented by mock_cdc.cpp
+  // on top of a modelled host terminal
+  bool tud_cdc_n_connected(uint8_t itf);
+  uint32_t tud_cdc_n_available(uint8_t itf);
+  uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize);
+  uint32_t tud_cdc_n_write(uint8_t itf, void const *buffer, uint32_t bufsize);
+  uint32_t tud_cdc_n_write_flush(uint8_t itf);
+  uint32_t tud_cdc_n_write_available(uint8_t itf);
+
+  static inline bool tud_cdc_connected(void) { return tud_cdc_n_connected(0); }
+  static inline uint32_t tud_cdc_available(void) { return tud_cdc_n_available(0); }
+  static inline uint32_t tud_cdc_read(void *buffer, uint32_t bufsize) { return tud_cdc_n_read(0, buffer, bufsize); }
+  static inline uint32_t tud_cdc_write(void const *buffer, uint32_t bufsize) { return tud_cdc_n_write(0, buffer, bufsize); }
+  static inline uint32_t tud_cdc_write_flush(void) { return tud_cdc_n_write_flush(0); }
+  static inline uint32_t tud_cdc_write_available(void) { return tud_cdc_n_write_available(0); }
+
+  // Application callbacks: data arrived from the host; a transfer to the
+  // host completed (optional, weak as in TinyUSB)
+  void tud_cdc_rx_cb(uint8_t itf);
+  __attribute__((weak)) void tud_cdc_tx_complete_cb(uint8_t itf);
+#endif
+
+  // Built-in video class driver (class/video/video_device.h)
+  void videod_init(void);
+  void videod_reset(uint8_t rhport);
+  uint16_t videod_open(uint8_t rhport, tusb_desc_interface_t const *itf_desc, uint16_t max_len);
+  bool videod_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request);
+  bool videod_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes);
+
+  // Application callbacks, defined by the firmware
+  uint8_t const *tud_descriptor_device_cb(void);
+  uint8_t const *tud_descriptor_configuration_cb(uint8_t index);
+  uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid);
+  void tud_mount_cb(void);
+  void tud_umount_cb(void);
+  void tud_video_frame_xfer_complete_cb(uint_fast8_t ctl_idx, uint_fast8_t stm_idx);
+  int tud_video_commit_cb(uint_fast8_t ctl_idx, uint_fast8_t stm_idx,
+                          video_probe_and_commit_control_t const *parameters);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,127 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Mock GDMA async memcpy: one channel working through its backlog in order
+// on a thread, at a rate typical of PSRAM reads sharing the bus with the
+// camera. Remembers which camera frame each copy came from, so the mock host
+// can time frames that only reach the endpoint through copies.
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "esp_async_memcpy.h"
+#include "sim.h"
+
+// PSRAM -> internal SRAM over the GDMA, bytes per microsecond
+#define MOCK_GDMA_BYTES_PER_US 40
+
+struct async_memcpy_context_t
+{
+    uint32_t backlog;
+};
+
+typedef struct
+{
+    void *dst;
+    const void *src;
+    size_t n;
+    async_memcpy_isr_cb_t cb;
+    void *cb_args;
+} mock_copy_t;
+
+// Destination ranges of recent copies and the capture time of their source
+typedef struct
+{
+    const uint8_t *dst;
+    size_t n;
+    int64_t capture_us;
+} mock_copy_origin_t;
+
+#define MOCK_COPY_ORIGINS 8
+
+static std::mutex copy_lock;
+static std::condition_variable copy_cond;
+static std::deque<mock_copy_t> copies;
+static mock_copy_origin_t origins[MOCK_COPY_ORIGINS];
+static size_t next_origin;
+static async_memcpy_context_t context;
+static bool installed;
+
+static void copy_loop(void)
+{
+    for (;;)
+    {
+        mock_copy_t copy;
+        {
+            std::unique_lock<std::mutex> lk(copy_lock);
+            copy_cond.wait(lk, [] { return !copies.empty(); });
+            copy = copies.front();
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(copy.n / MOCK_GDMA_BYTES_PER_US));
+        memcpy(copy.dst, copy.src, copy.n);
+        {
+            std::lock_guard<std::mutex> lk(copy_lock);
+            copies.pop_front();
+        }
+        async_memcpy_event_t event = {nullptr};
+        copy.cb(&context, &event, copy.cb_args);
+    }
+}
+
+esp_err_t esp_async_memcpy_install(const async_memcpy_config_t *config, async_memcpy_handle_t *mcp)
+{
+    std::lock_guard<std::mutex> lk(copy_lock);
+    if (installed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    installed = true;
+    context.backlog = config->backlog;
+    *mcp = &context;
+    std::thread(copy_loop).detach();
+    return ESP_OK;
+}
+
+esp_err_t esp_async_memcpy_uninstall(async_memcpy_handle_t mcp)
+{
+    (void)mcp;
+    return ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_async_memcpy(async_memcpy_handle_t mcp, void *dst, void *src, size_t n,
+                           async_memcpy_isr_cb_t cb_isr, void *cb_args)
+{
+    std::lock_guard<std::mutex> lk(copy_lock);
+    if (mcp != &context || copies.size() >= context.backlog)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    origins[next_origin] = {(const uint8_t *)dst, n, mock_camera_capture_time(src)};
+    next_origin = (next_origin + 1) % MOCK_COPY_ORIGINS;
+    copies.push_back({dst, src, n, cb_isr, cb_args});
+    copy_cond.notify_all();
+    return ESP_OK;
+}
+
+int64_t mock_async_memcpy_capture_time(const void *ptr)
+{
+    std::lock_guard<std::mutex> lk(copy_lock);
+    const uint8_t *p = (const uint8_t *)ptr;
+    // Newest first: destinations are reused
+    for (size_t i = 0; i < MOCK_COPY_ORIGINS; i++)
+    {
+        const mock_copy_origin_t &o = origins[(next_origin + MOCK_COPY_ORIGINS - 1 - i) % MOCK_COPY_ORIGINS];
+        if (o.dst && p >= o.dst && p < o.dst + o.n)
+        {
+            return o.capture_us;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,926 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Mock esp32-camera driver: a producer thread plays the sensor, writing JPEG
+// files (or synthetic frames) into fb_count buffers at the sensor frame rate
+// with the same latest/when-empty grab semantics as the DMA driver. Frames
+// land in their buffer DMA chunk by DMA chunk over the readout, through
+// ll_cam_memcpy like the driver's task, and become ready at its end. Its
+// VSYNC and DMA interrupts are allocated through esp_intr_alloc and raised
+// from the producer thread.
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "esp_camera.h"
+#include "esp_intr_alloc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sim.h"
+
+static const char *TAG = "MOCK_CAM";
+
+// OV2640 registers as addressed by the firmware (bit 8 = sensor bank)
+#define MOCK_REG_GAIN 0x100
+#define MOCK_REG_REG04 0x104
+#define MOCK_REG_COM2 0x109
+#define MOCK_REG_AEC 0x110
+#define MOCK_REG_CLKRC 0x111
+#define MOCK_REG_REG45 0x145
+
+// AEC/AGC state after power-up, far from any real scene
+#define MOCK_DEFAULT_EXPOSURE 64
+#define MOCK_DEFAULT_GAIN 0
+
+// COM2 after init: 3x output drive; bit 4 is soft standby
+#define MOCK_COM2_DEFAULT 0x02
+#define MOCK_COM2_STANDBY 0x10
+
+// Frames the sensor needs after leaving standby before the DMA sees a whole one
+#define MOCK_STANDBY_WAKE_FRAMES 1
+
+// esp32-camera gives up on a frame after FB_GET_TIMEOUT
+#define MOCK_FB_GET_TIMEOUT_MS 4000
+
+// Share of the frame period the sensor spends clocking out a frame; the rest
+// is vertical blanking
+#define MOCK_READOUT_PCT 90
+
+const resolution_info_t resolution[FRAMESIZE_INVALID] = {
+    {96, 96}, {160, 120}, {176, 144}, {240, 176}, {240, 240}, {320, 240}, {400, 296},
+    {480, 320}, {640, 480}, {800, 600}, {1024, 768}, {1280, 720}, {1280, 1024}, {1600, 1200},
+};
+
+mock_camera_config_t mock_camera_config = {
+    .sensor_fps = 0,
+    .jitter_us = 0,
+    .jpeg_files = {},
+    .synthetic_jpeg_size = 24 * 1024,
+    .jpeg_padding = 0,
+    .init_ms = 250,
+    .scene_exposure = 600,
+    .scene_gain = 32,
+    .fault_at_s = 0,
+    .fault_tier = 1,
+    .fault_corrupt = false,
+    .dma_chunk = 16384,
+};
+
+typedef enum
+{
+    MOCK_FB_FREE,
+    MOCK_FB_WRITING,
+    MOCK_FB_READY,
+    MOCK_FB_HELD,
+} mock_fb_state_t;
+
+typedef struct
+{
+    camera_fb_t fb;
+    size_t capacity;
+    mock_fb_state_t state;
+    int64_t capture_us;
+    uint64_t seq;
+} mock_fb_t;
+
+static std::mutex cam_lock;
+static std::condition_variable cam_cond;
+static std::thread producer;
+static bool running;
+static camera_config_t active_config;
+static std::vector<mock_fb_t> fbs;
+static mock_camera_stats_t cam_stats;
+static size_t next_file;
+static sensor_t mock_sensor;
+static uint8_t clkrc_div;
+static double readout_fps; // Set by set_res_raw, 0: follows the frame size
+static uint16_t aec_lines;
+static uint16_t agc_gain;
+static uint8_t com2;
+static uint32_t wake_frames;   // Sensor periods left before output resumes after standby
+static std::vector<uint8_t> staging; // The frame the sensor clocks out, landed chunk by chunk
+
+// Capture stopped by cam_stop, and the injected fault
+static bool capture_stopped;
+static int64_t fault_at_us;
+static bool faulted;
+
+// Frame rate the OV2640 delivers for a window with CLKRC at its default
+static double native_fps(framesize_t size)
+{
+    if (mock_camera_config.sensor_fps > 0)
+    {
+        return mock_camera_config.sensor_fps;
+    }
+    if (readout_fps > 0)
+    {
+        return readout_fps;
+    }
+    if (resolution[size].width <= 400 && resolution[size].height <= 296)
+    {
+        return 60;
+    }
+    if (resolution[size].width <= 800 && resolution[size].height <= 600)
+    {
+        return 30;
+    }
+    return 15;
+}
+
+// Render the next frame for buffer m into dst; called with cam_lock held.
+// The capture time is the start of the readout, as in the driver.
+// Baseline JPEG header of the synthetic frames: DC step 8, 4:2:2 like the
+// OV2640, the standard luma DC code for every component and an AC code that
+// only has the end of block
+static const uint8_t synthetic_dc_counts[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1};
+#define SYNTHETIC_DC_STEP 8
+// Leading MCUs given scan data, enough for the firmware's change signature
+#define SYNTHETIC_MCUS 64
+
+struct bit_writer_t
+{
+    uint8_t *dst;
+    size_t pos;
+    uint32_t acc;
+    int bits;
+
+    void put(uint32_t v, int n)
+    {
+        for (int i = n - 1; i >= 0; i--)
+        {
+            acc = (acc << 1) | ((v >> i) & 1);
+            if (++bits == 8)
+            {
+                flush_byte();
+            }
+        }
+    }
+
+    void flush_byte()
+    {
+        dst[pos++] = (uint8_t)acc;
+        if ((uint8_t)acc == 0xFF)
+        {
+            dst[pos++] = 0x00;  // Stuffed
+        }
+        acc = 0;
+        bits = 0;
+    }
+};
+
+// DC difference of a block, then an immediate end of block
+static void put_dc_block(bit_writer_t *w, int diff)
+{
+    int mag = diff < 0 ? -diff : diff;
+    int cat = 0;
+    while (mag >> cat)
+    {
+        cat++;
+    }
+    // Canonical code of symbol cat from the counts
+    int code = 0;
+    int symbol = 0;
+    for (int n = 0; n < 16; n++)
+    {
+        if (cat < symbol + synthetic_dc_counts[n])
+        {
+            w->put((uint32_t)(code + cat - symbol), n + 1);
+            break;
+        }
+        symbol += synthetic_dc_counts[n];
+        code = (code + synthetic_dc_counts[n]) << 1;
+    }
+    if (cat)
+    {
+        w->put((uint32_t)(diff < 0 ? diff + (1 << cat) - 1 : diff), cat);
+    }
+    w->put(0, 1);
+}
+
+// A baseline JPEG of size bytes: real headers and DC-only blocks of a flat
+// scene at level (plus noise) for the first MCUs, then filler up to EOI.
+// Returns false if size has no room for it.
+static bool synthetic_jpeg(uint8_t *dst, size_t size, uint16_t width, uint16_t height, int level, uint64_t seq)
+{
+    const uint8_t header[] = {
+        0xFF, 0xD8,
+        0xFF, 0xDB, 0x00, 0x43, 0x00, SYNTHETIC_DC_STEP,
+    };
+    const uint8_t sof[] = {
+        0xFF, 0xC0, 0x00, 0x11, 0x08, (uint8_t)(height >> 8), (uint8_t)height, (uint8_t)(width >> 8),
+        (uint8_t)width, 0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x00, 0x03, 0x11, 0x00,
+        0xFF, 0xC4, 0x00, 0x1F, 0x00,
+    };
+    const uint8_t tail[] = {
+        0xFF, 0xC4, 0x00, 0x14, 0x10, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00,
+        0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x00, 0x3F, 0x00,
+    };
+    // Headers, at most 5 bytes per MCU with stuffing, EOI
+    if (size < sizeof(header) + 63 + sizeof(sof) + 28 + sizeof(tail) + SYNTHETIC_MCUS * 5 + 2)
+    {
+        return false;
+    }
+
+    size_t p = 0;
+    memcpy(dst + p, header, sizeof(header));
+    p += sizeof(header);
+    memset(dst + p, 1, 63);
+    p += 63;
+    memcpy(dst + p, sof, sizeof(sof));
+    p += sizeof(sof);
+    memcpy(dst + p, synthetic_dc_counts, 16);
+    p += 16;
+    for (uint8_t i = 0; i < 12; i++)
+    {
+        dst[p++] = i;
+    }
+    memcpy(dst + p, tail, sizeof(tail));
+    p += sizeof(tail);
+
+    std::mt19937 noise((uint32_t)seq);
+    bit_writer_t w = {dst, p, 0, 0};
+    int pred = 0;
+    for (int mcu = 0; mcu < SYNTHETIC_MCUS; mcu++)
+    {
+        for (int block = 0; block < 2; block++)
+        {
+            int dc = (level - 128 + (int)(noise() % 3) - 1) * 8 / SYNTHETIC_DC_STEP;
+            put_dc_block(&w, dc - pred);
+            pred = dc;
+        }
+        put_dc_block(&w, 0);
+        put_dc_block(&w, 0);
+    }
+    // Pad with 1 bits, then filler that holds no marker
+    if (w.bits)
+    {
+        w.put(0xFF, 8 - w.bits);
+    }
+    memset(dst + w.pos, (uint8_t)(seq & 0x7F), size - 2 - w.pos);
+    dst[size - 2] = 0xFF;
+    dst[size - 1] = 0xD9;
+    return true;
+}
+
+static void render_frame(mock_fb_t *m, uint8_t *dst)
+{
+    const camera_status_t *st = &mock_sensor.status;
+    camera_fb_t *fb = &m->fb;
+
+    fb->width = resolution[st->framesize].width;
+    fb->height = resolution[st->framesize].height;
+    fb->format = mock_sensor.pixformat;
+
+    if (fb->format == PIXFORMAT_JPEG)
+    {
+        if (!mock_camera_config.jpeg_files.empty())
+        {
+            const std::vector<uint8_t> &file = mock_camera_config.jpeg_files[next_file];
+            next_file = (next_file + 1) % mock_camera_config.jpeg_files.size();
+            fb->len = std::min(file.size(), m->capacity);
+            memcpy(dst, file.data(), fb->len);
+        }
+        else
+        {
+            // Headers, the first MCUs and EOI are all the firmware looks at.
+            // The size shrinks roughly inversely with the quality value and
+            // grows with the frame area, synthetic_jpeg_size being the size
+            // of a VGA frame at quality 10.
+            size_t size = (size_t)((uint64_t)mock_camera_config.synthetic_jpeg_size * fb->width * fb->height /
+                                   (640 * 480) * 10 / std::max<int>(st->quality, 1));
+            // A scene change brightens the picture and grows the frame; the
+            // rest changes every frame like sensor noise
+            int level = 100;
+            if (mock_camera_config.scene_change_ms &&
+                (esp_timer_get_time() / 1000 / mock_camera_config.scene_change_ms) & 1)
+            {
+                size = size * 11 / 10;
+                level = 140;
+            }
+            fb->len = std::max<size_t>(std::min(size, m->capacity), 4);
+            if (!synthetic_jpeg(dst, fb->len, fb->width, fb->height, level, m->seq))
+            {
+                // Too small for headers: SOI, a sequence-numbered body and EOI
+                memset(dst, (uint8_t)m->seq, fb->len);
+                dst[0] = 0xFF;
+                dst[1] = 0xD8;
+                dst[fb->len - 2] = 0xFF;
+                dst[fb->len - 1] = 0xD9;
+            }
+        }
+
+        // Like the OV2640, keep clocking out data after EOI
+        size_t pad = std::min(mock_camera_config.jpeg_padding, m->capacity - fb->len);
+        memset(dst + fb->len, 0, pad);
+        fb->len += pad;
+    }
+    else
+    {
+        // Moving UYVY gradient, as the OV2640 emits it
+        fb->len = std::min(fb->width * fb->height * 2, m->capacity);
+        for (size_t i = 0; i < fb->len; i++)
+        {
+            dst[i] = (i & 1) ? (uint8_t)(i / 2 + m->seq) : 0x80;
+        }
+    }
+
+    m->capture_us = esp_timer_get_time();
+    fb->timestamp.tv_sec = m->capture_us / 1000000;
+    fb->timestamp.tv_usec = m->capture_us % 1000000;
+}
+
+// One AEC/AGC loop iteration per frame: a third of the remaining error, like
+// a damped sensor loop
+static uint16_t converge(uint16_t value, uint16_t target)
+{
+    int step = ((int)target - (int)value) / 3;
+    if (step == 0 && value != target)
+    {
+        step = target > value ? 1 : -1;
+    }
+    return (uint16_t)(value + step);
+}
+
+static mock_fb_t *find_fb(mock_fb_state_t state)
+{
+    mock_fb_t *found = nullptr;
+    for (mock_fb_t &m : fbs)
+    {
+        if (m.state == state && (found == nullptr || m.seq < found->seq))
+        {
+            found = &m;
+        }
+    }
+    return found;
+}
+
+// Called with cam_lock held
+static void clear_fault(int tier, const char *action)
+{
+    if (faulted && mock_camera_config.fault_tier <= tier)
+    {
+        faulted = false;
+        cam_stats.cleared_us = esp_timer_get_time();
+        cam_stats.cleared_by = action;
+        ESP_LOGI(TAG, "Fault cleared by %s", action);
+    }
+}
+
+// The sensor outputs frames and the DMA can take them; called with cam_lock held
+static bool capturing(void)
+{
+    return running && !capture_stopped && !(com2 & MOCK_COM2_STANDBY) && mock_xclk_running();
+}
+
+// The driver's interrupts only hand events to its task
+static intr_handle_t vsync_intr;
+static intr_handle_t dma_intr;
+static std::atomic<uint64_t> intr_events;
+
+static void cam_isr(void *arg)
+{
+    (void)arg;
+    intr_events++;
+}
+
+static void capture_one(uint64_t seq, int64_t period_us)
+{
+    std::unique_lock<std::mutex> lk(cam_lock);
+    int64_t now = esp_timer_get_time();
+    if (fault_at_us && now >= fault_at_us)
+    {
+        fault_at_us = 0;
+        faulted = true;
+        cam_stats.fault_us = now;
+        ESP_LOGI(TAG, "Injecting %s fault", mock_camera_config.fault_corrupt ? "corrupt frame" : "capture stall");
+    }
+    if (!capturing() || (faulted && !mock_camera_config.fault_corrupt))
+    {
+        return;
+    }
+    if (wake_frames)
+    {
+        wake_frames--;
+        return;
+    }
+
+    // VSYNC: the DMA picks the buffer this frame lands in
+    mock_intr_raise(vsync_intr);
+    mock_fb_t *target = find_fb(MOCK_FB_FREE);
+    if (target == nullptr && active_config.grab_mode == CAMERA_GRAB_LATEST)
+    {
+        // Every other buffer is held: the DMA overwrites the waiting frame
+        target = find_fb(MOCK_FB_READY);
+        if (target != nullptr)
+        {
+            cam_stats.overwritten++;
+        }
+    }
+    if (target == nullptr)
+    {
+        cam_stats.overruns++;
+        return;
+    }
+
+    aec_lines = converge(aec_lines, mock_camera_config.scene_exposure);
+    agc_gain = converge(agc_gain, mock_camera_config.scene_gain);
+    target->seq = seq;
+    target->state = MOCK_FB_WRITING;
+    staging.resize(target->capacity);
+    render_frame(target, staging.data());
+    if (faulted && target->fb.len >= 2)
+    {
+        // A DMA out of sync with VSYNC: the frame never reaches its EOI
+        staging[target->fb.len - 2] = 0;
+        staging[target->fb.len - 1] = 0;
+    }
+
+    // The driver's task copies each DMA chunk into the buffer as it fills,
+    // the last one at the end of the readout
+    size_t len = target->fb.len;
+    size_t chunk = std::max<size_t>(mock_camera_config.dma_chunk, 64);
+    int64_t readout_us = period_us * MOCK_READOUT_PCT / 100;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t off = 0; off < len;)
+    {
+        size_t n = std::min(chunk, len - off);
+        auto due = start + std::chrono::microseconds(readout_us * (int64_t)(off + n) / (int64_t)len);
+        cam_cond.wait_until(lk, due, [] { return !capturing(); });
+        if (!capturing())
+        {
+            // Stopped mid-frame: the partial frame is dropped
+            target->state = MOCK_FB_FREE;
+            return;
+        }
+        // Unlocked, like the driver's task: the copy hook may call back into the camera
+        lk.unlock();
+        mock_intr_raise(dma_intr);
+        ll_cam_memcpy(nullptr, target->fb.buf + off, staging.data() + off, n);
+        lk.lock();
+        off += n;
+    }
+
+    // VSYNC: the frame is complete
+    mock_fb_t *ready = find_fb(MOCK_FB_READY);
+    target->state = MOCK_FB_READY;
+    cam_stats.captured++;
+    if (ready != nullptr && active_config.grab_mode == CAMERA_GRAB_LATEST)
+    {
+        // Only the newest frame stays queued in latest mode
+        ready->state = MOCK_FB_FREE;
+        cam_stats.overwritten++;
+    }
+    cam_cond.notify_all();
+}
+
+static void producer_loop(void)
+{
+    std::mt19937 rng(1);
+    auto next = std::chrono::steady_clock::now();
+    uint64_t seq = 0;
+
+    for (;;)
+    {
+        double fps;
+        {
+            std::lock_guard<std::mutex> lk(cam_lock);
+            if (!running)
+            {
+                return;
+            }
+            fps = native_fps(mock_sensor.status.framesize) / (clkrc_div + 1);
+        }
+
+        int64_t period_us = (int64_t)(1000000 / fps);
+        if (mock_camera_config.jitter_us)
+        {
+            int32_t j = (int32_t)mock_camera_config.jitter_us;
+            period_us += std::uniform_int_distribution<int32_t>(-j, j)(rng);
+        }
+        next += std::chrono::microseconds(std::max<int64_t>(period_us, 0));
+
+        std::unique_lock<std::mutex> lk(cam_lock);
+        if (cam_cond.wait_until(lk, next, [] { return !running; }))
+        {
+            return;
+        }
+        lk.unlock();
+        capture_one(++seq, period_us);
+    }
+}
+
+static int set_framesize(sensor_t *s, framesize_t size)
+{
+    if (size >= FRAMESIZE_INVALID)
+    {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lk(cam_lock);
+    s->status.framesize = size;
+    clkrc_div = 0;
+    readout_fps = 0;
+    return 0;
+}
+
+static int set_pixformat(sensor_t *s, pixformat_t format)
+{
+    s->pixformat = format;
+    return 0;
+}
+
+static int set_quality(sensor_t *s, int quality)
+{
+    s->status.quality = quality;
+    return 0;
+}
+
+// Current value of a modelled register; called with cam_lock held
+static int read_reg(int reg)
+{
+    switch (reg)
+    {
+    case MOCK_REG_CLKRC:
+        return clkrc_div;
+    case MOCK_REG_COM2:
+        return com2;
+    case MOCK_REG_GAIN:
+        return agc_gain & 0xFF;
+    case MOCK_REG_REG04:
+        return aec_lines & 0x03;
+    case MOCK_REG_AEC:
+        return (aec_lines >> 2) & 0xFF;
+    case MOCK_REG_REG45:
+        return ((agc_gain >> 2) & 0xC0) | ((aec_lines >> 10) & 0x3F);
+    default:
+        return 0;
+    }
+}
+
+// The OV2640 only answers on SCCB while XCLK runs; called with cam_lock held
+static bool sccb_clocked(void)
+{
+    if (!mock_xclk_running())
+    {
+        cam_stats.sccb_unclocked++;
+        return false;
+    }
+    return true;
+}
+
+static int set_reg(sensor_t *s, int reg, int mask, int value)
+{
+    (void)s;
+    std::lock_guard<std::mutex> lk(cam_lock);
+    if (!sccb_clocked())
+    {
+        return -1;
+    }
+    value = (read_reg(reg) & ~mask) | (value & mask);
+    switch (reg)
+    {
+    case MOCK_REG_CLKRC:
+        clkrc_div = value;
+        break;
+    case MOCK_REG_COM2:
+        if ((value & MOCK_COM2_STANDBY) && !(com2 & MOCK_COM2_STANDBY))
+        {
+            cam_stats.standby_entries++;
+        }
+        else if (!(value & MOCK_COM2_STANDBY) && (com2 & MOCK_COM2_STANDBY))
+        {
+            wake_frames = MOCK_STANDBY_WAKE_FRAMES;
+        }
+        com2 = value;
+        break;
+    case MOCK_REG_GAIN:
+        agc_gain = (agc_gain & 0x300) | value;
+        break;
+    case MOCK_REG_REG04:
+        aec_lines = (aec_lines & ~0x03) | (value & 0x03);
+        break;
+    case MOCK_REG_AEC:
+        aec_lines = (aec_lines & ~0x3FC) | (value << 2);
+        break;
+    case MOCK_REG_REG45:
+        agc_gain = (agc_gain & 0xFF) | ((value & 0xC0) << 2);
+        aec_lines = (aec_lines & 0x3FF) | ((value & 0x3F) << 10);
+        break;
+    }
+    return 0;
+}
+
+static int get_reg(sensor_t *s, int reg, int mask)
+{
+    (void)s;
+    std::lock_guard<std::mutex> lk(cam_lock);
+    if (!sccb_clocked())
+    {
+        return -1;
+    }
+    return read_reg(reg) & mask;
+}
+
+// The OV2640 driver's set_window: startX is the readout mode (UXGA, SVGA,
+// CIF), the window lies within that mode's field and is only scaled down.
+// Frames keep the size of the current framesize, as in the driver.
+static int set_res_raw(sensor_t *s, int startX, int startY, int endX, int endY, int offsetX, int offsetY,
+                       int totalX, int totalY, int outputX, int outputY, bool scale, bool binning)
+{
+    (void)s, (void)startY, (void)endX, (void)endY, (void)scale, (void)binning;
+    static const struct
+    {
+        int width;
+        int height;
+        double fps;
+    } modes[] = {{1600, 1200, 15}, {800, 600, 30}, {400, 296, 60}};
+    if (startX < 0 || startX > 2 || offsetX < 0 || offsetY < 0 || offsetX + totalX > modes[startX].width ||
+        offsetY + totalY > modes[startX].height || outputX > totalX || outputY > totalY || (totalX & 7) ||
+        (totalY & 7))
+    {
+        ESP_LOGW(TAG, "Bad window mode %d: %dx%d at %d,%d to %dx%d", startX, totalX, totalY, offsetX, offsetY,
+                 outputX, outputY);
+        return -1;
+    }
+    std::lock_guard<std::mutex> lk(cam_lock);
+    if (!sccb_clocked())
+    {
+        return -1;
+    }
+    clkrc_div = 0;
+    readout_fps = modes[startX].fps;
+    cam_stats.window_writes++;
+    return 0;
+}
+
+static int set_pll(sensor_t *s, int bypass, int mul, int sys, int root, int pre, int seld5, int pclken, int pclk)
+{
+    (void)s, (void)bypass, (void)mul, (void)sys, (void)root, (void)pre, (void)seld5, (void)pclken, (void)pclk;
+    return 0;
+}
+
+static int set_xclk(sensor_t *s, int timer, int xclk)
+{
+    (void)timer;
+    s->xclk_freq_hz = xclk * 1000000;
+    return 0;
+}
+
+static int sensor_noop(sensor_t *s)
+{
+    (void)s;
+    return 0;
+}
+
+// Soft reset: back to the default register tables
+static int sensor_reset(sensor_t *s)
+{
+    (void)s;
+    std::lock_guard<std::mutex> lk(cam_lock);
+    clkrc_div = 0;
+    readout_fps = 0;
+    aec_lines = MOCK_DEFAULT_EXPOSURE;
+    agc_gain = MOCK_DEFAULT_GAIN;
+    com2 = MOCK_COM2_DEFAULT;
+    cam_stats.sensor_resets++;
+    clear_fault(2, "sensor reset");
+    return 0;
+}
+
+// Tuning setters only matter to the real image; count the SCCB writes they
+// stand for and ignore the value
+static int set_int_noop(sensor_t *s, int value)
+{
+    (void)s, (void)value;
+    std::lock_guard<std::mutex> lk(cam_lock);
+    if (!sccb_clocked())
+    {
+        return -1;
+    }
+    cam_stats.tuning_writes++;
+    return 0;
+}
+
+static int set_gainceiling(sensor_t *s, gainceiling_t g)
+{
+    s->status.gainceiling = g;
+    return 0;
+}
+
+static void sensor_setup(const camera_config_t *config)
+{
+    memset(&mock_sensor, 0, sizeof(mock_sensor));
+    mock_sensor.slv_addr = 0x30;
+    mock_sensor.pixformat = config->pixel_format;
+    mock_sensor.xclk_freq_hz = config->xclk_freq_hz;
+    mock_sensor.status.framesize = config->frame_size;
+    mock_sensor.status.quality = config->jpeg_quality;
+
+    mock_sensor.init_status = sensor_noop;
+    mock_sensor.reset = sensor_reset;
+    mock_sensor.set_pixformat = set_pixformat;
+    mock_sensor.set_framesize = set_framesize;
+    mock_sensor.set_quality = set_quality;
+    mock_sensor.set_gainceiling = set_gainceiling;
+    mock_sensor.set_reg = set_reg;
+    mock_sensor.get_reg = get_reg;
+    mock_sensor.set_res_raw = set_res_raw;
+    mock_sensor.set_pll = set_pll;
+    mock_sensor.set_xclk = set_xclk;
+
+    int (**setters[])(sensor_t *, int) = {
+        &mock_sensor.set_contrast, &mock_sensor.set_brightness, &mock_sensor.set_saturation,
+        &mock_sensor.set_sharpness, &mock_sensor.set_denoise, &mock_sensor.set_colorbar,
+        &mock_sensor.set_whitebal, &mock_sensor.set_gain_ctrl, &mock_sensor.set_exposure_ctrl,
+        &mock_sensor.set_hmirror, &mock_sensor.set_vflip, &mock_sensor.set_aec2,
+        &mock_sensor.set_awb_gain, &mock_sensor.set_agc_gain, &mock_sensor.set_aec_value,
+        &mock_sensor.set_special_effect, &mock_sensor.set_wb_mode, &mock_sensor.set_ae_level,
+        &mock_sensor.set_dcw, &mock_sensor.set_bpc, &mock_sensor.set_wpc,
+        &mock_sensor.set_raw_gma, &mock_sensor.set_lenc,
+    };
+    for (auto setter : setters)
+    {
+        *setter = set_int_noop;
+    }
+}
+
+esp_err_t esp_camera_init(const camera_config_t *config)
+{
+    if (running)
+    {
+        ESP_LOGE(TAG, "Camera already initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config->frame_size >= FRAMESIZE_INVALID || config->fb_count < 1)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Like the driver, size the buffers for the largest frame at init time
+    size_t capacity;
+    if (config->pixel_format == PIXFORMAT_JPEG)
+    {
+        capacity = (size_t)resolution[config->frame_size].width * resolution[config->frame_size].height / 5;
+        capacity = std::max(capacity, mock_camera_config.synthetic_jpeg_size);
+        for (const std::vector<uint8_t> &file : mock_camera_config.jpeg_files)
+        {
+            capacity = std::max(capacity, file.size());
+        }
+        capacity += mock_camera_config.jpeg_padding;
+    }
+    else
+    {
+        capacity = (size_t)resolution[config->frame_size].width * resolution[config->frame_size].height * 2;
+    }
+
+    // The driver configures (and so starts) the LEDC timer for XCLK first
+    ledc_timer_resume(LEDC_LOW_SPEED_MODE, config->ledc_timer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(mock_camera_config.init_ms));
+    const int intr_flags = ESP_INTR_FLAG_LOWMED | ESP_INTR_FLAG_SHARED | ESP_INTR_FLAG_IRAM;
+    esp_intr_alloc(ETS_LCD_CAM_INTR_SOURCE, intr_flags, cam_isr, nullptr, &vsync_intr);
+    esp_intr_alloc(ETS_DMA_IN_CH0_INTR_SOURCE, intr_flags, cam_isr, nullptr, &dma_intr);
+
+    std::lock_guard<std::mutex> lk(cam_lock);
+    active_config = *config;
+    sensor_setup(config);
+    clkrc_div = 0;
+    readout_fps = 0;
+    aec_lines = MOCK_DEFAULT_EXPOSURE;
+    agc_gain = MOCK_DEFAULT_GAIN;
+    com2 = MOCK_COM2_DEFAULT;
+    wake_frames = 0;
+    capture_stopped = false;
+    cam_stats.inits++;
+    clear_fault(3, "reinit");
+    fbs.assign(config->fb_count, mock_fb_t{});
+    for (mock_fb_t &m : fbs)
+    {
+        m.fb.buf = new uint8_t[capacity];
+        m.capacity = capacity;
+        m.state = MOCK_FB_FREE;
+    }
+    running = true;
+    producer = std::thread(producer_loop);
+    ESP_LOGI(TAG, "%zu x %zu byte buffers, format %d, size %dx%d", fbs.size(), capacity,
+             config->pixel_format, resolution[config->frame_size].width, resolution[config->frame_size].height);
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit(void)
+{
+    {
+        std::lock_guard<std::mutex> lk(cam_lock);
+        if (!running)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        running = false;
+        cam_cond.notify_all();
+    }
+    producer.join();
+    esp_intr_free(vsync_intr);
+    esp_intr_free(dma_intr);
+    vsync_intr = nullptr;
+    dma_intr = nullptr;
+
+    std::lock_guard<std::mutex> lk(cam_lock);
+    for (mock_fb_t &m : fbs)
+    {
+        if (m.state == MOCK_FB_HELD)
+        {
+            ESP_LOGW(TAG, "Deinit with a frame buffer still held");
+        }
+        delete[] m.fb.buf;
+    }
+    fbs.clear();
+    cam_stats.held = 0;
+    return ESP_OK;
+}
+
+camera_fb_t *esp_camera_fb_get(void)
+{
+    std::unique_lock<std::mutex> lk(cam_lock);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MOCK_FB_GET_TIMEOUT_MS);
+    if (!cam_cond.wait_until(lk, deadline, [] { return !running || find_fb(MOCK_FB_READY) != nullptr; }) || !running)
+    {
+        ESP_LOGW(TAG, "Failed to get the frame on time!");
+        return nullptr;
+    }
+
+    mock_fb_t *m = find_fb(MOCK_FB_READY);
+    m->state = MOCK_FB_HELD;
+    cam_stats.fetched++;
+    cam_stats.held++;
+    return &m->fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb)
+{
+    std::lock_guard<std::mutex> lk(cam_lock);
+    for (mock_fb_t &m : fbs)
+    {
+        if (&m.fb == fb && m.state == MOCK_FB_HELD)
+        {
+            m.state = MOCK_FB_FREE;
+            cam_stats.held--;
+            return;
+        }
+    }
+    ESP_LOGE(TAG, "Returned a frame buffer that is not held");
+}
+
+// esp32-camera internals the firmware uses for a DMA restart
+extern "C" void cam_stop(void)
+{
+    std::lock_guard<std::mutex> lk(cam_lock);
+    capture_stopped = true;
+}
+
+extern "C" void cam_start(void)
+{
+    std::lock_guard<std::mutex> lk(cam_lock);
+    capture_stopped = false;
+    cam_stats.dma_restarts++;
+    clear_fault(1, "DMA restart");
+}
+
+void mock_camera_arm_fault(int64_t commit_us)
+{
+    std::lock_guard<std::mutex> lk(cam_lock);
+    if (mock_camera_config.fault_at_s > 0)
+    {
+        fault_at_us = commit_us + (int64_t)(mock_camera_config.fault_at_s * 1000000);
+    }
+}
+
+sensor_t *esp_camera_sensor_get(void)
+{
+    return running ? &mock_sensor : nullptr;
+}
+
+void mock_camera_get_stats(mock_camera_stats_t *stats)
+{
+    std::lock_guard<std::mutex> lk(cam_lock);
+    *stats = cam_stats;
+}
+
+int64_t mock_camera_capture_time(const void *ptr)
+{
+    const uint8_t *p = (const uint8_t *)ptr;
+    std::lock_guard<std::mutex> lk(cam_lock);
+    for (const mock_fb_t &m : fbs)
+    {
+        if (p >= m.fb.buf && p < m.fb.buf + m.capacity)
+        {
+            return m.capture_us;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,370 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Mock CDC-ACM function: the device side FIFOs of TinyUSB's cdc_device.c and
+// a host terminal on a thread. The terminal opens the port once the device is
+// mounted, reads what the device sent every 1 ms, at most what the bulk
+// endpoint moves in a 1 ms frame, half of it while a video transfer shares
+// the frame (unless configured to stall, like a terminal that stopped
+// reading), and types the configured command lines. Received
+// data reaches the firmware's tud_cdc_rx_cb, and the end of each read its
+// tud_cdc_tx_complete_cb, in the USB device task, as on the device.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "esp_timer.h"
+#include "event_recorder.h"
+#include "sim.h"
+
+mock_cdc_config_t mock_cdc_config;
+
+#if CFG_TUD_CDC
+
+static std::mutex cdc_lock;
+static std::deque<uint8_t> tx_fifo; // Device -> host, CFG_TUD_CDC_TX_BUFSIZE at most
+static std::deque<uint8_t> rx_fifo; // Host -> device
+static bool dtr;
+static mock_cdc_stats_t cdc_stats;
+
+bool tud_cdc_n_connected(uint8_t itf)
+{
+    (void)itf;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    return dtr && tud_mounted();
+}
+
+uint32_t tud_cdc_n_available(uint8_t itf)
+{
+    (void)itf;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    return (uint32_t)rx_fifo.size();
+}
+
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize)
+{
+    (void)itf;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    uint32_t n = 0;
+    while (n < bufsize && !rx_fifo.empty())
+    {
+        ((uint8_t *)buffer)[n++] = rx_fifo.front();
+        rx_fifo.pop_front();
+    }
+    return n;
+}
+
+uint32_t tud_cdc_n_write(uint8_t itf, void const *buffer, uint32_t bufsize)
+{
+    (void)itf;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    uint32_t n = 0;
+    while (n < bufsize && tx_fifo.size() < CFG_TUD_CDC_TX_BUFSIZE)
+    {
+        tx_fifo.push_back(((const uint8_t *)buffer)[n++]);
+    }
+    return n;
+}
+
+uint32_t tud_cdc_n_write_flush(uint8_t itf)
+{
+    // The terminal polls the FIFO; nothing to kick
+    (void)itf;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    return (uint32_t)tx_fifo.size();
+}
+
+uint32_t tud_cdc_n_write_available(uint8_t itf)
+{
+    (void)itf;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    return (uint32_t)(CFG_TUD_CDC_TX_BUFSIZE - tx_fifo.size());
+}
+
+static void rx_deferred(void *param)
+{
+    (void)param;
+    tud_cdc_rx_cb(0);
+}
+
+static void tx_deferred(void *param)
+{
+    (void)param;
+    if (tud_cdc_tx_complete_cb)
+    {
+        tud_cdc_tx_complete_cb(0);
+    }
+}
+
+// Recorder dump being received: "OK dump <frames> <bytes>" announces it
+static struct
+{
+    uint64_t left;    // Bytes still to come
+    int64_t start_us;
+    uint8_t header[sizeof(event_recorder_frame_t)];
+    size_t header_len;
+    event_recorder_frame_t frame;  // Header of the frame whose data is coming
+    uint32_t data_done;
+    uint8_t tail[2];               // Last two data bytes, for the EOI
+    bool first;
+    int64_t first_us;
+    int64_t last_us;
+    uint32_t last_seq;
+} dump;
+
+static void dump_start(uint64_t bytes)
+{
+    dump.left = bytes;
+    dump.start_us = esp_timer_get_time();
+    dump.header_len = 0;
+    dump.first = true;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    cdc_stats.dump_frames = 0;
+    cdc_stats.dump_bad = 0;
+    cdc_stats.dump_bytes = 0;
+    cdc_stats.dump_complete = false;
+}
+
+// A whole frame record arrived: magic, JPEG markers and order
+static void dump_frame_done(void)
+{
+    const event_recorder_frame_t &f = dump.frame;
+    bool ok = f.magic == EVENT_RECORDER_MAGIC && f.len >= 4 && dump.tail[0] == 0xFF && dump.tail[1] == 0xD9 &&
+              (dump.first || (f.seq > dump.last_seq && f.capture_us > dump.last_us));
+    if (dump.first)
+    {
+        dump.first_us = f.capture_us;
+    }
+    dump.first = false;
+    dump.last_us = f.capture_us;
+    dump.last_seq = f.seq;
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    cdc_stats.dump_frames++;
+    if (!ok)
+    {
+        cdc_stats.dump_bad++;
+    }
+}
+
+// Binary dump data; returns how much of data belonged to it
+static size_t dump_receive(const uint8_t *data, size_t len)
+{
+    size_t used = 0;
+    while (used < len && dump.left)
+    {
+        if (dump.header_len < sizeof(dump.header))
+        {
+            dump.header[dump.header_len++] = data[used++];
+            dump.left--;
+            if (dump.header_len == sizeof(dump.header))
+            {
+                memcpy(&dump.frame, dump.header, sizeof(dump.frame));
+                dump.data_done = 0;
+            }
+            continue;
+        }
+        size_t n = std::min<size_t>({len - used, dump.frame.len - dump.data_done, (size_t)dump.left});
+        if (dump.data_done == 0 && n && data[used] != 0xFF)
+        {
+            dump.frame.magic = 0; // No SOI, counted bad
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            dump.tail[0] = dump.tail[1];
+            dump.tail[1] = data[used + i];
+        }
+        used += n;
+        dump.left -= n;
+        dump.data_done += n;
+        if (dump.data_done == dump.frame.len)
+        {
+            dump_frame_done();
+            dump.header_len = 0;
+        }
+    }
+    if (dump.left == 0)
+    {
+        std::lock_guard<std::mutex> lk(cdc_lock);
+        cdc_stats.dumps++;
+        cdc_stats.dump_complete = true;
+        cdc_stats.dump_us = esp_timer_get_time() - dump.start_us;
+        cdc_stats.dump_span_us = dump.first ? 0 : dump.last_us - dump.first_us;
+    }
+    {
+        std::lock_guard<std::mutex> lk(cdc_lock);
+        cdc_stats.dump_bytes += used;
+    }
+    return used;
+}
+
+// A whole line from the device
+static void line_received(const std::string &line)
+{
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    if (line.compare(0, 2, "S ") == 0)
+    {
+        cdc_stats.samples++;
+        cdc_stats.last_sample = line;
+        cdc_stats.task_lines = 0;
+        cdc_stats.core_lines.clear();
+    }
+    else if (line.compare(0, 2, "H ") == 0)
+    {
+        cdc_stats.last_hist = line;
+    }
+    else if (line.compare(0, 2, "T ") == 0)
+    {
+        cdc_stats.task_lines++;
+    }
+    else if (line.compare(0, 2, "C ") == 0)
+    {
+        cdc_stats.core_lines.push_back(line);
+    }
+    else if (line.compare(0, 2, "OK") == 0 || line.compare(0, 3, "ERR") == 0)
+    {
+        cdc_stats.replies.push_back(line);
+    }
+}
+
+// Time after opening the port command i is typed: "@<ms> " in front of a
+// line sets it, otherwise 1 s for the first and 100 ms after the previous one
+static int64_t command_due_ms(size_t i, int64_t prev_ms, std::string *text)
+{
+    const std::string &cmd = mock_cdc_config.commands[i];
+    if (cmd.size() > 1 && cmd[0] == '@')
+    {
+        size_t space = cmd.find(' ');
+        *text = space == std::string::npos ? std::string() : cmd.substr(space + 1);
+        return atoll(cmd.c_str() + 1);
+    }
+    *text = cmd;
+    return i == 0 ? 1000 : prev_ms + 100;
+}
+
+static void terminal_loop(void)
+{
+    while (!tud_mounted())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // The host's serial driver binds after the video function
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    int64_t opened_us = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lk(cdc_lock);
+        dtr = true;
+        cdc_stats.opened = true;
+    }
+
+    size_t next_command = 0;
+    std::string command;
+    int64_t command_ms = mock_cdc_config.commands.empty() ? 0 : command_due_ms(0, 0, &command);
+    std::string line;
+    std::vector<uint8_t> data;
+    for (;;)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        int64_t now = esp_timer_get_time();
+        if (next_command < mock_cdc_config.commands.size() && now - opened_us >= command_ms * 1000)
+        {
+            {
+                std::lock_guard<std::mutex> lk(cdc_lock);
+                for (char c : command)
+                {
+                    rx_fifo.push_back((uint8_t)c);
+                }
+                rx_fifo.push_back('\r');
+            }
+            next_command++;
+            usbd_defer_func(rx_deferred, nullptr, false);
+            if (next_command < mock_cdc_config.commands.size())
+            {
+                command_ms = command_due_ms(next_command, command_ms, &command);
+            }
+        }
+
+        if (mock_cdc_config.stall)
+        {
+            continue;
+        }
+        // What the bulk IN endpoint moves in a 1 ms frame; the host controller
+        // shares the frame's packets with a video transfer in progress
+        size_t budget = (size_t)mock_usb_config.packets_per_ms * mock_usb_config.packet_size;
+        if (mock_usb_video_busy())
+        {
+            budget /= 2;
+        }
+        data.clear();
+        {
+            std::lock_guard<std::mutex> lk(cdc_lock);
+            while (!tx_fifo.empty() && data.size() < budget)
+            {
+                data.push_back(tx_fifo.front());
+                tx_fifo.pop_front();
+            }
+            cdc_stats.bytes += data.size();
+        }
+        if (data.empty())
+        {
+            continue;
+        }
+        usbd_defer_func(tx_deferred, nullptr, false);
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            if (dump.left)
+            {
+                i += dump_receive(&data[i], data.size() - i) - 1;
+                continue;
+            }
+            char c = (char)data[i];
+            if (c != '\n')
+            {
+                line.push_back(c);
+                continue;
+            }
+            line_received(line);
+            unsigned long frames;
+            unsigned long long bytes;
+            if (sscanf(line.c_str(), "OK dump %lu %llu", &frames, &bytes) == 2 && bytes)
+            {
+                dump_start(bytes);
+            }
+            line.clear();
+        }
+    }
+}
+
+void mock_cdc_start(void)
+{
+    std::thread(terminal_loop).detach();
+}
+
+void mock_cdc_get_stats(mock_cdc_stats_t *stats)
+{
+    std::lock_guard<std::mutex> lk(cdc_lock);
+    *stats = cdc_stats;
+}
+
+#else
+
+void mock_cdc_start(void)
+{
+}
+
+void mock_cdc_get_stats(mock_cdc_stats_t *stats)
+{
+    *stats = mock_cdc_stats_t();
+}
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// esp_log, esp_timer, cycle counter, interrupt allocator, heap_caps, LEDC and
+// esp_pm stand-ins for the host simulation
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_intr_alloc.h"
+#include "esp_rom_sys.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_pm.h"
+#include "driver/ledc.h"
+#include "nvs.h"
+#include "sim.h"
+
+esp_log_level_t mock_log_level = ESP_LOG_WARN;
+
+static std::mutex log_lock;
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const int64_t start_ns = monotonic_ns();
+
+void mock_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    va_list args;
+
+    std::lock_guard<std::mutex> lk(log_lock);
+    printf("%c (%lld) %s: ", letters[level], (long long)(esp_timer_get_time() / 1000), tag);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (monotonic_ns() - start_ns) / 1000;
+}
+
+struct esp_timer
+{
+    esp_timer_create_args_t args;
+    int64_t expiry_us; // -1 while not armed
+};
+
+static std::mutex timer_lock;
+static std::condition_variable timer_cond;
+static std::vector<esp_timer_handle_t> timers;
+
+static void timer_dispatch_loop(void)
+{
+    std::unique_lock<std::mutex> lk(timer_lock);
+    for (;;)
+    {
+        int64_t next = -1;
+        for (esp_timer_handle_t t : timers)
+        {
+            if (t->expiry_us >= 0 && (next < 0 || t->expiry_us < next))
+            {
+                next = t->expiry_us;
+            }
+        }
+        if (next < 0)
+        {
+            timer_cond.wait(lk);
+            continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (now < next)
+        {
+            timer_cond.wait_for(lk, std::chrono::microseconds(next - now));
+            continue;
+        }
+
+        for (esp_timer_handle_t t : timers)
+        {
+            if (t->expiry_us >= 0 && t->expiry_us <= now)
+            {
+                t->expiry_us = -1;
+                // Callbacks may restart their own timer
+                lk.unlock();
+                t->args.callback(t->args.arg);
+                lk.lock();
+                break;
+            }
+        }
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    static std::once_flag dispatcher_started;
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::call_once(dispatcher_started, [] { std::thread(timer_dispatch_loop).detach(); });
+
+    esp_timer_handle_t t = new esp_timer{*create_args, -1};
+    std::lock_guard<std::mutex> lk(timer_lock);
+    timers.push_back(t);
+    *out_handle = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    std::lock_guard<std::mutex> lk(timer_lock);
+    if (timer->expiry_us >= 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expiry_us = esp_timer_get_time() + (int64_t)timeout_us;
+    timer_cond.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lk(timer_lock);
+    if (timer->expiry_us < 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expiry_us = -1;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lk(timer_lock);
+    if (timer->expiry_us >= 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timers.erase(std::remove(timers.begin(), timers.end(), timer), timers.end());
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lk(timer_lock);
+    return timer->expiry_us >= 0;
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return (uint32_t)monotonic_ns();
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 1000;
+}
+
+// An allocated interrupt: the mocks raise it from their own threads. Like
+// the hardware it belongs to the core that allocated it (or to the shared
+// handle's), which only the task plan's report uses.
+struct mock_intr
+{
+    int source;
+    intr_handler_t handler;
+    void *arg;
+    int cpu;
+};
+
+esp_err_t esp_intr_alloc_intrstatus_bind(int source, int flags, uint32_t intrstatusreg, uint32_t intrstatusmask,
+                                         intr_handler_t handler, void *arg, intr_handle_t shared_handle,
+                                         intr_handle_t *ret_handle)
+{
+    (void)flags, (void)intrstatusreg, (void)intrstatusmask;
+    int cpu = shared_handle ? shared_handle->cpu : esp_cpu_get_core_id();
+    intr_handle_t intr = new mock_intr{source, handler, arg, cpu};
+    if (ret_handle)
+    {
+        *ret_handle = intr;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_intr_alloc_intrstatus(int source, int flags, uint32_t intrstatusreg, uint32_t intrstatusmask,
+                                    intr_handler_t handler, void *arg, intr_handle_t *ret_handle)
+{
+    return esp_intr_alloc_intrstatus_bind(source, flags, intrstatusreg, intrstatusmask, handler, arg, nullptr,
+                                          ret_handle);
+}
+
+esp_err_t esp_intr_alloc_bind(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t shared_handle,
+                              intr_handle_t *ret_handle)
+{
+    return esp_intr_alloc_intrstatus_bind(source, flags, 0, 0, handler, arg, shared_handle, ret_handle);
+}
+
+esp_err_t esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *ret_handle)
+{
+    return esp_intr_alloc_intrstatus_bind(source, flags, 0, 0, handler, arg, nullptr, ret_handle);
+}
+
+int esp_intr_get_cpu(intr_handle_t handle)
+{
+    return handle ? handle->cpu : 0;
+}
+
+esp_err_t esp_intr_free(intr_handle_t handle)
+{
+    if (handle == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    delete handle;
+    return ESP_OK;
+}
+
+void mock_intr_raise(intr_handle_t handle)
+{
+    if (handle && handle->handler)
+    {
+        handle->handler(handle->arg);
+    }
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return calloc(n, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    (void)caps;
+    // aligned_alloc wants size to be a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+// The host has no meaningful heap figures; report the ESP32-S3 module sizes
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? 8 * 1024 * 1024 : 320 * 1024;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+unsigned long esp_get_free_heap_size(void)
+{
+    return heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_LENGTH:
+        return "ESP_ERR_NVS_INVALID_LENGTH";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+// XCLK: the camera driver starts the LEDC timer in esp_camera_init, the mock
+// camera only captures and answers on SCCB while it runs
+static std::mutex power_lock;
+static mock_power_stats_t power_stats = {
+    .xclk_running = true,
+    .xclk_pauses = 0,
+    .cpu_mhz = 240,
+    .freq_switches = 0,
+    .low_us = 0,
+};
+static esp_pm_config_t pm_config;
+static int64_t low_since_us;
+
+esp_err_t ledc_timer_pause(ledc_mode_t speed_mode, ledc_timer_t timer_sel)
+{
+    std::lock_guard<std::mutex> lk(power_lock);
+    power_stats.xclk_pauses += power_stats.xclk_running;
+    power_stats.xclk_running = false;
+    return ESP_OK;
+}
+
+esp_err_t ledc_timer_resume(ledc_mode_t speed_mode, ledc_timer_t timer_sel)
+{
+    std::lock_guard<std::mutex> lk(power_lock);
+    power_stats.xclk_running = true;
+    return ESP_OK;
+}
+
+bool mock_xclk_running(void)
+{
+    std::lock_guard<std::mutex> lk(power_lock);
+    return power_stats.xclk_running;
+}
+
+// Dynamic frequency scaling with CPU_FREQ_MAX locks only: the CPU runs at
+// the maximum while any is held, at the minimum otherwise
+struct esp_pm_lock
+{
+    esp_pm_lock_type_t type;
+    uint32_t count;
+};
+
+static uint32_t cpu_max_locks;
+
+// Called with power_lock held
+static void set_cpu_freq(void)
+{
+    uint32_t mhz = cpu_max_locks ? pm_config.max_freq_mhz : pm_config.min_freq_mhz;
+    if (mhz == power_stats.cpu_mhz)
+    {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (power_stats.cpu_mhz < (uint32_t)pm_config.max_freq_mhz)
+    {
+        power_stats.low_us += now - low_since_us;
+    }
+    low_since_us = now;
+    power_stats.cpu_mhz = mhz;
+    power_stats.freq_switches++;
+}
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    const esp_pm_config_t *c = (const esp_pm_config_t *)config;
+    if (c == NULL || c->min_freq_mhz > c->max_freq_mhz ||
+        (c->min_freq_mhz != 40 && c->min_freq_mhz != 80 && c->min_freq_mhz != 160 && c->min_freq_mhz != 240))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lk(power_lock);
+    pm_config = *c;
+    set_cpu_freq();
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle)
+{
+    if (out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_handle = new esp_pm_lock{lock_type, 0};
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+    std::lock_guard<std::mutex> lk(power_lock);
+    if (handle->count++ == 0 && handle->type == ESP_PM_CPU_FREQ_MAX)
+    {
+        cpu_max_locks++;
+        set_cpu_freq();
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+    std::lock_guard<std::mutex> lk(power_lock);
+    if (handle->count == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (--handle->count == 0 && handle->type == ESP_PM_CPU_FREQ_MAX)
+    {
+        cpu_max_locks--;
+        set_cpu_freq();
+    }
+    return ESP_OK;
+}
+
+void mock_power_get_stats(mock_power_stats_t *stats)
+{
+    std::lock_guard<std::mutex> lk(power_lock);
+    *stats = power_stats;
+    if (power_stats.cpu_mhz < (uint32_t)pm_config.max_freq_mhz)
+    {
+        stats->low_us += esp_timer_get_time() - low_since_us;
+    }
+}
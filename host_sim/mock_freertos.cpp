@@ -0,0 +1,297 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// FreeRTOS task, notification and semaphore subset on POSIX threads
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_cpu.h"
+
+struct mock_task
+{
+    std::string name;
+    UBaseType_t priority;
+    BaseType_t core_id;
+    std::mutex lock;
+    std::condition_variable cond;
+    uint32_t notify_value = 0;
+    bool notify_pending = false;
+    UBaseType_t number = 0;
+    pthread_t thread;
+    bool running = false;
+};
+
+struct mock_semaphore
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    UBaseType_t count;
+    UBaseType_t max_count;
+};
+
+static thread_local mock_task *current_task = nullptr;
+static const auto start_time = std::chrono::steady_clock::now();
+
+// Every task created, for uxTaskGetSystemState
+static std::mutex registry_lock;
+static std::vector<mock_task *> registry;
+
+// portMAX_DELAY waits forever, anything else is a tick (= 1 ms) timeout
+template <typename Pred>
+static bool wait_ticks(std::condition_variable &cond, std::unique_lock<std::mutex> &lk, TickType_t ticks, Pred pred)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        cond.wait(lk, pred);
+        return true;
+    }
+    return cond.wait_for(lk, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), pred);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core_id)
+{
+    (void)stack_depth;
+    mock_task *task = new mock_task;
+    task->name = name;
+    task->priority = priority;
+    task->core_id = core_id;
+    if (handle)
+    {
+        *handle = task;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(registry_lock);
+        task->number = registry.size() + 1;
+        registry.push_back(task);
+    }
+
+    std::thread([task, fn, arg]() {
+        current_task = task;
+        {
+            std::lock_guard<std::mutex> lk(registry_lock);
+            task->thread = pthread_self();
+            task->running = true;
+        }
+        fn(arg);
+    }).detach();
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Threads cannot be killed safely; only self-deletion is supported. The
+    // task leaves the system state like a deleted one, its thread sleeps.
+    if (task == nullptr || task == current_task)
+    {
+        {
+            std::lock_guard<std::mutex> lk(registry_lock);
+            registry.erase(std::remove(registry.begin(), registry.end(), current_task), registry.end());
+        }
+        for (;;)
+        {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start_time;
+    return (TickType_t)(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    mock_task *t = task ? task : current_task;
+    return t ? t->priority : 0;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    (void)task;
+    return 0;
+}
+
+int esp_cpu_get_core_id(void)
+{
+    mock_task *task = current_task;
+    return task && task->core_id >= 0 && task->core_id < portNUM_PROCESSORS ? (int)task->core_id : 0;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t count, uint32_t *total_run_time)
+{
+    std::lock_guard<std::mutex> lk(registry_lock);
+    UBaseType_t n = 0;
+    for (mock_task *task : registry)
+    {
+        if (n == count)
+        {
+            return 0;  // Like FreeRTOS: all or nothing
+        }
+        uint64_t cpu_us = 0;
+        clockid_t clock;
+        struct timespec ts;
+        if (task->running && pthread_getcpuclockid(task->thread, &clock) == 0 && clock_gettime(clock, &ts) == 0)
+        {
+            cpu_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+        TaskStatus_t *t = &status[n++];
+        memset(t, 0, sizeof(*t));
+        t->xHandle = task;
+        t->pcTaskName = task->name.c_str();
+        t->xTaskNumber = task->number;
+        t->eCurrentState = eBlocked;
+        t->uxCurrentPriority = task->priority;
+        t->uxBasePriority = task->priority;
+        t->ulRunTimeCounter = (uint32_t)cpu_us;
+        t->xCoreID = task->core_id;
+    }
+    if (total_run_time)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_time;
+        *total_run_time = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+    return n;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    std::lock_guard<std::mutex> lk(task->lock);
+    switch (action)
+    {
+    case eSetBits:
+        task->notify_value |= value;
+        break;
+    case eIncrement:
+        task->notify_value++;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->notify_pending)
+        {
+            return pdFAIL;
+        }
+        task->notify_value = value;
+        break;
+    case eSetValueWithOverwrite:
+        task->notify_value = value;
+        break;
+    case eNoAction:
+        break;
+    }
+    task->notify_pending = true;
+    task->cond.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+    mock_task *task = current_task;
+    std::unique_lock<std::mutex> lk(task->lock);
+    if (!task->notify_pending)
+    {
+        task->notify_value &= ~clear_on_entry;
+    }
+    if (!wait_ticks(task->cond, lk, ticks, [task] { return task->notify_pending; }))
+    {
+        return pdFALSE;
+    }
+    if (value)
+    {
+        *value = task->notify_value;
+    }
+    task->notify_value &= ~clear_on_exit;
+    task->notify_pending = false;
+    return pdTRUE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    mock_task *task = current_task;
+    std::unique_lock<std::mutex> lk(task->lock);
+    wait_ticks(task->cond, lk, ticks, [task] { return task->notify_value != 0; });
+    uint32_t value = task->notify_value;
+    if (value)
+    {
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    task->notify_pending = task->notify_value != 0;
+    return value;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    mock_semaphore *sem = new mock_semaphore;
+    sem->count = initial_count;
+    sem->max_count = max_count;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lk(sem->lock);
+    if (!wait_ticks(sem->cond, lk, ticks, [sem] { return sem->count > 0; }))
+    {
+        return pdFALSE;
+    }
+    sem->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    std::lock_guard<std::mutex> lk(sem->lock);
+    if (sem->count >= sem->max_count)
+    {
+        return pdFALSE;
+    }
+    sem->count++;
+    sem->cond.notify_one();
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    delete sem;
+}
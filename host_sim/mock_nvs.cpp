@@ -0,0 +1,156 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Mock NVS: blobs in memory, optionally loaded from and committed to a file
+// so a second simulation run boots with what the first one stored
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nvs_flash.h"
+#include "esp_log.h"
+#include "sim.h"
+
+static const char *TAG = "MOCK_NVS";
+
+std::string mock_nvs_path;
+
+static std::mutex nvs_lock;
+static bool initialized;
+static std::map<std::string, std::vector<uint8_t>> entries; // "namespace/key"
+static std::vector<std::string> namespaces;                  // Index + 1 is the handle
+
+// File format: per entry a line "name length" followed by length raw bytes
+static void load_file(void)
+{
+    FILE *f = mock_nvs_path.empty() ? nullptr : fopen(mock_nvs_path.c_str(), "rb");
+    if (f == nullptr)
+    {
+        return;
+    }
+    char name[64];
+    size_t len;
+    while (fscanf(f, "%63s %zu", name, &len) == 2 && fgetc(f) == '\n')
+    {
+        std::vector<uint8_t> data(len);
+        if (fread(data.data(), 1, len, f) != len)
+        {
+            break;
+        }
+        entries[name] = std::move(data);
+    }
+    fclose(f);
+}
+
+static void save_file(void)
+{
+    FILE *f = mock_nvs_path.empty() ? nullptr : fopen(mock_nvs_path.c_str(), "wb");
+    if (f == nullptr)
+    {
+        return;
+    }
+    for (const auto &e : entries)
+    {
+        fprintf(f, "%s %zu\n", e.first.c_str(), e.second.size());
+        fwrite(e.second.data(), 1, e.second.size(), f);
+    }
+    fclose(f);
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    std::lock_guard<std::mutex> lk(nvs_lock);
+    if (!initialized)
+    {
+        load_file();
+        initialized = true;
+        ESP_LOGI(TAG, "%zu entries loaded", entries.size());
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    std::lock_guard<std::mutex> lk(nvs_lock);
+    entries.clear();
+    save_file();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    (void)open_mode;
+    std::lock_guard<std::mutex> lk(nvs_lock);
+    if (!initialized)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    namespaces.push_back(namespace_name);
+    *out_handle = (nvs_handle_t)namespaces.size();
+    return ESP_OK;
+}
+
+static std::string entry_name(nvs_handle_t handle, const char *key)
+{
+    return namespaces[handle - 1] + "/" + key;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    std::lock_guard<std::mutex> lk(nvs_lock);
+    if (handle == 0 || handle > namespaces.size())
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    auto it = entries.find(entry_name(handle, key));
+    if (it == entries.end())
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value == nullptr)
+    {
+        *length = it->second.size();
+        return ESP_OK;
+    }
+    if (*length < it->second.size())
+    {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    *length = it->second.size();
+    memcpy(out_value, it->second.data(), *length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> lk(nvs_lock);
+    if (handle == 0 || handle > namespaces.size())
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    const uint8_t *p = (const uint8_t *)value;
+    entries[entry_name(handle, key)] = std::vector<uint8_t>(p, p + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lk(nvs_lock);
+    if (handle == 0 || handle > namespaces.size())
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    save_file();
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
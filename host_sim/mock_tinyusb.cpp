@@ -0,0 +1,986 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Mock TinyUSB device stack: a bus thread plays the host (enumerate, probe and
+// commit a stream, select an isochronous alternate setting, optionally stop
+// and restart the stream) and models how
+// long each frame takes to drain through the streaming endpoint. Frames come
+// either whole through the video driver or as payloads the firmware queues on
+// the endpoint itself, which the host reassembles from their headers.
+// Callbacks are delivered from tud_task like the real stack does, control
+// requests and endpoint completions through the application class driver
+// when there is one.
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "usb_descriptors.h"
+#include "still_capture.h"
+#include "frame_timing.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_intr_alloc.h"
+#include "soc/soc.h"
+#include "sim.h"
+
+static const char *TAG = "MOCK_USB";
+
+mock_usb_config_t mock_usb_config = {
+    .packets_per_ms = 19, // Full-speed bulk ceiling: 19 x 64 byte packets per frame
+    .packet_size = 64,
+    .payload_gap_us = 20,
+    .enumerate_ms = 300,
+    .commit_ms = 200,
+    .format_index = 1,
+    .frame_index = 4,
+    .frame_interval = 333333,
+    .control_burst = 0,
+    .still_at_s = 0,
+    .still_count = 1,
+    .hub_load_pct = 0,
+    .stop_at_s = 0,
+    .restart_ms = 0,
+};
+
+typedef enum
+{
+    USB_EVT_MOUNT,
+    USB_EVT_COMMIT,
+    USB_EVT_XFER_DONE,
+    USB_EVT_EDPT_DONE,
+    USB_EVT_DEFER,
+    USB_EVT_CONTROL,
+    USB_EVT_STILL,
+    USB_EVT_STOP,
+} usb_event_type_t;
+
+typedef struct
+{
+    usb_event_type_t type;
+    uint32_t xferred_bytes;  // USB_EVT_EDPT_DONE
+    osal_task_func_t func;   // USB_EVT_DEFER
+    void *param;
+} usb_event_t;
+
+static std::mutex usb_lock;
+static std::condition_variable usb_cond;
+static std::deque<usb_event_t> events;
+static bool mounted;
+static bool streaming;
+static bool host_reading = true; // The host application reads the endpoint
+
+// Transfer owned by the modelled endpoint: a whole frame from the video
+// driver, or a single payload queued by the firmware
+static bool xfer_busy;
+static bool xfer_payload;
+static const uint8_t *xfer_buffer;
+static size_t xfer_len;
+static int64_t xfer_capture_us;
+static bool xfer_still;
+static uint32_t xfer_gen;   // Bumped when SET_INTERFACE drops the transfer
+
+// Host reassembly of firmware payloads into frames
+static bool host_frame_open;
+static uint8_t host_fid;
+static size_t host_frame_bytes;
+static int64_t host_frame_start_us;
+static int64_t host_frame_capture_us;
+static uint8_t host_frame_head[2];   // First and last two bytes of the frame, for the JPEG check
+static uint8_t host_frame_tail[2];
+static bool host_frame_pts;          // The frame's payloads carry PTS and SCR
+static uint32_t host_frame_pts_value;
+static uint32_t host_frame_stc;      // Source clock of the last payload
+static bool host_frame_pts_bad;
+
+// Payload header of the video driver: kept between frames, FID toggles after
+// each one. Like the driver's endpoint buffer it has room for a longer header
+// and the length is taken from its first byte; opening the interface puts the
+// 2-byte one back.
+#define MOCK_PAYLOAD_HEADER_FID 0x01
+#define MOCK_PAYLOAD_HEADER_EOF 0x02
+#define MOCK_PAYLOAD_HEADER_PTS 0x04
+#define MOCK_PAYLOAD_HEADER_SCR 0x08
+#define MOCK_PAYLOAD_HEADER_ERR 0x40
+#define MOCK_PAYLOAD_HEADER_EOH 0x80
+static uint8_t payload_header[12] = {2, MOCK_PAYLOAD_HEADER_EOH};
+static uint8_t xfer_header[sizeof(payload_header)];  // As the transfer's first payload left
+
+// Host view of the stream around still images
+static int64_t newest_capture_us = -1;   // Newest capture time received
+static int64_t last_new_frame_us;        // Completion of the last frame with a new capture
+static int64_t still_gap_from_us;        // Gap opened by a still, 0 = none
+static int64_t still_trigger_us;
+
+static mock_usb_stats_t usb_stats;
+static int64_t last_start_us = -1;
+static int64_t restart_us;  // Stream committed again, 0 once its first frame arrived
+
+// Streaming interface: negotiated payload size and, for isochronous
+// endpoints, the packet size of the selected alternate setting
+static uint32_t stream_payload_size = CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE;
+static uint32_t iso_packet_size;
+static video_probe_and_commit_control_t probe_state;
+
+// Control pipe: data stage buffer handed over by tud_control_xfer; IN data is
+// copied to the EP0 buffer first, like usbd_control.c does
+static uint8_t ctrl_ep_buf[256];
+static void *ctrl_buffer;
+static uint16_t ctrl_len;
+static uint32_t controls_sent;
+
+static void post_event(usb_event_type_t type)
+{
+    std::lock_guard<std::mutex> lk(usb_lock);
+    events.push_back({type, 0, nullptr, nullptr});
+    usb_cond.notify_all();
+}
+
+void usbd_defer_func(osal_task_func_t func, void *param, bool in_isr)
+{
+    (void)in_isr;
+    std::lock_guard<std::mutex> lk(usb_lock);
+    events.push_back({USB_EVT_DEFER, 0, func, param});
+    usb_cond.notify_all();
+}
+
+// Time the endpoint needs for len bytes split into UVC payloads and packets.
+// An isochronous endpoint sends one payload in every 1 ms frame whatever else
+// is on the bus; bulk packets get what other devices (load_pct) leave.
+static int64_t transfer_time_us(size_t len, size_t header, uint32_t load_pct)
+{
+    const mock_usb_config_t &c = mock_usb_config;
+    size_t data_per_payload = stream_payload_size - header;
+    size_t payloads = (len + data_per_payload - 1) / data_per_payload;
+    size_t packets = 0;
+
+    if (iso_packet_size)
+    {
+        return (int64_t)payloads * 1000;
+    }
+    uint32_t packets_per_ms = std::max<uint32_t>(1, c.packets_per_ms * (100 - load_pct) / 100);
+
+    for (size_t done = 0; done < len; done += data_per_payload)
+    {
+        size_t bytes = std::min(data_per_payload, len - done) + header;
+        packets += (bytes + c.packet_size - 1) / c.packet_size;
+    }
+    return (int64_t)(packets * 1000 / packets_per_ms + payloads * c.payload_gap_us);
+}
+
+// Time the endpoint needs for one payload of len bytes, header included
+static int64_t payload_time_us(size_t len, uint32_t load_pct)
+{
+    const mock_usb_config_t &c = mock_usb_config;
+    if (iso_packet_size)
+    {
+        return 1000;
+    }
+    uint32_t packets_per_ms = std::max<uint32_t>(1, c.packets_per_ms * (100 - load_pct) / 100);
+    size_t packets = (len + c.packet_size - 1) / c.packet_size;
+    return (int64_t)(packets * 1000 / packets_per_ms + c.payload_gap_us);
+}
+
+// A whole frame reached the host. Called with usb_lock held.
+static void frame_received(size_t len, int64_t capture_us, bool still, int64_t start_us, int64_t now, uint32_t held)
+{
+    if (still)
+    {
+        // The stream is interrupted from the last new frame before
+        // the still until the next new one
+        usb_stats.stills++;
+        usb_stats.still_bytes += len;
+        usb_stats.still_transfer_max_us = std::max(usb_stats.still_transfer_max_us, (uint32_t)(now - start_us));
+        usb_stats.still_latency_max_us = std::max(usb_stats.still_latency_max_us, (uint32_t)(now - still_trigger_us));
+        if (still_gap_from_us == 0)
+        {
+            still_gap_from_us = last_new_frame_us ? last_new_frame_us : start_us;
+        }
+    }
+    else if (capture_us > newest_capture_us)
+    {
+        newest_capture_us = capture_us;
+        last_new_frame_us = now;
+        if (still_gap_from_us)
+        {
+            usb_stats.still_gap_max_us = std::max(usb_stats.still_gap_max_us, (uint32_t)(now - still_gap_from_us));
+            still_gap_from_us = 0;
+        }
+    }
+    if (usb_stats.frames == 0)
+    {
+        usb_stats.first_frame_us = start_us;
+    }
+    if (restart_us && start_us >= restart_us)
+    {
+        usb_stats.resume_last_us = (uint32_t)(now - restart_us);
+        usb_stats.resume_max_us = std::max(usb_stats.resume_max_us, usb_stats.resume_last_us);
+        restart_us = 0;
+    }
+    usb_stats.frames++;
+    usb_stats.bytes += len;
+    if (capture_us >= 0)
+    {
+        usb_stats.latency_us.push_back((uint32_t)(now - capture_us));
+    }
+    usb_stats.queue_depth.push_back(held);
+    if (last_start_us >= 0)
+    {
+        usb_stats.interval_us.push_back((uint32_t)(start_us - last_start_us));
+    }
+    last_start_us = start_us;
+}
+
+// A firmware payload reached the host: follow the frame through the FID and
+// EOF bits of its header, and drop it on the error bit like a UVC host
+// driver. Called with usb_lock held.
+static uint32_t header_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Presentation time and source clock of a payload header (UVC 1.5 Table
+// 2-5): every payload of a frame carries the same PTS, and the source clock
+// never runs behind it or backwards
+static void payload_clock(const uint8_t *payload, uint8_t info)
+{
+    bool pts = (info & MOCK_PAYLOAD_HEADER_PTS) != 0;
+    bool scr = (info & MOCK_PAYLOAD_HEADER_SCR) != 0;
+    if (!pts && !scr && !host_frame_pts)
+    {
+        return;
+    }
+    if (!pts || !scr || payload[0] != 12)
+    {
+        // Some payloads of the frame with the fields, some without
+        host_frame_pts_bad = true;
+        return;
+    }
+    uint32_t value = header_u32(payload + 2);
+    uint32_t stc = header_u32(payload + 6);
+    uint16_t sof = (uint16_t)(payload[10] | payload[11] << 8);
+    if (!host_frame_pts)
+    {
+        host_frame_pts = true;
+        host_frame_pts_value = value;
+        host_frame_stc = stc;
+    }
+    if (value != host_frame_pts_value || (int32_t)(stc - value) < 0 || (int32_t)(stc - host_frame_stc) < 0 ||
+        sof > 0x7FF)
+    {
+        host_frame_pts_bad = true;
+    }
+    host_frame_stc = stc;
+}
+
+static void payload_received(const uint8_t *payload, size_t len, int64_t start_us, int64_t now, uint32_t held)
+{
+    usb_stats.payloads++;
+    if (len < 2 || payload[0] < 2 || payload[0] > len)
+    {
+        return;
+    }
+    uint8_t info = payload[1];
+    uint8_t fid = info & MOCK_PAYLOAD_HEADER_FID;
+    if (host_frame_open && fid != host_fid)
+    {
+        // FID toggled before EOF: the device abandoned the frame
+        host_frame_open = false;
+    }
+    if (!host_frame_open)
+    {
+        host_frame_open = true;
+        host_fid = fid;
+        host_frame_bytes = 0;
+        host_frame_start_us = start_us;
+        host_frame_capture_us = xfer_capture_us;
+        host_frame_pts = false;
+        host_frame_pts_bad = false;
+    }
+    payload_clock(payload, info);
+    const uint8_t *data = payload + payload[0];
+    size_t data_len = len - payload[0];
+    for (size_t i = 0; i < data_len && host_frame_bytes + i < 2; i++)
+    {
+        host_frame_head[host_frame_bytes + i] = data[i];
+    }
+    for (size_t i = data_len > 2 ? data_len - 2 : 0; i < data_len; i++)
+    {
+        host_frame_tail[0] = host_frame_tail[1];
+        host_frame_tail[1] = data[i];
+    }
+    host_frame_bytes += data_len;
+    if (info & MOCK_PAYLOAD_HEADER_ERR)
+    {
+        // The device gave up on the frame: the host discards what it has
+        host_frame_open = false;
+        usb_stats.error_frames++;
+        return;
+    }
+    if (info & MOCK_PAYLOAD_HEADER_EOF)
+    {
+        host_frame_open = false;
+        bool still = (info & UVC_PAYLOAD_HEADER_STI) != 0;
+        if ((still || mock_usb_config.format_index == UVC_FORMAT_INDEX_MJPEG) &&
+            (host_frame_bytes < 4 || host_frame_head[0] != 0xFF || host_frame_head[1] != 0xD8 ||
+             host_frame_tail[0] != 0xFF || host_frame_tail[1] != 0xD9))
+        {
+            usb_stats.bad_frames++;
+        }
+        if (host_frame_pts)
+        {
+            usb_stats.pts_frames++;
+            usb_stats.pts_errors += host_frame_pts_bad;
+        }
+        frame_received(host_frame_bytes, host_frame_capture_us, still, host_frame_start_us, now, held);
+    }
+}
+
+// The controller's interrupt: a transfer completed, the event goes to the
+// device task like dcd_event_xfer_complete does
+static intr_handle_t usb_intr;
+static usb_event_t usb_irq_event;
+
+static void usb_isr(void *arg)
+{
+    (void)arg;
+    std::lock_guard<std::mutex> lk(usb_lock);
+    events.push_back(usb_irq_event);
+    usb_cond.notify_all();
+}
+
+static void bus_loop(void)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(mock_usb_config.enumerate_ms));
+    post_event(USB_EVT_MOUNT);
+    std::this_thread::sleep_for(std::chrono::milliseconds(mock_usb_config.commit_ms));
+    post_event(USB_EVT_COMMIT);
+
+    if (mock_usb_config.still_at_s > 0)
+    {
+        std::thread([] {
+            std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(mock_usb_config.still_at_s * 1000000)));
+            for (uint32_t i = 0; i < mock_usb_config.still_count; i++)
+            {
+                post_event(USB_EVT_STILL);
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }).detach();
+    }
+
+    if (mock_usb_config.stop_at_s > 0)
+    {
+        std::thread([] {
+            std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(mock_usb_config.stop_at_s * 1000000)));
+            post_event(USB_EVT_STOP);
+            if (mock_usb_config.restart_ms)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(mock_usb_config.restart_ms));
+                post_event(USB_EVT_COMMIT);
+            }
+        }).detach();
+    }
+
+    if (mock_usb_config.control_burst)
+    {
+        std::thread([] {
+            // Let the stream settle, then drag the brightness slider, then
+            // read the value back
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            for (uint32_t i = 0; i <= mock_usb_config.control_burst; i++)
+            {
+                post_event(USB_EVT_CONTROL);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }).detach();
+    }
+
+    // Other devices on the hub come in bursts: each frame meets a load between
+    // none and twice the average
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<uint32_t> load(0, std::min<uint32_t>(2 * mock_usb_config.hub_load_pct, 95));
+
+    for (;;)
+    {
+        size_t len;
+        size_t header;
+        bool payload;
+        uint32_t gen;
+        {
+            std::unique_lock<std::mutex> lk(usb_lock);
+            usb_cond.wait(lk, [] { return xfer_busy && host_reading; });
+            len = xfer_len;
+            header = xfer_header[0];
+            payload = xfer_payload;
+            gen = xfer_gen;
+        }
+
+        int64_t start_us = esp_timer_get_time();
+        uint32_t load_pct = mock_usb_config.hub_load_pct ? load(rng) : 0;
+        int64_t duration_us = payload ? payload_time_us(len, load_pct) : transfer_time_us(len, header, load_pct);
+        std::this_thread::sleep_until(std::chrono::steady_clock::now() + std::chrono::microseconds(duration_us));
+
+        mock_camera_stats_t cam;
+        mock_camera_get_stats(&cam);
+        int64_t now = esp_timer_get_time();
+        {
+            std::lock_guard<std::mutex> lk(usb_lock);
+            if (gen != xfer_gen)
+            {
+                // The endpoint was reset under the transfer
+                continue;
+            }
+            xfer_busy = false;
+            usb_stats.busy_us += now - start_us;
+            if (payload)
+            {
+                payload_received(xfer_buffer, len, start_us, now, cam.held);
+                usb_irq_event = {USB_EVT_EDPT_DONE, (uint32_t)len, nullptr, nullptr};
+            }
+            else
+            {
+                payload_header[1] ^= MOCK_PAYLOAD_HEADER_FID;
+                // Every payload of the frame had this header apart from the
+                // EOF bit, and the source clock moving on
+                host_frame_pts = false;
+                host_frame_pts_bad = false;
+                payload_clock(xfer_header, xfer_header[1]);
+                if (host_frame_pts)
+                {
+                    usb_stats.pts_frames++;
+                    usb_stats.pts_errors += host_frame_pts_bad;
+                }
+                frame_received(len, xfer_capture_us, xfer_still, start_us, now, cam.held);
+                usb_irq_event = {USB_EVT_XFER_DONE, 0, nullptr, nullptr};
+            }
+        }
+        mock_intr_raise(usb_intr);
+    }
+}
+
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const *request, void *buffer, uint16_t len)
+{
+    if (request->bmRequestType_bit.direction == TUSB_DIR_IN && len > 0)
+    {
+        // The whole data stage at once, the real stack goes packet by packet
+        len = std::min<uint16_t>(len, sizeof(ctrl_ep_buf));
+        memcpy(ctrl_ep_buf, buffer, len);
+        usbd_edpt_xfer(rhport, 0x80, ctrl_ep_buf, len);
+        buffer = ctrl_ep_buf;
+    }
+    ctrl_buffer = buffer;
+    ctrl_len = len;
+    return true;
+}
+
+// Runs one class request through the stages the real stack uses; data is
+// sent for OUT requests and receives the answer of IN requests
+static bool control_request(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                            uint8_t *data, uint16_t len)
+{
+    uint8_t count = 0;
+    const usbd_class_driver_t *driver = usbd_app_driver_get_cb(&count);
+    if (count == 0)
+    {
+        return false;
+    }
+
+    tusb_control_request_t request;
+    request.bmRequestType = bmRequestType;
+    request.bRequest = bRequest;
+    request.wValue = wValue;
+    request.wIndex = wIndex;
+    request.wLength = len;
+
+    ctrl_buffer = NULL;
+    ctrl_len = 0;
+    if (!driver->control_xfer_cb(0, CONTROL_STAGE_SETUP, &request) || ctrl_buffer == NULL)
+    {
+        return false;
+    }
+    if (request.bmRequestType_bit.direction == TUSB_DIR_IN)
+    {
+        memcpy(data, ctrl_buffer, std::min(ctrl_len, len));
+    }
+    else
+    {
+        memcpy(ctrl_buffer, data, std::min(ctrl_len, len));
+    }
+    return driver->control_xfer_cb(0, CONTROL_STAGE_DATA, &request) &&
+           driver->control_xfer_cb(0, CONTROL_STAGE_ACK, &request);
+}
+
+// SET_INTERFACE on the streaming interface, no data stage
+static bool set_interface(uint8_t alt)
+{
+    uint8_t count = 0;
+    const usbd_class_driver_t *driver = usbd_app_driver_get_cb(&count);
+    if (count == 0)
+    {
+        return false;
+    }
+
+    tusb_control_request_t request;
+    request.bmRequestType = 0x01; // Standard, interface, OUT
+    request.bRequest = TUSB_REQ_SET_INTERFACE;
+    request.wValue = alt;
+    request.wIndex = ITF_NUM_VIDEO_STREAMING;
+    request.wLength = 0;
+    return driver->control_xfer_cb(0, CONTROL_STAGE_SETUP, &request);
+}
+
+// CLEAR_FEATURE(ENDPOINT_HALT) on the streaming endpoint. The stack handles
+// it and forwards it to the driver owning the endpoint; the request is
+// acknowledged whatever the driver answers.
+static void clear_halt(void)
+{
+    uint8_t count = 0;
+    const usbd_class_driver_t *driver = usbd_app_driver_get_cb(&count);
+    if (count == 0)
+    {
+        return;
+    }
+
+    tusb_control_request_t request;
+    request.bmRequestType = 0x02; // Standard, endpoint, OUT
+    request.bRequest = TUSB_REQ_CLEAR_FEATURE;
+    request.wValue = TUSB_REQ_FEATURE_EDPT_HALT;
+    request.wIndex = EPNUM_VIDEO_IN;
+    request.wLength = 0;
+    (void)driver->control_xfer_cb(0, CONTROL_STAGE_SETUP, &request);
+}
+
+// The host application closes the camera, the way Linux and Windows stop a
+// stream: the zero-bandwidth alternate setting for isochronous endpoints,
+// CLEAR_FEATURE(ENDPOINT_HALT) for bulk ones
+static void stop_step(void)
+{
+    {
+        std::lock_guard<std::mutex> lk(usb_lock);
+        host_reading = false;
+        host_frame_open = false;
+        last_start_us = -1;
+        usb_stats.stops++;
+    }
+    if (CFG_TUD_VIDEO_STREAMING_BULK)
+    {
+        clear_halt();
+    }
+    else if (!set_interface(0))
+    {
+        ESP_LOGE(TAG, "SET_INTERFACE 0 stalled");
+    }
+}
+
+// Smallest isochronous alternate setting of the streaming interface whose
+// wMaxPacketSize carries payload, the largest if none does, as hosts pick
+// it. Returns 0 if the interface has no isochronous settings.
+static uint8_t pick_alt_setting(uint32_t payload, uint32_t *packet_size)
+{
+    const uint8_t *desc = tud_descriptor_configuration_cb(0);
+    uint16_t total = desc[2] | (desc[3] << 8);
+    uint8_t itf = 0xff, alt = 0;
+    uint8_t best = 0, largest = 0;
+    uint32_t best_size = UINT32_MAX, largest_size = 0;
+
+    for (uint16_t pos = 0; pos + 2 <= total && desc[pos] != 0; pos += desc[pos])
+    {
+        const uint8_t *d = desc + pos;
+        if (d[1] == TUSB_DESC_INTERFACE)
+        {
+            itf = d[2];
+            alt = d[3];
+        }
+        else if (d[1] == TUSB_DESC_ENDPOINT && itf == ITF_NUM_VIDEO_STREAMING && alt != 0 &&
+                 (d[3] & 0x03) == TUSB_XFER_ISOCHRONOUS)
+        {
+            uint32_t size = (d[4] | (d[5] << 8)) & 0x7ff;
+            if (size >= payload && size < best_size)
+            {
+                best = alt;
+                best_size = size;
+            }
+            if (size > largest_size)
+            {
+                largest = alt;
+                largest_size = size;
+            }
+        }
+    }
+    if (best == 0)
+    {
+        best = largest;
+        best_size = largest_size;
+    }
+    *packet_size = best ? best_size : 0;
+    return best;
+}
+
+// One step of the control burst: brightness alternates across its range on
+// every SET_CUR, a final GET_CUR reads back what stuck
+static void control_step(void)
+{
+    const uint16_t wIndex = (UVC_ENTITY_PROCESSING_UNIT << 8) | ITF_NUM_VIDEO_CONTROL;
+    const uint16_t wValue = UVC_PU_BRIGHTNESS_CONTROL << 8;
+    uint8_t data[2];
+    bool last = ++controls_sent > mock_usb_config.control_burst;
+    int16_t value = (int16_t)(controls_sent % 5) - 2;
+
+    int64_t start = esp_timer_get_time();
+    bool ok;
+    if (last)
+    {
+        ok = control_request(0xA1, VIDEO_REQUEST_GET_CUR, wValue, wIndex, data, sizeof(data));
+    }
+    else
+    {
+        data[0] = (uint8_t)value;
+        data[1] = (uint8_t)((uint16_t)value >> 8);
+        ok = control_request(0x21, VIDEO_REQUEST_SET_CUR, wValue, wIndex, data, sizeof(data));
+    }
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+    std::lock_guard<std::mutex> lk(usb_lock);
+    usb_stats.control_requests++;
+    usb_stats.control_stalls += ok ? 0 : 1;
+    usb_stats.control_max_us = std::max(usb_stats.control_max_us, elapsed);
+    if (last)
+    {
+        usb_stats.brightness_read = ok ? (int16_t)(data[0] | (data[1] << 8)) : INT16_MIN;
+    }
+    else if (ok)
+    {
+        usb_stats.brightness_set = value;
+    }
+}
+
+// Still image method 2 as a host application takes a picture: negotiate the
+// still size with probe and commit, then trigger
+static void still_step(void)
+{
+    const uint16_t wIndex = ITF_NUM_VIDEO_STREAMING;
+    still_probe_commit_t params;
+    memset(&params, 0, sizeof(params));
+    params.bFormatIndex = UVC_FORMAT_INDEX_MJPEG;
+    params.bFrameIndex = 1;
+    params.bCompressionIndex = 1;
+    uint8_t trigger = UVC_STILL_TRIGGER_TRANSMIT;
+
+    bool ok = control_request(0x21, VIDEO_REQUEST_SET_CUR, UVC_VS_STILL_PROBE_CONTROL << 8, wIndex,
+                              (uint8_t *)&params, sizeof(params)) &&
+              control_request(0xA1, VIDEO_REQUEST_GET_CUR, UVC_VS_STILL_PROBE_CONTROL << 8, wIndex,
+                              (uint8_t *)&params, sizeof(params)) &&
+              control_request(0x21, VIDEO_REQUEST_SET_CUR, UVC_VS_STILL_COMMIT_CONTROL << 8, wIndex,
+                              (uint8_t *)&params, sizeof(params));
+    int64_t now = esp_timer_get_time();
+    ok = ok && control_request(0x21, VIDEO_REQUEST_SET_CUR, UVC_VS_STILL_IMAGE_TRIGGER_CONTROL << 8, wIndex,
+                               &trigger, sizeof(trigger));
+
+    std::lock_guard<std::mutex> lk(usb_lock);
+    if (ok)
+    {
+        usb_stats.still_triggers++;
+        still_trigger_us = now;
+    }
+    else
+    {
+        usb_stats.still_stalls++;
+    }
+}
+
+bool tud_init(uint8_t rhport)
+{
+    (void)rhport;
+    esp_intr_alloc(ETS_USB_INTR_SOURCE, ESP_INTR_FLAG_LOWMED, usb_isr, nullptr, &usb_intr);
+    std::thread(bus_loop).detach();
+    mock_cdc_start();
+    return true;
+}
+
+void tud_task(void)
+{
+    usb_event_t evt;
+    {
+        std::unique_lock<std::mutex> lk(usb_lock);
+        usb_cond.wait(lk, [] { return !events.empty(); });
+        evt = events.front();
+        events.pop_front();
+    }
+
+    switch (evt.type)
+    {
+    case USB_EVT_MOUNT:
+    {
+        {
+            std::lock_guard<std::mutex> lk(usb_lock);
+            usb_stats.mount_us = esp_timer_get_time();
+        }
+        mounted = true;
+        tud_mount_cb();
+        break;
+    }
+    case USB_EVT_COMMIT:
+    {
+        // Probe the mode and take the device's payload size, then commit it
+        video_probe_and_commit_control_t commit;
+        memset(&commit, 0, sizeof(commit));
+        commit.bFormatIndex = mock_usb_config.format_index;
+        commit.bFrameIndex = mock_usb_config.frame_index;
+        commit.dwFrameInterval = mock_usb_config.frame_interval;
+        const uint16_t probe = VIDEO_VS_CTL_PROBE << 8;
+        if (!control_request(0x21, VIDEO_REQUEST_SET_CUR, probe, ITF_NUM_VIDEO_STREAMING, (uint8_t *)&commit, sizeof(commit)) ||
+            !control_request(0xA1, VIDEO_REQUEST_GET_CUR, probe, ITF_NUM_VIDEO_STREAMING, (uint8_t *)&commit, sizeof(commit)))
+        {
+            ESP_LOGE(TAG, "Probe of format %u frame %u stalled", commit.bFormatIndex, commit.bFrameIndex);
+            break;
+        }
+        uint32_t probe_payload = commit.dwMaxPayloadTransferSize;
+
+        int err = tud_video_commit_cb(0, 1, &commit);
+        if (err != VIDEO_ERROR_NONE)
+        {
+            ESP_LOGE(TAG, "Commit of format %u frame %u rejected: %d", commit.bFormatIndex, commit.bFrameIndex, err);
+            break;
+        }
+
+        // Isochronous streaming starts when the host selects the bandwidth
+        uint32_t packet_size = 0;
+        uint8_t alt = CFG_TUD_VIDEO_STREAMING_BULK ? 0 : pick_alt_setting(commit.dwMaxPayloadTransferSize, &packet_size);
+        if (alt)
+        {
+            ESP_LOGI(TAG, "Payload %lu, selecting alternate setting %u (%lu bytes per frame)",
+                     (unsigned long)commit.dwMaxPayloadTransferSize, alt, (unsigned long)packet_size);
+            iso_packet_size = packet_size;
+            if (!set_interface(alt))
+            {
+                ESP_LOGE(TAG, "SET_INTERFACE %u stalled", alt);
+                break;
+            }
+        }
+        std::lock_guard<std::mutex> lk(usb_lock);
+        stream_payload_size = alt ? std::min<uint32_t>(commit.dwMaxPayloadTransferSize, packet_size)
+                                  : commit.dwMaxPayloadTransferSize;
+        streaming = true;
+        host_reading = true;
+        if (usb_stats.first_commit_us)
+        {
+            usb_stats.restarts++;
+            restart_us = esp_timer_get_time();
+        }
+        else
+        {
+            usb_stats.first_commit_us = esp_timer_get_time();
+        }
+        usb_stats.iso = !CFG_TUD_VIDEO_STREAMING_BULK;
+        usb_stats.probe_payload = probe_payload;
+        usb_stats.payload_size = commit.dwMaxPayloadTransferSize;
+        usb_stats.alt_setting = alt;
+        usb_stats.iso_packet = packet_size;
+        break;
+    }
+    case USB_EVT_XFER_DONE:
+        tud_video_frame_xfer_complete_cb(0, 0);
+        break;
+    case USB_EVT_EDPT_DONE:
+    {
+        uint8_t count = 0;
+        const usbd_class_driver_t *driver = usbd_app_driver_get_cb(&count);
+        if (count)
+        {
+            driver->xfer_cb(0, EPNUM_VIDEO_IN, XFER_RESULT_SUCCESS, evt.xferred_bytes);
+        }
+        break;
+    }
+    case USB_EVT_DEFER:
+        evt.func(evt.param);
+        break;
+    case USB_EVT_CONTROL:
+        control_step();
+        break;
+    case USB_EVT_STILL:
+        still_step();
+        break;
+    case USB_EVT_STOP:
+        stop_step();
+        break;
+    }
+}
+
+bool tud_mounted(void)
+{
+    return mounted;
+}
+
+bool tud_ready(void)
+{
+    return mounted;
+}
+
+bool tud_video_n_streaming(uint_fast8_t ctl_idx, uint_fast8_t stm_idx)
+{
+    (void)ctl_idx, (void)stm_idx;
+    std::lock_guard<std::mutex> lk(usb_lock);
+    return streaming;
+}
+
+bool tud_video_n_frame_xfer(uint_fast8_t ctl_idx, uint_fast8_t stm_idx, void *buffer, size_t bufsize)
+{
+    (void)ctl_idx, (void)stm_idx;
+    int64_t capture_us = mock_camera_capture_time(buffer);
+
+    {
+        std::lock_guard<std::mutex> lk(usb_lock);
+        if (!streaming || xfer_busy || bufsize == 0)
+        {
+            usb_stats.rejected++;
+            return false;
+        }
+    }
+
+    // The first payload goes to the endpoint with the driver's header; only
+    // uvc_task submits, so the endpoint cannot be taken meanwhile
+    usbd_edpt_xfer(0, EPNUM_VIDEO_IN, payload_header, payload_header[0]);
+
+    std::lock_guard<std::mutex> lk(usb_lock);
+    memcpy(xfer_header, payload_header, sizeof(xfer_header));
+    xfer_still = (payload_header[1] & UVC_PAYLOAD_HEADER_STI) != 0;
+    xfer_payload = false;
+    xfer_busy = true;
+    xfer_len = bufsize;
+    xfer_capture_us = capture_us;
+    usb_cond.notify_all();
+    return true;
+}
+
+bool mock_usb_edpt_xfer(uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes)
+{
+    if (ep_addr != EPNUM_VIDEO_IN || buffer == payload_header)
+    {
+        // EP0 and the video driver's header: modelled elsewhere
+        return true;
+    }
+
+    // The data after the header came from the frame buffer
+    int64_t capture_us = total_bytes > buffer[0] ? mock_async_memcpy_capture_time(buffer + buffer[0]) : -1;
+    std::lock_guard<std::mutex> lk(usb_lock);
+    if (!streaming || xfer_busy || total_bytes == 0)
+    {
+        usb_stats.rejected++;
+        return false;
+    }
+    xfer_payload = true;
+    xfer_buffer = buffer;
+    xfer_len = total_bytes;
+    xfer_capture_us = capture_us;
+    xfer_busy = true;
+    usb_cond.notify_all();
+    return true;
+}
+
+// Device status register of the controller: SOFFN in bits 21:8 counts the
+// 1 ms full-speed frames since the bus came up
+uint32_t mock_reg_read(uint32_t reg)
+{
+    if (reg != DR_REG_USB_BASE + 0x808)
+    {
+        return 0;
+    }
+    return (uint32_t)((esp_timer_get_time() / 1000) & 0x3FFF) << 8;
+}
+
+// The built-in video driver only matters here for what the application
+// driver forwards to it: the probe control and SET_INTERFACE, other requests
+// are stalled
+void videod_init(void)
+{
+}
+
+void videod_reset(uint8_t rhport)
+{
+    (void)rhport;
+}
+
+uint16_t videod_open(uint8_t rhport, tusb_desc_interface_t const *itf_desc, uint16_t max_len)
+{
+    (void)rhport, (void)itf_desc, (void)max_len;
+    return 0;
+}
+
+bool videod_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request)
+{
+    if ((request->wIndex & 0xff) != ITF_NUM_VIDEO_STREAMING)
+    {
+        return false;
+    }
+    if (request->bmRequestType_bit.type == TUSB_REQ_TYPE_STANDARD)
+    {
+        if (request->bRequest != TUSB_REQ_SET_INTERFACE)
+        {
+            return false;
+        }
+        // Closes the endpoints of the previous setting, dropping a queued
+        // transfer, and opens those of the new one; alternate setting 0 of
+        // an isochronous interface has none
+        std::lock_guard<std::mutex> lk(usb_lock);
+        if (xfer_busy)
+        {
+            xfer_busy = false;
+            xfer_gen++;
+            usb_stats.dropped_xfers++;
+        }
+        if (!CFG_TUD_VIDEO_STREAMING_BULK && request->wValue == 0)
+        {
+            streaming = false;
+        }
+        payload_header[0] = 2;
+        return true;
+    }
+    if (request->bmRequestType_bit.type != TUSB_REQ_TYPE_CLASS || (request->wValue >> 8) != VIDEO_VS_CTL_PROBE)
+    {
+        return false;
+    }
+    if (stage != CONTROL_STAGE_SETUP)
+    {
+        return true;
+    }
+    uint16_t len = std::min<uint16_t>(request->wLength, sizeof(probe_state));
+    switch (request->bRequest)
+    {
+    case VIDEO_REQUEST_SET_CUR:
+        return tud_control_xfer(rhport, request, &probe_state, len);
+    case VIDEO_REQUEST_GET_CUR:
+        // TinyUSB caps the payload at its endpoint buffer for frames whose
+        // worst-case size needs more per 1 ms than that
+        probe_state.dwMaxPayloadTransferSize = CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE;
+        return tud_control_xfer(rhport, request, &probe_state, len);
+    default:
+        return false;
+    }
+}
+
+bool videod_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+{
+    (void)rhport, (void)ep_addr, (void)result, (void)xferred_bytes;
+    return true;
+}
+
+bool mock_usb_video_busy(void)
+{
+    std::lock_guard<std::mutex> lk(usb_lock);
+    return xfer_busy && host_reading;
+}
+
+void mock_usb_get_stats(mock_usb_stats_t *stats)
+{
+    std::lock_guard<std::mutex> lk(usb_lock);
+    *stats = usb_stats;
+}
@@ -0,0 +1,19 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Endpoint transfers of the mock device stack. They live apart from the mock
+// video driver in mock_tinyusb.cpp so its calls reach them as undefined
+// references, like video_device.c calling into usbd.c, and the firmware's
+// link-time wrap of usbd_edpt_xfer applies to them.
+#include "device/usbd_pvt.h"
+#include "sim.h"
+
+// The bus thread of mock_tinyusb.cpp models the transfer time
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes)
+{
+    (void)rhport;
+    return mock_usb_edpt_xfer(ep_addr, buffer, total_bytes);
+}
@@ -0,0 +1,22 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Wi-Fi station of the host simulation. The host's own network stack stands
+// in for lwIP, so there is nothing to join: the HTTP server is reachable on
+// loopback as soon as it listens.
+extern "C" {
+#include "esp_log.h"
+}
+#include "wifi_sta.h"
+
+static const char *TAG = "WIFI_STA";
+
+esp_err_t wifi_sta_start(const char *ssid, const char *password)
+{
+    (void)password;
+    ESP_LOGI(TAG, "Not joining \"%s\", the simulation serves on the host's interfaces", ssid);
+    return ESP_OK;
+}
@@ -0,0 +1,206 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Shared configuration and statistics of the host simulation mocks
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Mock camera: replays JPEG files (or synthetic frames) at a sensor rate
+typedef struct
+{
+    double sensor_fps;                            // Native rate, divided by the programmed CLKRC divider
+    uint32_t jitter_us;                           // Uniform +/- jitter applied to every capture period
+    std::vector<std::vector<uint8_t>> jpeg_files; // Replayed in order, synthetic frames if empty
+    size_t synthetic_jpeg_size;                   // Size of synthetic VGA JPEG frames at quality 10, scaled by area
+    uint32_t scene_change_ms;                     // Synthetic frames grow or shrink by 10% this often, 0 = static scene
+    size_t jpeg_padding;                          // Zero bytes the DMA leaves after EOI
+    uint32_t init_ms;                             // esp_camera_init duration (probe, register tables)
+    uint16_t scene_exposure;                      // Exposure (lines) and gain the AEC/AGC loops converge to
+    uint16_t scene_gain;
+    double fault_at_s;                            // Camera fault this long after commit, 0 = none
+    int fault_tier;                               // Cheapest action that clears it: 1 DMA restart, 2 sensor reset, 3 reinit
+    bool fault_corrupt;                           // Fault corrupts frames instead of stalling the capture
+    size_t dma_chunk;                             // Bytes the driver copies out of the DMA at a time
+} mock_camera_config_t;
+
+typedef struct
+{
+    uint64_t captured;    // Frames written by the modelled sensor
+    uint64_t overwritten; // Ready frames replaced before the firmware fetched them
+    uint64_t overruns;    // Captures lost because every buffer was held by the firmware
+    uint64_t fetched;     // Frames handed out by esp_camera_fb_get
+    uint32_t held;        // Buffers currently owned by the firmware
+    uint64_t tuning_writes; // Image tuning setter calls (brightness, exposure, ...)
+    uint32_t window_writes; // set_res_raw calls
+    int64_t fault_us;       // Injected fault began, 0 = none
+    int64_t cleared_us;     // Fault cleared, 0 = not (yet)
+    const char *cleared_by; // Action that cleared it
+    uint32_t dma_restarts;  // cam_stop/cam_start cycles
+    uint32_t sensor_resets;
+    uint32_t inits;         // esp_camera_init calls
+    uint32_t standby_entries; // COM2 soft standby set
+    uint32_t sccb_unclocked;  // Register accesses while XCLK was stopped, failed
+} mock_camera_stats_t;
+
+// Mock TinyUSB: models the host and a full-speed bus
+typedef struct
+{
+    uint32_t packets_per_ms;    // Bulk packets the host schedules per 1 ms frame
+    uint32_t packet_size;       // Max packet size of the streaming endpoint
+    uint32_t payload_gap_us;    // Turnaround between payloads spent in the device stack
+    uint32_t enumerate_ms;      // Delay from tud_init to mount
+    uint32_t commit_ms;         // Delay from mount to stream commit
+    uint8_t format_index;       // Committed bFormatIndex
+    uint8_t frame_index;        // Committed bFrameIndex
+    uint32_t frame_interval;    // Committed dwFrameInterval (100 ns units)
+    uint32_t control_burst;     // Brightness SET_CURs sent after commit, one per ms, like a dragged slider
+    double still_at_s;          // First still image trigger this long after commit, 0 = none
+    uint32_t still_count;       // Triggers sent, 1 s apart
+    uint32_t hub_load_pct;      // Average share of each frame other devices' bulk traffic takes, bursty
+    double stop_at_s;           // Host stops the stream this long after commit, 0 = never
+    uint32_t restart_ms;        // ... and commits it again this much later, 0 = never
+} mock_usb_config_t;
+
+typedef struct
+{
+    uint64_t frames;            // Transfers completed
+    uint64_t bytes;             // Payload bytes delivered, without headers
+    uint64_t rejected;          // tud_video_n_frame_xfer calls refused (busy or not streaming)
+    uint64_t busy_us;           // Time the endpoint spent transferring
+    int64_t mount_us;           // Enumeration complete, 0 until mounted
+    int64_t first_commit_us;    // Commit time, 0 until committed
+    int64_t first_frame_us;     // Start of the first transfer, 0 until then
+    std::vector<uint32_t> latency_us;   // Capture -> transfer complete, per frame
+    std::vector<uint32_t> queue_depth;  // Buffers held by the firmware at each completion
+    std::vector<uint32_t> interval_us;  // Between the starts of consecutive transfers
+    uint32_t control_requests;  // Entity control requests sent by the host
+    uint32_t control_stalls;    // ... stalled by the device
+    uint32_t control_max_us;    // Longest request, setup to status stage
+    int16_t brightness_set;     // Last brightness the host set
+    int16_t brightness_read;    // Brightness read back with GET_CUR after the burst
+    uint32_t still_triggers;    // Still image triggers accepted by the device
+    uint32_t still_stalls;      // Still probe/commit/trigger requests stalled
+    uint32_t stills;            // Frames received with the STI bit set
+    uint64_t still_bytes;
+    uint32_t still_latency_max_us;  // Trigger -> still image complete
+    uint32_t still_transfer_max_us; // Still image on the bus
+    uint32_t still_gap_max_us;      // Last new stream frame before a still -> first new one after
+    bool iso;                   // Isochronous streaming interface
+    uint32_t probe_payload;     // dwMaxPayloadTransferSize of the device's probe answer
+    uint8_t alt_setting;        // Alternate setting the host selected, 0 for bulk
+    uint32_t iso_packet;        // Its wMaxPacketSize: bytes reserved per 1 ms frame
+    uint32_t payload_size;      // Committed dwMaxPayloadTransferSize
+    uint64_t payloads;          // Payloads the firmware queued on the endpoint itself, 0 via the video driver
+    uint32_t stops;             // Streams the host stopped
+    uint32_t restarts;          // ... and committed again
+    uint32_t dropped_xfers;     // Transfers dropped by an endpoint reset
+    uint32_t resume_last_us;    // Repeated commit -> first whole frame received
+    uint32_t resume_max_us;
+    uint32_t error_frames;      // Frames the device ended with the error bit, dropped
+    uint32_t bad_frames;        // MJPEG frames received that do not run from SOI to EOI
+    uint32_t pts_frames;        // Frames whose payload headers carried PTS and SCR
+    uint32_t pts_errors;        // ... with a PTS changing within the frame or a source clock behind it
+} mock_usb_stats_t;
+
+extern mock_camera_config_t mock_camera_config;
+extern mock_usb_config_t mock_usb_config;
+
+void mock_camera_get_stats(mock_camera_stats_t *stats);
+// Schedule the configured fault relative to the stream commit
+void mock_camera_arm_fault(int64_t commit_us);
+// Capture timestamp (esp_timer us) of the frame buffer containing ptr, -1 if none
+int64_t mock_camera_capture_time(const void *ptr);
+// esp32-camera's copy of a DMA chunk into the frame buffer, see mock_ll_cam.cpp
+extern "C" size_t ll_cam_memcpy(void *cam, uint8_t *out, const uint8_t *in, size_t len);
+
+void mock_usb_get_stats(mock_usb_stats_t *stats);
+// The video endpoint has a transfer on the bus that the host is reading
+bool mock_usb_video_busy(void);
+// Endpoint transfer queued through usbd_edpt_xfer
+bool mock_usb_edpt_xfer(uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes);
+
+// Mock LEDC timer driving XCLK and esp_pm frequency scaling
+typedef struct
+{
+    bool xclk_running;
+    uint32_t xclk_pauses;       // Times XCLK was stopped
+    uint32_t cpu_mhz;           // Current CPU frequency
+    uint32_t freq_switches;
+    uint64_t low_us;            // Time spent below the maximum frequency
+} mock_power_stats_t;
+
+bool mock_xclk_running(void);
+void mock_power_get_stats(mock_power_stats_t *stats);
+
+// Mock CDC-ACM port: a host terminal that opens the port after enumeration
+typedef struct
+{
+    std::vector<std::string> commands; // Lines sent 1 s after the port opened, 100 ms apart, or "@<ms> line"
+    bool stall;                        // Never read what the device sends
+} mock_cdc_config_t;
+
+typedef struct
+{
+    bool opened;                       // The terminal set DTR
+    uint32_t samples;                  // "S" lines received
+    uint32_t task_lines;               // "T" lines of the last sample
+    uint64_t bytes;
+    std::string last_sample;           // Last "S" line, without the newline
+    std::string last_hist;             // Last "H" line
+    std::vector<std::string> core_lines; // "C" lines of the last sample
+    std::vector<std::string> replies;  // "OK ..." and "ERR ..." lines, in order
+    uint32_t dumps;                    // Recorder dumps received whole
+    uint32_t dump_frames;              // Frames of the last dump
+    uint32_t dump_bad;                 // ... with a bad header or JPEG markers, or out of order
+    uint64_t dump_bytes;
+    bool dump_complete;                // The last dump arrived whole
+    int64_t dump_us;                   // "OK dump" line to the last byte
+    int64_t dump_span_us;              // Capture time from the first frame to the last
+} mock_cdc_stats_t;
+
+extern mock_cdc_config_t mock_cdc_config;
+
+// Start the host terminal; called by tud_init
+void mock_cdc_start(void);
+void mock_cdc_get_stats(mock_cdc_stats_t *stats);
+
+// Capture timestamp of the camera frame the async memcpy copied to ptr, -1 if none
+int64_t mock_async_memcpy_capture_time(const void *ptr);
+
+// Loopback HTTP clients reading the MJPEG stream
+typedef struct
+{
+    uint32_t clients;           // Connections opened at commit
+    uint32_t slow_kbps;         // Read rate of the last client, 0 = as fast as frames arrive
+    uint16_t port;
+} sim_http_config_t;
+
+typedef struct
+{
+    int status;                 // HTTP status of the response, 0 = none
+    uint64_t frames;            // Parts carrying a whole JPEG (SOI .. EOI)
+    uint64_t bad_frames;        // Parts that do not
+    uint64_t bytes;
+    uint32_t gap_max_us;        // Longest time between consecutive frames
+    int64_t first_frame_us;
+    int64_t last_frame_us;
+    bool closed;                // Connection ended (or never opened)
+} sim_http_client_stats_t;
+
+extern sim_http_config_t sim_http_config;
+
+void sim_http_start(void);
+void sim_http_get_stats(std::vector<sim_http_client_stats_t> &stats);
+
+// Mock NVS contents are loaded from and committed to this file, if set
+extern std::string mock_nvs_path;
+
+// Reads a whole file, returns false on error
+bool sim_load_file(const std::string &path, std::vector<uint8_t> &data);
@@ -0,0 +1,229 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Loopback HTTP clients: each thread opens the firmware's MJPEG stream on
+// 127.0.0.1 like a browser would, splits the multipart body into frames and
+// checks every one is a whole JPEG. The last client can be throttled to model
+// a reader on a poor link.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "sim.h"
+
+sim_http_config_t sim_http_config = {
+    .clients = 0,
+    .slow_kbps = 0,
+    .port = CONFIG_UVC_HTTP_PORT,
+};
+
+static std::mutex http_lock;
+static std::vector<sim_http_client_stats_t> http_stats;
+
+// Buffered reader with an optional rate limit
+typedef struct
+{
+    int fd;
+    uint32_t rate_kbps;
+    int64_t start_us;
+    uint64_t total;
+    std::string buf;
+    size_t pos;
+} http_reader_t;
+
+static bool fill(http_reader_t *r)
+{
+    if (r->pos > 0)
+    {
+        r->buf.erase(0, r->pos);
+        r->pos = 0;
+    }
+    if (r->rate_kbps)
+    {
+        // Hold back until the bytes read so far fit the rate
+        int64_t due_us = r->start_us + (int64_t)(r->total * 8000 / r->rate_kbps);
+        int64_t wait_us = due_us - esp_timer_get_time();
+        if (wait_us > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+        }
+    }
+    char chunk[4096];
+    // A slow reader takes small bites, like a congested TCP window would
+    size_t want = r->rate_kbps ? std::min<size_t>(sizeof(chunk), 1024) : sizeof(chunk);
+    ssize_t n = recv(r->fd, chunk, want, 0);
+    if (n <= 0)
+    {
+        return false;
+    }
+    r->buf.append(chunk, n);
+    r->total += n;
+    return true;
+}
+
+static bool read_line(http_reader_t *r, std::string &line)
+{
+    size_t eol;
+    while ((eol = r->buf.find("\r\n", r->pos)) == std::string::npos)
+    {
+        if (!fill(r))
+        {
+            return false;
+        }
+    }
+    line = r->buf.substr(r->pos, eol - r->pos);
+    r->pos = eol + 2;
+    return true;
+}
+
+static bool read_bytes(http_reader_t *r, std::string &out, size_t len)
+{
+    while (r->buf.size() - r->pos < len)
+    {
+        if (!fill(r))
+        {
+            return false;
+        }
+    }
+    out = r->buf.substr(r->pos, len);
+    r->pos += len;
+    return true;
+}
+
+static void update(int index, const sim_http_client_stats_t &s)
+{
+    std::lock_guard<std::mutex> lk(http_lock);
+    http_stats[index] = s;
+}
+
+static void client_thread(int index, uint32_t rate_kbps)
+{
+    sim_http_client_stats_t s = {};
+    int fd = -1;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(sim_http_config.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // The server may still be coming up
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (rate_kbps)
+        {
+            // A small window, so the backlog stays with the server, not in
+            // the host's socket buffers
+            int rcvbuf = 8192;
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            break;
+        }
+        close(fd);
+        fd = -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    if (fd < 0)
+    {
+        s.closed = true;
+        update(index, s);
+        return;
+    }
+
+    static const char request[] = "GET /stream HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+
+    http_reader_t r = {.fd = fd, .rate_kbps = rate_kbps, .start_us = esp_timer_get_time(), .total = 0, .pos = 0};
+    std::string line;
+    if (read_line(&r, line) && line.compare(0, 9, "HTTP/1.1 ") == 0)
+    {
+        s.status = atoi(line.c_str() + 9);
+    }
+    while (read_line(&r, line) && !line.empty())
+    {
+    }
+    update(index, s);
+
+    while (s.status == 200)
+    {
+        // Boundary, part headers, body, line break
+        size_t len = 0;
+        bool have_len = false;
+        if (!read_line(&r, line) || line != "--frame")
+        {
+            break;
+        }
+        while (read_line(&r, line) && !line.empty())
+        {
+            if (line.compare(0, 16, "Content-Length: ") == 0)
+            {
+                len = strtoul(line.c_str() + 16, nullptr, 10);
+                have_len = true;
+            }
+        }
+        std::string body;
+        if (!have_len || !read_bytes(&r, body, len) || !read_line(&r, line))
+        {
+            break;
+        }
+
+        int64_t now = esp_timer_get_time();
+        bool whole = len >= 4 && (uint8_t)body[0] == 0xFF && (uint8_t)body[1] == 0xD8 &&
+                     (uint8_t)body[len - 2] == 0xFF && (uint8_t)body[len - 1] == 0xD9;
+        if (whole)
+        {
+            s.frames++;
+            s.bytes += len;
+        }
+        else
+        {
+            s.bad_frames++;
+        }
+        if (s.last_frame_us)
+        {
+            s.gap_max_us = std::max(s.gap_max_us, (uint32_t)(now - s.last_frame_us));
+        }
+        else
+        {
+            s.first_frame_us = now;
+        }
+        s.last_frame_us = now;
+        update(index, s);
+    }
+
+    s.closed = true;
+    update(index, s);
+    close(fd);
+}
+
+void sim_http_start(void)
+{
+    {
+        std::lock_guard<std::mutex> lk(http_lock);
+        http_stats.assign(sim_http_config.clients, sim_http_client_stats_t{});
+    }
+    for (uint32_t i = 0; i < sim_http_config.clients; i++)
+    {
+        bool slow = i + 1 == sim_http_config.clients;
+        std::thread(client_thread, (int)i, slow ? sim_http_config.slow_kbps : 0).detach();
+    }
+}
+
+void sim_http_get_stats(std::vector<sim_http_client_stats_t> &stats)
+{
+    std::lock_guard<std::mutex> lk(http_lock);
+    stats = http_stats;
+}
@@ -0,0 +1,612 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Host simulation entry point: runs the unmodified firmware app_main against
+// the mock camera and mock TinyUSB, then reports what reached the host.
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+extern "C" {
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "tusb.h"
+}
+#include "usb_descriptors.h"
+#include "frame_ring.h"
+#include "change_gate.h"
+#include "sensor_window.h"
+#include "subframe_stream.h"
+#include "http_stream.h"
+#include "power_idle.h"
+#include "telemetry.h"
+#include "task_plan.h"
+#include "usb_bench.h"
+#include "sim.h"
+
+extern "C" void app_main(void);
+
+typedef struct
+{
+    double duration_s;
+} sim_options_t;
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options] [frame.jpg ...]\n"
+           "Replays the JPEG files (or synthetic frames) through the firmware pipeline.\n"
+           "  --duration S        Simulated run time in seconds after commit (default 10)\n"
+           "  --sensor-fps F      Sensor frame rate, 0 models the OV2640 per frame size (default 0)\n"
+           "  --jitter-us N       +/- jitter on every capture period (default 0)\n"
+           "  --frame-bytes N     Size of synthetic VGA JPEG frames, scaled by frame area (default 24576)\n"
+           "  --jpeg-padding N    Zero bytes the sensor appends after EOI (default 0)\n"
+           "  --dma-chunk N       Bytes the camera driver copies out of the DMA at a time (default 16384)\n"
+           "  --format mjpeg|yuy2 Committed stream format (default mjpeg)\n"
+           "  --frame N           Committed bFrameIndex (default %u)\n"
+           "  --fps F             Committed frame rate (default 30)\n"
+           "  --packets-per-ms N  Bulk packets the host schedules per 1 ms frame (default 19)\n"
+           "  --payload-gap-us N  Device turnaround per UVC payload (default 20)\n"
+           "  --hub-load PCT      Average share of the bus other devices' bulk traffic takes, bursty (default 0)\n"
+           "  --control-burst N   Brightness SET_CURs the host sends 1 ms apart after commit (default 0)\n"
+           "  --camera-init-ms N  Duration of esp_camera_init (default 250)\n"
+           "  --nvs FILE          Load and store the mock NVS in FILE, so a rerun boots warm\n"
+           "  --fault-at S        Camera fault S seconds after commit (default none)\n"
+           "  --fault-tier N      Cheapest recovery that clears it: 1 DMA restart, 2 sensor reset, 3 reinit (default 1)\n"
+           "  --fault-corrupt     The fault corrupts frames instead of stalling the capture\n"
+           "  --still-at S        Trigger a still image S seconds after commit (default none)\n"
+           "  --still-count N     Still images to trigger, 1 s apart (default 1)\n"
+           "  --stop-at S         Host stops the stream S seconds after commit (default never)\n"
+           "  --restart-after MS  ... and commits it again MS later (default never)\n"
+           "  --http-clients N    Loopback clients reading the MJPEG stream from commit on (default 0)\n"
+           "  --http-slow-kbps K  Read rate of the last HTTP client (default unlimited)\n"
+           "  --scene-change-ms N Synthetic frames change size by 10%% every N ms (default static scene)\n"
+           "  --cdc-cmd LINE      Type LINE on the telemetry port 1 s after opening it, 100 ms after\n"
+           "                      the previous one, or \"@MS LINE\" MS ms after opening it (repeatable)\n"
+           "  --cdc-stall         The telemetry terminal never reads\n"
+           "  -v                  Firmware log level INFO (-vv DEBUG)\n",
+           prog, UVC_MJPEG_DEFAULT_FRAME_INDEX);
+}
+
+bool sim_load_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+    {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Walk the configuration descriptor: every bLength must chain up to
+// wTotalLength and each class-specific header must cover the class-specific
+// descriptors that follow it
+static bool check_descriptors(void)
+{
+    const uint8_t *desc = tud_descriptor_configuration_cb(0);
+    uint16_t total = desc[2] | (desc[3] << 8);
+    uint16_t pos = 0;
+    uint8_t itf_class = 0;
+    uint8_t subclass = 0;
+    int count = 0;
+
+    while (pos < total)
+    {
+        uint8_t len = desc[pos];
+        if (len < 2 || pos + len > total)
+        {
+            printf("Descriptor %d at offset %u has bad length %u (total %u)\n", count, pos, len, total);
+            return false;
+        }
+
+        uint8_t type = desc[pos + 1];
+        uint8_t subtype = desc[pos + 2];
+        if (type == TUSB_DESC_INTERFACE)
+        {
+            itf_class = desc[pos + 5];
+            subclass = desc[pos + 6];
+        }
+        // VC and VS headers share subtype 1; the interface subclass tells them
+        // apart. Other functions (CDC) use subtype 1 for something else.
+        else if (type == TUSB_DESC_CS_INTERFACE && itf_class == TUSB_CLASS_VIDEO && subtype == VIDEO_CS_ITF_VC_HEADER)
+        {
+            // VC header wTotalLength at offset 5, VS input header at offset 4
+            uint16_t off = subclass == VIDEO_SUBCLASS_CONTROL ? 5 : 4;
+            uint16_t cs_total = desc[pos + off] | (desc[pos + off + 1] << 8);
+            uint16_t cs_end = pos;
+            do
+            {
+                cs_end += desc[cs_end];
+            } while (cs_end < total && desc[cs_end + 1] == TUSB_DESC_CS_INTERFACE);
+            if (cs_total != cs_end - pos)
+            {
+                printf("Class-specific header subtype %u at offset %u claims %u bytes, found %u\n",
+                       subtype, pos, cs_total, cs_end - pos);
+                return false;
+            }
+        }
+        pos += len;
+        count++;
+    }
+
+    printf("Configuration descriptor: %u bytes, %d descriptors, OK\n", total, count);
+    return true;
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, double p)
+{
+    if (v.empty())
+    {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(p / 100.0 * v.size()))];
+}
+
+// Report everything that happened after the baseline snapshot taken at commit
+static void report(const mock_camera_stats_t *cam0, const mock_usb_stats_t *usb0, const task_plan_sample_t *load0,
+                   double seconds)
+{
+    mock_camera_stats_t cam;
+    mock_usb_stats_t usb;
+    mock_camera_get_stats(&cam);
+    mock_usb_get_stats(&usb);
+
+    cam.captured -= cam0->captured;
+    cam.fetched -= cam0->fetched;
+    cam.overwritten -= cam0->overwritten;
+    cam.overruns -= cam0->overruns;
+    usb.frames -= usb0->frames;
+    usb.bytes -= usb0->bytes;
+    usb.rejected -= usb0->rejected;
+    usb.busy_us -= usb0->busy_us;
+    usb.latency_us.erase(usb.latency_us.begin(), usb.latency_us.begin() + usb0->latency_us.size());
+    usb.queue_depth.erase(usb.queue_depth.begin(), usb.queue_depth.begin() + usb0->queue_depth.size());
+    usb.interval_us.erase(usb.interval_us.begin(), usb.interval_us.begin() + usb0->interval_us.size());
+
+    uint64_t sum = 0;
+    for (uint32_t l : usb.latency_us)
+    {
+        sum += l;
+    }
+    uint64_t depth_sum = 0;
+    uint32_t depth_max = 0;
+    for (uint32_t d : usb.queue_depth)
+    {
+        depth_sum += d;
+        depth_max = std::max(depth_max, d);
+    }
+
+    // Captured frames that never reached the host, wherever they were lost
+    uint64_t dropped = cam.captured > usb.frames ? cam.captured - usb.frames : 0;
+
+    printf("\n=== Simulation report (%.1f s streaming) ===\n", seconds);
+    printf("Boot:     enumerated at %.0f ms, committed at %.0f ms, first frame at %.0f ms\n",
+           usb.mount_us / 1000.0, usb.first_commit_us / 1000.0, usb.first_frame_us / 1000.0);
+    printf("Camera:   captured %llu, fetched %llu, overwritten %llu, overruns %llu\n",
+           (unsigned long long)cam.captured, (unsigned long long)cam.fetched,
+           (unsigned long long)cam.overwritten, (unsigned long long)cam.overruns);
+    printf("USB:      delivered %llu frames (%.2f fps), %.1f KB/s, rejected %llu, bus busy %.1f%%\n",
+           (unsigned long long)usb.frames, usb.frames / seconds, usb.bytes / seconds / 1024.0,
+           (unsigned long long)usb.rejected, seconds > 0 ? usb.busy_us / (seconds * 10000.0) : 0.0);
+    if (usb.iso)
+    {
+        printf("Endpoint: isochronous, probe payload %lu, alternate setting %u reserves %lu bytes per 1 ms frame, hub load %lu%%\n",
+               (unsigned long)usb.probe_payload, usb.alt_setting, (unsigned long)usb.iso_packet,
+               (unsigned long)mock_usb_config.hub_load_pct);
+    }
+    else
+    {
+        printf("Endpoint: bulk, %lu packets of %lu bytes per 1 ms frame, hub load %lu%%; %lu byte payloads %s\n",
+               (unsigned long)mock_usb_config.packets_per_ms, (unsigned long)mock_usb_config.packet_size,
+               (unsigned long)mock_usb_config.hub_load_pct, (unsigned long)usb.payload_size,
+               usb.payloads ? "queued by the firmware" : "from the video driver");
+    }
+    if (usb.pts_frames)
+    {
+        printf("Clock:    PTS and SCR in %lu frames, %lu inconsistent\n", (unsigned long)usb.pts_frames,
+               (unsigned long)usb.pts_errors);
+    }
+    printf("Drops:    %llu of %llu captured frames (%.1f%%)\n", (unsigned long long)dropped,
+           (unsigned long long)cam.captured, cam.captured ? dropped * 100.0 / cam.captured : 0.0);
+    if (!usb.latency_us.empty())
+    {
+        printf("Latency:  capture->complete min %.1f ms, avg %.1f ms, p99 %.1f ms, max %.1f ms\n",
+               percentile(usb.latency_us, 0) / 1000.0, sum / 1000.0 / usb.latency_us.size(),
+               percentile(usb.latency_us, 99) / 1000.0, percentile(usb.latency_us, 100) / 1000.0);
+    }
+    subframe_stream_stats_t sub;
+    subframe_stream_get_stats(&sub);
+    if (sub.started || usb.error_frames - usb0->error_frames || usb.bad_frames - usb0->bad_frames)
+    {
+        // Whole run for the firmware side; the host counts since commit
+        printf("Sub-frame: %u streamed during readout, %u delivered, %u failed, %u aborted, %u dropped by the driver, "
+               "%u rejected late, %u busy; EOI->end avg %.1f ms, max %.1f ms; host dropped %u errored, "
+               "%u frames not SOI..EOI\n",
+               sub.started, sub.delivered, sub.failed, sub.aborted, sub.dropped, sub.late_rejects, sub.busy,
+               sub.delivered ? sub.tail_sum_us / 1000.0 / sub.delivered : 0.0, sub.tail_max_us / 1000.0,
+               usb.error_frames - usb0->error_frames, usb.bad_frames - usb0->bad_frames);
+    }
+    if (!usb.interval_us.empty())
+    {
+        uint64_t interval_sum = 0;
+        for (uint32_t i : usb.interval_us)
+        {
+            interval_sum += i;
+        }
+        printf("Cadence:  frame start interval min %.1f ms, avg %.1f ms, p1 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+               percentile(usb.interval_us, 0) / 1000.0, interval_sum / 1000.0 / usb.interval_us.size(),
+               percentile(usb.interval_us, 1) / 1000.0, percentile(usb.interval_us, 99) / 1000.0,
+               percentile(usb.interval_us, 100) / 1000.0);
+    }
+    // Interrupts by the core the plan put them on; their handler time is
+    // host time and says little
+    static task_plan_sample_t load1;
+    static task_plan_load_t load;
+    task_plan_sample(&load1);
+    task_plan_load(load0, &load1, &load);
+    printf("Load:     %s plan, interrupts/s", task_plan_name());
+    for (int c = 0; c < portNUM_PROCESSORS; c++)
+    {
+        printf("%s core%d", c ? ";" : "", c);
+        for (int o = 0; o < TASK_PLAN_ISR_COUNT; o++)
+        {
+            printf(" %s %lu", task_plan_isr_name((task_plan_isr_t)o), (unsigned long)load.isr_rate[c][o]);
+        }
+    }
+    printf("\n");
+    usb_bench_stats_t bench;
+    usb_bench_get_stats(&bench);
+    if (bench.steps || bench.aborted)
+    {
+        printf("Bench:    %u sweeps, %u configurations measured, %u sweeps aborted (CSV in the BENCH lines above)\n",
+               bench.sweeps, bench.steps, bench.aborted);
+    }
+    if (usb.control_requests)
+    {
+        // Sensor writes include the full set made at every (re)init
+        printf("Controls: %u requests, %u stalled, max %u us each; %llu sensor writes; brightness set %d, read back %d\n",
+               usb.control_requests, usb.control_stalls, usb.control_max_us,
+               (unsigned long long)(cam.tuning_writes - cam0->tuning_writes), usb.brightness_set, usb.brightness_read);
+    }
+    sensor_window_stats_t window;
+    sensor_window_get_stats(&window);
+    if (window.switches || window.torn)
+    {
+        // Whole run: zoom arrives over the telemetry port
+        printf("Window:   %u switches, %u sensor window writes, switch last %.1f ms, max %.1f ms; %u torn frames dropped\n",
+               window.switches, cam.window_writes, window.last_us / 1000.0, window.max_us / 1000.0, window.torn);
+    }
+    power_idle_stats_t idle;
+    power_idle_get_stats(&idle);
+    if (usb.stops || idle.entries)
+    {
+        // Resume: firmware wake -> first valid frame; host: commit -> first frame received
+        mock_power_stats_t power;
+        mock_power_get_stats(&power);
+        printf("Idle:     %u stops, %u restarts, %u transfers dropped; camera idle %u times for %.1f s, "
+               "%u standby, XCLK stopped %u times, CPU below max %.1f s (now %u MHz); resume %u, last/max %.1f/%.1f ms "
+               "(%u over budget, %u stale frames), host commit->frame last/max %.1f/%.1f ms; %u SCCB accesses unclocked\n",
+               usb.stops, usb.restarts, usb.dropped_xfers, idle.entries, idle.idle_us / 1e6, cam.standby_entries,
+               power.xclk_pauses, power.low_us / 1e6, power.cpu_mhz, idle.resumes, idle.resume_last_us / 1000.0,
+               idle.resume_max_us / 1000.0, idle.over_budget, idle.stale, usb.resume_last_us / 1000.0,
+               usb.resume_max_us / 1000.0, cam.sccb_unclocked);
+    }
+    if (cam.fault_us)
+    {
+        printf("Fault:    at %.0f ms, ", cam.fault_us / 1000.0);
+        if (cam.cleared_us)
+        {
+            printf("cleared by %s after %.0f ms", cam.cleared_by, (cam.cleared_us - cam.fault_us) / 1000.0);
+        }
+        else
+        {
+            printf("not cleared");
+        }
+        printf("; %u DMA restarts, %u sensor resets, %u inits\n", cam.dma_restarts - cam0->dma_restarts,
+               cam.sensor_resets - cam0->sensor_resets, cam.inits - cam0->inits);
+    }
+    if (usb.still_triggers || usb.still_stalls)
+    {
+        // The gap covers the sensor switching both ways and the still on the bus
+        double period_ms = mock_usb_config.frame_interval / 10000.0;
+        printf("Still:    %u triggered, %u stalled, %u received (%.0f KB avg), trigger->received max %.1f ms, "
+               "on the bus max %.1f ms; stream gap max %.1f ms (%.1f frame periods)\n",
+               usb.still_triggers, usb.still_stalls, usb.stills,
+               usb.stills ? usb.still_bytes / 1024.0 / usb.stills : 0.0, usb.still_latency_max_us / 1000.0,
+               usb.still_transfer_max_us / 1000.0, usb.still_gap_max_us / 1000.0,
+               usb.still_gap_max_us / 1000.0 / period_ms);
+    }
+    std::vector<sim_http_client_stats_t> http;
+    sim_http_get_stats(http);
+    for (size_t i = 0; i < http.size(); i++)
+    {
+        const sim_http_client_stats_t &h = http[i];
+        double span = (h.last_frame_us - h.first_frame_us) / 1000000.0;
+        printf("HTTP %zu:   status %d, %llu frames (%.2f fps), %.1f KB/s, %llu bad, max gap %.1f ms%s\n", i,
+               h.status, (unsigned long long)h.frames, span > 0 ? (h.frames - 1) / span : 0.0,
+               span > 0 ? h.bytes / span / 1024.0 : 0.0, (unsigned long long)h.bad_frames,
+               h.gap_max_us / 1000.0, h.closed ? ", closed" : "");
+    }
+    if (!http.empty())
+    {
+        // Server side: frames skipped per connection, and how often the ring
+        // had to refuse a reader a buffer
+        http_stream_stats_t server;
+        http_stream_get_stats(&server);
+        frame_ring_stats_t ring;
+        frame_ring_get_stats(&ring);
+        printf("Server:   accepted %u, rejected %u, timeouts %u, closed %u; skipped per client",
+               server.accepted, server.rejected, server.timeouts, server.closed);
+        for (int i = 0; i < HTTP_STREAM_MAX_CLIENTS; i++)
+        {
+            printf(" %u", server.clients[i].skipped);
+        }
+        printf("; ring shares %u, refused %u\n", ring.shared, ring.refused);
+    }
+    // Whole run, like the CDC figures: gates are switched on over the port
+    for (int stream = 0; stream < CHANGE_GATE_STREAM_COUNT; stream++)
+    {
+        change_gate_stats_t gate;
+        change_gate_get_stats((change_gate_stream_t)stream, &gate);
+        if (gate.changed || gate.keepalive || gate.skipped)
+        {
+            printf("Gate %s: %u changed, %u keepalive, %u skipped, %.1f KB saved\n",
+                   stream == CHANGE_GATE_USB ? "USB " : "HTTP", gate.changed, gate.keepalive, gate.skipped,
+                   gate.bytes_saved / 1024.0);
+        }
+    }
+    mock_cdc_stats_t cdc;
+    mock_cdc_get_stats(&cdc);
+    if (cdc.opened)
+    {
+        // Whole run: the terminal opens before the stream is committed
+        telemetry_stats_t telemetry;
+        telemetry_get_stats(&telemetry);
+        printf("CDC:      %u samples received (%.1f KB), %u dropped by the device, %u task lines in the last\n",
+               cdc.samples, cdc.bytes / 1024.0, telemetry.dropped, cdc.task_lines);
+        if (!cdc.last_sample.empty())
+        {
+            printf("          %s\n          %s\n", cdc.last_sample.c_str(), cdc.last_hist.c_str());
+        }
+        for (const std::string &core : cdc.core_lines)
+        {
+            printf("          %s\n", core.c_str());
+        }
+        for (const std::string &reply : cdc.replies)
+        {
+            printf("          > %s\n", reply.c_str());
+        }
+        if (cdc.dump_bytes && !cdc.dump_complete)
+        {
+            printf("Dump:     %u whole, last one still arriving: %u frames (%u bad), %.1f KB\n", cdc.dumps,
+                   cdc.dump_frames, cdc.dump_bad, cdc.dump_bytes / 1024.0);
+        }
+        else if (cdc.dump_bytes)
+        {
+            // Real time: how long the camera took to capture what the dump holds
+            printf("Dump:     %u whole, last %u frames (%u bad), %.1f KB covering %.2f s of capture in %.2f s, "
+                   "%.1f KB/s, %.1fx real time\n",
+                   cdc.dumps, cdc.dump_frames, cdc.dump_bad, cdc.dump_bytes / 1024.0, cdc.dump_span_us / 1e6,
+                   cdc.dump_us / 1e6, cdc.dump_us ? cdc.dump_bytes * 1e6 / 1024.0 / cdc.dump_us : 0.0,
+                   cdc.dump_us ? (double)cdc.dump_span_us / cdc.dump_us : 0.0);
+        }
+    }
+    if (!usb.queue_depth.empty())
+    {
+        printf("Queue:    buffers held by firmware avg %.2f, max %u\n",
+               (double)depth_sum / usb.queue_depth.size(), depth_max);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    sim_options_t opt = {.duration_s = 10};
+    double stream_fps = 30;
+    bool yuy2 = false;
+    int frame_index = -1;
+    int verbose = 0;
+
+    static const struct option long_opts[] = {
+        {"duration", required_argument, nullptr, 'd'},
+        {"sensor-fps", required_argument, nullptr, 's'},
+        {"jitter-us", required_argument, nullptr, 'j'},
+        {"frame-bytes", required_argument, nullptr, 'b'},
+        {"jpeg-padding", required_argument, nullptr, 'P'},
+        {"dma-chunk", required_argument, nullptr, 'D'},
+        {"format", required_argument, nullptr, 'f'},
+        {"frame", required_argument, nullptr, 'n'},
+        {"fps", required_argument, nullptr, 'r'},
+        {"packets-per-ms", required_argument, nullptr, 'p'},
+        {"payload-gap-us", required_argument, nullptr, 'g'},
+        {"hub-load", required_argument, nullptr, 'L'},
+        {"control-burst", required_argument, nullptr, 'c'},
+        {"camera-init-ms", required_argument, nullptr, 'i'},
+        {"nvs", required_argument, nullptr, 'N'},
+        {"fault-at", required_argument, nullptr, 'F'},
+        {"fault-tier", required_argument, nullptr, 'T'},
+        {"fault-corrupt", no_argument, nullptr, 'C'},
+        {"still-at", required_argument, nullptr, 'S'},
+        {"still-count", required_argument, nullptr, 'K'},
+        {"stop-at", required_argument, nullptr, 'O'},
+        {"restart-after", required_argument, nullptr, 'A'},
+        {"http-clients", required_argument, nullptr, 'H'},
+        {"http-slow-kbps", required_argument, nullptr, 'W'},
+        {"scene-change-ms", required_argument, nullptr, 'G'},
+        {"cdc-cmd", required_argument, nullptr, 'M'},
+        {"cdc-stall", no_argument, nullptr, 'X'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "vh", long_opts, nullptr)) != -1)
+    {
+        switch (c)
+        {
+        case 'd':
+            opt.duration_s = atof(optarg);
+            break;
+        case 's':
+            mock_camera_config.sensor_fps = atof(optarg);
+            break;
+        case 'j':
+            mock_camera_config.jitter_us = strtoul(optarg, nullptr, 0);
+            break;
+        case 'b':
+            mock_camera_config.synthetic_jpeg_size = std::max<size_t>(strtoul(optarg, nullptr, 0), 4);
+            break;
+        case 'P':
+            mock_camera_config.jpeg_padding = strtoul(optarg, nullptr, 0);
+            break;
+        case 'D':
+            mock_camera_config.dma_chunk = std::max<size_t>(strtoul(optarg, nullptr, 0), 64);
+            break;
+        case 'f':
+            yuy2 = strcmp(optarg, "yuy2") == 0;
+            if (!yuy2 && strcmp(optarg, "mjpeg") != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            frame_index = atoi(optarg);
+            break;
+        case 'r':
+            stream_fps = atof(optarg);
+            break;
+        case 'p':
+            mock_usb_config.packets_per_ms = std::max<uint32_t>(strtoul(optarg, nullptr, 0), 1);
+            break;
+        case 'g':
+            mock_usb_config.payload_gap_us = strtoul(optarg, nullptr, 0);
+            break;
+        case 'L':
+            mock_usb_config.hub_load_pct = std::min<uint32_t>(strtoul(optarg, nullptr, 0), 90);
+            break;
+        case 'c':
+            mock_usb_config.control_burst = strtoul(optarg, nullptr, 0);
+            break;
+        case 'i':
+            mock_camera_config.init_ms = strtoul(optarg, nullptr, 0);
+            break;
+        case 'N':
+            mock_nvs_path = optarg;
+            break;
+        case 'F':
+            mock_camera_config.fault_at_s = atof(optarg);
+            break;
+        case 'T':
+            mock_camera_config.fault_tier = std::min(std::max(atoi(optarg), 1), 3);
+            break;
+        case 'C':
+            mock_camera_config.fault_corrupt = true;
+            break;
+        case 'S':
+            mock_usb_config.still_at_s = atof(optarg);
+            break;
+        case 'K':
+            mock_usb_config.still_count = strtoul(optarg, nullptr, 0);
+            break;
+        case 'O':
+            mock_usb_config.stop_at_s = atof(optarg);
+            break;
+        case 'A':
+            mock_usb_config.restart_ms = strtoul(optarg, nullptr, 0);
+            break;
+        case 'H':
+            sim_http_config.clients = strtoul(optarg, nullptr, 0);
+            break;
+        case 'W':
+            sim_http_config.slow_kbps = strtoul(optarg, nullptr, 0);
+            break;
+        case 'G':
+            mock_camera_config.scene_change_ms = strtoul(optarg, nullptr, 0);
+            break;
+        case 'M':
+            mock_cdc_config.commands.push_back(optarg);
+            break;
+        case 'X':
+            mock_cdc_config.stall = true;
+            break;
+        case 'v':
+            verbose++;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        std::vector<uint8_t> data;
+        if (!sim_load_file(argv[i], data) || data.size() < 4)
+        {
+            fprintf(stderr, "Cannot read JPEG %s\n", argv[i]);
+            return 1;
+        }
+        mock_camera_config.jpeg_files.push_back(std::move(data));
+    }
+
+    mock_log_level = verbose >= 2 ? ESP_LOG_DEBUG : verbose ? ESP_LOG_INFO : ESP_LOG_WARN;
+    mock_usb_config.format_index = yuy2 ? UVC_FORMAT_INDEX_YUY2 : UVC_FORMAT_INDEX_MJPEG;
+    mock_usb_config.frame_index = frame_index > 0 ? frame_index
+                                  : yuy2          ? UVC_YUY2_DEFAULT_FRAME_INDEX
+                                                  : UVC_MJPEG_DEFAULT_FRAME_INDEX;
+    mock_usb_config.frame_interval = (uint32_t)(10000000 / stream_fps);
+
+    if (!check_descriptors())
+    {
+        return 1;
+    }
+
+    // app_main runs in the main task, on core 0 like on the device
+    xTaskCreatePinnedToCore([](void *) { app_main(); }, "main", 3584, nullptr, 1, nullptr, 0);
+
+    // Measure from the host's commit so enumeration and camera bring-up do not
+    // dilute the rates
+    mock_usb_stats_t usb;
+    do
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        mock_usb_get_stats(&usb);
+        if (esp_timer_get_time() > 30 * 1000000LL)
+        {
+            fprintf(stderr, "Stream was never committed\n");
+            return 1;
+        }
+    } while (usb.first_commit_us == 0);
+
+    mock_camera_arm_fault(usb.first_commit_us);
+    sim_http_start();
+    mock_camera_stats_t cam;
+    mock_camera_get_stats(&cam);
+    static task_plan_sample_t load;
+    task_plan_sample(&load);
+    int64_t start_us = esp_timer_get_time();
+
+    // A benchmark build is done with its first sweep, if that comes first
+    int64_t end_us = start_us + (int64_t)(opt.duration_s * 1000000);
+    usb_bench_stats_t bench = {};
+    while (esp_timer_get_time() < end_us && bench.sweeps == 0)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min<int64_t>(end_us - esp_timer_get_time(), 100000)));
+        usb_bench_get_stats(&bench);
+    }
+    report(&cam, &usb, &load, (esp_timer_get_time() - start_us) / 1000000.0);
+
+    // Firmware tasks never return; leave without running their destructors
+    fflush(stdout);
+    _Exit(0);
+}
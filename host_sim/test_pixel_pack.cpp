@@ -0,0 +1,151 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Unit test of the pixel repacking kernels (ctest target pixel_pack). Built
+// with CONFIG_UVC_PIXEL_PACK_PIE, so pixel_pack_swap16 takes its PIE path
+// through the host model of the vector loop: every start alignment, in place
+// and between buffers, for lengths around the 32-byte block and the head and
+// tail split, must give the scalar kernel's result and leave the bytes around
+// the span alone.
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "pixel_pack.h"
+
+// What pixel_pack.cpp links against besides the kernels (its benchmark)
+esp_log_level_t mock_log_level = ESP_LOG_WARN;
+
+void mock_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    (void)level;
+    va_list args;
+    va_start(args, format);
+    printf("%s: ", tag);
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return 0;
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+// Guard bytes on either side of every span
+#define GUARD 48
+
+static int failures;
+
+static void check(const char *what, size_t src_align, size_t dst_align, size_t len, const uint8_t *got,
+                  const uint8_t *want, size_t size)
+{
+    if (memcmp(got, want, size) == 0)
+    {
+        return;
+    }
+    size_t at = 0;
+    while (got[at] == want[at])
+    {
+        at++;
+    }
+    if (failures++ < 20)
+    {
+        printf("FAIL %s: src align %zu, dst align %zu, len %zu: byte %zd is %02X, expected %02X\n", what,
+               src_align, dst_align, len, (ssize_t)at - GUARD, got[at], want[at]);
+    }
+}
+
+// One case: src at src_align, dst at dst_align within 16-byte aligned buffers
+static void run_case(size_t src_align, size_t dst_align, size_t len, bool in_place)
+{
+    size_t size = GUARD + 16 + len + GUARD;
+    uint8_t *src_buf = (uint8_t *)aligned_alloc(16, (size + 15) & ~(size_t)15);
+    uint8_t *dst_buf = (uint8_t *)aligned_alloc(16, (size + 15) & ~(size_t)15);
+    std::vector<uint8_t> want(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        src_buf[i] = (uint8_t)(i * 7 + 3);
+        dst_buf[i] = (uint8_t)(0xA5 ^ i);
+    }
+
+    uint8_t *src = src_buf + GUARD + src_align;
+    uint8_t *dst = in_place ? src : dst_buf + GUARD + dst_align;
+    uint8_t *out_buf = in_place ? src_buf : dst_buf;
+    size_t dst_off = (size_t)(dst - out_buf);
+
+    // Reference: the bytes of each word swapped, nothing else touched
+    memcpy(want.data(), out_buf, size);
+    for (size_t i = 0; i < len; i += 2)
+    {
+        want[dst_off + i] = src[i + 1];
+        want[dst_off + i + 1] = src[i];
+    }
+
+    std::vector<uint8_t> saved(src_buf, src_buf + size);
+    std::vector<uint8_t> saved_dst(dst_buf, dst_buf + size);
+    pixel_pack_swap16_scalar(dst, src, len);
+    check(in_place ? "scalar in place" : "scalar", src_align, dst_align, len, out_buf, want.data(), size);
+
+    memcpy(src_buf, saved.data(), size);
+    memcpy(dst_buf, saved_dst.data(), size);
+    pixel_pack_swap16(dst, src, len);
+    check(in_place ? "swap16 in place" : "swap16", src_align, dst_align, len, out_buf, want.data(), size);
+
+    free(src_buf);
+    free(dst_buf);
+}
+
+int main(void)
+{
+    // Shorter than a block, exactly one or two, and every remainder, with
+    // room for the largest head (14 bytes) in front
+    std::vector<size_t> lengths;
+    for (size_t len = 0; len <= 16 + 3 * 32; len += 2)
+    {
+        lengths.push_back(len);
+    }
+    lengths.push_back(320 * 2);
+    lengths.push_back(320 * 2 + 6);
+    lengths.push_back(4096 + 14);
+
+    int cases = 0;
+    for (size_t src_align = 0; src_align < 16; src_align++)
+    {
+        for (size_t len : lengths)
+        {
+            run_case(src_align, src_align, len, true);
+            run_case(src_align, src_align, len, false);
+            // Buffers that never align together take the scalar path
+            run_case(src_align, (src_align + 2) % 16, len, false);
+            cases += 3;
+        }
+    }
+
+    if (failures)
+    {
+        printf("pixel_pack: %d of %d cases failed\n", failures, cases);
+        return 1;
+    }
+    printf("pixel_pack: %d cases passed\n", cases);
+    return 0;
+}
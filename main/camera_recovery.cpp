@@ -0,0 +1,129 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+}
+#include "camera_recovery.h"
+
+static const char *TAG = "CAM_RECOVERY";
+
+static camera_recovery_stats_t stats;
+static portMUX_TYPE recovery_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Current fault: when the last good frame before it arrived and how many
+// actions it has cost
+static int64_t last_ok_us;
+static uint32_t fault_attempts;
+static camera_recovery_tier_t last_tier;
+
+void camera_recovery_init(void)
+{
+    portENTER_CRITICAL(&recovery_lock);
+    memset(&stats, 0, sizeof(stats));
+    fault_attempts = 0;
+    portEXIT_CRITICAL(&recovery_lock);
+}
+
+camera_recovery_tier_t camera_recovery_next(uint32_t *backoff_ms)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&recovery_lock);
+    if (!stats.active)
+    {
+        stats.active = true;
+        stats.faults++;
+        if (last_ok_us == 0)
+        {
+            last_ok_us = now;
+        }
+        stats.detect_last_us = (uint32_t)(now - last_ok_us);
+        fault_attempts = 0;
+    }
+
+    // The last tier repeats for as long as the fault lasts
+    uint32_t tier = fault_attempts / CONFIG_UVC_CAMERA_RECOVERY_RETRIES;
+    if (tier >= CAMERA_RECOVERY_TIER_COUNT)
+    {
+        tier = CAMERA_RECOVERY_TIER_COUNT - 1;
+    }
+
+    // The first, cheapest action goes right away
+    uint32_t backoff = 0;
+    if (fault_attempts > 0)
+    {
+        uint32_t shift = fault_attempts - 1 < 16 ? fault_attempts - 1 : 16;
+        backoff = (uint32_t)CONFIG_UVC_CAMERA_RECOVERY_BACKOFF_MS << shift;
+        if (backoff > CONFIG_UVC_CAMERA_RECOVERY_BACKOFF_MAX_MS)
+        {
+            backoff = CONFIG_UVC_CAMERA_RECOVERY_BACKOFF_MAX_MS;
+        }
+    }
+
+    fault_attempts++;
+    last_tier = (camera_recovery_tier_t)tier;
+    stats.attempts[tier]++;
+    portEXIT_CRITICAL(&recovery_lock);
+
+    *backoff_ms = backoff;
+    return (camera_recovery_tier_t)tier;
+}
+
+bool camera_recovery_frame_ok(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&recovery_lock);
+    if (!stats.active)
+    {
+        last_ok_us = now;
+        portEXIT_CRITICAL(&recovery_lock);
+        return false;
+    }
+    uint32_t elapsed = (uint32_t)(now - last_ok_us);
+    last_ok_us = now;
+    stats.active = false;
+    stats.recovered[last_tier]++;
+    stats.last_us = elapsed;
+    stats.total_us += elapsed;
+    if (elapsed > stats.max_us)
+    {
+        stats.max_us = elapsed;
+    }
+    uint32_t attempts = fault_attempts;
+    camera_recovery_tier_t tier = last_tier;
+    portEXIT_CRITICAL(&recovery_lock);
+
+    ESP_LOGW(TAG, "Camera recovered by %s after %lu action(s), %lu ms without new frames",
+             camera_recovery_tier_name(tier), (unsigned long)attempts, (unsigned long)(elapsed / 1000));
+    return true;
+}
+
+const char *camera_recovery_tier_name(camera_recovery_tier_t tier)
+{
+    switch (tier)
+    {
+    case CAMERA_RECOVERY_DMA_RESTART:
+        return "DMA restart";
+    case CAMERA_RECOVERY_SENSOR_RESET:
+        return "sensor reset";
+    case CAMERA_RECOVERY_REINIT:
+        return "reinit";
+    default:
+        return "?";
+    }
+}
+
+void camera_recovery_get_stats(camera_recovery_stats_t *out)
+{
+    portENTER_CRITICAL(&recovery_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&recovery_lock);
+}
@@ -0,0 +1,57 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Recovery actions, cheapest first
+  typedef enum
+  {
+    CAMERA_RECOVERY_DMA_RESTART = 0, // Stop and restart the capture DMA
+    CAMERA_RECOVERY_SENSOR_RESET,    // Sensor soft reset, cached registers reapplied
+    CAMERA_RECOVERY_REINIT,          // Driver deinit and init
+    CAMERA_RECOVERY_TIER_COUNT,
+  } camera_recovery_tier_t;
+
+  typedef struct
+  {
+    uint32_t faults;                                  // Faults detected
+    uint32_t attempts[CAMERA_RECOVERY_TIER_COUNT];    // Actions taken per tier
+    uint32_t recovered[CAMERA_RECOVERY_TIER_COUNT];   // Faults cleared by each tier
+    uint32_t last_us;                                 // Outage of the last fault: last good frame -> next good frame
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t detect_last_us;                          // Last good frame -> fault detected, last fault
+    bool active;                                      // A fault is being recovered from
+  } camera_recovery_stats_t;
+
+  void camera_recovery_init(void);
+
+  // A fault was detected (or persists after the previous action): returns the
+  // action to take now and how long to back off before taking it. Each tier is
+  // tried CONFIG_UVC_CAMERA_RECOVERY_RETRIES times before escalating, and the
+  // backoff doubles with every attempt of the same fault.
+  camera_recovery_tier_t camera_recovery_next(uint32_t *backoff_ms);
+
+  // Called for every good frame. Ends an active recovery, crediting the last
+  // action. Returns true if a recovery ended.
+  bool camera_recovery_frame_ok(void);
+
+  const char *camera_recovery_tier_name(camera_recovery_tier_t tier);
+  void camera_recovery_get_stats(camera_recovery_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,216 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "freertos/FreeRTOS.h"
+}
+#include "sdkconfig.h"
+#include "change_gate.h"
+#include "jpeg_scan.h"
+
+// Words of a JPEG frame that go into its hash
+#define CHANGE_GATE_JPEG_SAMPLES 64
+// Pixels per luma grid cell, per axis
+#define CHANGE_GATE_CELL_SAMPLES 4
+
+#if CONFIG_UVC_CHANGE_GATE
+#define CHANGE_GATE_DEFAULT(_enabled)                                                  \
+  {                                                                                    \
+    .enabled = (_enabled), .size_permille = CONFIG_UVC_CHANGE_GATE_SIZE_PERMILLE,      \
+    .luma_threshold = CONFIG_UVC_CHANGE_GATE_LUMA_THRESHOLD,                           \
+    .keepalive_ms = CONFIG_UVC_CHANGE_GATE_KEEPALIVE_MS,                               \
+  }
+#if CONFIG_UVC_CHANGE_GATE_USB
+#define CHANGE_GATE_USB_ENABLED true
+#else
+#define CHANGE_GATE_USB_ENABLED false
+#endif
+#if CONFIG_UVC_CHANGE_GATE_HTTP
+#define CHANGE_GATE_HTTP_ENABLED true
+#else
+#define CHANGE_GATE_HTTP_ENABLED false
+#endif
+#else
+#define CHANGE_GATE_DEFAULT(_enabled)                                                  \
+  {                                                                                    \
+    .enabled = false, .size_permille = 5, .luma_threshold = 3, .keepalive_ms = 1000,   \
+  }
+#define CHANGE_GATE_USB_ENABLED false
+#define CHANGE_GATE_HTTP_ENABLED false
+#endif
+
+static change_gate_config_t configs[CHANGE_GATE_STREAM_COUNT] = {
+    CHANGE_GATE_DEFAULT(CHANGE_GATE_USB_ENABLED),
+    CHANGE_GATE_DEFAULT(CHANGE_GATE_HTTP_ENABLED),
+};
+static change_gate_stats_t stats[CHANGE_GATE_STREAM_COUNT];
+static portMUX_TYPE gate_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint32_t hash_word(uint32_t hash, uint32_t word)
+{
+    // FNV-1a over whole words: enough to tell frames apart, not cryptographic
+    return (hash ^ word) * 16777619u;
+}
+
+void change_gate_sign(const uint8_t *buf, size_t len, bool jpeg, uint16_t width, uint16_t height,
+                      change_sig_t *sig)
+{
+    uint32_t hash = hash_word(2166136261u, (uint32_t)len);
+    sig->len = (uint32_t)len;
+    sig->raw = !jpeg && width && height && len >= (size_t)width * height * 2;
+    sig->cells = 0;
+    sig->luma_step = 0;
+
+    if (!sig->raw)
+    {
+        // Evenly spread over the frame; the headers in front are the same
+        // for every frame of a mode and quality, the scan data is not
+        memset(sig->luma, 0, sizeof(sig->luma));
+        size_t step = len / CHANGE_GATE_JPEG_SAMPLES;
+        for (size_t i = 0; step >= 4 && i < CHANGE_GATE_JPEG_SAMPLES; i++)
+        {
+            uint32_t word;
+            memcpy(&word, buf + i * step, sizeof(word));
+            hash = hash_word(hash, word);
+        }
+        sig->hash = hash;
+        // Sensor noise changes nearly every sampled word, so the content
+        // check is the luma of the first MCUs
+        if (jpeg)
+        {
+            sig->cells = (uint8_t)jpeg_scan_dc_luma(buf, len, sig->luma, sizeof(sig->luma), &sig->luma_step);
+        }
+        return;
+    }
+    sig->cells = sizeof(sig->luma);
+
+    // YUY2: luma is every even byte
+    for (int cy = 0; cy < CHANGE_GATE_LUMA_ROWS; cy++)
+    {
+        for (int cx = 0; cx < CHANGE_GATE_LUMA_COLS; cx++)
+        {
+            uint32_t sum = 0;
+            for (int sy = 0; sy < CHANGE_GATE_CELL_SAMPLES; sy++)
+            {
+                uint32_t y = ((cy * CHANGE_GATE_CELL_SAMPLES + sy) * 2 + 1) * height /
+                             (CHANGE_GATE_LUMA_ROWS * CHANGE_GATE_CELL_SAMPLES * 2);
+                for (int sx = 0; sx < CHANGE_GATE_CELL_SAMPLES; sx++)
+                {
+                    uint32_t x = ((cx * CHANGE_GATE_CELL_SAMPLES + sx) * 2 + 1) * width /
+                                 (CHANGE_GATE_LUMA_COLS * CHANGE_GATE_CELL_SAMPLES * 2);
+                    sum += buf[((size_t)y * width + x) * 2];
+                }
+            }
+            uint8_t luma = (uint8_t)(sum / (CHANGE_GATE_CELL_SAMPLES * CHANGE_GATE_CELL_SAMPLES));
+            sig->luma[cy * CHANGE_GATE_LUMA_COLS + cx] = luma;
+            hash = hash_word(hash, luma);
+        }
+    }
+    sig->hash = hash;
+}
+
+void change_gate_set_config(change_gate_stream_t stream, const change_gate_config_t *config)
+{
+    portENTER_CRITICAL(&gate_lock);
+    configs[stream] = *config;
+    portEXIT_CRITICAL(&gate_lock);
+}
+
+void change_gate_get_config(change_gate_stream_t stream, change_gate_config_t *config)
+{
+    portENTER_CRITICAL(&gate_lock);
+    *config = configs[stream];
+    portEXIT_CRITICAL(&gate_lock);
+}
+
+static bool same_scene(const change_gate_config_t *config, const change_sig_t *ref, const change_sig_t *sig)
+{
+    if (sig->len == 0)
+    {
+        return false;  // Never signed
+    }
+    if (sig->hash == ref->hash && sig->len == ref->len)
+    {
+        return true;
+    }
+    if (sig->raw != ref->raw || sig->cells != ref->cells)
+    {
+        return false;
+    }
+    // A JPEG DC coefficient moves by whole quantization steps
+    int threshold = config->luma_threshold + (sig->luma_step > ref->luma_step ? sig->luma_step : ref->luma_step);
+    for (size_t i = 0; i < sig->cells; i++)
+    {
+        int diff = (int)sig->luma[i] - (int)ref->luma[i];
+        if (diff > threshold || -diff > threshold)
+        {
+            return false;
+        }
+    }
+    if (sig->raw)
+    {
+        return true;
+    }
+    // JPEG: the size must agree as well, and without luma it cannot decide alone
+    if (sig->cells == 0)
+    {
+        return false;
+    }
+    uint32_t diff = sig->len > ref->len ? sig->len - ref->len : ref->len - sig->len;
+    return (uint64_t)diff * 1000 <= (uint64_t)ref->len * config->size_permille;
+}
+
+bool change_gate_pass(change_gate_stream_t stream, change_gate_state_t *state, const change_sig_t *sig,
+                      int64_t now)
+{
+    portENTER_CRITICAL(&gate_lock);
+    change_gate_config_t config = configs[stream];
+    if (!config.enabled)
+    {
+        portEXIT_CRITICAL(&gate_lock);
+        state->has_ref = false;
+        return true;
+    }
+
+    bool pass = true;
+    change_gate_stats_t *st = &stats[stream];
+    if (!state->has_ref || !same_scene(&config, &state->ref, sig))
+    {
+        st->changed++;
+    }
+    else if (now - state->sent_us >= (int64_t)config.keepalive_ms * 1000)
+    {
+        st->keepalive++;
+    }
+    else
+    {
+        st->skipped++;
+        st->bytes_saved += sig->len;
+        pass = false;
+    }
+    portEXIT_CRITICAL(&gate_lock);
+
+    if (pass)
+    {
+        state->ref = *sig;
+        state->has_ref = true;
+        state->sent_us = now;
+    }
+    return pass;
+}
+
+void change_gate_reset(change_gate_state_t *state)
+{
+    state->has_ref = false;
+}
+
+void change_gate_get_stats(change_gate_stream_t stream, change_gate_stats_t *out)
+{
+    portENTER_CRITICAL(&gate_lock);
+    *out = stats[stream];
+    portEXIT_CRITICAL(&gate_lock);
+}
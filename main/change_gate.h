@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Low-resolution luma grid of raw frames; JPEG frames use the same number
+// of cells for their first MCUs
+#define CHANGE_GATE_LUMA_COLS 8
+#define CHANGE_GATE_LUMA_ROWS 6
+
+  // Change-gated streaming: a stream skips frames that show the same scene as
+  // the last frame it sent, and still sends one at least every keepalive_ms so
+  // the host sees a live device. The capture side computes a signature once
+  // per frame; each consumer keeps its own reference to compare against.
+  // A JPEG frame counts as unchanged when it is byte-identical at sampled
+  // positions of the scan data, or when two checks agree: its size is within
+  // size_permille of the reference (compressed size follows scene content
+  // closely, sensor noise moves it by a few tenths of a percent), and the
+  // mean luma of its first MCUs, read from their DC coefficients, moved by
+  // no more than luma_threshold plus one quantization step. The size covers
+  // the whole picture, the MCUs only its top edge. A JPEG that is not
+  // baseline has no luma and always counts as changed. A raw frame counts
+  // as unchanged when no cell of its luma grid moved by more than
+  // luma_threshold.
+  // UVC has no way to say "same frame again", so a skip simply sends nothing:
+  // the host keeps showing the last frame and saves the decode as well.
+
+  typedef enum
+  {
+    CHANGE_GATE_USB = 0,
+    CHANGE_GATE_HTTP,
+    CHANGE_GATE_STREAM_COUNT,
+  } change_gate_stream_t;
+
+  typedef struct
+  {
+    uint32_t len;   // Frame bytes
+    uint32_t hash;  // Over sampled words of the frame, and len
+    bool raw;           // A raw frame: luma is its grid
+    uint8_t cells;      // Valid entries of luma; for JPEG, MCUs decoded
+    uint8_t luma_step;  // JPEG: luma of one DC quantization step
+    uint8_t luma[CHANGE_GATE_LUMA_COLS * CHANGE_GATE_LUMA_ROWS];
+  } change_sig_t;
+
+  typedef struct
+  {
+    bool enabled;
+    uint16_t size_permille;  // JPEG: size change that still counts as the same scene
+    uint8_t luma_threshold;  // Largest cell luma change that still counts as the same scene
+    uint32_t keepalive_ms;   // Longest time without sending a frame
+  } change_gate_config_t;
+
+  typedef struct
+  {
+    uint32_t changed;     // Frames sent because the scene changed
+    uint32_t keepalive;   // Unchanged frames sent to honour keepalive_ms
+    uint32_t skipped;     // Unchanged frames not sent
+    uint64_t bytes_saved; // Bytes of the skipped frames
+  } change_gate_stats_t;
+
+  // One consumer's view: the last frame it sent. Zero-initialized, or after
+  // change_gate_reset, the next frame always passes.
+  typedef struct
+  {
+    change_sig_t ref;
+    bool has_ref;
+    int64_t sent_us;
+  } change_gate_state_t;
+
+  // Capture side: signature of a frame. JPEG frames read 64 words and the
+  // Huffman data of 48 MCUs, raw YUY2 frames 16 pixels per grid cell, so
+  // the cost does not grow with the size.
+  void change_gate_sign(const uint8_t *buf, size_t len, bool jpeg, uint16_t width, uint16_t height,
+                        change_sig_t *sig);
+
+  void change_gate_set_config(change_gate_stream_t stream, const change_gate_config_t *config);
+  void change_gate_get_config(change_gate_stream_t stream, change_gate_config_t *config);
+
+  // Consumer side: true if the frame with sig should be sent at now. A frame
+  // that passes becomes the reference. Always true while the stream's gate
+  // is disabled.
+  bool change_gate_pass(change_gate_stream_t stream, change_gate_state_t *state, const change_sig_t *sig,
+                        int64_t now);
+
+  // New stream or connection: the next frame passes
+  void change_gate_reset(change_gate_state_t *state);
+
+  void change_gate_get_stats(change_gate_stream_t stream, change_gate_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
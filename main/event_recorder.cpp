@@ -0,0 +1,364 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+}
+#include "event_recorder.h"
+
+static const char *TAG = "RECORDER";
+
+// Records start on this boundary, so headers are read in place
+#define RECORD_ALIGN 8
+
+static_assert(sizeof(event_recorder_frame_t) == 24, "dump format changed");
+static_assert(sizeof(event_recorder_frame_t) % RECORD_ALIGN == 0, "record data must follow the header directly");
+
+// Records run from head to tail; once the ring has wrapped they run from
+// head to end and on from the start of the block to tail (tail <= head)
+static uint8_t *ring;
+static size_t capacity;
+static size_t head;
+static size_t tail;
+static size_t end;
+static bool wrapped;
+static uint32_t frames;
+static uint32_t bytes;
+
+static event_recorder_state_t state;
+static bool writing;   // camera_task is copying a frame in, outside the lock
+static bool dumping;
+static bool thinning;  // The dump asked the UVC stream to make room
+static uint32_t interval_us;
+static uint32_t default_post_ms;
+static int64_t last_recorded_us;
+static int64_t oldest_us;
+static int64_t newest_us;
+static int64_t trigger_us;
+static int64_t freeze_at_us;
+static uint32_t seq;
+static TaskHandle_t capture_task_handle;
+
+static event_recorder_stats_t stats;
+static portMUX_TYPE recorder_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t record_size(size_t len)
+{
+    return (sizeof(event_recorder_frame_t) + len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+static const event_recorder_frame_t *record_at(size_t pos)
+{
+    return (const event_recorder_frame_t *)(ring + pos);
+}
+
+// Position of the record after the one at pos
+static size_t record_next(size_t pos)
+{
+    pos += record_size(record_at(pos)->len);
+    return wrapped && pos == end ? 0 : pos;
+}
+
+// Under the lock: drop the oldest record
+static void evict_oldest(void)
+{
+    const event_recorder_frame_t *oldest = record_at(head);
+    bytes -= sizeof(event_recorder_frame_t) + oldest->len;
+    frames--;
+    stats.evicted++;
+    head += record_size(oldest->len);
+    if (wrapped && head == end)
+    {
+        head = 0;
+        wrapped = false;
+    }
+    oldest_us = frames ? record_at(head)->capture_us : 0;
+}
+
+// Under the lock: room for size bytes at tail, evicting as needed. size is
+// at most the capacity, so this always ends, at worst with an empty ring.
+static void make_room(size_t size)
+{
+    if (frames == 0)
+    {
+        head = tail = end = 0;
+        wrapped = false;
+    }
+    for (;;)
+    {
+        if (!wrapped)
+        {
+            if (capacity - tail >= size)
+            {
+                return;
+            }
+            // Not enough after the newest record: go on from the start, the
+            // rest of the block stays unused until head passes it
+            end = tail;
+            tail = 0;
+            wrapped = true;
+        }
+        else
+        {
+            if (head - tail >= size)
+            {
+                return;
+            }
+            evict_oldest();
+        }
+    }
+}
+
+// Under the lock: a trigger's post-trigger time has passed. Not while a
+// frame is being copied in, it ends with the same check.
+static void check_freeze(int64_t now)
+{
+    if (state == EVENT_RECORDER_TRIGGERED && !writing && now >= freeze_at_us)
+    {
+        state = EVENT_RECORDER_FROZEN;
+    }
+}
+
+esp_err_t event_recorder_init(size_t size, uint32_t interval_ms, uint32_t post_ms, TaskHandle_t capture_task)
+{
+    size &= ~(size_t)(RECORD_ALIGN - 1);
+    // One block for the life of the firmware: eviction moves offsets, never
+    // frees, so the recorder cannot fragment the heap
+    ring = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (ring == NULL)
+    {
+        ESP_LOGE(TAG, "No PSRAM for a %zu KB recorder ring, recorder disabled", size / 1024);
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&recorder_lock);
+    capacity = size;
+    head = tail = end = 0;
+    wrapped = false;
+    frames = bytes = 0;
+    interval_us = interval_ms * 1000;
+    default_post_ms = post_ms;
+    capture_task_handle = capture_task;
+    state = EVENT_RECORDER_RECORDING;
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&recorder_lock);
+
+    ESP_LOGI(TAG, "Recording the last %zu KB of frames, %lu ms after a trigger", size / 1024,
+             (unsigned long)post_ms);
+    if (capture_task)
+    {
+        xTaskNotifyGive(capture_task);
+    }
+    return ESP_OK;
+}
+
+bool event_recorder_capturing(void)
+{
+    event_recorder_state_t s = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    return s == EVENT_RECORDER_RECORDING || s == EVENT_RECORDER_TRIGGERED;
+}
+
+void event_recorder_add(const uint8_t *jpeg, size_t len, int64_t capture_us, uint16_t width, uint16_t height)
+{
+    size_t size = record_size(len);
+
+    portENTER_CRITICAL(&recorder_lock);
+    if (state != EVENT_RECORDER_RECORDING && state != EVENT_RECORDER_TRIGGERED)
+    {
+        portEXIT_CRITICAL(&recorder_lock);
+        return;
+    }
+    if (last_recorded_us && capture_us - last_recorded_us < (int64_t)interval_us)
+    {
+        stats.skipped++;
+        portEXIT_CRITICAL(&recorder_lock);
+        return;
+    }
+    if (size > capacity)
+    {
+        stats.too_large++;
+        portEXIT_CRITICAL(&recorder_lock);
+        return;
+    }
+    make_room(size);
+    size_t pos = tail;
+    uint32_t frame_seq = seq++;
+    writing = true;
+    portEXIT_CRITICAL(&recorder_lock);
+
+    // The only copy of the frame; the header is written in place beside it.
+    // Nothing reads the new record before it is committed below, and a
+    // frozen ring is only read once no copy is in progress.
+    int64_t start = esp_timer_get_time();
+    event_recorder_frame_t *record = (event_recorder_frame_t *)(ring + pos);
+    record->magic = EVENT_RECORDER_MAGIC;
+    record->seq = frame_seq;
+    record->capture_us = capture_us;
+    record->len = (uint32_t)len;
+    record->width = width;
+    record->height = height;
+    memcpy(record + 1, jpeg, len);
+    int64_t now = esp_timer_get_time();
+    uint32_t copy_us = (uint32_t)(now - start);
+
+    portENTER_CRITICAL(&recorder_lock);
+    writing = false;
+    tail = pos + size;
+    frames++;
+    bytes += sizeof(event_recorder_frame_t) + len;
+    if (frames == 1)
+    {
+        oldest_us = capture_us;
+    }
+    newest_us = capture_us;
+    last_recorded_us = capture_us;
+    stats.recorded++;
+    stats.copy_last_us = copy_us;
+    if (copy_us > stats.copy_max_us)
+    {
+        stats.copy_max_us = copy_us;
+    }
+    check_freeze(now);
+    uint32_t frozen_frames = state == EVENT_RECORDER_FROZEN ? frames : 0;
+    portEXIT_CRITICAL(&recorder_lock);
+
+    if (frozen_frames)
+    {
+        ESP_LOGI(TAG, "Ring frozen with %lu frames", (unsigned long)frozen_frames);
+    }
+}
+
+bool event_recorder_trigger(uint32_t post_ms)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&recorder_lock);
+    bool ok = state == EVENT_RECORDER_RECORDING || state == EVENT_RECORDER_TRIGGERED;
+    if (ok)
+    {
+        // A second trigger moves the freeze, later or earlier
+        state = EVENT_RECORDER_TRIGGERED;
+        trigger_us = now;
+        freeze_at_us = now + (int64_t)post_ms * 1000;
+        stats.triggers++;
+        check_freeze(now);
+    }
+    portEXIT_CRITICAL(&recorder_lock);
+    if (ok)
+    {
+        ESP_LOGI(TAG, "Triggered, freezing in %lu ms", (unsigned long)post_ms);
+    }
+    return ok;
+}
+
+uint32_t event_recorder_post_ms(void)
+{
+    return default_post_ms;
+}
+
+bool event_recorder_arm(void)
+{
+    portENTER_CRITICAL(&recorder_lock);
+    bool ok = state != EVENT_RECORDER_OFF && !dumping;
+    if (ok)
+    {
+        // A copy in progress (reserved at tail) lands in the emptied ring as
+        // its first record
+        head = tail = writing ? tail : 0;
+        end = 0;
+        wrapped = false;
+        frames = bytes = 0;
+        oldest_us = newest_us = 0;
+        trigger_us = 0;
+        last_recorded_us = 0;
+        state = EVENT_RECORDER_RECORDING;
+    }
+    portEXIT_CRITICAL(&recorder_lock);
+    if (ok && capture_task_handle)
+    {
+        xTaskNotifyGive(capture_task_handle);
+    }
+    return ok;
+}
+
+void event_recorder_get_info(event_recorder_info_t *info)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&recorder_lock);
+    // Without frames (a failed camera) the post-trigger time still ends
+    check_freeze(now);
+    info->state = state;
+    info->frames = frames;
+    info->bytes = bytes;
+    info->capacity = (uint32_t)capacity;
+    info->oldest_us = oldest_us;
+    info->newest_us = newest_us;
+    info->trigger_us = trigger_us;
+    portEXIT_CRITICAL(&recorder_lock);
+}
+
+void event_recorder_get_stats(event_recorder_stats_t *out)
+{
+    portENTER_CRITICAL(&recorder_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&recorder_lock);
+}
+
+bool event_recorder_dump_begin(event_recorder_cursor_t *cursor, event_recorder_info_t *info, bool thin_stream)
+{
+    event_recorder_get_info(info);
+    portENTER_CRITICAL(&recorder_lock);
+    bool ok = state == EVENT_RECORDER_FROZEN;
+    if (ok)
+    {
+        dumping = true;
+        thinning = thin_stream;
+        cursor->pos = head;
+        cursor->left = frames;
+    }
+    portEXIT_CRITICAL(&recorder_lock);
+    return ok;
+}
+
+const event_recorder_frame_t *event_recorder_dump_next(event_recorder_cursor_t *cursor)
+{
+    // Frozen and held by the dump: the ring cannot change under the cursor
+    if (cursor->left == 0)
+    {
+        return NULL;
+    }
+    const event_recorder_frame_t *record = record_at(cursor->pos);
+    cursor->pos = record_next(cursor->pos);
+    cursor->left--;
+    return record;
+}
+
+bool event_recorder_thinning(void)
+{
+    return __atomic_load_n(&thinning, __ATOMIC_RELAXED);
+}
+
+void event_recorder_dump_end(const event_recorder_cursor_t *cursor, uint32_t sent, uint32_t elapsed_us)
+{
+    portENTER_CRITICAL(&recorder_lock);
+    dumping = false;
+    thinning = false;
+    if (cursor->left == 0)
+    {
+        stats.dumps++;
+    }
+    else
+    {
+        stats.dumps_aborted++;
+    }
+    stats.dump_last_bytes = sent;
+    stats.dump_last_us = elapsed_us;
+    portEXIT_CRITICAL(&recorder_lock);
+}
@@ -0,0 +1,129 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// "EVRF" in the first four bytes of every frame record, little-endian
+#define EVENT_RECORDER_MAGIC 0x46525645u
+
+  // Pre-event recorder: the most recent MJPEG frames in one PSRAM block
+  // allocated at boot, recorded whether or not anything streams. Frames are
+  // stored back to back as records, oldest first, and a new frame evicts as
+  // many of the oldest as it needs room for; only the space after the newest
+  // record, when the next one does not fit before the end of the block, is
+  // left unused until the ring wraps past it. Nothing is allocated per frame.
+  //
+  // A trigger keeps recording for the post-trigger time, then freezes the
+  // ring: nothing is recorded or evicted until it is armed again. A frozen
+  // ring can be read out (dumped) any number of times.
+  //
+  // Each record is this header followed by len bytes of JPEG data, the
+  // layout the dump sends to the host as well
+
+  typedef struct
+  {
+    uint32_t magic;       // EVENT_RECORDER_MAGIC
+    uint32_t seq;         // Frames recorded since boot, gaps are skipped frames
+    int64_t capture_us;   // esp_timer time the frame was captured
+    uint32_t len;         // Trimmed JPEG length
+    uint16_t width;
+    uint16_t height;
+  } event_recorder_frame_t;
+
+  typedef enum
+  {
+    EVENT_RECORDER_OFF = 0,     // Not initialized
+    EVENT_RECORDER_RECORDING,
+    EVENT_RECORDER_TRIGGERED,   // Recording until the post-trigger time has passed
+    EVENT_RECORDER_FROZEN,
+  } event_recorder_state_t;
+
+  // What the ring holds now
+  typedef struct
+  {
+    event_recorder_state_t state;
+    uint32_t frames;
+    uint32_t bytes;       // Records, headers included: the size of a dump
+    uint32_t capacity;
+    int64_t oldest_us;    // Capture time of the oldest and newest frame
+    int64_t newest_us;
+    int64_t trigger_us;   // Last trigger, 0 if none since the ring was armed
+  } event_recorder_info_t;
+
+  typedef struct
+  {
+    uint32_t recorded;      // Frames copied into the ring
+    uint32_t evicted;       // Oldest frames dropped to make room
+    uint32_t skipped;       // Within the recording interval of the last one
+    uint32_t too_large;     // Frames larger than the whole ring
+    uint32_t triggers;
+    uint32_t dumps;         // Dumps read out to the end
+    uint32_t dumps_aborted; // ... and given up, the host stopped reading
+    uint32_t copy_last_us;  // memcpy of one frame into the ring
+    uint32_t copy_max_us;
+    uint32_t dump_last_bytes;
+    uint32_t dump_last_us;
+  } event_recorder_stats_t;
+
+  // Read position of a dump
+  typedef struct
+  {
+    size_t pos;
+    uint32_t left;  // Records still to read
+  } event_recorder_cursor_t;
+
+  // Allocates capacity bytes of PSRAM and starts recording. Frames closer
+  // than interval_ms to the last recorded one are skipped (0 records every
+  // frame); a trigger without its own time freezes the ring post_ms after.
+  // capture_task is woken whenever the recorder starts wanting frames.
+  esp_err_t event_recorder_init(size_t capacity, uint32_t interval_ms, uint32_t post_ms, TaskHandle_t capture_task);
+
+  // Capture side: the recorder wants frames, the camera must run
+  bool event_recorder_capturing(void);
+
+  // Capture side: a valid JPEG frame; copied into the ring with one memcpy
+  // unless the ring is frozen or the frame falls within the interval
+  void event_recorder_add(const uint8_t *jpeg, size_t len, int64_t capture_us, uint16_t width, uint16_t height);
+
+  // Freeze the ring post_ms from now; false if not recording. Any task.
+  bool event_recorder_trigger(uint32_t post_ms);
+
+  // Post-trigger time of event_recorder_init
+  uint32_t event_recorder_post_ms(void);
+
+  // Drop everything and record again; false while a dump reads the ring
+  bool event_recorder_arm(void);
+
+  void event_recorder_get_info(event_recorder_info_t *info);
+  void event_recorder_get_stats(event_recorder_stats_t *stats);
+
+  // Read a frozen ring out, oldest frame first: begin fails unless the ring
+  // is frozen; next returns each record (its data right after the header)
+  // and NULL at the end. The ring cannot be armed until end. thin_stream
+  // asks the UVC stream to make room on the bus until end.
+  bool event_recorder_dump_begin(event_recorder_cursor_t *cursor, event_recorder_info_t *info, bool thin_stream);
+  const event_recorder_frame_t *event_recorder_dump_next(event_recorder_cursor_t *cursor);
+  void event_recorder_dump_end(const event_recorder_cursor_t *cursor, uint32_t bytes, uint32_t elapsed_us);
+
+  // A dump begun with thin_stream is reading the ring
+  bool event_recorder_thinning(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,230 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+}
+#include "frame_pacer.h"
+
+static const char *TAG = "FRAME_PACER";
+
+// A deadline this close counts as reached, so a timer that fires a little
+// early never costs a second wake-up
+#define FRAME_PACER_EARLY_US 200
+
+#if CONFIG_UVC_FRAME_PACING
+#define FRAME_PACER_GRACE_PCT CONFIG_UVC_FRAME_PACING_GRACE_PCT
+#else
+#define FRAME_PACER_GRACE_PCT 0
+#endif
+
+static esp_timer_handle_t deadline_timer;
+static void (*deadline_cb)(void);
+static portMUX_TYPE pacer_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t interval_us;        // 0 = unpaced
+static bool anchored;               // Grid starts at the first frame of the stream
+static int64_t deadline_us;         // Next deadline on the grid
+static int64_t armed_for_us = -1;   // Wake-up the timer is set for, -1 = none
+static frame_pacer_action_t pending_action;
+static frame_pacer_stats_t stats;
+
+static void deadline_timer_cb(void *arg)
+{
+    (void)arg;
+    if (deadline_cb)
+    {
+        deadline_cb();
+    }
+}
+
+esp_err_t frame_pacer_init(void (*on_deadline)(void))
+{
+    const esp_timer_create_args_t args = {
+        .callback = deadline_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "frame_pacer",
+        .skip_unhandled_events = true,
+    };
+
+    deadline_cb = on_deadline;
+    esp_err_t err = esp_timer_create(&args, &deadline_timer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create deadline timer: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void frame_pacer_start(uint32_t frame_interval)
+{
+    portENTER_CRITICAL(&pacer_lock);
+    memset(&stats, 0, sizeof(stats));
+#if CONFIG_UVC_FRAME_PACING
+    interval_us = frame_interval / 10;
+#else
+    interval_us = 0;
+#endif
+    stats.interval_us = interval_us;
+    anchored = false;
+    armed_for_us = -1;
+    portEXIT_CRITICAL(&pacer_lock);
+
+    // Only fails if the timer was not running
+    esp_timer_stop(deadline_timer);
+}
+
+void frame_pacer_stop(void)
+{
+    frame_pacer_start(0);
+}
+
+frame_pacer_action_t frame_pacer_poll(bool have_new_frame, bool can_repeat)
+{
+    frame_pacer_action_t action = FRAME_PACER_WAIT;
+    int64_t now = esp_timer_get_time();
+    int64_t wake_at = -1;
+
+    portENTER_CRITICAL(&pacer_lock);
+    if (interval_us == 0 || !anchored)
+    {
+        // Unpaced, or the first frame of the stream: send as soon as possible
+        action = have_new_frame ? FRAME_PACER_SEND : FRAME_PACER_WAIT;
+    }
+    else if (now < deadline_us - FRAME_PACER_EARLY_US)
+    {
+        wake_at = deadline_us;
+    }
+    else if (have_new_frame)
+    {
+        action = FRAME_PACER_SEND;
+    }
+    else
+    {
+        // A frame landing just after the deadline is better than a repeat
+        int64_t grace_end = deadline_us + (int64_t)interval_us * FRAME_PACER_GRACE_PCT / 100;
+        if (now < grace_end - FRAME_PACER_EARLY_US)
+        {
+            wake_at = grace_end;
+        }
+        else if (can_repeat)
+        {
+            action = FRAME_PACER_REPEAT;
+        }
+        // Otherwise the next frame goes out as soon as it is queued
+    }
+
+    if (wake_at == armed_for_us)
+    {
+        wake_at = -1;
+    }
+    else if (wake_at >= 0)
+    {
+        armed_for_us = wake_at;
+    }
+    pending_action = action;
+    portEXIT_CRITICAL(&pacer_lock);
+
+    // Timer calls may block, so never make them inside the critical section
+    if (wake_at >= 0)
+    {
+        esp_timer_stop(deadline_timer);
+        esp_timer_start_once(deadline_timer, wake_at > now ? wake_at - now : 0);
+    }
+    return action;
+}
+
+// Caller holds pacer_lock: move to the next deadline on the grid. A
+// transfer or sensor that fell more than a whole period behind gives up the
+// deadlines it missed instead of bursting.
+static void advance_deadline(int64_t now)
+{
+    deadline_us += interval_us;
+    if (now >= deadline_us)
+    {
+        uint32_t missed = (uint32_t)((now - deadline_us) / interval_us) + 1;
+        deadline_us += (int64_t)missed * interval_us;
+        stats.skipped += missed;
+    }
+}
+
+void frame_pacer_submitted(int64_t now)
+{
+    portENTER_CRITICAL(&pacer_lock);
+    if (interval_us == 0)
+    {
+        portEXIT_CRITICAL(&pacer_lock);
+        return;
+    }
+    if (!anchored)
+    {
+        anchored = true;
+        deadline_us = now;
+    }
+
+    uint32_t lateness = now > deadline_us ? (uint32_t)(now - deadline_us) : 0;
+    if (lateness > stats.lateness_max_us)
+    {
+        stats.lateness_max_us = lateness;
+    }
+    stats.lateness_sum_us += lateness;
+    if (pending_action == FRAME_PACER_REPEAT)
+    {
+        stats.repeated++;
+    }
+    else
+    {
+        stats.sent++;
+        if (lateness > (uint64_t)interval_us * FRAME_PACER_GRACE_PCT / 100)
+        {
+            stats.late++;
+        }
+    }
+
+    advance_deadline(now);
+    portEXIT_CRITICAL(&pacer_lock);
+}
+
+void frame_pacer_streamed(int64_t now)
+{
+    portENTER_CRITICAL(&pacer_lock);
+    if (interval_us != 0)
+    {
+        anchored = true;
+        deadline_us = now + interval_us;
+        stats.sent++;
+    }
+    portEXIT_CRITICAL(&pacer_lock);
+}
+
+void frame_pacer_withheld(int64_t now)
+{
+    portENTER_CRITICAL(&pacer_lock);
+    if (interval_us == 0)
+    {
+        portEXIT_CRITICAL(&pacer_lock);
+        return;
+    }
+    if (!anchored)
+    {
+        anchored = true;
+        deadline_us = now;
+    }
+    stats.withheld++;
+    advance_deadline(now);
+    portEXIT_CRITICAL(&pacer_lock);
+}
+
+void frame_pacer_get_stats(frame_pacer_stats_t *out)
+{
+    portENTER_CRITICAL(&pacer_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&pacer_lock);
+}
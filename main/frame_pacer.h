@@ -0,0 +1,75 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Frame pacing for the USB side. Deadlines sit on a fixed grid of the
+  // committed dwFrameInterval, anchored at the first frame of the stream. At
+  // each deadline the newest queued frame is sent; frames that arrive between
+  // deadlines replace each other (decimation), and a deadline with no new
+  // frame repeats the previous one once a short grace period has passed.
+  // A one-shot esp_timer wakes the USB task for the next deadline.
+
+  typedef enum
+  {
+    FRAME_PACER_WAIT = 0, // Nothing to send yet
+    FRAME_PACER_SEND,     // Send the newest queued frame
+    FRAME_PACER_REPEAT,   // No new frame this period, send the previous one again
+  } frame_pacer_action_t;
+
+  typedef struct
+  {
+    uint32_t interval_us;     // Active pacing interval, 0 = unpaced
+    uint32_t sent;            // New frames sent on a deadline
+    uint32_t repeated;        // Deadlines served by repeating the previous frame
+    uint32_t late;            // Frames sent after the grace period of their deadline
+    uint32_t skipped;         // Deadlines missed entirely (endpoint or sensor too slow)
+    uint32_t withheld;        // Deadlines deliberately left without a frame (scene unchanged, thinning recorder dump)
+    uint32_t lateness_max_us; // Worst submit time after the deadline
+    uint64_t lateness_sum_us;
+  } frame_pacer_stats_t;
+
+  // on_deadline is called from the esp_timer task when a deadline (or the end
+  // of its grace period) is reached; it should only wake the USB task.
+  esp_err_t frame_pacer_init(void (*on_deadline)(void));
+
+  // Stream committed with dwFrameInterval in 100 ns units; 0 disables pacing
+  // and every queued frame is sent as soon as the endpoint is idle
+  void frame_pacer_start(uint32_t frame_interval);
+  void frame_pacer_stop(void);
+
+  // Endpoint idle: decide what to send now. Arms the timer when the answer
+  // is to wait for a deadline.
+  frame_pacer_action_t frame_pacer_poll(bool have_new_frame, bool can_repeat);
+
+  // The frame chosen by frame_pacer_poll was submitted at now
+  void frame_pacer_submitted(int64_t now);
+
+  // A frame went out on the sensor's schedule rather than a deadline
+  // (sub-frame streaming) at now: it counts as sent and the next deadline
+  // is a period after it, so repeats only fill in for a late sensor
+  void frame_pacer_streamed(int64_t now);
+
+  // The frame chosen by frame_pacer_poll was not sent, on purpose: the
+  // deadline counts as served and the next one is a period later
+  void frame_pacer_withheld(int64_t now);
+
+  void frame_pacer_get_stats(frame_pacer_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,562 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+}
+#include "frame_ring.h"
+#include "pipeline_stats.h"
+
+static const char *TAG = "FRAME_RING";
+
+static frame_slot_t slots[FRAME_RING_BUFFERS];
+static frame_slot_t *queued_slot = NULL;
+static frame_slot_t *in_flight_slot = NULL;
+static frame_slot_t *retained_slot = NULL;
+static bool retain_last = false;
+static uint32_t next_seq = 1; // 0 is never used, readers start after it
+static bool sharing = true;
+static frame_ring_stats_t ring_stats;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Recovery hold: a copy of the last good frame outside the driver's buffers,
+// served by frame_ring_acquire_repeat in place of a retained frame
+static uint8_t *hold_buf = NULL;
+static size_t hold_capacity = 0;
+static camera_fb_t hold_fb;
+static frame_slot_t hold_slot;
+static bool holding = false;
+
+static frame_slot_t *find_free_slot(void)
+{
+    for (int i = 0; i < FRAME_RING_BUFFERS; i++)
+    {
+        if (slots[i].state == FRAME_SLOT_FREE)
+        {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t frame_ring_init(void)
+{
+    portENTER_CRITICAL(&ring_lock);
+    memset(slots, 0, sizeof(slots));
+    memset(&ring_stats, 0, sizeof(ring_stats));
+    queued_slot = NULL;
+    in_flight_slot = NULL;
+    retained_slot = NULL;
+    retain_last = false;
+    next_seq = 1;
+    sharing = true;
+    portEXIT_CRITICAL(&ring_lock);
+
+    ESP_LOGI(TAG, "Frame ring initialized with %d buffers (%d for readers)", FRAME_RING_BUFFERS,
+             FRAME_RING_SHARED_MAX);
+    return ESP_OK;
+}
+
+// Caller holds ring_lock: the ring is done with slot. Returns its buffer for
+// the driver, or NULL if readers still reference it; the last one returns it.
+static camera_fb_t *retire_slot(frame_slot_t *slot)
+{
+    if (slot->refs)
+    {
+        slot->state = FRAME_SLOT_SHARED;
+        return NULL;
+    }
+    camera_fb_t *fb = slot->fb;
+    slot->fb = NULL;
+    slot->state = FRAME_SLOT_FREE;
+    return fb;
+}
+
+// Caller holds ring_lock: a new frame from the capture side
+static void fill_slot(frame_slot_t *slot, camera_fb_t *fb, size_t len, const change_sig_t *sig, int64_t now)
+{
+    slot->fb = fb;
+    slot->len = len;
+    slot->seq = next_seq++;
+    slot->ts.capture_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    slot->ts.handoff_us = now;
+    slot->ts.submit_us = 0;
+    slot->ts.complete_us = 0;
+    slot->repeat = false;
+    if (sig != NULL)
+    {
+        slot->sig = *sig;
+    }
+    else
+    {
+        memset(&slot->sig, 0, sizeof(slot->sig));
+    }
+}
+
+bool frame_ring_push(camera_fb_t *fb, size_t len, const change_sig_t *sig)
+{
+    camera_fb_t *stale = NULL;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&ring_lock);
+    frame_slot_t *slot;
+    if (queued_slot != NULL && queued_slot->refs == 0)
+    {
+        // Latest-frame policy: an unsent frame is superseded by the new one
+        slot = queued_slot;
+        stale = slot->fb;
+        ring_stats.replaced++;
+        pipeline_count(PIPELINE_DROPPED);
+    }
+    else
+    {
+        slot = find_free_slot();
+        if (slot == NULL)
+        {
+            portEXIT_CRITICAL(&ring_lock);
+            return false;
+        }
+        if (queued_slot != NULL)
+        {
+            // Superseded as well, but readers keep it until they are done
+            retire_slot(queued_slot);
+            ring_stats.replaced++;
+            pipeline_count(PIPELINE_DROPPED);
+        }
+    }
+
+    fill_slot(slot, fb, len, sig, now);
+    slot->state = FRAME_SLOT_QUEUED;
+    queued_slot = slot;
+    ring_stats.pushed++;
+    portEXIT_CRITICAL(&ring_lock);
+
+    // Driver calls may block, so never make them inside the critical section
+    if (stale != NULL)
+    {
+        esp_camera_fb_return(stale);
+    }
+    return true;
+}
+
+// Caller holds ring_lock; returns the retained buffer for the driver
+static camera_fb_t *drop_retained(void)
+{
+    camera_fb_t *fb = NULL;
+    if (retained_slot != NULL)
+    {
+        fb = retire_slot(retained_slot);
+        retained_slot = NULL;
+    }
+    return fb;
+}
+
+bool frame_ring_push_sent(camera_fb_t *fb, size_t len, const change_sig_t *sig, int64_t submit_us)
+{
+    camera_fb_t *stale[2] = {NULL, NULL};
+
+    portENTER_CRITICAL(&ring_lock);
+    frame_slot_t *slot = in_flight_slot == NULL ? find_free_slot() : NULL;
+    if (slot == NULL)
+    {
+        portEXIT_CRITICAL(&ring_lock);
+        return false;
+    }
+    if (queued_slot != NULL)
+    {
+        // Read out earlier, but never sent: the host already has a newer one
+        stale[0] = retire_slot(queued_slot);
+        queued_slot = NULL;
+        ring_stats.replaced++;
+        pipeline_count(PIPELINE_DROPPED);
+    }
+    stale[1] = drop_retained();
+
+    // Handed to USB when its first chunk went out, before the capture side had it
+    fill_slot(slot, fb, len, sig, submit_us);
+    slot->ts.submit_us = submit_us;
+    slot->state = FRAME_SLOT_IN_FLIGHT;
+    in_flight_slot = slot;
+    ring_stats.pushed++;
+    portEXIT_CRITICAL(&ring_lock);
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (stale[i] != NULL)
+        {
+            esp_camera_fb_return(stale[i]);
+        }
+    }
+    return true;
+}
+
+frame_slot_t *frame_ring_acquire(void)
+{
+    frame_slot_t *slot = NULL;
+    camera_fb_t *superseded = NULL;
+
+    portENTER_CRITICAL(&ring_lock);
+    if (in_flight_slot == NULL && queued_slot != NULL)
+    {
+        slot = queued_slot;
+        slot->state = FRAME_SLOT_IN_FLIGHT;
+        in_flight_slot = slot;
+        queued_slot = NULL;
+        superseded = drop_retained();
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (superseded != NULL)
+    {
+        esp_camera_fb_return(superseded);
+    }
+    return slot;
+}
+
+frame_slot_t *frame_ring_acquire_repeat(void)
+{
+    frame_slot_t *slot = NULL;
+
+    portENTER_CRITICAL(&ring_lock);
+    if (in_flight_slot == NULL && (retained_slot != NULL || holding))
+    {
+        slot = retained_slot != NULL ? retained_slot : &hold_slot;
+        slot->state = FRAME_SLOT_IN_FLIGHT;
+        slot->repeat = true;
+        in_flight_slot = slot;
+        retained_slot = NULL;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    return slot;
+}
+
+bool frame_ring_release(bool delivered, frame_slot_t *released)
+{
+    camera_fb_t *done = NULL;
+    bool released_any = false;
+
+    portENTER_CRITICAL(&ring_lock);
+    if (in_flight_slot != NULL)
+    {
+        if (released != NULL)
+        {
+            *released = *in_flight_slot;
+        }
+        if (delivered)
+        {
+            ring_stats.sent++;
+            if (in_flight_slot->repeat)
+            {
+                ring_stats.repeated++;
+            }
+        }
+        else
+        {
+            ring_stats.aborted++;
+        }
+
+        if (in_flight_slot == &hold_slot)
+        {
+            // The copy is ours, not the driver's
+            hold_slot.state = FRAME_SLOT_RETAINED;
+        }
+        else if (delivered && retain_last)
+        {
+            in_flight_slot->state = FRAME_SLOT_RETAINED;
+            retained_slot = in_flight_slot;
+        }
+        else
+        {
+            done = retire_slot(in_flight_slot);
+        }
+        in_flight_slot = NULL;
+        released_any = true;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (done != NULL)
+    {
+        esp_camera_fb_return(done);
+    }
+    return released_any;
+}
+
+void frame_ring_withhold(void)
+{
+    camera_fb_t *done = NULL;
+
+    portENTER_CRITICAL(&ring_lock);
+    if (in_flight_slot != NULL)
+    {
+        ring_stats.withheld++;
+        if (in_flight_slot == &hold_slot)
+        {
+            hold_slot.state = FRAME_SLOT_RETAINED;
+        }
+        else if (retain_last)
+        {
+            in_flight_slot->state = FRAME_SLOT_RETAINED;
+            retained_slot = in_flight_slot;
+        }
+        else
+        {
+            done = retire_slot(in_flight_slot);
+        }
+        in_flight_slot = NULL;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (done != NULL)
+    {
+        esp_camera_fb_return(done);
+    }
+}
+
+void frame_ring_set_retain(bool retain)
+{
+    camera_fb_t *done = NULL;
+
+    portENTER_CRITICAL(&ring_lock);
+    retain_last = retain;
+    if (!retain)
+    {
+        done = drop_retained();
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (done != NULL)
+    {
+        esp_camera_fb_return(done);
+    }
+}
+
+bool frame_ring_hold(bool hold)
+{
+    camera_fb_t *src = NULL;
+    frame_slot_t *src_slot = NULL;
+    frame_slot_t from;
+
+    portENTER_CRITICAL(&ring_lock);
+    if (!hold || holding || in_flight_slot == &hold_slot)
+    {
+        // Ending, already holding, or the old copy is still on the bus and
+        // must not be overwritten: keep sending it
+        holding = hold;
+        portEXIT_CRITICAL(&ring_lock);
+        return true;
+    }
+    frame_slot_t *slot = retained_slot != NULL ? retained_slot : queued_slot;
+    if (slot != NULL)
+    {
+        // Referenced like a reader's share for the copy, so a reader
+        // finishing meanwhile cannot hand the buffer back under it
+        from = *slot;
+        src = slot->fb;
+        src_slot = slot;
+        slot->refs++;
+        retire_slot(slot);
+        if (slot == retained_slot)
+        {
+            retained_slot = NULL;
+        }
+        else
+        {
+            queued_slot = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (src == NULL)
+    {
+        return false;
+    }
+
+    // Allocated on first use and kept: recoveries are rare but should not
+    // depend on a large PSRAM allocation succeeding mid-fault
+    if (from.len > hold_capacity)
+    {
+        heap_caps_free(hold_buf);
+        hold_buf = (uint8_t *)heap_caps_malloc(from.len, MALLOC_CAP_SPIRAM);
+        hold_capacity = hold_buf ? from.len : 0;
+    }
+    bool copied = hold_buf != NULL;
+    if (copied)
+    {
+        memcpy(hold_buf, src->buf, from.len);
+        hold_fb = *src;
+        hold_fb.buf = hold_buf;
+        hold_fb.len = from.len;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No memory to hold a %zu byte frame", from.len);
+    }
+    frame_ring_unshare(src_slot);
+
+    portENTER_CRITICAL(&ring_lock);
+    if (copied)
+    {
+        hold_slot = from;
+        hold_slot.fb = &hold_fb;
+        hold_slot.refs = 0;
+        hold_slot.state = FRAME_SLOT_RETAINED;
+        holding = true;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+    return copied;
+}
+
+void frame_ring_reset(void)
+{
+    camera_fb_t *pending[FRAME_RING_BUFFERS];
+    int count = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    for (int i = 0; i < FRAME_RING_BUFFERS; i++)
+    {
+        if (slots[i].state != FRAME_SLOT_FREE)
+        {
+            if (slots[i].state == FRAME_SLOT_IN_FLIGHT)
+            {
+                ring_stats.aborted++;
+            }
+            camera_fb_t *fb = retire_slot(&slots[i]);
+            if (fb != NULL)
+            {
+                pending[count++] = fb;
+            }
+        }
+    }
+    queued_slot = NULL;
+    if (in_flight_slot != &hold_slot)
+    {
+        in_flight_slot = NULL;
+    }
+    retained_slot = NULL;
+    portEXIT_CRITICAL(&ring_lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        esp_camera_fb_return(pending[i]);
+    }
+}
+
+const frame_slot_t *frame_ring_share(uint32_t after_seq)
+{
+    frame_slot_t *newest = NULL;
+    int pinned = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    for (int i = 0; i < FRAME_RING_BUFFERS; i++)
+    {
+        frame_slot_t *slot = &slots[i];
+        if (slot->refs)
+        {
+            pinned++;
+        }
+        if (slot->state != FRAME_SLOT_FREE && (int32_t)(slot->seq - after_seq) > 0 &&
+            (newest == NULL || (int32_t)(slot->seq - newest->seq) > 0))
+        {
+            newest = slot;
+        }
+    }
+    if (!sharing)
+    {
+        newest = NULL;
+    }
+    else if (newest != NULL && newest->refs == 0 && pinned >= FRAME_RING_SHARED_MAX)
+    {
+        // A new pin could outlive the USB side's use of the frame and cost
+        // the driver a buffer it is owed
+        ring_stats.refused++;
+        newest = NULL;
+    }
+    if (newest != NULL)
+    {
+        newest->refs++;
+        ring_stats.shared++;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    return newest;
+}
+
+void frame_ring_unshare(const frame_slot_t *shared)
+{
+    camera_fb_t *done = NULL;
+    frame_slot_t *slot = (frame_slot_t *)shared;
+
+    portENTER_CRITICAL(&ring_lock);
+    if (slot->refs && --slot->refs == 0 && slot->state == FRAME_SLOT_SHARED)
+    {
+        done = retire_slot(slot);
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (done != NULL)
+    {
+        esp_camera_fb_return(done);
+    }
+}
+
+void frame_ring_set_sharing(bool enable)
+{
+    portENTER_CRITICAL(&ring_lock);
+    sharing = enable;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+int frame_ring_shared(void)
+{
+    int pinned = 0;
+    portENTER_CRITICAL(&ring_lock);
+    for (int i = 0; i < FRAME_RING_BUFFERS; i++)
+    {
+        if (slots[i].refs)
+        {
+            pinned++;
+        }
+    }
+    portEXIT_CRITICAL(&ring_lock);
+    return pinned;
+}
+
+bool frame_ring_has_queued(void)
+{
+    portENTER_CRITICAL(&ring_lock);
+    bool queued = queued_slot != NULL;
+    portEXIT_CRITICAL(&ring_lock);
+    return queued;
+}
+
+bool frame_ring_in_flight(void)
+{
+    portENTER_CRITICAL(&ring_lock);
+    bool busy = in_flight_slot != NULL;
+    portEXIT_CRITICAL(&ring_lock);
+    return busy;
+}
+
+bool frame_ring_has_retained(void)
+{
+    portENTER_CRITICAL(&ring_lock);
+    bool retained = retained_slot != NULL || holding;
+    portEXIT_CRITICAL(&ring_lock);
+    return retained;
+}
+
+void frame_ring_get_stats(frame_ring_stats_t *stats)
+{
+    portENTER_CRITICAL(&ring_lock);
+    *stats = ring_stats;
+    portEXIT_CRITICAL(&ring_lock);
+}
@@ -0,0 +1,151 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_camera.h"
+#include "sdkconfig.h"
+#include "frame_timing.h"
+#include "change_gate.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Number of camera frame buffers shared between the sensor driver and USB.
+#define FRAME_RING_DEPTH CONFIG_UVC_FRAME_RING_DEPTH
+
+// Extra buffers network readers may keep from the driver once the USB side
+// is done with them, so a slow reader never takes one USB or capture needs
+#if CONFIG_UVC_HTTP_STREAM
+#define FRAME_RING_SHARED_MAX CONFIG_UVC_HTTP_SHARED_FRAMES
+#else
+#define FRAME_RING_SHARED_MAX 0
+#endif
+
+// Driver buffers (fb_count) managed by the ring
+#define FRAME_RING_BUFFERS (FRAME_RING_DEPTH + FRAME_RING_SHARED_MAX)
+
+  // Ownership of a frame buffer moves FREE (driver) -> QUEUED -> IN_FLIGHT -> FREE.
+  // With retention on, a delivered frame goes IN_FLIGHT -> RETAINED instead and
+  // may be sent again until a newer frame is acquired. A frame the USB side
+  // is done with but readers still reference waits in SHARED for the last one.
+  typedef enum
+  {
+    FRAME_SLOT_FREE = 0,
+    FRAME_SLOT_QUEUED,
+    FRAME_SLOT_IN_FLIGHT,
+    FRAME_SLOT_RETAINED,
+    FRAME_SLOT_SHARED,
+  } frame_slot_state_t;
+
+  typedef struct
+  {
+    camera_fb_t *fb;          // Driver buffer, only valid while not FREE
+    size_t len;               // Number of bytes to transfer over USB
+    uint32_t seq;             // Capture sequence number
+    frame_timestamps_t ts;    // Capture and handoff set by push, submit by the USB side
+    bool repeat;              // In flight again through frame_ring_acquire_repeat
+    change_sig_t sig;         // Scene signature for change-gated streams
+    uint8_t refs;             // Readers holding it through frame_ring_share
+    frame_slot_state_t state;
+  } frame_slot_t;
+
+  typedef struct
+  {
+    uint32_t pushed;   // Frames handed over by the capture side
+    uint32_t replaced; // Queued frames superseded by a newer one before being sent
+    uint32_t sent;     // Frames whose USB transfer completed
+    uint32_t aborted;  // In-flight frames released without a completed transfer
+    uint32_t repeated; // Retained frames sent again
+    uint32_t withheld; // Acquired frames not sent: scene unchanged, or a thinning recorder dump
+    uint32_t shared;   // References handed to readers
+    uint32_t refused;  // Shares refused because readers already pinned FRAME_RING_SHARED_MAX frames
+  } frame_ring_stats_t;
+
+  esp_err_t frame_ring_init(void);
+
+  // Capture side: takes ownership of fb and stamps its capture and handoff
+  // times. Any older frame still waiting to be sent is returned to the driver
+  // (or left to its readers) so the USB side always gets the newest one.
+  // sig is the frame's change signature, NULL if none was computed.
+  // Returns false (and leaves fb with the caller) if no slot is available.
+  bool frame_ring_push(camera_fb_t *fb, size_t len, const change_sig_t *sig);
+
+  // Capture side, sub-frame streaming: fb went to the USB side while it was
+  // read out, from submit_us on. It goes straight to in flight and stands
+  // in for a queued or retained frame, which is returned; its handoff time
+  // is the submit time. Returns false (and leaves fb with the caller) if
+  // another transfer is in flight or no slot is free.
+  bool frame_ring_push_sent(camera_fb_t *fb, size_t len, const change_sig_t *sig, int64_t submit_us);
+
+  // USB side: claim the newest queued frame and mark it in flight. A retained
+  // frame is returned to the driver, the new one supersedes it.
+  // Returns NULL if nothing is queued or a transfer is already in flight.
+  frame_slot_t *frame_ring_acquire(void);
+
+  // USB side: send the retained (last delivered) frame again.
+  // Returns NULL if none is retained or a transfer is already in flight.
+  frame_slot_t *frame_ring_acquire_repeat(void);
+
+  // Transfer complete (delivered) or rejected by the USB stack: hand the
+  // in-flight buffer back to the camera driver, or keep a delivered one as
+  // the retained frame. If released is not NULL it receives a copy of the
+  // slot for its length and timestamps; the copy's fb must not be used.
+  // Returns false if nothing was in flight.
+  bool frame_ring_release(bool delivered, frame_slot_t *released);
+
+  // The in-flight frame is not sent after all (change gate, thinning dump):
+  // it is kept as the retained frame if retention is on, as if it had been
+  // delivered, and returned to the driver otherwise.
+  void frame_ring_withhold(void);
+
+  // Keep the last delivered frame so it can be repeated. Holds one buffer
+  // back from the driver between transfers; turning it off returns it.
+  void frame_ring_set_retain(bool retain);
+
+  // Camera recovery: copy the last good frame (retained, else queued) into a
+  // private PSRAM buffer and return its driver buffer, so the driver can be
+  // restarted or reinitialized while the USB side keeps repeating the copy.
+  // Returns false if there was no frame to hold. hold = false ends it.
+  bool frame_ring_hold(bool hold);
+
+  // Stream stopped: return every buffer, including one still marked in flight,
+  // to the driver. Only call once the USB stack no longer references it.
+  // A held frame survives, and so do frames readers still reference.
+  void frame_ring_reset(void);
+
+  // Readers (network clients): reference the newest frame with a sequence
+  // number after after_seq, without copying it. The slot's fb, len and seq
+  // stay valid until frame_ring_unshare; the buffer goes back to the driver
+  // only after the USB side and every reader are done with it. Readers never
+  // delay capture or USB: at most FRAME_RING_SHARED_MAX distinct frames are
+  // referenced at once, beyond that the share is refused and NULL returned,
+  // as it is when there is no newer frame or sharing is off.
+  const frame_slot_t *frame_ring_share(uint32_t after_seq);
+  void frame_ring_unshare(const frame_slot_t *slot);
+
+  // Stop (or resume) handing out references, e.g. before the driver frees
+  // its buffers. References already taken stay valid until released.
+  void frame_ring_set_sharing(bool enable);
+
+  // Number of frames readers currently reference
+  int frame_ring_shared(void);
+
+  bool frame_ring_has_queued(void);
+  bool frame_ring_in_flight(void);
+  bool frame_ring_has_retained(void);
+  void frame_ring_get_stats(frame_ring_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
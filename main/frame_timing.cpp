@@ -0,0 +1,142 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "soc/soc.h"
+}
+#include "frame_timing.h"
+
+#define UVC_PAYLOAD_HEADER_PTS (1u << 2)
+#define UVC_PAYLOAD_HEADER_SCR (1u << 3)
+
+// DWC2 device status register: SOFFN, the frame number of the last SOF, in
+// bits 21:8. Full speed counts 1 ms frames in its low 11 bits.
+#define USB_DWC_DSTS_REG (DR_REG_USB_BASE + 0x808)
+#define USB_DWC_DSTS_SOFFN_S 8
+#define USB_SOF_COUNT_MASK 0x7FF
+
+// One circular window of samples per stage
+typedef struct
+{
+    uint32_t samples[FRAME_TIMING_WINDOW];
+    uint32_t next;  // Slot the next sample goes to
+    uint32_t count; // Valid samples, saturates at FRAME_TIMING_WINDOW
+} timing_window_t;
+
+static timing_window_t windows[FRAME_TIMING_STAGE_COUNT];
+static int64_t last_capture_us;
+static uint32_t scratch[FRAME_TIMING_WINDOW];
+static portMUX_TYPE timing_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *const stage_names[FRAME_TIMING_STAGE_COUNT] = {
+    "capture->handoff",
+    "handoff->submit",
+    "submit->complete",
+    "capture->complete",
+    "frame interval",
+};
+
+static void window_add(timing_window_t *w, int64_t us)
+{
+    w->samples[w->next] = us < 0 ? 0 : (uint32_t)us;
+    w->next = (w->next + 1) % FRAME_TIMING_WINDOW;
+    if (w->count < FRAME_TIMING_WINDOW)
+    {
+        w->count++;
+    }
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void frame_timing_reset(void)
+{
+    portENTER_CRITICAL(&timing_lock);
+    memset(windows, 0, sizeof(windows));
+    last_capture_us = 0;
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+void frame_timing_record(const frame_timestamps_t *ts)
+{
+    portENTER_CRITICAL(&timing_lock);
+    window_add(&windows[FRAME_TIMING_CAPTURE_TO_HANDOFF], ts->handoff_us - ts->capture_us);
+    window_add(&windows[FRAME_TIMING_HANDOFF_TO_SUBMIT], ts->submit_us - ts->handoff_us);
+    window_add(&windows[FRAME_TIMING_SUBMIT_TO_COMPLETE], ts->complete_us - ts->submit_us);
+    window_add(&windows[FRAME_TIMING_CAPTURE_TO_COMPLETE], ts->complete_us - ts->capture_us);
+    if (last_capture_us)
+    {
+        window_add(&windows[FRAME_TIMING_FRAME_INTERVAL], ts->capture_us - last_capture_us);
+    }
+    last_capture_us = ts->capture_us;
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+void frame_timing_get(frame_timing_stage_t stage, frame_timing_summary_t *summary)
+{
+    memset(summary, 0, sizeof(*summary));
+    if (stage >= FRAME_TIMING_STAGE_COUNT)
+    {
+        return;
+    }
+
+    // Copy out under the lock, sort outside it
+    portENTER_CRITICAL(&timing_lock);
+    uint32_t count = windows[stage].count;
+    memcpy(scratch, windows[stage].samples, count * sizeof(uint32_t));
+    portEXIT_CRITICAL(&timing_lock);
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    qsort(scratch, count, sizeof(uint32_t), compare_u32);
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sum += scratch[i];
+    }
+
+    summary->count = count;
+    summary->min_us = scratch[0];
+    summary->max_us = scratch[count - 1];
+    summary->avg_us = (uint32_t)(sum / count);
+    // Nearest rank: the smallest sample at or above 99% of them
+    summary->p99_us = scratch[(count * 99 + 99) / 100 - 1];
+}
+
+const char *frame_timing_stage_name(frame_timing_stage_t stage)
+{
+    return stage < FRAME_TIMING_STAGE_COUNT ? stage_names[stage] : "?";
+}
+
+// Header fields are little-endian and unaligned
+static void header_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+void frame_timing_put_clock(uint8_t *header, uint32_t pts)
+{
+    header[1] |= UVC_PAYLOAD_HEADER_PTS | UVC_PAYLOAD_HEADER_SCR;
+    header_put_u32(header + 2, pts);
+    header_put_u32(header + 6, frame_timing_to_uvc_clock(esp_timer_get_time()));
+    uint16_t sof = (uint16_t)((REG_READ(USB_DWC_DSTS_REG) >> USB_DWC_DSTS_SOFFN_S) & USB_SOF_COUNT_MASK);
+    header[10] = (uint8_t)sof;
+    header[11] = (uint8_t)(sof >> 8);
+}
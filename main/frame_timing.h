@@ -0,0 +1,83 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Samples kept per stage; statistics cover the most recent window only
+#define FRAME_TIMING_WINDOW CONFIG_UVC_TIMING_WINDOW
+
+// Device clock advertised in the VC header (dwClockFrequency). PTS and STC
+// values are esp_timer microseconds scaled to this clock.
+#define UVC_CLOCK_FREQUENCY_HZ 48000000
+
+// Payload header with the presentation time and the source clock (UVC 1.5
+// Table 2-5): bHeaderLength, bmHeaderInfo, dwPTS, then the SCR's STC and SOF
+// count
+#define FRAME_TIMING_HEADER_LEN 12
+
+  // esp_timer time of a frame at each pipeline stage, 0 if not reached yet
+  typedef struct
+  {
+    int64_t capture_us;  // Driver timestamp of the frame (start of readout)
+    int64_t handoff_us;  // camera_task queued the frame for USB
+    int64_t submit_us;   // Frame handed to tud_video_n_frame_xfer
+    int64_t complete_us; // Last payload left the endpoint
+  } frame_timestamps_t;
+
+  typedef enum
+  {
+    FRAME_TIMING_CAPTURE_TO_HANDOFF = 0, // Driver + validation/repacking in camera_task
+    FRAME_TIMING_HANDOFF_TO_SUBMIT,      // Waiting in the frame ring for the endpoint
+    FRAME_TIMING_SUBMIT_TO_COMPLETE,     // USB transfer time
+    FRAME_TIMING_CAPTURE_TO_COMPLETE,    // Sensor to host, end to end
+    FRAME_TIMING_FRAME_INTERVAL,         // Capture-to-capture spacing of delivered frames
+    FRAME_TIMING_STAGE_COUNT,
+  } frame_timing_stage_t;
+
+  typedef struct
+  {
+    uint32_t count; // Samples in the window
+    uint32_t min_us;
+    uint32_t avg_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+  } frame_timing_summary_t;
+
+  // Drop all samples, e.g. when a new stream starts
+  void frame_timing_reset(void);
+
+  // Record a delivered frame; safe to call from any task
+  void frame_timing_record(const frame_timestamps_t *ts);
+
+  // Summarize one stage over the current window. Uses a shared scratch
+  // buffer, so only call it from one task (the status reporter).
+  void frame_timing_get(frame_timing_stage_t stage, frame_timing_summary_t *summary);
+
+  const char *frame_timing_stage_name(frame_timing_stage_t stage);
+
+  // esp_timer microseconds -> 32-bit UVC device clock (PTS / SCR STC)
+  static inline uint32_t frame_timing_to_uvc_clock(int64_t us)
+  {
+    return (uint32_t)(us * (UVC_CLOCK_FREQUENCY_HZ / 1000000));
+  }
+
+  // Fill the PTS and SCR of a FRAME_TIMING_HEADER_LEN payload header and set
+  // their bits in bmHeaderInfo. The source clock is sampled now, so call it
+  // as the payload goes to the endpoint.
+  void frame_timing_put_clock(uint8_t *header, uint32_t pts);
+
+#ifdef __cplusplus
+}
+#endif
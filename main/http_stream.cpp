@@ -0,0 +1,417 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+}
+#include "change_gate.h"
+#include "frame_ring.h"
+#include "http_stream.h"
+
+static const char *TAG = "HTTP_STREAM";
+
+#define HTTP_STREAM_BOUNDARY "frame"
+
+// A client without new frames checks this often whether its peer has gone
+#define HTTP_STREAM_IDLE_MS 1000
+
+#define HTTP_REQUEST_MAX 512
+
+// Below the capture and USB tasks: the network only ever gets what is left
+#define HTTP_STREAM_TASK_PRIORITY 3
+
+// Data a client may have queued in the TCP stack. Less than a frame, so a
+// reader that cannot keep up blocks the send and skips frames, instead of the
+// stack piling up stale ones. lwIP has no SO_SNDBUF and bounds this with
+// TCP_SND_BUF (CONFIG_LWIP_TCP_SND_BUF_DEFAULT) instead; stacks that do,
+// like the host simulation's, would otherwise buffer megabytes.
+#define HTTP_STREAM_SNDBUF 16384
+
+typedef struct
+{
+    TaskHandle_t task;
+    int fd;         // Connection handed over by the server task, -1 = slot free
+    bool streaming; // Past the HTTP response header, wants frames
+} http_client_t;
+
+typedef enum
+{
+    HTTP_SEND_OK = 0,
+    HTTP_SEND_TIMEOUT,
+    HTTP_SEND_CLOSED,
+} http_send_result_t;
+
+static http_client_t clients[HTTP_STREAM_MAX_CLIENTS];
+static int listen_fd = -1;
+static uint32_t send_timeout_ms;
+static TaskHandle_t wake_on_connect;
+static http_stream_stats_t stats;
+static portMUX_TYPE http_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char http_stream_response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=" HTTP_STREAM_BOUNDARY "\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+static const char http_not_found_response[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_busy_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+// Blocking sends are bounded by SO_SNDTIMEO each; deadline bounds the whole
+// buffer, so a reader trickling data cannot hold a frame indefinitely
+static http_send_result_t send_all(int fd, const void *data, size_t len, int64_t deadline_us)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (len > 0)
+    {
+        ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            p += sent;
+            len -= sent;
+        }
+        else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            return HTTP_SEND_CLOSED;
+        }
+        if (len > 0 && esp_timer_get_time() >= deadline_us)
+        {
+            return HTTP_SEND_TIMEOUT;
+        }
+    }
+    return HTTP_SEND_OK;
+}
+
+static bool peer_closed(int fd)
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_DONTWAIT);
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+// Reads the request head; only a GET of / or /stream is served
+static bool read_request(int fd)
+{
+    char request[HTTP_REQUEST_MAX];
+    size_t len = 0;
+    while (len < sizeof(request) - 1)
+    {
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL)
+        {
+            break;
+        }
+    }
+    return strncmp(request, "GET /stream ", 12) == 0 || strncmp(request, "GET /stream?", 12) == 0 ||
+           strncmp(request, "GET / ", 6) == 0;
+}
+
+// One multipart part: boundary and headers, the JPEG from the camera buffer
+// itself, and the line break that ends it
+static http_send_result_t send_frame(int fd, const frame_slot_t *slot, int64_t deadline_us)
+{
+    char header[128];
+    int header_len = snprintf(header, sizeof(header),
+                              "--" HTTP_STREAM_BOUNDARY "\r\n"
+                              "Content-Type: image/jpeg\r\n"
+                              "Content-Length: %u\r\n"
+                              "X-Timestamp: %lld.%06ld\r\n"
+                              "\r\n",
+                              (unsigned)slot->len, (long long)(slot->ts.capture_us / 1000000),
+                              (long)(slot->ts.capture_us % 1000000));
+
+    http_send_result_t result = send_all(fd, header, header_len, deadline_us);
+    if (result == HTTP_SEND_OK)
+    {
+        result = send_all(fd, slot->fb->buf, slot->len, deadline_us);
+    }
+    if (result == HTTP_SEND_OK)
+    {
+        result = send_all(fd, "\r\n", 2, deadline_us);
+    }
+    return result;
+}
+
+// Streams until the client goes away or stalls on a frame
+static void stream_frames(http_client_t *client, int index)
+{
+    int fd = client->fd;
+    http_stream_client_stats_t *cs = &stats.clients[index];
+    uint32_t last_seq = 0;
+#if CONFIG_UVC_CHANGE_GATE
+    // Last frame this client got; a new connection starts with a frame
+    change_gate_state_t gate = {};
+#endif
+
+    portENTER_CRITICAL(&http_lock);
+    memset(cs, 0, sizeof(*cs));
+    cs->connected = true;
+    cs->connected_us = esp_timer_get_time();
+    stats.accepted++;
+    portEXIT_CRITICAL(&http_lock);
+    __atomic_store_n(&client->streaming, true, __ATOMIC_RELEASE);
+    if (wake_on_connect)
+    {
+        xTaskNotifyGive(wake_on_connect);
+    }
+
+    while (1)
+    {
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HTTP_STREAM_IDLE_MS)) == 0)
+        {
+            if (peer_closed(fd))
+            {
+                break;
+            }
+            continue;
+        }
+
+        // Only ever the newest frame: whatever was captured while the last
+        // one was being sent is skipped for this client alone
+        const frame_slot_t *slot = frame_ring_share(last_seq);
+        if (slot == NULL)
+        {
+            continue;
+        }
+        if (slot->fb->format != PIXFORMAT_JPEG)
+        {
+            last_seq = slot->seq;
+            frame_ring_unshare(slot);
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+#if CONFIG_UVC_CHANGE_GATE
+        if (!change_gate_pass(CHANGE_GATE_HTTP, &gate, &slot->sig, start))
+        {
+            last_seq = slot->seq;
+            frame_ring_unshare(slot);
+            continue;
+        }
+#endif
+        http_send_result_t result = send_frame(fd, slot, start + send_timeout_ms * 1000LL);
+        int64_t now = esp_timer_get_time();
+        uint32_t skipped = last_seq ? slot->seq - last_seq - 1 : 0;
+        size_t len = slot->len;
+        last_seq = slot->seq;
+        frame_ring_unshare(slot);
+
+        portENTER_CRITICAL(&http_lock);
+        if (result == HTTP_SEND_OK)
+        {
+            cs->frames++;
+            cs->skipped += skipped;
+            cs->bytes += len;
+            cs->send_last_us = (uint32_t)(now - start);
+            if (cs->send_last_us > cs->send_max_us)
+            {
+                cs->send_max_us = cs->send_last_us;
+            }
+            cs->last_frame_us = now;
+        }
+        else if (result == HTTP_SEND_TIMEOUT)
+        {
+            stats.timeouts++;
+        }
+        portEXIT_CRITICAL(&http_lock);
+
+        if (result == HTTP_SEND_TIMEOUT)
+        {
+            ESP_LOGW(TAG, "Client %d stalled for %lu ms on a %zu byte frame, dropping it", index,
+                     (unsigned long)send_timeout_ms, len);
+            return;
+        }
+        if (result == HTTP_SEND_CLOSED)
+        {
+            break;
+        }
+    }
+
+    portENTER_CRITICAL(&http_lock);
+    stats.closed++;
+    portEXIT_CRITICAL(&http_lock);
+}
+
+static void http_client_task(void *pvParameters)
+{
+    http_client_t *client = (http_client_t *)pvParameters;
+    int index = client - clients;
+
+    while (1)
+    {
+        portENTER_CRITICAL(&http_lock);
+        int fd = client->fd;
+        portEXIT_CRITICAL(&http_lock);
+        if (fd < 0)
+        {
+            // Also woken by frames published after the last client left
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (read_request(fd) &&
+            send_all(fd, http_stream_response, sizeof(http_stream_response) - 1,
+                     esp_timer_get_time() + send_timeout_ms * 1000LL) == HTTP_SEND_OK)
+        {
+            ESP_LOGI(TAG, "Client %d streaming", index);
+            stream_frames(client, index);
+            ESP_LOGI(TAG, "Client %d disconnected", index);
+        }
+        else
+        {
+            send_all(fd, http_not_found_response, sizeof(http_not_found_response) - 1,
+                     esp_timer_get_time() + send_timeout_ms * 1000LL);
+            portENTER_CRITICAL(&http_lock);
+            stats.rejected++;
+            portEXIT_CRITICAL(&http_lock);
+        }
+        __atomic_store_n(&client->streaming, false, __ATOMIC_RELEASE);
+        close(fd);
+
+        portENTER_CRITICAL(&http_lock);
+        client->fd = -1;
+        stats.clients[index].connected = false;
+        portEXIT_CRITICAL(&http_lock);
+    }
+}
+
+static void http_server_task(void *pvParameters)
+{
+    while (1)
+    {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept(listen_fd, (struct sockaddr *)&peer, &peer_len);
+        if (fd < 0)
+        {
+            ESP_LOGW(TAG, "accept failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        struct timeval timeout = {
+            .tv_sec = (time_t)(send_timeout_ms / 1000),
+            .tv_usec = (suseconds_t)(send_timeout_ms % 1000) * 1000,
+        };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int sndbuf = HTTP_STREAM_SNDBUF;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+        http_client_t *client = NULL;
+        portENTER_CRITICAL(&http_lock);
+        for (int i = 0; i < HTTP_STREAM_MAX_CLIENTS; i++)
+        {
+            if (clients[i].fd < 0)
+            {
+                client = &clients[i];
+                client->fd = fd;
+                break;
+            }
+        }
+        if (client == NULL)
+        {
+            stats.rejected++;
+        }
+        portEXIT_CRITICAL(&http_lock);
+
+        if (client != NULL)
+        {
+            xTaskNotifyGive(client->task);
+        }
+        else
+        {
+            send_all(fd, http_busy_response, sizeof(http_busy_response) - 1,
+                     esp_timer_get_time() + send_timeout_ms * 1000LL);
+            close(fd);
+        }
+    }
+}
+
+esp_err_t http_stream_start(uint16_t port, uint32_t timeout_ms, TaskHandle_t capture_task)
+{
+    listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_fd < 0)
+    {
+        ESP_LOGE(TAG, "socket failed: errno %d", errno);
+        return ESP_FAIL;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, HTTP_STREAM_MAX_CLIENTS) != 0)
+    {
+        ESP_LOGE(TAG, "Cannot listen on port %u: errno %d", port, errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return ESP_FAIL;
+    }
+
+    send_timeout_ms = timeout_ms;
+    wake_on_connect = capture_task;
+    for (int i = 0; i < HTTP_STREAM_MAX_CLIENTS; i++)
+    {
+        clients[i].fd = -1;
+        xTaskCreatePinnedToCore(http_client_task, "http_client", 4096, &clients[i], HTTP_STREAM_TASK_PRIORITY,
+                                &clients[i].task, tskNO_AFFINITY);
+    }
+    xTaskCreatePinnedToCore(http_server_task, "http_server", 3072, NULL, HTTP_STREAM_TASK_PRIORITY, NULL,
+                            tskNO_AFFINITY);
+
+    ESP_LOGI(TAG, "Serving MJPEG at :%u/stream to up to %d clients", port, HTTP_STREAM_MAX_CLIENTS);
+    return ESP_OK;
+}
+
+void http_stream_publish(void)
+{
+    for (int i = 0; i < HTTP_STREAM_MAX_CLIENTS; i++)
+    {
+        if (__atomic_load_n(&clients[i].streaming, __ATOMIC_ACQUIRE))
+        {
+            xTaskNotifyGive(clients[i].task);
+        }
+    }
+}
+
+int http_stream_clients(void)
+{
+    int count = 0;
+    for (int i = 0; i < HTTP_STREAM_MAX_CLIENTS; i++)
+    {
+        count += __atomic_load_n(&clients[i].streaming, __ATOMIC_ACQUIRE) ? 1 : 0;
+    }
+    return count;
+}
+
+void http_stream_get_stats(http_stream_stats_t *out)
+{
+    portENTER_CRITICAL(&http_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&http_lock);
+}
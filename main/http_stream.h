@@ -0,0 +1,69 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if CONFIG_UVC_HTTP_STREAM
+#define HTTP_STREAM_MAX_CLIENTS CONFIG_UVC_HTTP_MAX_CLIENTS
+#else
+#define HTTP_STREAM_MAX_CLIENTS 1
+#endif
+
+  typedef struct
+  {
+    bool connected;         // Streaming to a client right now
+    uint32_t frames;        // Frames sent in full on this connection
+    uint32_t skipped;       // Frames captured while the client was busy, never sent to it
+    uint64_t bytes;         // JPEG bytes sent, without multipart headers
+    uint32_t send_last_us;  // Time to hand the last frame to the TCP stack
+    uint32_t send_max_us;
+    int64_t connected_us;   // esp_timer time of the accept
+    int64_t last_frame_us;  // Last frame sent
+  } http_stream_client_stats_t;
+
+  typedef struct
+  {
+    uint32_t accepted;      // Connections that started streaming
+    uint32_t rejected;      // Turned away: every client slot busy, or not a GET of the stream
+    uint32_t timeouts;      // Dropped for taking longer than the send timeout over one frame
+    uint32_t closed;        // Closed by the client
+    http_stream_client_stats_t clients[HTTP_STREAM_MAX_CLIENTS];
+  } http_stream_stats_t;
+
+  // Listen on port and serve multipart/x-mixed-replace MJPEG at /stream to up
+  // to HTTP_STREAM_MAX_CLIENTS clients, each with its own task. Frames are
+  // sent straight from the camera buffers through frame_ring_share; a client
+  // busy with one frame skips the ones captured meanwhile, so a slow reader
+  // only lowers its own frame rate. A client that needs longer than
+  // timeout_ms for one frame is disconnected, which bounds how long it can
+  // keep a buffer from the driver. capture_task is notified whenever a client
+  // connects, so capture can start without a USB stream.
+  esp_err_t http_stream_start(uint16_t port, uint32_t timeout_ms, TaskHandle_t capture_task);
+
+  // Capture side: a new frame is in the ring, wake the clients
+  void http_stream_publish(void);
+
+  // Number of clients streaming
+  int http_stream_clients(void);
+
+  void http_stream_get_stats(http_stream_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,445 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+#include "jpeg_scan.h"
+
+// Non-zero if any byte of w is 0xFF (classic "has zero byte" test on ~w)
+#define WORD_HAS_FF(w) ((~(w) - 0x01010101u) & (w) & 0x80808080u)
+
+// Marker check for a candidate 0xFF at p; EOI ends right after the D9
+static inline bool is_eoi_at(const uint8_t *buf, size_t len, size_t p)
+{
+    return buf[p] == 0xFF && p + 1 < len && buf[p + 1] == 0xD9;
+}
+
+size_t jpeg_scan_end(const uint8_t *buf, size_t len)
+{
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8)
+    {
+        return 0;
+    }
+
+    // Candidate positions of the EOI's 0xFF byte, highest first; never
+    // below 2 so the SOI itself cannot match. `end` is one past the next
+    // candidate to examine.
+    size_t end = len;
+
+    // Byte steps until buf + end is word aligned
+    while (end > 2 && ((uintptr_t)(buf + end) & 3))
+    {
+        end--;
+        if (is_eoi_at(buf, len, end))
+        {
+            return end + 2;
+        }
+    }
+
+    // Whole words: padding (usually zeros) contains no 0xFF and is skipped
+    // four bytes per load. A word holding 0xFF is checked byte by byte; its
+    // D9 partner may sit in the word examined just before.
+    while (end >= 2 + 4)
+    {
+        uint32_t w;
+        memcpy(&w, buf + end - 4, 4);
+        if (WORD_HAS_FF(w))
+        {
+            for (size_t p = end - 1; p >= end - 4; p--)
+            {
+                if (is_eoi_at(buf, len, p))
+                {
+                    return p + 2;
+                }
+            }
+        }
+        end -= 4;
+    }
+
+    while (end > 2)
+    {
+        end--;
+        if (is_eoi_at(buf, len, end))
+        {
+            return end + 2;
+        }
+    }
+    return 0;
+}
+
+size_t jpeg_scan_data_start(const uint8_t *buf, size_t len)
+{
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8)
+    {
+        return 0;
+    }
+
+    // Every header marker carries a 2-byte big-endian length that counts
+    // itself, SOS included
+    size_t p = 2;
+    while (p + 4 <= len && buf[p] == 0xFF)
+    {
+        uint8_t marker = buf[p + 1];
+        size_t seg = ((size_t)buf[p + 2] << 8) | buf[p + 3];
+        if (marker == 0xD9 || seg < 2)
+        {
+            return 0;
+        }
+        p += 2 + seg;
+        if (marker == 0xDA)
+        {
+            return p <= len ? p : 0;
+        }
+    }
+    return 0;
+}
+
+size_t jpeg_scan_eoi(const uint8_t *buf, size_t from, size_t to)
+{
+    size_t p = from ? from - 1 : 0;
+    while (p + 1 < to)
+    {
+        // Entropy-coded data has few FF bytes: each one is stuffed with 00
+        const uint8_t *ff = (const uint8_t *)memchr(buf + p, 0xFF, to - 1 - p);
+        if (ff == NULL)
+        {
+            return 0;
+        }
+        p = (size_t)(ff - buf);
+        if (buf[p + 1] == 0xD9)
+        {
+            return p + 2;
+        }
+        p++;
+    }
+    return 0;
+}
+
+// Entropy-coded data read a bit at a time, most significant first. A
+// stuffed FF 00 is a data byte FF; any other marker ends the data.
+typedef struct
+{
+    const uint8_t *buf;
+    size_t pos;
+    size_t len;
+    uint8_t byte;
+    uint8_t left;  // Bits of byte not read yet
+} jpeg_bits_t;
+
+static int get_bit(jpeg_bits_t *b)
+{
+    if (b->left == 0)
+    {
+        if (b->pos >= b->len)
+        {
+            return -1;
+        }
+        uint8_t v = b->buf[b->pos];
+        if (v == 0xFF)
+        {
+            if (b->pos + 1 >= b->len || b->buf[b->pos + 1] != 0x00)
+            {
+                return -1;
+            }
+            b->pos++;
+        }
+        b->pos++;
+        b->byte = v;
+        b->left = 8;
+    }
+    b->left--;
+    return (b->byte >> b->left) & 1;
+}
+
+static int get_bits(jpeg_bits_t *b, int n)
+{
+    int v = 0;
+    while (n-- > 0)
+    {
+        int bit = get_bit(b);
+        if (bit < 0)
+        {
+            return -1;
+        }
+        v = (v << 1) | bit;
+    }
+    return v;
+}
+
+// One symbol of the canonical Huffman code given by counts (codes of each
+// length 1-16) and symbols, straight from the DHT segment: a code of a
+// length is below first + count, so no lookup tables are built
+static int get_symbol(jpeg_bits_t *b, const uint8_t *counts, const uint8_t *symbols)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int n = 0; n < 16; n++)
+    {
+        int bit = get_bit(b);
+        if (bit < 0)
+        {
+            return -1;
+        }
+        code |= bit;
+        int count = counts[n];
+        if (code - first < count)
+        {
+            return symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// Coefficient difference of s bits, in the JPEG's one's complement style
+static int extend(int v, int s)
+{
+    return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+}
+
+#define JPEG_SCAN_MAX_COMPONENTS 4
+
+size_t jpeg_scan_dc_luma(const uint8_t *buf, size_t len, uint8_t *luma, size_t cells, uint8_t *step)
+{
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8)
+    {
+        return 0;
+    }
+
+    uint16_t quant_dc[4] = {0};
+    const uint8_t *dc_counts[4] = {NULL};
+    const uint8_t *dc_symbols[4] = {NULL};
+    const uint8_t *ac_counts[4] = {NULL};
+    const uint8_t *ac_symbols[4] = {NULL};
+    uint8_t frame_id[JPEG_SCAN_MAX_COMPONENTS];
+    uint8_t frame_hv[JPEG_SCAN_MAX_COMPONENTS];
+    uint8_t frame_tq[JPEG_SCAN_MAX_COMPONENTS];
+    uint8_t frame_n = 0;
+    size_t width = 0;
+    size_t height = 0;
+    size_t restart = 0;
+
+    // Header: the same walk as jpeg_scan_data_start, keeping the tables
+    size_t p = 2;
+    size_t data = 0;
+    const uint8_t *sos = NULL;
+    while (data == 0)
+    {
+        if (p + 4 > len || buf[p] != 0xFF)
+        {
+            return 0;
+        }
+        uint8_t marker = buf[p + 1];
+        size_t seg = ((size_t)buf[p + 2] << 8) | buf[p + 3];
+        if (marker == 0xD9 || seg < 2 || p + 2 + seg > len)
+        {
+            return 0;
+        }
+        const uint8_t *s = buf + p + 4;
+        const uint8_t *end = buf + p + 2 + seg;
+        switch (marker)
+        {
+        case 0xDB:  // DQT: only the DC step of each table is needed
+            while (s < end)
+            {
+                bool wide = *s >> 4;
+                uint8_t t = *s & 3;
+                if (s + 1 + (wide ? 128 : 64) > end)
+                {
+                    return 0;
+                }
+                quant_dc[t] = wide ? (uint16_t)((s[1] << 8) | s[2]) : s[1];
+                s += 1 + (wide ? 128 : 64);
+            }
+            break;
+        case 0xC4:  // DHT
+            while (s < end)
+            {
+                if (s + 17 > end)
+                {
+                    return 0;
+                }
+                size_t total = 0;
+                for (int i = 1; i <= 16; i++)
+                {
+                    total += s[i];
+                }
+                if (s + 17 + total > end)
+                {
+                    return 0;
+                }
+                uint8_t t = *s & 3;
+                if (*s >> 4)
+                {
+                    ac_counts[t] = s + 1;
+                    ac_symbols[t] = s + 17;
+                }
+                else
+                {
+                    dc_counts[t] = s + 1;
+                    dc_symbols[t] = s + 17;
+                }
+                s += 17 + total;
+            }
+            break;
+        case 0xC0:  // SOF0 and SOF1: Huffman-coded sequential DCT
+        case 0xC1:
+            frame_n = seg >= 8 ? s[5] : 0;
+            if (frame_n == 0 || frame_n > JPEG_SCAN_MAX_COMPONENTS || seg < 8 + 3 * (size_t)frame_n)
+            {
+                return 0;
+            }
+            height = ((size_t)s[1] << 8) | s[2];
+            width = ((size_t)s[3] << 8) | s[4];
+            for (uint8_t i = 0; i < frame_n; i++)
+            {
+                frame_id[i] = s[6 + 3 * i];
+                frame_hv[i] = s[7 + 3 * i];
+                frame_tq[i] = s[8 + 3 * i] & 3;
+            }
+            break;
+        case 0xDD:  // DRI
+            if (seg < 4)
+            {
+                return 0;
+            }
+            restart = ((size_t)s[0] << 8) | s[1];
+            break;
+        case 0xDA:  // SOS
+            sos = s;
+            data = p + 2 + seg;
+            break;
+        default:
+            // Progressive, lossless and arithmetic-coded frames are not read
+            if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+            {
+                return 0;
+            }
+            break;
+        }
+        p += 2 + seg;
+    }
+
+    // The scan's components, in the order their blocks come in an MCU
+    uint8_t scan_n = sos[0];
+    if (frame_n == 0 || scan_n == 0 || scan_n > frame_n || sos + 1 + 2 * scan_n + 3 > buf + data)
+    {
+        return 0;
+    }
+    uint8_t h_max = 1;
+    uint8_t v_max = 1;
+    for (uint8_t c = 0; c < frame_n; c++)
+    {
+        h_max = (frame_hv[c] >> 4) > h_max ? frame_hv[c] >> 4 : h_max;
+        v_max = (frame_hv[c] & 15) > v_max ? frame_hv[c] & 15 : v_max;
+    }
+    // MCUs in the frame: blocks of the largest sampling, or of the one
+    // component of a single-component scan
+    size_t mcu_w = 8 * h_max;
+    size_t mcu_h = 8 * v_max;
+    uint8_t blocks[JPEG_SCAN_MAX_COMPONENTS];
+    uint8_t dc_table[JPEG_SCAN_MAX_COMPONENTS];
+    uint8_t ac_table[JPEG_SCAN_MAX_COMPONENTS];
+    int luma_index = -1;
+    for (uint8_t i = 0; i < scan_n; i++)
+    {
+        uint8_t c = 0;
+        while (c < frame_n && frame_id[c] != sos[1 + 2 * i])
+        {
+            c++;
+        }
+        if (c == frame_n)
+        {
+            return 0;
+        }
+        // A scan of one component has one block per MCU whatever its sampling
+        blocks[i] = scan_n == 1 ? 1 : (uint8_t)((frame_hv[c] >> 4) * (frame_hv[c] & 15));
+        dc_table[i] = (sos[2 + 2 * i] >> 4) & 3;
+        ac_table[i] = sos[2 + 2 * i] & 3;
+        if (blocks[i] == 0 || !dc_counts[dc_table[i]] || !ac_counts[ac_table[i]])
+        {
+            return 0;
+        }
+        if (c == 0)
+        {
+            luma_index = i;
+        }
+        if (scan_n == 1)
+        {
+            mcu_w = 8 * h_max / (frame_hv[c] >> 4 ? frame_hv[c] >> 4 : 1);
+            mcu_h = 8 * v_max / (frame_hv[c] & 15 ? frame_hv[c] & 15 : 1);
+        }
+    }
+    size_t mcus = ((width + mcu_w - 1) / mcu_w) * ((height + mcu_h - 1) / mcu_h);
+    cells = cells < mcus ? cells : mcus;
+    // The first frame component is the luma one
+    if (luma_index < 0 || quant_dc[frame_tq[0]] == 0)
+    {
+        return 0;
+    }
+    uint32_t q = quant_dc[frame_tq[0]];
+    *step = (uint8_t)((q + 7) / 8 < 255 ? (q + 7) / 8 : 255);
+
+    // The DC coefficient of a block is 8 times its mean sample, less 128.
+    // AC coefficients are decoded only to find the next block.
+    jpeg_bits_t b = {buf, data, len, 0, 0};
+    int pred[JPEG_SCAN_MAX_COMPONENTS] = {0};
+    size_t done = 0;
+    for (size_t mcu = 0; done < cells; mcu++)
+    {
+        if (restart && mcu && mcu % restart == 0)
+        {
+            // RSTn on a byte boundary, and the predictions start over
+            b.left = 0;
+            if (b.pos + 2 > len || buf[b.pos] != 0xFF || (buf[b.pos + 1] & 0xF8) != 0xD0)
+            {
+                return done;
+            }
+            b.pos += 2;
+            memset(pred, 0, sizeof(pred));
+        }
+        int32_t luma_sum = 0;
+        for (uint8_t i = 0; i < scan_n; i++)
+        {
+            for (uint8_t k = 0; k < blocks[i]; k++)
+            {
+                int s = get_symbol(&b, dc_counts[dc_table[i]], dc_symbols[dc_table[i]]);
+                if (s < 0 && i == 0 && k == 0)
+                {
+                    return done;  // End of the scan data, padding bits aside
+                }
+                int v = s >= 0 && s <= 11 ? get_bits(&b, s) : -1;
+                if (v < 0)
+                {
+                    return 0;
+                }
+                pred[i] += s ? extend(v, s) : 0;
+                for (int z = 1; z < 64; z++)
+                {
+                    int rs = get_symbol(&b, ac_counts[ac_table[i]], ac_symbols[ac_table[i]]);
+                    if (rs < 0 || get_bits(&b, rs & 15) < 0)
+                    {
+                        return 0;
+                    }
+                    if ((rs & 15) == 0 && rs != 0xF0)
+                    {
+                        break;  // End of block
+                    }
+                    z += rs >> 4;
+                }
+                if (i == luma_index)
+                {
+                    luma_sum += pred[i];
+                }
+            }
+        }
+        int32_t mean = 128 + luma_sum * (int32_t)q / (8 * blocks[luma_index]);
+        luma[done++] = (uint8_t)(mean < 0 ? 0 : mean > 255 ? 255 : mean);
+    }
+    return done;
+}
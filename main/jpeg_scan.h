@@ -0,0 +1,45 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Validate a JPEG frame from the sensor and find where it really ends.
+  // Returns the length up to and including the last EOI (FF D9) marker, so
+  // any padding the sensor/DMA appended is excluded, or 0 if the buffer does
+  // not start with SOI or contains no EOI. Scans backwards from len a word at
+  // a time, so the cost is proportional to the padding, not the frame size.
+  size_t jpeg_scan_end(const uint8_t *buf, size_t len);
+
+  // Where the entropy-coded data of a JPEG starting with SOI begins: just
+  // past the SOS segment, found by walking the header's marker segments.
+  // Tables may hold FF D9 byte pairs, scan data cannot. Returns 0 if the
+  // header is malformed or does not end within len bytes.
+  size_t jpeg_scan_data_start(const uint8_t *buf, size_t len);
+
+  // Forward search for the first EOI in buf[from, to), including one whose
+  // FF is the byte before from, for data that arrives in pieces. Returns
+  // the length up to and including it, or 0.
+  size_t jpeg_scan_eoi(const uint8_t *buf, size_t from, size_t to);
+
+  // Mean luma of the first MCUs of a baseline JPEG, from the DC coefficients
+  // alone: decodes the Huffman data of up to cells MCUs (AC coefficients are
+  // only skipped) and writes one value per MCU, the mean of its luma blocks.
+  // step receives the luma of one DC quantization step, the resolution of
+  // the values. Returns the number of values written, fewer at the end of
+  // the scan, or 0 if the frame is not a baseline JPEG or is malformed.
+  size_t jpeg_scan_dc_luma(const uint8_t *buf, size_t len, uint8_t *luma, size_t cells, uint8_t *step);
+
+#ifdef __cplusplus
+}
+#endif
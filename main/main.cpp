@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -19,9 +20,41 @@ extern "C" {
 #include "esp_camera.h"
 #include "tusb.h"
 #include "class/video/video.h"
+#include "device/usbd_pvt.h"
 #include "esp_heap_caps.h"
+#include "nvs_flash.h"
+
+// esp32-camera capture start/stop from driver/private_include/cam_hal.h,
+// which the component does not export. Not a public API: these match the
+// version pinned in idf_component.yml, check them before moving the pin
+// (esp_camera_deinit/esp_camera_init would do the same, at the cost of a
+// sensor reprobe and a reallocation of the frame buffers)
+void cam_stop(void);
+void cam_start(void);
 }
 #include "usb_descriptors.h"
+#include "camera_recovery.h"
+#include "change_gate.h"
+#include "event_recorder.h"
+#include "frame_ring.h"
+#include "frame_pacer.h"
+#include "frame_timing.h"
+#include "http_stream.h"
+#include "jpeg_scan.h"
+#include "pipeline_stats.h"
+#include "pixel_pack.h"
+#include "power_idle.h"
+#include "rate_ctrl.h"
+#include "sensor_state.h"
+#include "sensor_window.h"
+#include "still_capture.h"
+#include "subframe_stream.h"
+#include "task_plan.h"
+#include "telemetry.h"
+#include "usb_bench.h"
+#include "usb_bounce.h"
+#include "uvc_controls.h"
+#include "wifi_sta.h"
 
 static const char *TAG = "USB_UVC_CAMERA";
 
@@ -48,6 +81,14 @@ static const char *TAG = "USB_UVC_CAMERA";
 #define HREF_GPIO_NUM 7
 #define PCLK_GPIO_NUM 13
 
+// At 16 MHz esp32-camera's ESP32-S3 port DMAs frames straight into PSRAM
+// (its psram_mode) and never calls ll_cam_memcpy, the hook sub-frame
+// streaming sees the frame land through
+#define CAMERA_XCLK_FREQ_HZ 20000000
+#if CONFIG_UVC_SUBFRAME_STREAM
+static_assert(CAMERA_XCLK_FREQ_HZ != 16000000, "sub-frame streaming needs the copying capture path, not 16 MHz XCLK");
+#endif
+
 // Camera configuration
 static camera_config_t camera_config = {
     .pin_pwdn = PWDN_GPIO_NUM,
@@ -68,406 +109,2143 @@ static camera_config_t camera_config = {
     .pin_href = HREF_GPIO_NUM,
     .pin_pclk = PCLK_GPIO_NUM,
 
-    .xclk_freq_hz = 20000000,
+    .xclk_freq_hz = CAMERA_XCLK_FREQ_HZ,
     .ledc_timer = LEDC_TIMER_0,
     .ledc_channel = LEDC_CHANNEL_0,
 
     .pixel_format = PIXFORMAT_JPEG,
-    .frame_size = FRAMESIZE_VGA,
+    .frame_size = FRAMESIZE_UXGA, // Sizes the JPEG buffers for the largest mode, see UVC_MJPEG_FRAME_LIST
     .jpeg_quality = 10, // Better quality to ensure proper JPEG headers
-    .fb_count = 1,      // Reduce to single buffer
+    .fb_count = FRAME_RING_BUFFERS, // Shared with the USB side and network clients through frame_ring
     .fb_location = CAMERA_FB_IN_PSRAM,
-    .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
+    .grab_mode = CAMERA_GRAB_LATEST,
     .sccb_i2c_port = 1, // Default I2C port
 };
 
 // UVC related variables
 static bool uvc_streaming = false;
-static camera_fb_t *current_fb = NULL;
-static SemaphoreHandle_t frame_ready_sem = NULL;
+static TaskHandle_t uvc_task_handle = NULL;
+static TaskHandle_t camera_task_handle = NULL;
+
+// Notification bits that wake uvc_task
+#define UVC_EVENT_FRAME_READY (1UL << 0) // camera_task queued a new frame
+#define UVC_EVENT_XFER_DONE   (1UL << 1) // previous frame left the endpoint
+#define UVC_EVENT_STREAM      (1UL << 2) // stream committed or device unmounted
+#define UVC_EVENT_DEADLINE    (1UL << 3) // frame_pacer deadline reached
+#define UVC_EVENT_STREAMED    (1UL << 4) // a frame started streaming during its readout
+
+// uvc_task only needs to wake without an event to notice a stopped stream
+#define UVC_HOUSEKEEPING_MS 100
 
-// JPEG validation function
-static bool is_valid_jpeg(const uint8_t *data, size_t len)
+// Streaming latency measurements, all in microseconds of esp_timer time
+typedef struct
 {
-    if (len < 4)
-        return false;
+    int64_t commit_us;              // Time of the last stream commit
+    int64_t last_complete_us;       // Time the last frame transfer completed
+    bool first_frame_pending;       // Commit seen, first frame not yet submitted
+    uint32_t commit_to_first_frame_us;
+    uint32_t gap_min_us;            // Transfer complete -> next frame submitted
+    uint32_t gap_max_us;
+    uint64_t gap_sum_us;
+    uint32_t gap_count;
+} uvc_latency_t;
 
-    // Check for JPEG SOI marker (0xFFD8)
-    if (data[0] != 0xFF || data[1] != 0xD8)
-    {
-        return false;
-    }
+static uvc_latency_t uvc_latency;
 
-    // Check for EOI marker (0xFFD9) at the end
-    if (data[len - 2] != 0xFF || data[len - 1] != 0xD9)
-    {
-        return false;
-    }
+#if CONFIG_UVC_CHANGE_GATE
+// Last frame the USB stream sent, for the change gate; uvc_task only
+static change_gate_state_t uvc_gate;
+#endif
 
-    return true;
+#if CONFIG_UVC_EVENT_RECORDER
+// During a "record dump thin" the stream keeps one frame per interval and
+// leaves the rest of the bus to the dump
+#define UVC_DUMP_FRAME_INTERVAL_US 1000000
+// Submit time of the last frame sent; uvc_task only
+static int64_t uvc_last_sent_us;
+#endif
+
+// Committed dwMaxPayloadTransferSize, and the CPU time the video driver
+// spends sending frames when the bounce stage does not (its payload copies
+// out of PSRAM included), for the status log
+static uint32_t uvc_payload_size;
+static uint32_t uvc_frames_delivered;
+
+// The video driver writes a 2-byte payload header at the start of its
+// endpoint buffer and takes the header length from its first byte for every
+// payload. Once seen, the buffer's header is widened between frames and each
+// payload gets the frame's PTS and the SCR on its way to the endpoint; the
+// driver puts the 2 bytes back when the interface is opened again, so the
+// first frame of a stream goes without them. Touched only by whoever has the
+// endpoint: uvc_task submitting a frame, the USB device task sending the rest.
+static uint8_t *uvc_driver_header;
+static uint32_t uvc_driver_pts;  // Of the frame the driver is sending
+static uint64_t uvc_direct_cpu_us;
+static portMUX_TYPE uvc_cpu_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void uvc_direct_cpu_add(int64_t start_us)
+{
+    int64_t elapsed = esp_timer_get_time() - start_us;
+    portENTER_CRITICAL(&uvc_cpu_lock);
+    uvc_direct_cpu_us += elapsed;
+    portEXIT_CRITICAL(&uvc_cpu_lock);
 }
 
-// UVC format descriptors
-static const uint8_t desc_uvc_format[] = {
-    // Format descriptor (MJPEG)
-    TUD_VIDEO_DESC_CS_VS_FMT_MJPEG(1, 1, 1, 1, 0, 0, 0, 0),
-    // Frame descriptor (VGA: 640x480)
-    TUD_VIDEO_DESC_CS_VS_FRM_MJPEG_CONT(1, 0, 640, 480, 640*480*16, 640*480*16*30, 640*480*2, 333333, 333333, 1000000, 333333),
-};
+// Boot milestones in esp_timer time (since startup), 0 until reached
+typedef struct
+{
+    int64_t usb_started_us;     // tud_init returned, enumeration can begin
+    int64_t enumerated_us;      // First mount
+    int64_t camera_ready_us;    // Driver initialized, sensor configured
+    int64_t sensor_settled_us;  // AEC/AGC steady, frames usable
+    int64_t first_frame_us;     // First frame submitted to the host
+    uint32_t settle_frames;     // Frames discarded while settling
+    bool settle_timed_out;
+    bool state_restored;        // AEC/AGC seeded from the previous boot
+} boot_metrics_t;
 
-// Initialize camera
-static esp_err_t init_camera(void)
+static boot_metrics_t boot_metrics;
+
+static void uvc_notify(uint32_t events)
 {
-    ESP_LOGI(TAG, "Initializing camera...");
-    
-    esp_err_t err = esp_camera_init(&camera_config);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
-        return err;
+    if (uvc_task_handle)
+    {
+        xTaskNotify(uvc_task_handle, events, eSetBits);
     }
+}
 
-    // Let camera settle
-    vTaskDelay(pdMS_TO_TICKS(1000));
+static void uvc_pacer_deadline(void)
+{
+    uvc_notify(UVC_EVENT_DEADLINE);
+}
 
-    sensor_t *s = esp_camera_sensor_get();
-    if (s != NULL) {
-        // Set initial settings for better JPEG output
-        s->set_brightness(s, 0);     // -2 to 2
-        s->set_contrast(s, 0);       // -2 to 2
-        s->set_saturation(s, 0);     // -2 to 2
-        s->set_special_effect(s, 0); // 0 to 6 (0 - No Effect, 1 - Negative, 2 - Grayscale, 3 - Red Tint, 4 - Green Tint, 5 - Blue Tint, 6 - Sepia)
-        s->set_whitebal(s, 1);       // 0 = disable , 1 = enable
-        s->set_awb_gain(s, 1);       // 0 = disable , 1 = enable
-        s->set_wb_mode(s, 0);        // 0 to 4 - if awb_gain enabled (0 - Auto, 1 - Sunny, 2 - Cloudy, 3 - Office, 4 - Home)
-        s->set_exposure_ctrl(s, 1);  // 0 = disable , 1 = enable
-        s->set_aec2(s, 0);           // 0 = disable , 1 = enable
-        s->set_ae_level(s, 0);       // -2 to 2
-        s->set_aec_value(s, 300);    // 0 to 1200
-        s->set_gain_ctrl(s, 1);      // 0 = disable , 1 = enable
-        s->set_agc_gain(s, 0);       // 0 to 30
-        s->set_gainceiling(s, (gainceiling_t)0);  // 0 to 6
-        s->set_bpc(s, 0);            // 0 = disable , 1 = enable
-        s->set_wpc(s, 1);            // 0 = disable , 1 = enable
-        s->set_raw_gma(s, 1);        // 0 = disable , 1 = enable
-        s->set_lenc(s, 1);           // 0 = disable , 1 = enable
-        s->set_hmirror(s, 0);        // 0 = disable , 1 = enable
-        s->set_vflip(s, 0);          // 0 = disable , 1 = enable
-        s->set_dcw(s, 1);            // 0 = disable , 1 = enable
-        s->set_colorbar(s, 0);       // 0 = disable , 1 = enable
-
-        // Try a few test captures to warm up the sensor
-        for (int i = 0; i < 3; i++)
-        {
-            camera_fb_t *fb = esp_camera_fb_get();
-            if (fb)
-            {
-                ESP_LOGI(TAG, "Warmup capture %d: len=%zu, format=%d", i + 1, fb->len, fb->format);
-                esp_camera_fb_return(fb);
-            }
-            vTaskDelay(pdMS_TO_TICKS(500));
-        }
-    }
-    
-    ESP_LOGI(TAG, "Camera initialized successfully");
-    return ESP_OK;
+// Start of the last frame that went to USB during its readout, for uvc_task
+static int64_t uvc_streamed_start_us;
+
+#if CONFIG_UVC_SUBFRAME_STREAM
+// Runs in the camera driver's task: the frame went out at the sensor's pace,
+// the pacer counts it as this period's frame
+static void uvc_subframe_started(void)
+{
+    int64_t now = esp_timer_get_time();
+    frame_pacer_streamed(now);
+    __atomic_store_n(&uvc_streamed_start_us, now, __ATOMIC_RELAXED);
+    uvc_notify(UVC_EVENT_STREAMED);
 }
+#endif
 
-// Camera capture task
-static void camera_task(void *pvParameters)
+// Sensor modes selectable by the host, indexed by bFrameIndex - 1 per format
+typedef struct
 {
-    ESP_LOGI(TAG, "Camera task started");
+    pixformat_t pixel_format;
+    framesize_t frame_size;
+    uint16_t width;
+    uint16_t height;
+} uvc_frame_mode_t;
 
-    int consecutive_errors = 0;
-    const int MAX_CONSECUTIVE_ERRORS = 10;
-    int frame_count = 0;
+#define UVC_MJPEG_MODE_ENTRY(_idx, _fs, _w, _h, _fps0, _fps1, _fps2) {PIXFORMAT_JPEG, FRAMESIZE_##_fs, _w, _h},
+static const uvc_frame_mode_t uvc_mjpeg_modes[] = {
+    UVC_MJPEG_FRAME_LIST(UVC_MJPEG_MODE_ENTRY)
+};
 
-    while (1) {
-        if (uvc_streaming) {
-            ESP_LOGI(TAG, "Attempting to capture frame %d", frame_count++);
-            camera_fb_t *fb = esp_camera_fb_get();
-            if (fb) {
-                consecutive_errors = 0; // Reset error counter on success
-                ESP_LOGI(TAG, "Frame captured successfully: len=%zu, format=%d, width=%d, height=%d",
-                         fb->len, fb->format, fb->width, fb->height);
+#define UVC_YUY2_MODE_ENTRY(_idx, _fs, _w, _h, _fps0, _fps1, _fps2) {PIXFORMAT_YUV422, FRAMESIZE_##_fs, _w, _h},
+static const uvc_frame_mode_t uvc_yuy2_modes[] = {
+    UVC_YUY2_FRAME_LIST(UVC_YUY2_MODE_ENTRY)
+};
 
-                // Validate the frame
-                if (fb->len > 0 && fb->format == PIXFORMAT_JPEG)
-                {
-                    // Additional JPEG validation
-                    if (is_valid_jpeg(fb->buf, fb->len))
-                    {
-                        ESP_LOGI(TAG, "JPEG validation passed, setting current frame");
-                        if (current_fb)
-                        {
-                            esp_camera_fb_return(current_fb);
-                        }
-                        current_fb = fb;
-                        xSemaphoreGive(frame_ready_sem);
-                        ESP_LOGI(TAG, "Frame ready semaphore given");
-                    }
-                    else
-                    {
-                        ESP_LOGW(TAG, "Camera provided invalid JPEG data (len=%zu)", fb->len);
-                        if (fb->len >= 4)
-                        {
-                            ESP_LOGW(TAG, "Frame header: 0x%02X 0x%02X 0x%02X 0x%02X",
-                                     fb->buf[0], fb->buf[1], fb->buf[2], fb->buf[3]);
-                        }
-                        esp_camera_fb_return(fb);
-                    }
-                }
-                else
-                {
-                    ESP_LOGW(TAG, "Camera frame invalid: len=%zu, format=%d", fb->len, fb->format);
-                    esp_camera_fb_return(fb);
-                }
-            }
-            else
-            {
-                consecutive_errors++;
-                ESP_LOGW(TAG, "Failed to capture frame (error %d/%d)", consecutive_errors, MAX_CONSECUTIVE_ERRORS);
+#define UVC_STILL_MODE_ENTRY(_idx, _fs, _w, _h) {PIXFORMAT_JPEG, FRAMESIZE_##_fs, _w, _h},
+static const uvc_frame_mode_t uvc_still_modes[] = {
+    UVC_STILL_FRAME_LIST(UVC_STILL_MODE_ENTRY)
+};
 
-                if (consecutive_errors >= MAX_CONSECUTIVE_ERRORS)
-                {
-                    ESP_LOGE(TAG, "Too many consecutive camera errors, restarting camera");
-                    esp_camera_deinit();
-                    vTaskDelay(pdMS_TO_TICKS(1000));
+static const uvc_frame_mode_t *find_frame_mode(uint8_t format_index, uint8_t frame_index)
+{
+    const uvc_frame_mode_t *modes;
+    size_t count;
 
-                    if (esp_camera_init(&camera_config) != ESP_OK)
-                    {
-                        ESP_LOGE(TAG, "Camera restart failed!");
-                        vTaskDelay(pdMS_TO_TICKS(5000));
-                    }
-                    else
-                    {
-                        ESP_LOGI(TAG, "Camera restarted successfully");
-                        consecutive_errors = 0;
-                    }
-                }
-                vTaskDelay(pdMS_TO_TICKS(100));
-            }
-        }
-        else
-        {
-            ESP_LOGD(TAG, "UVC not streaming, camera task waiting...");
-            vTaskDelay(pdMS_TO_TICKS(1000)); // Longer delay when not streaming
-        }
+    switch (format_index)
+    {
+    case UVC_FORMAT_INDEX_MJPEG:
+        modes = uvc_mjpeg_modes;
+        count = sizeof(uvc_mjpeg_modes) / sizeof(uvc_mjpeg_modes[0]);
+        break;
+    case UVC_FORMAT_INDEX_YUY2:
+        modes = uvc_yuy2_modes;
+        count = sizeof(uvc_yuy2_modes) / sizeof(uvc_yuy2_modes[0]);
+        break;
+    default:
+        return NULL;
+    }
+
+    if (frame_index < 1 || frame_index > count)
+    {
+        return NULL;
     }
+    return &modes[frame_index - 1];
 }
 
-// TinyUSB Video Class callbacks
-extern "C" void tud_video_frame_xfer_complete_cb(uint_fast8_t ctl_idx, uint_fast8_t stm_idx)
+// Frame rate of the OV2640 readout mode (CIF, SVGA or UXGA) that serves a
+// given output size at the current zoom, with the default clock divider
+static uint32_t sensor_native_fps(const uvc_frame_mode_t *mode)
 {
-    (void)ctl_idx;
-    (void)stm_idx;
-    ESP_LOGD(TAG, "Video frame transfer complete");
+    sensor_window_t win;
+    sensor_window_get(mode->width, mode->height, &win);
+    return win.fps;
 }
 
-extern "C" int tud_video_commit_cb(uint_fast8_t ctl_idx, uint_fast8_t stm_idx, video_probe_and_commit_control_t const *parameters)
+// Frame period of the stream for a committed interval (100 ns units, 0 = native rate)
+static uint32_t frame_period_us(const uvc_frame_mode_t *mode, uint32_t interval)
 {
-    (void)ctl_idx;
-    (void)stm_idx;
-    (void)parameters;
-
-    ESP_LOGI(TAG, "UVC stream commit - Host requesting video stream start");
-    uvc_streaming = true;
-    return VIDEO_ERROR_NONE;
+    return interval ? interval / 10 : 1000000 / sensor_native_fps(mode);
 }
 
-// Note: TinyUSB UVC does not provide a specific "uncommit" callback.
-// Use tud_video_n_streaming() in the task loop and USB mount/unmount events.
+// OV2640 CLKRC register in the sensor bank (bit 8 selects BANK_SENSOR for set_reg)
+#define OV2640_REG_CLKRC 0x111
+#define OV2640_CLKRC_DIV_MASK 0x3F
 
-extern "C" void tud_mount_cb(void)
-{
-    ESP_LOGI(TAG, "USB Device mounted and connected!");
-}
+// Mode committed by the host, applied by camera_task between frames so the
+// SCCB writes never run in the USB device task
+static portMUX_TYPE mode_lock = portMUX_INITIALIZER_UNLOCKED;
+static const uvc_frame_mode_t *requested_mode = NULL;
+static uint32_t requested_interval = 0; // 100 ns units
+static const uvc_frame_mode_t *active_mode = &uvc_mjpeg_modes[UVC_MJPEG_DEFAULT_FRAME_INDEX - 1];
+static uint32_t active_interval = 0;      // 100 ns units, 0 = native rate
+static int64_t mode_switch_start_us = 0;  // Non-zero until the first frame in the new mode
+static uint32_t last_mode_switch_us = 0;
 
-extern "C" void tud_umount_cb(void)
+// Sensor window of the mode's output size at the current zoom, pan and tilt,
+// then the clock divider for the frame rate. With full_field set,
+// set_framesize() has just programmed the default window, which needs no
+// further writes.
+static esp_err_t apply_sensor_window(sensor_t *s, const uvc_frame_mode_t *mode, uint32_t interval, bool full_field)
 {
-    ESP_LOGI(TAG, "USB Device unmounted");
-    uvc_streaming = false;
+    // Any change pending so far is applied here
+    sensor_window_changed();
+    sensor_window_t win;
+    sensor_window_get(mode->width, mode->height, &win);
+    if ((!full_field || win.cropped) && sensor_window_program(s, &win) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set sensor window for %ux%u", mode->width, mode->height);
+        return ESP_FAIL;
+    }
+
+    // set_framesize() and set_res_raw() reload CLKRC for the readout mode;
+    // divide the sensor clock further when the host asked for fewer frames
+    // than the mode delivers
+    uint32_t native_fps = win.fps;
+    uint32_t fps = interval ? 10000000 / interval : native_fps;
+    if (fps > native_fps)
+    {
+        ESP_LOGW(TAG, "Zoom %u.%02ux needs the %s readout, %lu fps instead of %lu", win.zoom / 100, win.zoom % 100,
+                 sensor_window_readout_name(win.readout), (unsigned long)native_fps, (unsigned long)fps);
+        fps = native_fps;
+    }
+    uint32_t div = fps ? native_fps / fps : 1;
+    if (div < 1)
+    {
+        div = 1;
+    }
+    if (div > OV2640_CLKRC_DIV_MASK + 1)
+    {
+        div = OV2640_CLKRC_DIV_MASK + 1;
+    }
+    if (div > 1 && s->set_reg(s, OV2640_REG_CLKRC, OV2640_CLKRC_DIV_MASK, div - 1) != 0)
+    {
+        ESP_LOGW(TAG, "Failed to set sensor clock divider %lu", (unsigned long)div);
+    }
+
+    ESP_LOGI(TAG, "Sensor mode %ux%u @ %lu fps (clock divider %lu, zoom %u.%02ux)",
+             mode->width, mode->height, (unsigned long)fps, (unsigned long)div, win.zoom / 100, win.zoom % 100);
+    return ESP_OK;
 }
 
-// TinyUSB descriptor callbacks
-extern "C" uint8_t const* tud_descriptor_device_cb(void)
+// Reprogram output size and frame rate without reinitializing the driver
+static esp_err_t apply_sensor_mode(const uvc_frame_mode_t *mode, uint32_t interval)
 {
-    return (uint8_t const*)&desc_device;
+    sensor_t *s = esp_camera_sensor_get();
+    if (s == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    if (s->set_framesize(s, mode->frame_size) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to set frame size %ux%u", mode->width, mode->height);
+        return ESP_FAIL;
+    }
+    return apply_sensor_window(s, mode, interval, true);
 }
 
-extern "C" uint8_t const* tud_descriptor_configuration_cb(uint8_t index)
+// Zoom, pan or tilt changed: only the window moves, the stream keeps its
+// format and size. Frames whose readout began before the new window was
+// written are torn and dropped; the switch time runs to the first good one.
+static int64_t window_switch_start_us = 0; // Non-zero until the first frame with the new window
+static int64_t window_switch_done_us = 0;  // Sensor writes finished
+static uint32_t window_switch_sccb_us = 0;
+
+static void apply_window_change(void)
 {
-    (void)index;
-    return desc_configuration;
+    sensor_t *s = esp_camera_sensor_get();
+    int64_t start = esp_timer_get_time();
+    if (s == NULL || apply_sensor_window(s, active_mode, active_interval, false) != ESP_OK)
+    {
+        return;
+    }
+    window_switch_done_us = esp_timer_get_time();
+    window_switch_sccb_us = (uint32_t)(window_switch_done_us - start);
+    window_switch_start_us = start;
 }
 
-extern "C" uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
+// Image tuning applied after every driver (re)initialization. Returns true if
+// the exposure loops started from a saved state.
+static bool apply_sensor_settings(sensor_t *s)
 {
-    (void)langid;
+    if (s == NULL)
+    {
+        return false;
+    }
 
-    static uint16_t desc_str[32 + 1]; // Static buffer for string descriptor
-    uint8_t chr_count;
-    
-    if (index == 0) {
-        // Language ID descriptor
-        desc_str[0] = (TUSB_DESC_STRING << 8) | (2 + 2);
-        desc_str[1] = 0x0409; // English (United States)
-        return desc_str;
-    } else {
-        if (!(index < sizeof(string_desc_arr)/sizeof(string_desc_arr[0]))) return NULL;
-        
-        const char* str = string_desc_arr[index];
-        chr_count = strlen(str);
-        if (chr_count > 31) chr_count = 31;
+    // Brightness, exposure, white balance, ... as last set by the host
+    uvc_controls_apply_all(s);
 
-        // First byte is length (in bytes) and type
-        desc_str[0] = (TUSB_DESC_STRING << 8) | (2 * chr_count + 2);
+    // Restore the rate controller's quality after a (re)init
+    s->set_quality(s, rate_ctrl_quality());
 
-        // Convert ASCII to UTF-16
-        for (uint8_t i = 0; i < chr_count; i++) {
-            desc_str[1 + i] = str[i];
-        }
+    // Start the exposure loops from the last converged state
+    return sensor_state_restore(s);
+}
 
-        return desc_str;
-    }
+// esp_camera_init on the plan's camera core, where its VSYNC and DMA
+// interrupts are then serviced
+static esp_err_t camera_init_here(void *arg)
+{
+    return esp_camera_init((const camera_config_t *)arg);
 }
 
-// UVC streaming task
-static void uvc_task(void *pvParameters)
+// The driver sizes its DMA descriptors and buffers for the pixel format and,
+// for raw formats, the exact frame size at init time, so changing those needs
+// a full restart. JPEG buffers are always sized for the largest frame.
+// ESP_ERR_TIMEOUT: a network client still holds a frame, nothing changed.
+static esp_err_t reinit_camera_for_mode(const uvc_frame_mode_t *mode)
 {
-    ESP_LOGI(TAG, "UVC task started");
-    
-    while (1) {
-        ESP_LOGD(TAG, "UVC task loop: streaming=%d, tud_video_n_streaming=%d",
-                 uvc_streaming, tud_video_n_streaming(0, 0));
+    // Buffers are freed by deinit, wait for USB to finish reading one
+    subframe_stream_cancel();
+    for (int i = 0; i < 100 && (frame_ring_in_flight() || subframe_stream_busy()); i++)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+#if CONFIG_UVC_HTTP_STREAM
+    // ... and for network clients, which finish a frame or are dropped
+    // within their send timeout, plus one SO_SNDTIMEO for the send blocked
+    // when the frame deadline passed
+    frame_ring_set_sharing(false);
+    int64_t deadline_us = esp_timer_get_time() + 2 * CONFIG_UVC_HTTP_SEND_TIMEOUT_MS * 1000LL;
+    while (frame_ring_shared() && esp_timer_get_time() < deadline_us)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    if (frame_ring_shared())
+    {
+        // A client still reads a driver buffer that deinit would free: keep
+        // the current mode, the caller tries again
+        ESP_LOGW(TAG, "Camera reinit deferred, %d frames still held by network clients", frame_ring_shared());
+        frame_ring_set_sharing(true);
+        return ESP_ERR_TIMEOUT;
+    }
+#endif
+    subframe_stream_reset();
+    frame_ring_reset();
+    esp_camera_deinit();
 
-        if (uvc_streaming && tud_video_n_streaming(0, 0)) {
-            ESP_LOGI(TAG, "UVC streaming active, waiting for frame...");
-            if (xSemaphoreTake(frame_ready_sem, pdMS_TO_TICKS(100)) == pdTRUE) {
-                if (current_fb && current_fb->len > 0) {
-                    static unsigned frame_num = 0;
+    camera_config.pixel_format = mode->pixel_format;
+    camera_config.frame_size = mode->pixel_format == PIXFORMAT_JPEG ? FRAMESIZE_UXGA : mode->frame_size;
+    esp_err_t err = task_plan_isr_call(TASK_PLAN_ISR_CAMERA, camera_init_here, &camera_config);
+    frame_ring_set_sharing(true);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Camera reinit for new format failed with error 0x%x", err);
+        return err;
+    }
+    apply_sensor_settings(esp_camera_sensor_get());
+    return ESP_OK;
+}
 
-                    ESP_LOGI(TAG, "Frame received for streaming: len=%zu", current_fb->len);
+// Called from camera_task: switch to a newly committed mode, if any
+static void apply_pending_mode(void)
+{
+    portENTER_CRITICAL(&mode_lock);
+    const uvc_frame_mode_t *mode = requested_mode;
+    uint32_t interval = requested_interval;
+    requested_mode = NULL;
+    portEXIT_CRITICAL(&mode_lock);
 
-                    // Validate JPEG data before sending
-                    if (is_valid_jpeg(current_fb->buf, current_fb->len))
-                    {
-                        ESP_LOGI(TAG, "Sending frame %u to USB (len=%zu)", frame_num, current_fb->len);
-                        tud_video_n_frame_xfer(0, 0, (void *)(uintptr_t)current_fb->buf, current_fb->len);
-                        frame_num++;
+    if (mode == NULL)
+    {
+        return;
+    }
 
-                        if (frame_num % 10 == 0)
-                        {
-                            ESP_LOGI(TAG, "Streamed %u frames successfully", frame_num);
-                        }
-                    }
-                    else
-                    {
-                        ESP_LOGW(TAG, "Invalid JPEG frame detected, skipping (len=%zu)", current_fb->len);
-                        if (current_fb->len >= 4)
-                        {
-                            ESP_LOGW(TAG, "Frame header: 0x%02X 0x%02X 0x%02X 0x%02X",
-                                     current_fb->buf[0], current_fb->buf[1],
-                                     current_fb->buf[2], current_fb->buf[3]);
-                        }
-                    }
-                }
-                else
-                {
-                    ESP_LOGW(TAG, "Frame ready but current_fb is null or empty");
-                }
-            }
-            else
-            {
-                ESP_LOGD(TAG, "No frame available, timeout waiting for semaphore");
-            }
-        }
-        else
+    mode_switch_start_us = esp_timer_get_time();
+    bool needs_reinit = mode->pixel_format != active_mode->pixel_format ||
+                        (mode->pixel_format != PIXFORMAT_JPEG && mode != active_mode);
+    esp_err_t err = needs_reinit ? reinit_camera_for_mode(mode) : ESP_OK;
+    if (err == ESP_ERR_TIMEOUT)
+    {
+        // Deferred: the request stands unless the host made a newer one
+        portENTER_CRITICAL(&mode_lock);
+        if (requested_mode == NULL)
         {
-            if (!uvc_streaming)
-            {
-                ESP_LOGD(TAG, "UVC streaming not active");
-            }
-            if (!tud_video_n_streaming(0, 0))
-            {
-                ESP_LOGD(TAG, "TinyUSB video not streaming");
-            }
-            vTaskDelay(pdMS_TO_TICKS(100));
+            requested_mode = mode;
+            requested_interval = interval;
         }
-
-        tud_task();
+        portEXIT_CRITICAL(&mode_lock);
+        return;
+    }
+    if (err != ESP_OK)
+    {
+        return;
+    }
+    if (apply_sensor_mode(mode, interval) == ESP_OK)
+    {
+        active_mode = mode;
+        active_interval = interval;
     }
+
+    // Frame sizes change with the mode, and so does the per-frame budget
+    rate_ctrl_set_frame_interval(interval / 10);
+    rate_ctrl_reset_stats();
 }
 
-extern "C" void app_main(void)
+// Initialize camera; runs in camera_task while USB enumerates
+static esp_err_t init_camera(void)
 {
-    ESP_LOGI(TAG, "USB UVC Camera starting...");
-    
-    // Create semaphore for frame synchronization
-    frame_ready_sem = xSemaphoreCreateBinary();
-    if (!frame_ready_sem) {
-        ESP_LOGE(TAG, "Failed to create semaphore");
-        return;
-    }
+    ESP_LOGI(TAG, "Initializing camera...");
     
-    // Initialize camera
-    esp_err_t ret = init_camera();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize camera");
-        return;
+    esp_err_t err = task_plan_isr_call(TASK_PLAN_ISR_CAMERA, camera_init_here, &camera_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
+        return err;
     }
-    
-    // Initialize TinyUSB directly
-    ESP_LOGI(TAG, "Initializing USB (TinyUSB)...");
-    if (!tud_init(BOARD_TUD_RHPORT)) {
-        ESP_LOGE(TAG, "Failed to initialize TinyUSB device");
-        return;
+
+    sensor_t *s = esp_camera_sensor_get();
+    if (s != NULL) {
+        boot_metrics.state_restored = apply_sensor_settings(s);
+
+        // Buffers are sized for UXGA, start streaming in the default descriptor mode
+        apply_sensor_mode(active_mode, 0);
     }
+    boot_metrics.camera_ready_us = esp_timer_get_time();
     
-    // Create camera capture task
-    xTaskCreatePinnedToCore(
-        camera_task,
-        "camera_task",
-        4096,
-        NULL,
-        5,
-        NULL,
-        1
-    );
-    
-    // Create UVC streaming task
-    xTaskCreatePinnedToCore(
-        uvc_task,
-        "uvc_task",
-        4096,
-        NULL,
-        5,
-        NULL,
-        0
-    );
-    
-    ESP_LOGI(TAG, "USB UVC Camera initialized successfully");
+    ESP_LOGI(TAG, "Camera initialized successfully");
+    return ESP_OK;
+}
 
-    int status_counter = 0;
-    while (1) {
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        status_counter++;
+// Instead of a fixed warm-up, discard frames until the AEC/AGC registers stop
+// moving (AWB converges alongside), then remember where they ended up
+static void wait_sensor_ready(void)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    sensor_state_t state;
+    bool settled = false;
+    int64_t start = esp_timer_get_time();
 
-        if (status_counter % 5 == 0)
+    sensor_state_settle_start();
+    while (!settled && esp_timer_get_time() - start < CONFIG_UVC_SENSOR_SETTLE_TIMEOUT_MS * 1000LL)
+    {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (fb == NULL)
         {
-            ESP_LOGI(TAG, "=== System Status ===");
-            ESP_LOGI(TAG, "Free heap: %lu bytes", esp_get_free_heap_size());
-            ESP_LOGI(TAG, "USB mounted: %s", tud_mounted() ? "YES" : "NO");
-            ESP_LOGI(TAG, "USB ready: %s", tud_ready() ? "YES" : "NO");
-            ESP_LOGI(TAG, "UVC streaming: %s", uvc_streaming ? "YES" : "NO");
-            ESP_LOGI(TAG, "TinyUSB video streaming: %s", tud_video_n_streaming(0, 0) ? "YES" : "NO");
-            ESP_LOGI(TAG, "Current frame buffer: %s", current_fb ? "Available" : "NULL");
-            ESP_LOGI(TAG, "==================");
+            continue;
         }
-        else
-        {
-            ESP_LOGD(TAG, "System running... USB: %s, UVC: %s",
-                     tud_mounted() ? "Connected" : "Disconnected",
-                     uvc_streaming ? "Streaming" : "Idle");
+        esp_camera_fb_return(fb);
+        boot_metrics.settle_frames++;
+        settled = sensor_state_read(s, &state) && sensor_state_settle_update(&state);
+    }
+
+    boot_metrics.sensor_settled_us = esp_timer_get_time();
+    boot_metrics.settle_timed_out = !settled;
+    if (settled)
+    {
+        sensor_state_save(&state);
+        ESP_LOGI(TAG, "Sensor settled after %lu frames in %lu ms (exposure %u, gain %u, %s)",
+                 (unsigned long)boot_metrics.settle_frames,
+                 (unsigned long)((boot_metrics.sensor_settled_us - start) / 1000), state.aec, state.agc,
+                 boot_metrics.state_restored ? "restored" : "cold");
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Sensor did not settle within %d ms, streaming anyway", CONFIG_UVC_SENSOR_SETTLE_TIMEOUT_MS);
+    }
+}
+
+// Consecutive frames that failed validation
+static int camera_bad_frames = 0;
+
+// Last stream frame handed over, and the one before a still image switched
+// the sensor away (0 = no still gap open)
+static int64_t last_queued_us = 0;
+static int64_t still_gap_start_us = 0;
+
+static void uvc_streamed_done(subframe_xfer_t result, int64_t now);
+
+// Give a frame camera_task will not use back to the driver; a streamed one
+// ends with the error bit and goes back once off the bus
+static void reject_frame(camera_fb_t *fb)
+{
+    if (!subframe_stream_reject(fb))
+    {
+        esp_camera_fb_return(fb);
+    }
+}
+
+// Frames may go to USB while they are read out only if nothing can reject
+// them once their EOI landed. The gate decides on whole frames.
+static bool subframe_wanted(void)
+{
+    if (!uvc_streaming || !usb_bounce_enabled() || active_mode->pixel_format != PIXFORMAT_JPEG ||
+        mode_switch_start_us || window_switch_start_us || camera_bad_frames || still_capture_pending())
+    {
+        return false;
+    }
+#if CONFIG_UVC_EVENT_RECORDER
+    // Frames are thinned in uvc_task during a thinning dump
+    if (event_recorder_thinning())
+    {
+        return false;
+    }
+#endif
+#if CONFIG_UVC_CHANGE_GATE
+    change_gate_config_t gate;
+    change_gate_get_config(CHANGE_GATE_USB, &gate);
+    if (gate.enabled)
+    {
+        return false;
+    }
+#endif
+    portENTER_CRITICAL(&mode_lock);
+    bool switching = requested_mode != NULL;
+    portEXIT_CRITICAL(&mode_lock);
+    return !switching;
+}
+
+// The ring took a stream frame
+static void frame_queued(void)
+{
+    last_queued_us = esp_timer_get_time();
+    if (still_gap_start_us)
+    {
+        uint32_t gap = (uint32_t)(last_queued_us - still_gap_start_us);
+        still_gap_start_us = 0;
+        still_capture_record_gap(gap, frame_period_us(active_mode, active_interval));
+        ESP_LOGI(TAG, "Stream resumed %lu us after the last frame before the still", (unsigned long)gap);
+    }
+    pipeline_count(PIPELINE_VALIDATED);
+#if CONFIG_UVC_HTTP_STREAM
+    http_stream_publish();
+#endif
+}
+
+// Hand a validated frame over to the USB side, len bytes of it are sent
+static void queue_frame(camera_fb_t *fb, size_t len)
+{
+    // Already on the bus: the host gets what the EOI search found
+    int64_t streamed_us = 0;
+    bool streamed = subframe_stream_accept(fb, &len, &streamed_us);
+
+    const change_sig_t *sig = NULL;
+#if CONFIG_UVC_CHANGE_GATE
+    // Once per frame for every stream; a few dozen PSRAM reads
+    change_sig_t frame_sig;
+    change_gate_sign(fb->buf, len, fb->format == PIXFORMAT_JPEG, fb->width, fb->height, &frame_sig);
+    sig = &frame_sig;
+#endif
+    if (streamed)
+    {
+        // Network clients take it from the ring like any other frame
+        bool pushed = frame_ring_push_sent(fb, len, sig, streamed_us);
+        if (pushed)
+        {
+            frame_queued();
+        }
+        else
+        {
+            pipeline_count(PIPELINE_DROPPED);
+        }
+        int64_t done_us = 0;
+        subframe_xfer_t result = subframe_stream_handoff(pushed, &done_us);
+        if (result != SUBFRAME_XFER_PENDING)
+        {
+            // The transfer ended before camera_task had the frame
+            uvc_streamed_done(result, done_us);
+        }
+        return;
+    }
+    if (frame_ring_push(fb, len, sig))
+    {
+        frame_queued();
+        uvc_notify(UVC_EVENT_FRAME_READY);
+        PIPELINE_TRACE(TAG, "Frame ready notification sent");
+    }
+    else
+    {
+        pipeline_count(PIPELINE_DROPPED);
+        PIPELINE_TRACE(TAG, "No free frame slot, dropping frame");
+        esp_camera_fb_return(fb);
+    }
+}
+
+
+// A frame passed validation: ends a recovery and releases the held frame
+static void camera_frame_ok(void)
+{
+    camera_bad_frames = 0;
+#if CONFIG_UVC_IDLE_POWER_SAVE
+    power_idle_frame_ok();
+#endif
+    if (camera_recovery_frame_ok())
+    {
+        frame_ring_hold(false);
+    }
+}
+
+// Soft reset loads the sensor's default register tables; put back the
+// format, mode and every cached setting on top of them
+static esp_err_t reset_sensor(void)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    if (s == NULL || s->reset(s) != 0)
+    {
+        return ESP_FAIL;
+    }
+    s->set_pixformat(s, active_mode->pixel_format);
+    apply_sensor_settings(s);
+    return apply_sensor_mode(active_mode, active_interval);
+}
+
+// Called for a capture timeout or a run of corrupt frames, and again for as
+// long as the fault lasts: each call takes the next, more expensive action
+// after a growing backoff. The USB side repeats the last good frame meanwhile.
+static void recover_camera(void)
+{
+    uint32_t backoff_ms;
+    camera_recovery_tier_t tier = camera_recovery_next(&backoff_ms);
+    frame_ring_hold(true);
+    // A frame streaming from a stalled capture would keep the repeats off the bus
+    subframe_stream_cancel();
+    camera_bad_frames = 0;
+
+    ESP_LOGW(TAG, "Camera fault, %s in %lu ms", camera_recovery_tier_name(tier), (unsigned long)backoff_ms);
+    if (backoff_ms)
+    {
+        vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+    }
+
+    esp_err_t err = ESP_OK;
+    switch (tier)
+    {
+    case CAMERA_RECOVERY_DMA_RESTART:
+        // Drops the frame the DMA was part-way through, capture resumes at
+        // the next VSYNC
+        cam_stop();
+        cam_start();
+        break;
+    case CAMERA_RECOVERY_SENSOR_RESET:
+        cam_stop();
+        err = reset_sensor();
+        cam_start();
+        break;
+    default:
+        err = reinit_camera_for_mode(active_mode);
+        if (err == ESP_OK)
+        {
+            err = apply_sensor_mode(active_mode, active_interval);
+        }
+        break;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Camera %s failed: %s", camera_recovery_tier_name(tier), esp_err_to_name(err));
+    }
+}
+
+// Still image method 2: one frame at the still size, copied into the still
+// buffer, then straight back to the stream's mode. The stream loses the frame
+// in progress at the switch and the still frame time; the gap is measured up
+// to the next stream frame handed over.
+static void capture_still(void)
+{
+    const uvc_frame_mode_t *mode = NULL;
+    uint8_t frame_index = still_capture_begin();
+    if (frame_index >= 1 && frame_index <= sizeof(uvc_still_modes) / sizeof(uvc_still_modes[0]))
+    {
+        mode = &uvc_still_modes[frame_index - 1];
+    }
+    sensor_t *s = esp_camera_sensor_get();
+    if (mode == NULL || s == NULL || active_mode->pixel_format != PIXFORMAT_JPEG)
+    {
+        still_capture_finish(NULL, 0, 0);
+        return;
+    }
+
+    // The still's frames must not go out as stream frames
+    subframe_stream_cancel();
+    int64_t start = esp_timer_get_time();
+    still_gap_start_us = last_queued_us ? last_queued_us : start;
+#if CONFIG_UVC_STILL_CAPTURE
+    s->set_quality(s, CONFIG_UVC_STILL_JPEG_QUALITY);
+#endif
+    apply_sensor_mode(mode, 0);
+
+    // Frames still in the DMA from before the switch, or torn by it, are skipped
+    camera_fb_t *fb = NULL;
+    size_t len = 0;
+    for (int i = 0; i < CONFIG_UVC_STILL_MAX_FRAMES; i++)
+    {
+        fb = esp_camera_fb_get();
+        if (fb == NULL)
+        {
+            break;
+        }
+        if (fb->width == mode->width && fb->height == mode->height && fb->format == PIXFORMAT_JPEG)
+        {
+            len = jpeg_scan_end(fb->buf, fb->len);
+            if (len)
+            {
+                break;
+            }
+        }
+        reject_frame(fb);
+        fb = NULL;
+    }
+
+    // Back to the stream before the copy, the sensor switches meanwhile
+    apply_sensor_mode(active_mode, active_interval);
+    s->set_quality(s, rate_ctrl_quality());
+
+    int64_t capture_us = fb ? (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec : 0;
+    bool ok = still_capture_finish(fb ? fb->buf : NULL, len, capture_us);
+    if (fb)
+    {
+        esp_camera_fb_return(fb);
+    }
+    if (ok)
+    {
+        uvc_notify(UVC_EVENT_FRAME_READY);
+    }
+    ESP_LOGI(TAG, "Still %ux%u %s: %zu bytes in %lu us", mode->width, mode->height, ok ? "captured" : "failed",
+             len, (unsigned long)(esp_timer_get_time() - start));
+}
+
+#if CONFIG_UVC_IDLE_POWER_SAVE
+// Nothing wanted frames for the idle delay: stop the DMA before the sensor
+// stops driving PCLK, then power everything down
+static void enter_idle(void)
+{
+    cam_stop();
+    power_idle_enter(esp_camera_sensor_get());
+    ESP_LOGI(TAG, "Camera idle, waiting for a stream or client");
+}
+
+// Clock and sensor first, the DMA starts at the next VSYNC; the first valid
+// frame completes the resume, see camera_frame_ok
+static void leave_idle(void)
+{
+    power_idle_exit(esp_camera_sensor_get());
+    cam_start();
+}
+#endif
+
+// Frames go to a USB stream or a network client
+static bool stream_wanted(void)
+{
+#if CONFIG_UVC_HTTP_STREAM
+    return uvc_streaming || http_stream_clients() > 0;
+#else
+    return uvc_streaming;
+#endif
+}
+
+// Capture runs for a stream, or for the pre-event recorder until it freezes
+static bool capture_wanted(void)
+{
+#if CONFIG_UVC_EVENT_RECORDER
+    return stream_wanted() || event_recorder_capturing();
+#else
+    return stream_wanted();
+#endif
+}
+
+// Camera capture task
+static void camera_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Camera task started");
+
+    while (init_camera() != ESP_OK)
+    {
+        vTaskDelay(pdMS_TO_TICKS(5000));
+    }
+    wait_sensor_ready();
+
+    while (1) {
+        if (capture_wanted()) {
+#if CONFIG_UVC_IDLE_POWER_SAVE
+            if (power_idle_active())
+            {
+                leave_idle();
+            }
+#endif
+            apply_pending_mode();
+            // Host control changes land between frames, batched
+            uvc_controls_apply_pending(esp_camera_sensor_get());
+            if (sensor_window_changed())
+            {
+                apply_window_change();
+            }
+            if (still_capture_pending())
+            {
+                capture_still();
+                continue;
+            }
+
+            subframe_stream_arm(subframe_wanted());
+
+            camera_fb_t *fb = esp_camera_fb_get();
+            if (fb) {
+                pipeline_count(PIPELINE_CAPTURED);
+                PIPELINE_TRACE(TAG, "Frame captured: len=%zu, format=%d, width=%zu, height=%zu",
+                               fb->len, fb->format, fb->width, fb->height);
+                // The stream stopped while this frame was read out; queued, it
+                // would be the first frame of the next one
+                if (!capture_wanted())
+                {
+                    pipeline_count(PIPELINE_DROPPED);
+                    reject_frame(fb);
+                    continue;
+                }
+#if CONFIG_UVC_IDLE_POWER_SAVE
+                // Left in the driver's queue when capture stopped for idle
+                if (power_idle_stale((int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec))
+                {
+                    pipeline_count(PIPELINE_DROPPED);
+                    PIPELINE_TRACE(TAG, "Dropping frame captured before the camera went idle");
+                    reject_frame(fb);
+                    continue;
+                }
+#endif
+
+                // Frames still in flight in the DMA when the mode changed keep
+                // the old size, the host must only see the committed one
+                if (fb->width != active_mode->width || fb->height != active_mode->height)
+                {
+                    pipeline_count(PIPELINE_DROPPED);
+                    PIPELINE_TRACE(TAG, "Dropping %zux%zu frame captured before mode switch", fb->width, fb->height);
+                    reject_frame(fb);
+                    continue;
+                }
+                if (mode_switch_start_us)
+                {
+                    last_mode_switch_us = (uint32_t)(esp_timer_get_time() - mode_switch_start_us);
+                    mode_switch_start_us = 0;
+                    ESP_LOGI(TAG, "Mode switch to %ux%u took %lu us",
+                             active_mode->width, active_mode->height, (unsigned long)last_mode_switch_us);
+                }
+                if (window_switch_start_us)
+                {
+                    int64_t capture_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+                    if (capture_us < window_switch_done_us)
+                    {
+                        sensor_window_count_torn();
+                        pipeline_count(PIPELINE_DROPPED);
+                        PIPELINE_TRACE(TAG, "Dropping frame read out across a window switch");
+                        reject_frame(fb);
+                        continue;
+                    }
+                    uint32_t switch_us = (uint32_t)(esp_timer_get_time() - window_switch_start_us);
+                    window_switch_start_us = 0;
+                    sensor_window_record_switch(switch_us, window_switch_sccb_us);
+                    ESP_LOGI(TAG, "Window switch took %lu us (%lu us of sensor writes)", (unsigned long)switch_us,
+                             (unsigned long)window_switch_sccb_us);
+                }
+
+                // Validate the frame
+                if (fb->len > 0 && fb->format == PIXFORMAT_JPEG)
+                {
+                    // The only JPEG check in the pipeline: finds the real EOI
+                    // so padding the sensor appended never goes over USB
+                    size_t jpeg_len = jpeg_scan_end(fb->buf, fb->len);
+                    if (jpeg_len)
+                    {
+                        PIPELINE_TRACE(TAG, "JPEG valid, %zu of %zu bytes, queueing frame", jpeg_len, fb->len);
+                        pipeline_count_n(PIPELINE_TRIMMED_BYTES, fb->len - jpeg_len);
+                        camera_frame_ok();
+#if CONFIG_UVC_EVENT_RECORDER
+                        // Straight from the driver's buffer, before any
+                        // stream takes the frame
+                        event_recorder_add(fb->buf, jpeg_len,
+                                           (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec,
+                                           (uint16_t)fb->width, (uint16_t)fb->height);
+#endif
+                        if (!stream_wanted())
+                        {
+                            // Captured for the recorder only
+                            reject_frame(fb);
+                            continue;
+                        }
+                        int quality = rate_ctrl_on_frame(jpeg_len);
+                        queue_frame(fb, jpeg_len);
+
+                        // Between frames, after the handoff, so the SCCB write
+                        // does not delay this one
+                        sensor_t *s = quality >= 0 ? esp_camera_sensor_get() : NULL;
+                        if (s)
+                        {
+                            s->set_quality(s, quality);
+                        }
+                    }
+                    else
+                    {
+                        pipeline_count(PIPELINE_ERRORED);
+                        PIPELINE_TRACE(TAG, "Camera provided invalid JPEG data (len=%zu, header %02X %02X)",
+                                       fb->len, fb->len >= 2 ? fb->buf[0] : 0, fb->len >= 2 ? fb->buf[1] : 0);
+                        reject_frame(fb);
+                        camera_bad_frames++;
+                    }
+                }
+                else if (fb->format == PIXFORMAT_YUV422 && fb->len == fb->width * fb->height * 2)
+                {
+                    // The recorder keeps JPEG frames only
+                    if (!stream_wanted())
+                    {
+                        camera_frame_ok();
+                        reject_frame(fb);
+                        continue;
+                    }
+#if CONFIG_UVC_YUY2_SWAP_BYTES
+                    // DVP delivers UYVY, the host expects YUY2
+                    pixel_pack_swap16(fb->buf, fb->buf, fb->len);
+#endif
+                    camera_frame_ok();
+                    queue_frame(fb, fb->len);
+                }
+                else
+                {
+                    pipeline_count(PIPELINE_ERRORED);
+                    PIPELINE_TRACE(TAG, "Camera frame invalid: len=%zu, format=%d", fb->len, fb->format);
+                    reject_frame(fb);
+                    camera_bad_frames++;
+                }
+
+                if (camera_bad_frames >= CONFIG_UVC_CAMERA_FAULT_BAD_FRAMES)
+                {
+                    recover_camera();
+                }
+            }
+            else
+            {
+                // The driver already waited its full timeout for this frame
+                pipeline_count(PIPELINE_ERRORED);
+                ESP_LOGW(TAG, "Failed to capture frame");
+                recover_camera();
+            }
+        }
+        else
+        {
+#if CONFIG_UVC_IDLE_POWER_SAVE
+            if (power_idle_active())
+            {
+                // Parked until the commit or a network client wakes it.
+                // Control changes wait for the resume: without XCLK the
+                // sensor does not answer on SCCB.
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+#endif
+            ESP_LOGD(TAG, "UVC not streaming, camera task waiting...");
+            uvc_controls_apply_pending(esp_camera_sensor_get());
+            // Woken by the commit or a network client, so the first frame
+            // does not wait out the delay
+#if CONFIG_UVC_IDLE_POWER_SAVE
+            // Hosts stop and restart the stream around a format change, only
+            // a longer pause powers the camera down
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_UVC_IDLE_DELAY_MS)) == 0 && !capture_wanted())
+            {
+                enter_idle();
+            }
+#else
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+#endif
+        }
+    }
+}
+
+// USB benchmark source in place of camera_task (CONFIG_UVC_USB_BENCH_EMBEDDED):
+// the sensor stays off and a frame of the committed mode is queued whenever
+// the last one was taken, so only the USB side sets the pace
+static void bench_source_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Benchmark source task started");
+
+    while (1) {
+        if (!stream_wanted() || frame_ring_has_queued())
+        {
+            // Woken by the commit, and by uvc_task taking the queued frame
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        portENTER_CRITICAL(&mode_lock);
+        const uvc_frame_mode_t *mode = requested_mode;
+        uint32_t interval = requested_interval;
+        requested_mode = NULL;
+        portEXIT_CRITICAL(&mode_lock);
+        if (mode)
+        {
+            active_mode = mode;
+            active_interval = interval;
+        }
+
+        camera_fb_t *fb = usb_bench_fb_get(active_mode->pixel_format, active_mode->width, active_mode->height, 1000);
+        if (fb)
+        {
+            pipeline_count(PIPELINE_CAPTURED);
+            queue_frame(fb, fb->len);
+        }
+    }
+}
+
+#if CONFIG_UVC_USB_BENCHMARK
+// The sweep changed the pacing: re-evaluate it like after a commit
+static void uvc_bench_reconfigured(void)
+{
+    uvc_notify(UVC_EVENT_STREAM);
+}
+#endif
+
+// The ring's in-flight frame reached the host at now
+static void uvc_frame_delivered(int64_t now)
+{
+    frame_slot_t done;
+    if (frame_ring_release(true, &done))
+    {
+        rate_ctrl_on_transfer(done.len, (uint32_t)(now - done.ts.submit_us));
+        telemetry_record_frame(done.len);
+#if CONFIG_UVC_USB_BENCHMARK
+        usb_bench_record_frame(done.len, done.repeat);
+#endif
+        if (done.repeat)
+        {
+            // A repeat's capture time is a period old, keep it out of the latency stats
+            pipeline_count(PIPELINE_REPEATED);
+        }
+        else
+        {
+            done.ts.complete_us = now;
+            frame_timing_record(&done.ts);
+            pipeline_count(PIPELINE_SENT);
+        }
+    }
+    uvc_latency.last_complete_us = now;
+    __atomic_fetch_add(&uvc_frames_delivered, 1, __ATOMIC_RELAXED);
+    uvc_notify(UVC_EVENT_XFER_DONE);
+}
+
+// A frame sent during its readout is over on the bus and, unless PENDING,
+// was handed over by camera_task too. Runs in whichever task came last.
+static void uvc_streamed_done(subframe_xfer_t result, int64_t now)
+{
+    switch (result)
+    {
+    case SUBFRAME_XFER_DELIVERED:
+        uvc_frame_delivered(now);
+        break;
+    case SUBFRAME_XFER_FAILED:
+        // The host dropped it on the error bit
+        pipeline_count(PIPELINE_ERRORED);
+        frame_ring_release(false, NULL);
+        uvc_notify(UVC_EVENT_XFER_DONE);
+        break;
+    default:
+        // The endpoint is free for a queued frame or still
+        uvc_notify(UVC_EVENT_XFER_DONE);
+        break;
+    }
+}
+
+// A frame or still image is delivered, by the video driver or the bounce
+// stage. Runs in the USB device task.
+static void uvc_frame_complete(void)
+{
+    PIPELINE_TRACE(TAG, "Video frame transfer complete");
+
+    // The USB stack is done with the buffer, only now may the driver reuse it
+    int64_t now = esp_timer_get_time();
+    subframe_xfer_t streamed = subframe_stream_xfer_done();
+    if (streamed != SUBFRAME_XFER_NONE)
+    {
+        uvc_streamed_done(streamed, now);
+    }
+    else if (still_capture_release(true))
+    {
+        // Not a stream frame, keep it out of the rate control and latency stats
+        PIPELINE_TRACE(TAG, "Still image delivered");
+        uvc_latency.last_complete_us = now;
+        __atomic_fetch_add(&uvc_frames_delivered, 1, __ATOMIC_RELAXED);
+        uvc_notify(UVC_EVENT_XFER_DONE);
+    }
+    else
+    {
+        uvc_frame_delivered(now);
+    }
+}
+
+// TinyUSB Video Class callbacks
+extern "C" void tud_video_frame_xfer_complete_cb(uint_fast8_t ctl_idx, uint_fast8_t stm_idx)
+{
+    (void)ctl_idx;
+    (void)stm_idx;
+    // The driver's payload buffer is idle between frames: from the next one
+    // on, its payloads leave room for the PTS and SCR
+    if (uvc_driver_header != NULL && uvc_driver_header[0] == 2)
+    {
+        uvc_driver_header[0] = FRAME_TIMING_HEADER_LEN;
+    }
+    uvc_frame_complete();
+}
+
+extern "C" int tud_video_commit_cb(uint_fast8_t ctl_idx, uint_fast8_t stm_idx, video_probe_and_commit_control_t const *parameters)
+{
+    (void)ctl_idx;
+    (void)stm_idx;
+
+    const uvc_frame_mode_t *mode = find_frame_mode(parameters->bFormatIndex, parameters->bFrameIndex);
+    if (mode == NULL)
+    {
+        ESP_LOGW(TAG, "UVC commit with unknown format %u / frame %u",
+                 parameters->bFormatIndex, parameters->bFrameIndex);
+        return VIDEO_ERROR_OUT_OF_RANGE;
+    }
+
+#if CONFIG_UVC_USB_BULK
+    // The video driver copies payloads through its endpoint buffer; larger
+    // ones only go out through the bounce stage, which offered its own size
+    bool bounce = parameters->dwMaxPayloadTransferSize == usb_bounce_payload_size();
+    if (!bounce && parameters->dwMaxPayloadTransferSize > CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE)
+    {
+        ESP_LOGW(TAG, "UVC commit with payload %lu above the %u byte endpoint buffer",
+                 (unsigned long)parameters->dwMaxPayloadTransferSize, CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE);
+        return VIDEO_ERROR_OUT_OF_RANGE;
+    }
+    usb_bounce_set_enabled(bounce);
+#endif
+
+    ESP_LOGI(TAG, "UVC stream commit - Host requesting video stream start (format %u, frame %u, interval %lu, payload %lu)",
+             parameters->bFormatIndex, parameters->bFrameIndex, (unsigned long)parameters->dwFrameInterval,
+             (unsigned long)parameters->dwMaxPayloadTransferSize);
+    uvc_payload_size = parameters->dwMaxPayloadTransferSize;
+
+    portENTER_CRITICAL(&mode_lock);
+    requested_mode = mode;
+    requested_interval = parameters->dwFrameInterval;
+    portEXIT_CRITICAL(&mode_lock);
+
+    uvc_latency.commit_us = esp_timer_get_time();
+    uvc_latency.last_complete_us = 0;
+    uvc_latency.first_frame_pending = true;
+    frame_timing_reset();
+    frame_pacer_start(parameters->dwFrameInterval);
+    still_capture_stream_start(parameters->bFormatIndex);
+    // Frames already being read out are of the old mode; camera_task arms
+    // again after the switch
+    subframe_stream_arm(false);
+#if CONFIG_UVC_USB_BENCHMARK
+    usb_bench_stream_start(parameters->dwFrameInterval, parameters->dwMaxPayloadTransferSize);
+#endif
+    uvc_streaming = true;
+    uvc_notify(UVC_EVENT_STREAM);
+    if (camera_task_handle)
+    {
+        xTaskNotifyGive(camera_task_handle);
+    }
+    return VIDEO_ERROR_NONE;
+}
+
+// TinyUSB has no callback for the end of a stream: the host stops it with a
+// standard request, see uvc_is_stream_stop, or goes away with the bus.
+// uvc_task reclaims the buffers, camera_task goes idle.
+static void uvc_stream_stop(void)
+{
+    uvc_streaming = false;
+    subframe_stream_arm(false);
+    frame_pacer_stop();
+#if CONFIG_UVC_USB_BENCHMARK
+    usb_bench_stream_stop();
+#endif
+    uvc_notify(UVC_EVENT_STREAM);
+}
+
+extern "C" void tud_mount_cb(void)
+{
+    ESP_LOGI(TAG, "USB Device mounted and connected!");
+    if (boot_metrics.enumerated_us == 0)
+    {
+        boot_metrics.enumerated_us = esp_timer_get_time();
+        ESP_LOGI(TAG, "Enumerated %lu ms after boot", (unsigned long)(boot_metrics.enumerated_us / 1000));
+    }
+}
+
+extern "C" void tud_umount_cb(void)
+{
+    ESP_LOGI(TAG, "USB Device unmounted");
+    uvc_stream_stop();
+}
+
+// TinyUSB 0.15 has no application callback for unit and terminal control
+// requests or the still image controls and stalls them, so an application
+// class driver wraps the built-in video driver and answers those itself.
+// Everything else, including the probe/commit and request error code
+// controls, goes to the video driver.
+static uint8_t uvc_control_buf[sizeof(still_probe_commit_t) > UVC_CONTROL_MAX_LEN ? sizeof(still_probe_commit_t)
+                                                                                 : UVC_CONTROL_MAX_LEN];
+
+static bool uvc_is_entity_request(tusb_control_request_t const *request)
+{
+    return request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS &&
+           request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE &&
+           (request->wIndex & 0xff) == ITF_NUM_VIDEO_CONTROL &&
+           (request->wIndex >> 8) != 0;
+}
+
+static bool uvc_is_still_request(tusb_control_request_t const *request)
+{
+    uint8_t selector = request->wValue >> 8;
+    return request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS &&
+           request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE &&
+           (request->wIndex & 0xff) == ITF_NUM_VIDEO_STREAMING &&
+           selector >= UVC_VS_STILL_PROBE_CONTROL && selector <= UVC_VS_STILL_IMAGE_TRIGGER_CONTROL;
+}
+
+// UVC leaves stopping a stream to the endpoint type: an isochronous stream
+// ends with SET_INTERFACE to the zero-bandwidth alternate setting, a bulk
+// stream with CLEAR_FEATURE(ENDPOINT_HALT) on its endpoint, which Windows
+// and Linux both send. The stack forwards either to the driver owning the
+// interface or endpoint, which is this one.
+static bool uvc_is_stream_stop(tusb_control_request_t const *request)
+{
+    if (request->bmRequestType_bit.type != TUSB_REQ_TYPE_STANDARD)
+    {
+        return false;
+    }
+    if (request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE)
+    {
+        return request->bRequest == TUSB_REQ_SET_INTERFACE && request->wValue == 0 &&
+               (request->wIndex & 0xff) == ITF_NUM_VIDEO_STREAMING;
+    }
+    return request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_ENDPOINT &&
+           request->bRequest == TUSB_REQ_CLEAR_FEATURE && request->wValue == TUSB_REQ_FEATURE_EDPT_HALT &&
+           (request->wIndex & 0xff) == EPNUM_VIDEO_IN;
+}
+
+#if CONFIG_UVC_USB_ISO || CONFIG_UVC_USB_BOUNCE
+// Set while the video driver answers a probe or commit GET: TinyUSB derives
+// dwMaxPayloadTransferSize from dwMaxVideoFrameSize, the worst case, which
+// would put every stream from VGA up on the largest alternate setting, and
+// caps it at its endpoint buffer, below the bounce stage's payloads
+static bool uvc_probe_reply_pending;
+
+static bool uvc_is_probe_reply(tusb_control_request_t const *request)
+{
+    uint8_t selector = request->wValue >> 8;
+    return request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS &&
+           request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE &&
+           request->bmRequestType_bit.direction == TUSB_DIR_IN &&
+           (request->wIndex & 0xff) == ITF_NUM_VIDEO_STREAMING &&
+           (selector == VIDEO_VS_CTL_PROBE || selector == VIDEO_VS_CTL_COMMIT);
+}
+#endif
+
+#if CONFIG_UVC_USB_ISO
+// Isochronous alternate settings, in descriptor order
+#define UVC_ISO_ALT_PACKET(_alt, _size) _size,
+static const uint16_t uvc_iso_packet_sizes[] = {UVC_ISO_ALT_LIST(UVC_ISO_ALT_PACKET)};
+
+// Bytes per 1 ms frame the stream needs, payload header included, rounded up
+// to the smallest alternate setting that carries it. The host selects the
+// alternate setting from this value.
+static uint32_t uvc_iso_payload_size(uint8_t format_index, uint8_t frame_index, uint32_t interval)
+{
+    const size_t count = sizeof(uvc_iso_packet_sizes) / sizeof(uvc_iso_packet_sizes[0]);
+    const uvc_frame_mode_t *mode = find_frame_mode(format_index, frame_index);
+    if (mode == NULL)
+    {
+        return uvc_iso_packet_sizes[count - 1];
+    }
+
+    uint64_t frame_bytes = (uint64_t)mode->width * mode->height * 2;
+    if (mode->pixel_format == PIXFORMAT_JPEG)
+    {
+        frame_bytes = frame_bytes * CONFIG_UVC_ISO_MJPEG_RESERVE_PCT / 100;
+    }
+    uint32_t period_us = frame_period_us(mode, interval);
+    uint32_t need = (uint32_t)((frame_bytes * 1000 + period_us - 1) / period_us) + FRAME_TIMING_HEADER_LEN;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (uvc_iso_packet_sizes[i] >= need)
+        {
+            return uvc_iso_packet_sizes[i];
+        }
+    }
+    return uvc_iso_packet_sizes[count - 1];
+}
+#endif
+
+static bool uvc_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request)
+{
+    bool still = uvc_is_still_request(request);
+    if (stage == CONTROL_STAGE_SETUP && uvc_is_stream_stop(request))
+    {
+        if (uvc_streaming)
+        {
+            ESP_LOGI(TAG, "UVC stream stopped by the host");
+            uvc_stream_stop();
+        }
+        if (request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_ENDPOINT)
+        {
+            // The host will never read the transfer still queued on the bulk
+            // endpoint; reset the streaming interface like SET_INTERFACE 0
+            // does, which closes and reopens the endpoint. The stack sends
+            // the status stage once for both.
+            tusb_control_request_t reset = {};
+            reset.bmRequestType_bit.recipient = TUSB_REQ_RCPT_INTERFACE;
+            reset.bRequest = TUSB_REQ_SET_INTERFACE;
+            reset.wIndex = ITF_NUM_VIDEO_STREAMING;
+            return videod_control_xfer_cb(rhport, stage, &reset);
+        }
+    }
+    if (!still && !uvc_is_entity_request(request))
+    {
+#if CONFIG_UVC_USB_ISO || CONFIG_UVC_USB_BOUNCE
+        // The reply reaches usbd_edpt_xfer within this call, see below
+        uvc_probe_reply_pending = stage == CONTROL_STAGE_SETUP && uvc_is_probe_reply(request);
+        bool ok = videod_control_xfer_cb(rhport, stage, request);
+        uvc_probe_reply_pending = false;
+        return ok;
+#else
+        return videod_control_xfer_cb(rhport, stage, request);
+#endif
+    }
+
+    uint8_t entity = request->wIndex >> 8;
+    uint8_t selector = request->wValue >> 8;
+    if (request->bmRequestType_bit.direction == TUSB_DIR_IN)
+    {
+        if (stage != CONTROL_STAGE_SETUP)
+        {
+            return true;
+        }
+        uint16_t len = sizeof(uvc_control_buf);
+        video_error_code_t err = still ? still_capture_get(selector, request->bRequest, uvc_control_buf, &len)
+                                       : uvc_controls_get(entity, selector, request->bRequest, uvc_control_buf, &len);
+        if (err != VIDEO_ERROR_NONE)
+        {
+            return false;
+        }
+        return tud_control_xfer(rhport, request, uvc_control_buf, len < request->wLength ? len : request->wLength);
+    }
+
+    if (request->bRequest != VIDEO_REQUEST_SET_CUR || request->wLength > sizeof(uvc_control_buf))
+    {
+        return false;
+    }
+    if (stage == CONTROL_STAGE_SETUP)
+    {
+        return tud_control_xfer(rhport, request, uvc_control_buf, request->wLength);
+    }
+    if (stage == CONTROL_STAGE_DATA)
+    {
+        // Only recorded here, camera_task writes the sensor between frames
+        // and picks up a still image trigger before its next frame
+        video_error_code_t err = still ? still_capture_set(selector, uvc_control_buf, request->wLength)
+                                       : uvc_controls_set(entity, selector, uvc_control_buf, request->wLength);
+        return err == VIDEO_ERROR_NONE;
+    }
+    return true;
+}
+
+static void uvc_driver_init(void)
+{
+    // The built-in video driver is initialized by the stack as well
+}
+
+static void uvc_driver_reset(uint8_t rhport)
+{
+    (void)rhport;
+}
+
+// Streaming endpoint completions belong to the bounce stage while it sends a
+// frame; the video driver would take them for its own
+static bool uvc_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+{
+    if (ep_addr == EPNUM_VIDEO_IN && usb_bounce_xfer_cb(result, xferred_bytes))
+    {
+        return true;
+    }
+    int64_t start = esp_timer_get_time();
+    bool ok = videod_xfer_cb(rhport, ep_addr, result, xferred_bytes);
+    if (ep_addr == EPNUM_VIDEO_IN)
+    {
+        uvc_direct_cpu_add(start);
+    }
+    return ok;
+}
+
+static const usbd_class_driver_t uvc_app_driver = {
+#if CFG_TUSB_DEBUG >= 2
+    .name = "UVC+controls",
+#endif
+    .init = uvc_driver_init,
+    .reset = uvc_driver_reset,
+    .open = videod_open,
+    .control_xfer_cb = uvc_control_xfer_cb,
+    .xfer_cb = uvc_xfer_cb,
+    .sof = NULL,
+};
+
+extern "C" usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count)
+{
+    *driver_count = 1;
+    return &uvc_app_driver;
+}
+
+// The video driver builds the payload headers in its endpoint buffer and has
+// no still image bit, so it is set on the way to the endpoint: the link wraps
+// usbd_edpt_xfer (see CMakeLists.txt). The driver keeps its header between
+// frames, so stream frames get the bit cleared again.
+// In isochronous mode the same hook puts the bandwidth the stream needs into
+// probe replies, which tud_control_xfer copies to EP0 before returning; with
+// the bounce stage it offers the stage's payload size instead.
+extern "C" bool __real_usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes);
+
+extern "C" bool __wrap_usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes)
+{
+#if CONFIG_UVC_USB_ISO || CONFIG_UVC_USB_BOUNCE
+    if (ep_addr == 0x80 && uvc_probe_reply_pending && buffer != NULL &&
+        total_bytes >= offsetof(video_probe_and_commit_control_t, dwClockFrequency))
+    {
+        video_probe_and_commit_control_t *param = (video_probe_and_commit_control_t *)buffer;
+#if CONFIG_UVC_USB_ISO
+        param->dwMaxPayloadTransferSize = uvc_iso_payload_size(param->bFormatIndex, param->bFrameIndex,
+                                                               param->dwFrameInterval);
+#else
+        if (usb_bounce_payload_size())
+        {
+            param->dwMaxPayloadTransferSize = usb_bounce_payload_size();
+        }
+#endif
+    }
+#endif
+    // Every payload starts with the driver's header, 2 bytes until it is
+    // widened, or the bounce stage's longer one
+    if (ep_addr == EPNUM_VIDEO_IN && buffer != NULL && total_bytes >= 2 && buffer[0] == 2)
+    {
+        uvc_driver_header = buffer;
+    }
+    else if (ep_addr == EPNUM_VIDEO_IN && buffer == uvc_driver_header && buffer[0] == FRAME_TIMING_HEADER_LEN &&
+             total_bytes >= FRAME_TIMING_HEADER_LEN)
+    {
+        frame_timing_put_clock(buffer, uvc_driver_pts);
+    }
+    if (ep_addr == EPNUM_VIDEO_IN && buffer != NULL && total_bytes >= 2 &&
+        (buffer[0] == 2 || (buffer[0] == FRAME_TIMING_HEADER_LEN && total_bytes >= FRAME_TIMING_HEADER_LEN)))
+    {
+        if (still_capture_in_flight())
+        {
+            buffer[1] |= UVC_PAYLOAD_HEADER_STI;
+        }
+        else
+        {
+            buffer[1] &= ~UVC_PAYLOAD_HEADER_STI;
+        }
+    }
+    return __real_usbd_edpt_xfer(rhport, ep_addr, buffer, total_bytes);
+}
+
+// TinyUSB descriptor callbacks
+extern "C" uint8_t const* tud_descriptor_device_cb(void)
+{
+    return (uint8_t const*)&desc_device;
+}
+
+extern "C" uint8_t const* tud_descriptor_configuration_cb(uint8_t index)
+{
+    (void)index;
+    return desc_configuration;
+}
+
+// String descriptors; the indices are the ones usb_descriptors.h refers to
+static const char *string_desc_arr[] = {
+    (const char[]){0x09, 0x04}, // 0: is supported language is English (0x0409)
+    "Espressif",                // 1: Manufacturer
+    "ESP32-S3 UVC Camera",      // 2: Product
+    "123456",                   // 3: Serials
+    "UVC",                      // 4: UVC Interface
+    "UVC Telemetry",            // 5: CDC Interface
+};
+
+extern "C" uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
+{
+    (void)langid;
+
+    static uint16_t desc_str[32 + 1]; // Static buffer for string descriptor
+    uint8_t chr_count;
+    
+    if (index == 0) {
+        // Language ID descriptor
+        desc_str[0] = (TUSB_DESC_STRING << 8) | (2 + 2);
+        desc_str[1] = 0x0409; // English (United States)
+        return desc_str;
+    } else {
+        if (!(index < sizeof(string_desc_arr)/sizeof(string_desc_arr[0]))) return NULL;
+        
+        const char* str = string_desc_arr[index];
+        chr_count = strlen(str);
+        if (chr_count > 31) chr_count = 31;
+
+        // First byte is length (in bytes) and type
+        desc_str[0] = (TUSB_DESC_STRING << 8) | (2 * chr_count + 2);
+
+        // Convert ASCII to UTF-16
+        for (uint8_t i = 0; i < chr_count; i++) {
+            desc_str[1 + i] = str[i];
+        }
+
+        return desc_str;
+    }
+}
+
+// USB device task: services TinyUSB as soon as any bus, control or endpoint
+// event is queued, independently of frame production
+static void usb_device_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "USB device task started");
+
+    while (1) {
+        // Blocks on the TinyUSB event queue until there is work to do
+        tud_task();
+    }
+}
+
+static void uvc_record_submit(int64_t now)
+{
+    if (boot_metrics.first_frame_us == 0)
+    {
+        boot_metrics.first_frame_us = now;
+        ESP_LOGI(TAG, "First frame %lu ms after boot", (unsigned long)(now / 1000));
+    }
+    if (uvc_latency.first_frame_pending)
+    {
+        uvc_latency.commit_to_first_frame_us = (uint32_t)(now - uvc_latency.commit_us);
+        uvc_latency.first_frame_pending = false;
+        ESP_LOGI(TAG, "First frame submitted %lu us after commit",
+                 (unsigned long)uvc_latency.commit_to_first_frame_us);
+    }
+    else if (uvc_latency.last_complete_us)
+    {
+        uint32_t gap = (uint32_t)(now - uvc_latency.last_complete_us);
+        if (uvc_latency.gap_count == 0 || gap < uvc_latency.gap_min_us)
+        {
+            uvc_latency.gap_min_us = gap;
+        }
+        if (gap > uvc_latency.gap_max_us)
+        {
+            uvc_latency.gap_max_us = gap;
+        }
+        uvc_latency.gap_sum_us += gap;
+        uvc_latency.gap_count++;
+    }
+}
+
+// Send a frame or still through the bounce stage if the host committed its
+// payload size, through the video driver otherwise. Either way the payload
+// headers carry the capture time as PTS, see __wrap_usbd_edpt_xfer for the
+// video driver's.
+static bool uvc_frame_xfer(const uint8_t *buf, size_t len, int64_t capture_us)
+{
+    if (usb_bounce_enabled())
+    {
+        return usb_bounce_xfer(buf, len, capture_us);
+    }
+    int64_t start = esp_timer_get_time();
+    uvc_driver_pts = frame_timing_to_uvc_clock(capture_us);
+    bool ok = tud_video_n_frame_xfer(0, 0, (void *)(uintptr_t)buf, len);
+    uvc_direct_cpu_add(start);
+    return ok;
+}
+
+// Hand the newest queued frame (or a repeat) to the endpoint if it is idle
+// and the pacer says the frame is due
+static void uvc_submit_frame(void)
+{
+    if (frame_ring_in_flight() || still_capture_in_flight() || subframe_stream_busy())
+    {
+        PIPELINE_TRACE(TAG, "Previous transfer still in flight");
+        return;
+    }
+
+    // A still image goes out as soon as the endpoint is free, the stream's
+    // next frame waits for it
+    size_t still_len;
+    int64_t still_capture_us;
+    const uint8_t *still = still_capture_acquire(&still_len, &still_capture_us);
+    if (still)
+    {
+        if (!uvc_frame_xfer(still, still_len, still_capture_us))
+        {
+            PIPELINE_TRACE(TAG, "USB rejected still image transfer");
+            still_capture_release(false);
+        }
+        return;
+    }
+
+    frame_pacer_action_t action = frame_pacer_poll(frame_ring_has_queued(), frame_ring_has_retained());
+    frame_slot_t *slot = NULL;
+    if (action == FRAME_PACER_SEND)
+    {
+        slot = frame_ring_acquire();
+#if CONFIG_UVC_USB_BENCH_EMBEDDED
+        // The benchmark source queues the next one right away
+        xTaskNotifyGive(camera_task_handle);
+#endif
+    }
+    else if (action == FRAME_PACER_REPEAT)
+    {
+        slot = frame_ring_acquire_repeat();
+    }
+    if (!slot)
+    {
+        PIPELINE_TRACE(TAG, "No frame due yet");
+        return;
+    }
+
+    // Frames were validated and trimmed once in camera_task
+    int64_t now = esp_timer_get_time();
+#if CONFIG_UVC_CHANGE_GATE
+    if (!change_gate_pass(CHANGE_GATE_USB, &uvc_gate, &slot->sig, now))
+    {
+        // The host keeps showing the frame it has; the deadline counts as
+        // served and the next poll arms the pacer for the one after
+        PIPELINE_TRACE(TAG, "Scene unchanged, withholding frame seq=%lu", (unsigned long)slot->seq);
+        frame_ring_withhold();
+        frame_pacer_withheld(now);
+        uvc_notify(UVC_EVENT_DEADLINE);
+        return;
+    }
+#endif
+#if CONFIG_UVC_EVENT_RECORDER
+    if (event_recorder_thinning() && now - uvc_last_sent_us < UVC_DUMP_FRAME_INTERVAL_US)
+    {
+        // Withheld like an unchanged scene: the host keeps its last frame
+        PIPELINE_TRACE(TAG, "Recorder dump running, withholding frame seq=%lu", (unsigned long)slot->seq);
+        frame_ring_withhold();
+        frame_pacer_withheld(now);
+        uvc_notify(UVC_EVENT_DEADLINE);
+        return;
+    }
+    uvc_last_sent_us = now;
+#endif
+    slot->ts.submit_us = now;
+    // Presentation time and source clock in dwClockFrequency units, as the
+    // payload headers carry them
+    PIPELINE_TRACE(TAG, "Sending frame seq=%lu len=%zu PTS=%lu STC=%lu", (unsigned long)slot->seq, slot->len,
+                   (unsigned long)frame_timing_to_uvc_clock(slot->ts.capture_us),
+                   (unsigned long)frame_timing_to_uvc_clock(now));
+    // The buffer stays in flight until uvc_frame_complete
+    if (!uvc_frame_xfer(slot->fb->buf, slot->len, slot->ts.capture_us))
+    {
+        pipeline_count(PIPELINE_ERRORED);
+        PIPELINE_TRACE(TAG, "USB rejected frame transfer");
+        frame_ring_release(false, NULL);
+        return;
+    }
+    frame_pacer_submitted(now);
+    uvc_record_submit(now);
+}
+
+// UVC streaming task: submits frames in response to frame-ready and
+// transfer-complete notifications
+static void uvc_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "UVC task started");
+
+    bool was_streaming = false;
+
+    while (1) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(UVC_HOUSEKEEPING_MS));
+
+        PIPELINE_TRACE(TAG, "UVC task wake: events=0x%lx streaming=%d", (unsigned long)events, uvc_streaming);
+
+        if (uvc_streaming && tud_video_n_streaming(0, 0)) {
+#if CONFIG_UVC_FRAME_PACING_REPEAT
+            if (!was_streaming || (events & UVC_EVENT_STREAM))
+            {
+                // Repeats need the last frame, which only makes sense when paced
+                frame_pacer_stats_t pacing;
+                frame_pacer_get_stats(&pacing);
+                frame_ring_set_retain(pacing.interval_us != 0);
+            }
+#endif
+#if CONFIG_UVC_CHANGE_GATE
+            if (!was_streaming || (events & UVC_EVENT_STREAM))
+            {
+                // A new stream starts with a frame whatever it shows
+                change_gate_reset(&uvc_gate);
+            }
+#endif
+            was_streaming = true;
+            if (events & UVC_EVENT_STREAMED)
+            {
+                uvc_record_submit(__atomic_load_n(&uvc_streamed_start_us, __ATOMIC_RELAXED));
+            }
+            if (events & (UVC_EVENT_FRAME_READY | UVC_EVENT_XFER_DONE | UVC_EVENT_STREAM | UVC_EVENT_DEADLINE))
+            {
+                uvc_submit_frame();
+            }
+        }
+        else if (was_streaming)
+        {
+            // The stack dropped any pending transfer, reclaim its buffer
+            ESP_LOGI(TAG, "Streaming stopped, returning frame buffers to driver");
+            frame_ring_set_retain(false);
+            // Copies still reading the frame finish before it goes back
+            usb_bounce_abort();
+            subframe_stream_abort();
+            frame_ring_reset();
+            still_capture_stream_stop();
+            was_streaming = false;
+        }
+    }
+}
+
+// Status summary: each core's load and interrupts, and every task that ran,
+// since the previous summary
+static void log_cpu_load(void)
+{
+    static task_plan_sample_t samples[2];
+    static int newest = -1;
+    static task_plan_load_t load;
+    static char line[640];
+
+    int prev = newest;
+    newest = newest == 0 ? 1 : 0;
+    task_plan_sample(&samples[newest]);
+    if (prev < 0)
+    {
+        return;
+    }
+    task_plan_load(&samples[prev], &samples[newest], &load);
+
+    size_t pos = 0;
+    for (int c = 0; c < portNUM_PROCESSORS && pos < sizeof(line); c++)
+    {
+#if CONFIG_UVC_TASK_PLAN_ISR_TIMING
+        pos += snprintf(line + pos, sizeof(line) - pos, "%score%d %u.%u%% (ISR %u.%u%%:", c ? ", " : "", c,
+                        load.core_busy[c] / 10, load.core_busy[c] % 10, load.isr_total[c] / 10,
+                        load.isr_total[c] % 10);
+        for (int o = 0; o < TASK_PLAN_ISR_COUNT && pos < sizeof(line); o++)
+        {
+            if (load.isr_rate[c][o] == 0)
+            {
+                continue;
+            }
+            pos += snprintf(line + pos, sizeof(line) - pos, " %s %u.%u%%/%lu/s",
+                            task_plan_isr_name((task_plan_isr_t)o), load.isr[c][o] / 10, load.isr[c][o] % 10,
+                            (unsigned long)load.isr_rate[c][o]);
+        }
+        if (pos < sizeof(line))
+        {
+            pos += snprintf(line + pos, sizeof(line) - pos, ")");
+        }
+#else
+        // Interrupts are not timed, their share is in the tasks'
+        pos += snprintf(line + pos, sizeof(line) - pos, "%score%d %u.%u%%", c ? ", " : "", c,
+                        load.core_busy[c] / 10, load.core_busy[c] % 10);
+#endif
+    }
+    ESP_LOGI(TAG, "CPU %s plan: busy %u.%u%%, %s", task_plan_name(), load.busy / 10, load.busy % 10, line);
+
+    pos = 0;
+    line[0] = '\0';
+    for (UBaseType_t i = 0; i < load.task_count && pos < sizeof(line); i++)
+    {
+        const task_plan_task_load_t *t = &load.tasks[i];
+        if (t->permille == 0 || strncmp(t->name, "IDLE", 4) == 0)
+        {
+            continue;
+        }
+        pos += snprintf(line + pos, sizeof(line) - pos, "%s%s/%d %u.%u%% %lu B", pos ? ", " : "", t->name, t->core,
+                        t->permille / 10, t->permille % 10, (unsigned long)t->stack_free);
+    }
+    if (pos)
+    {
+        ESP_LOGI(TAG, "Tasks (core, CPU, stack left): %s", line);
+    }
+}
+
+#if CONFIG_UVC_USB_BOUNCE
+// usb_bounce_init on the plan's USB core, with its GDMA interrupts
+static esp_err_t usb_bounce_init_here(void *arg)
+{
+    return usb_bounce_init(EPNUM_VIDEO_IN, CONFIG_UVC_USB_BOUNCE_CHUNK, CONFIG_UVC_USB_BOUNCE_BUFFERS,
+                           uvc_frame_complete);
+}
+#endif
+
+// tud_init on the plan's USB core, which then services the controller's
+// interrupt
+static esp_err_t usb_init_here(void *arg)
+{
+    return tud_init(BOARD_TUD_RHPORT) ? ESP_OK : ESP_FAIL;
+}
+
+extern "C" void app_main(void)
+{
+    ESP_LOGI(TAG, "USB UVC Camera starting...");
+
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        // Only the sensor state lives here, it is cheap to lose
+        nvs_flash_erase();
+        ret = nvs_flash_init();
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "NVS unavailable (%s), sensor state will not persist", esp_err_to_name(ret));
+    }
+    sensor_state_init();
+
+    frame_ring_init();
+    camera_recovery_init();
+    uvc_controls_init();
+#if CONFIG_UVC_USB_BOUNCE
+    // The bounce stage's GDMA interrupts go with the USB controller's
+    if (task_plan_isr_call(TASK_PLAN_ISR_USB, usb_bounce_init_here, NULL) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Bounce stage unavailable, the video driver feeds the endpoint from PSRAM");
+    }
+#endif
+#if CONFIG_UVC_SUBFRAME_STREAM
+    subframe_stream_init(uvc_subframe_started);
+#endif
+#if CONFIG_UVC_STILL_CAPTURE
+    // Stills share the stream's path to the endpoint
+    uint32_t still_payload = usb_bounce_payload_size() ? usb_bounce_payload_size() : CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE;
+    still_capture_init(UVC_FORMAT_INDEX_MJPEG, UVC_STILL_FRAME_COUNT, CONFIG_UVC_STILL_BUFFER_KB * 1024, still_payload);
+#endif
+    rate_ctrl_init(camera_config.jpeg_quality);
+    frame_pacer_init(uvc_pacer_deadline);
+#if CONFIG_UVC_IDLE_POWER_SAVE
+    power_idle_init(camera_config.ledc_timer, CONFIG_UVC_IDLE_CPU_FREQ_MHZ, CONFIG_UVC_IDLE_RESUME_BUDGET_MS);
+#endif
+
+#if CONFIG_UVC_PIXEL_PACK_BENCHMARK
+    pixel_pack_benchmark();
+#endif
+#if CONFIG_UVC_USB_BENCHMARK
+    usb_bench_start(uvc_bench_reconfigured);
+#endif
+    
+    // USB first: the host enumerates while camera_task brings up the sensor
+    ESP_LOGI(TAG, "Initializing USB (TinyUSB)...");
+    if (task_plan_isr_call(TASK_PLAN_ISR_USB, usb_init_here, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize TinyUSB device");
+        return;
+    }
+    boot_metrics.usb_started_us = esp_timer_get_time();
+
+    // Tasks as the plan places them; the USB device task runs above the
+    // pipeline tasks so control requests and endpoint completions are never
+    // held back by frame work
+    task_plan_log();
+    task_plan_create(TASK_PLAN_USB, usb_device_task, NULL, NULL);
+    
+    // Create camera capture task, it initializes the camera; the USB
+    // benchmark's embedded frames leave the camera off
+#if CONFIG_UVC_USB_BENCH_EMBEDDED
+    const bool bench_source = true;
+#else
+    const bool bench_source = false;
+#endif
+    TaskFunction_t capture_task = bench_source ? bench_source_task : camera_task;
+    task_plan_create(TASK_PLAN_CAMERA, capture_task, NULL, &camera_task_handle);
+    
+    // Create UVC streaming task
+    task_plan_create(TASK_PLAN_UVC, uvc_task, NULL, &uvc_task_handle);
+
+#if CONFIG_UVC_HTTP_STREAM
+    // The server listens right away, the network joins in the background
+    if (wifi_sta_start(CONFIG_UVC_HTTP_WIFI_SSID, CONFIG_UVC_HTTP_WIFI_PASSWORD) == ESP_OK)
+    {
+        http_stream_start(CONFIG_UVC_HTTP_PORT, CONFIG_UVC_HTTP_SEND_TIMEOUT_MS, camera_task_handle);
+    }
+#endif
+
+#if CONFIG_UVC_EVENT_RECORDER
+    // Wakes camera_task: the recorder captures whether or not anything streams
+    event_recorder_init(CONFIG_UVC_EVENT_RECORDER_BUFFER_KB * 1024, CONFIG_UVC_EVENT_RECORDER_INTERVAL_MS,
+                        CONFIG_UVC_EVENT_RECORDER_POST_MS, camera_task_handle);
+#endif
+
+#if CONFIG_UVC_CDC_TELEMETRY
+    // Lowest priority of all, so a busy terminal costs the video path nothing
+    telemetry_start(CONFIG_UVC_CDC_TELEMETRY_PERIOD_MS);
+#endif
+    
+    ESP_LOGI(TAG, "USB UVC Camera started");
+    log_cpu_load();
+
+    // Periodic summary; the per-frame path only bumps counters
+    usb_bounce_stats_t bounce_prev = {};
+    uint64_t direct_cpu_prev = 0;
+    uint32_t delivered_prev = 0;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_UVC_STATS_INTERVAL_MS));
+
+        ESP_LOGI(TAG, "=== System Status ===");
+        pipeline_stats_log_summary();
+        ESP_LOGI(TAG, "Free heap: %lu bytes", esp_get_free_heap_size());
+        ESP_LOGI(TAG, "USB mounted: %s", tud_mounted() ? "YES" : "NO");
+        ESP_LOGI(TAG, "USB ready: %s", tud_ready() ? "YES" : "NO");
+        ESP_LOGI(TAG, "UVC streaming: %s", uvc_streaming ? "YES" : "NO");
+        ESP_LOGI(TAG, "TinyUSB video streaming: %s", tud_video_n_streaming(0, 0) ? "YES" : "NO");
+        frame_ring_stats_t ring;
+        frame_ring_get_stats(&ring);
+        ESP_LOGI(TAG, "Frame ring: pushed=%lu replaced=%lu sent=%lu repeated=%lu aborted=%lu",
+                 (unsigned long)ring.pushed, (unsigned long)ring.replaced,
+                 (unsigned long)ring.sent, (unsigned long)ring.repeated, (unsigned long)ring.aborted);
+        camera_recovery_stats_t recovery;
+        camera_recovery_get_stats(&recovery);
+        if (recovery.faults)
+        {
+            ESP_LOGI(TAG, "Camera recovery: faults=%lu%s attempts dma/reset/reinit=%lu/%lu/%lu "
+                          "recovered=%lu/%lu/%lu outage last/max/total=%lu/%lu/%lu ms (detected after %lu ms)",
+                     (unsigned long)recovery.faults, recovery.active ? " (active)" : "",
+                     (unsigned long)recovery.attempts[CAMERA_RECOVERY_DMA_RESTART],
+                     (unsigned long)recovery.attempts[CAMERA_RECOVERY_SENSOR_RESET],
+                     (unsigned long)recovery.attempts[CAMERA_RECOVERY_REINIT],
+                     (unsigned long)recovery.recovered[CAMERA_RECOVERY_DMA_RESTART],
+                     (unsigned long)recovery.recovered[CAMERA_RECOVERY_SENSOR_RESET],
+                     (unsigned long)recovery.recovered[CAMERA_RECOVERY_REINIT],
+                     (unsigned long)(recovery.last_us / 1000), (unsigned long)(recovery.max_us / 1000),
+                     (unsigned long)(recovery.total_us / 1000), (unsigned long)(recovery.detect_last_us / 1000));
+        }
+        ESP_LOGI(TAG, "Boot: usb=%lu enumerated=%lu camera=%lu settled=%lu (%lu frames%s%s) first frame=%lu ms",
+                 (unsigned long)(boot_metrics.usb_started_us / 1000),
+                 (unsigned long)(boot_metrics.enumerated_us / 1000),
+                 (unsigned long)(boot_metrics.camera_ready_us / 1000),
+                 (unsigned long)(boot_metrics.sensor_settled_us / 1000),
+                 (unsigned long)boot_metrics.settle_frames,
+                 boot_metrics.state_restored ? ", restored" : "",
+                 boot_metrics.settle_timed_out ? ", timed out" : "",
+                 (unsigned long)(boot_metrics.first_frame_us / 1000));
+        ESP_LOGI(TAG, "Stream mode: %ux%u, last switch took %lu us",
+                 active_mode->width, active_mode->height, (unsigned long)last_mode_switch_us);
+        sensor_window_stats_t window;
+        sensor_window_get_stats(&window);
+        if (window.switches || window.torn)
+        {
+            sensor_window_t win;
+            sensor_window_get(active_mode->width, active_mode->height, &win);
+            ESP_LOGI(TAG, "Sensor window: zoom %u.%02ux, %ux%u at %u,%u of the %s readout (%lu fps); %lu switches, last %lu us (%lu us writes), max %lu us, %lu torn frames",
+                     win.zoom / 100, win.zoom % 100, win.total_x, win.total_y, win.offset_x, win.offset_y,
+                     sensor_window_readout_name(win.readout), (unsigned long)win.fps, (unsigned long)window.switches,
+                     (unsigned long)window.last_us, (unsigned long)window.sccb_last_us, (unsigned long)window.max_us,
+                     (unsigned long)window.torn);
+        }
+#if CONFIG_UVC_IDLE_POWER_SAVE
+        power_idle_stats_t idle;
+        power_idle_get_stats(&idle);
+        if (idle.entries)
+        {
+            ESP_LOGI(TAG, "Idle: %s, entered=%lu resumed=%lu idle=%lu s%s, enter/wake=%lu/%lu us "
+                          "resume last/max=%lu/%lu us over budget=%lu stale=%lu failed=%lu",
+                     idle.idle ? "yes" : "no", (unsigned long)idle.entries, (unsigned long)idle.resumes,
+                     (unsigned long)(idle.idle_us / 1000000), idle.cpu_scaling ? "" : " (no CPU scaling)",
+                     (unsigned long)idle.enter_last_us, (unsigned long)idle.wake_last_us,
+                     (unsigned long)idle.resume_last_us, (unsigned long)idle.resume_max_us,
+                     (unsigned long)idle.over_budget, (unsigned long)idle.stale, (unsigned long)idle.failures);
+        }
+#endif
+        frame_pacer_stats_t pacing;
+        frame_pacer_get_stats(&pacing);
+        if (pacing.interval_us)
+        {
+            uint32_t paced = pacing.sent + pacing.repeated;
+            ESP_LOGI(TAG, "Pacing %lu us: sent=%lu repeated=%lu late=%lu skipped=%lu withheld=%lu lateness avg/max=%lu/%lu us",
+                     (unsigned long)pacing.interval_us, (unsigned long)pacing.sent,
+                     (unsigned long)pacing.repeated, (unsigned long)pacing.late, (unsigned long)pacing.skipped,
+                     (unsigned long)pacing.withheld,
+                     (unsigned long)(paced ? pacing.lateness_sum_us / paced : 0),
+                     (unsigned long)pacing.lateness_max_us);
+        }
+        rate_ctrl_state_t rc;
+        rate_ctrl_get_state(&rc);
+        ESP_LOGI(TAG, "Rate control %s: quality=%u avg frame=%lu B budget=%lu B usb=%lu kbps adjustments=%lu",
+                 rc.enabled ? "on" : "off", rc.quality, (unsigned long)rc.avg_frame_bytes,
+                 (unsigned long)rc.budget_bytes, (unsigned long)(rc.throughput_bps / 1000),
+                 (unsigned long)rc.adjustments);
+        // CPU share of the USB path over the interval, whichever fed the endpoint
+        usb_bounce_stats_t bounce;
+        usb_bounce_get_stats(&bounce);
+        portENTER_CRITICAL(&uvc_cpu_lock);
+        uint64_t direct_cpu = uvc_direct_cpu_us;
+        portEXIT_CRITICAL(&uvc_cpu_lock);
+        uint32_t delivered = __atomic_load_n(&uvc_frames_delivered, __ATOMIC_RELAXED);
+        uint32_t path_frames = delivered - delivered_prev;
+        uint64_t path_cpu = (bounce.cpu_us - bounce_prev.cpu_us) + (direct_cpu - direct_cpu_prev);
+        if (path_frames)
+        {
+            ESP_LOGI(TAG, "USB path: %s payload=%lu B, CPU %lu.%lu%% (%lu us/frame), copies dma/cpu=%lu/%lu "
+                          "copy waits=%lu copy max=%lu us",
+                     usb_bounce_enabled() ? "bounce" : "direct", (unsigned long)uvc_payload_size,
+                     (unsigned long)(path_cpu * 100 / (CONFIG_UVC_STATS_INTERVAL_MS * 1000ULL)),
+                     (unsigned long)(path_cpu * 1000 / (CONFIG_UVC_STATS_INTERVAL_MS * 1000ULL) % 10),
+                     (unsigned long)(path_cpu / path_frames),
+                     (unsigned long)(bounce.dma_copies - bounce_prev.dma_copies),
+                     (unsigned long)(bounce.cpu_copies - bounce_prev.cpu_copies),
+                     (unsigned long)(bounce.copy_waits - bounce_prev.copy_waits),
+                     (unsigned long)bounce.copy_max_us);
+        }
+        bounce_prev = bounce;
+        direct_cpu_prev = direct_cpu;
+        delivered_prev = delivered;
+        log_cpu_load();
+        subframe_stream_stats_t sub;
+        subframe_stream_get_stats(&sub);
+        if (sub.started || sub.busy)
+        {
+            ESP_LOGI(TAG, "Sub-frame: started=%lu delivered=%lu failed=%lu aborted=%lu dropped=%lu late rejects=%lu "
+                          "busy=%lu EOI->end last/avg/max=%lu/%lu/%lu us scan=%lu us",
+                     (unsigned long)sub.started, (unsigned long)sub.delivered, (unsigned long)sub.failed,
+                     (unsigned long)sub.aborted, (unsigned long)sub.dropped, (unsigned long)sub.late_rejects,
+                     (unsigned long)sub.busy, (unsigned long)sub.tail_last_us,
+                     (unsigned long)(sub.delivered ? sub.tail_sum_us / sub.delivered : 0),
+                     (unsigned long)sub.tail_max_us, (unsigned long)sub.scan_us);
+        }
+        still_capture_stats_t still;
+        still_capture_get_stats(&still);
+        if (still.triggers)
+        {
+            ESP_LOGI(TAG, "Still: triggers=%lu sent=%lu failed=%lu aborted=%lu last=%lu B capture last/max=%lu/%lu us "
+                          "send=%lu us stream gap last/max=%lu/%lu us (%lu/%lu frames)",
+                     (unsigned long)still.triggers, (unsigned long)still.sent, (unsigned long)still.failed,
+                     (unsigned long)still.aborted, (unsigned long)still.last_bytes,
+                     (unsigned long)still.capture_last_us, (unsigned long)still.capture_max_us,
+                     (unsigned long)still.send_last_us, (unsigned long)still.gap_last_us,
+                     (unsigned long)still.gap_max_us, (unsigned long)still.gap_last_frames,
+                     (unsigned long)still.gap_max_frames);
+        }
+#if CONFIG_UVC_EVENT_RECORDER
+        event_recorder_info_t rec;
+        event_recorder_get_info(&rec);
+        if (rec.state != EVENT_RECORDER_OFF)
+        {
+            static const char *const rec_states[] = {"off", "recording", "triggered", "frozen"};
+            event_recorder_stats_t rec_stats;
+            event_recorder_get_stats(&rec_stats);
+            ESP_LOGI(TAG, "Recorder: %s, %lu frames in %lu/%lu KB covering %lu ms, recorded=%lu evicted=%lu "
+                          "skipped=%lu too large=%lu copy last/max=%lu/%lu us triggers=%lu dumps=%lu aborted=%lu "
+                          "last dump %lu KB in %lu ms",
+                     rec_states[rec.state], (unsigned long)rec.frames, (unsigned long)(rec.bytes / 1024),
+                     (unsigned long)(rec.capacity / 1024),
+                     (unsigned long)(rec.frames ? (rec.newest_us - rec.oldest_us) / 1000 : 0),
+                     (unsigned long)rec_stats.recorded, (unsigned long)rec_stats.evicted,
+                     (unsigned long)rec_stats.skipped, (unsigned long)rec_stats.too_large,
+                     (unsigned long)rec_stats.copy_last_us, (unsigned long)rec_stats.copy_max_us,
+                     (unsigned long)rec_stats.triggers, (unsigned long)rec_stats.dumps,
+                     (unsigned long)rec_stats.dumps_aborted, (unsigned long)(rec_stats.dump_last_bytes / 1024),
+                     (unsigned long)(rec_stats.dump_last_us / 1000));
+        }
+#endif
+#if CONFIG_UVC_HTTP_STREAM
+        http_stream_stats_t http;
+        http_stream_get_stats(&http);
+        if (http.accepted || http.rejected)
+        {
+            ESP_LOGI(TAG, "HTTP: clients=%d accepted=%lu rejected=%lu timeouts=%lu closed=%lu shared=%lu refused=%lu",
+                     http_stream_clients(), (unsigned long)http.accepted, (unsigned long)http.rejected,
+                     (unsigned long)http.timeouts, (unsigned long)http.closed, (unsigned long)ring.shared,
+                     (unsigned long)ring.refused);
+            int64_t now = esp_timer_get_time();
+            for (int i = 0; i < HTTP_STREAM_MAX_CLIENTS; i++)
+            {
+                const http_stream_client_stats_t *cs = &http.clients[i];
+                uint32_t elapsed_ms = (uint32_t)((now - cs->connected_us) / 1000);
+                if (!cs->connected || elapsed_ms == 0)
+                {
+                    continue;
+                }
+                ESP_LOGI(TAG, "HTTP client %d: frames=%lu (%lu.%lu fps) %lu kbps skipped=%lu send last/max=%lu/%lu us",
+                         i, (unsigned long)cs->frames, (unsigned long)(cs->frames * 1000ULL / elapsed_ms),
+                         (unsigned long)(cs->frames * 10000ULL / elapsed_ms % 10),
+                         (unsigned long)(cs->bytes * 8 / elapsed_ms), (unsigned long)cs->skipped,
+                         (unsigned long)cs->send_last_us, (unsigned long)cs->send_max_us);
+            }
+        }
+#endif
+#if CONFIG_UVC_CDC_TELEMETRY
+        telemetry_stats_t telemetry;
+        telemetry_get_stats(&telemetry);
+        if (telemetry.samples || telemetry.dropped || telemetry.commands || telemetry.rejected)
+        {
+            ESP_LOGI(TAG, "Telemetry: samples=%lu dropped=%lu commands=%lu rejected=%lu",
+                     (unsigned long)telemetry.samples, (unsigned long)telemetry.dropped,
+                     (unsigned long)telemetry.commands, (unsigned long)telemetry.rejected);
+        }
+#endif
+#if CONFIG_UVC_CHANGE_GATE
+        static const char *const gate_names[CHANGE_GATE_STREAM_COUNT] = {"USB", "HTTP"};
+        for (int stream = 0; stream < CHANGE_GATE_STREAM_COUNT; stream++)
+        {
+            change_gate_stats_t gate;
+            change_gate_get_stats((change_gate_stream_t)stream, &gate);
+            if (gate.changed || gate.keepalive || gate.skipped)
+            {
+                ESP_LOGI(TAG, "Change gate %s: changed=%lu keepalive=%lu skipped=%lu saved=%lu KB",
+                         gate_names[stream], (unsigned long)gate.changed, (unsigned long)gate.keepalive,
+                         (unsigned long)gate.skipped, (unsigned long)(gate.bytes_saved / 1024));
+            }
+        }
+#endif
+        uvc_controls_stats_t controls;
+        uvc_controls_get_stats(&controls);
+        if (controls.get_requests || controls.set_requests || controls.rejected)
+        {
+            ESP_LOGI(TAG, "Controls: get=%lu set=%lu rejected=%lu applied=%lu coalesced=%lu failed=%lu apply max=%lu us",
+                     (unsigned long)controls.get_requests, (unsigned long)controls.set_requests,
+                     (unsigned long)controls.rejected, (unsigned long)controls.applied,
+                     (unsigned long)controls.coalesced, (unsigned long)controls.failed,
+                     (unsigned long)controls.apply_max_us);
+        }
+        if (uvc_latency.gap_count)
+        {
+            ESP_LOGI(TAG, "USB latency: commit->first frame=%lu us, idle gap min/avg/max=%lu/%lu/%lu us",
+                     (unsigned long)uvc_latency.commit_to_first_frame_us,
+                     (unsigned long)uvc_latency.gap_min_us,
+                     (unsigned long)(uvc_latency.gap_sum_us / uvc_latency.gap_count),
+                     (unsigned long)uvc_latency.gap_max_us);
+        }
+        for (int stage = 0; stage < FRAME_TIMING_STAGE_COUNT; stage++)
+        {
+            frame_timing_summary_t t;
+            frame_timing_get((frame_timing_stage_t)stage, &t);
+            if (t.count)
+            {
+                ESP_LOGI(TAG, "Timing %-17s min/avg/p99/max=%lu/%lu/%lu/%lu us (%lu frames)",
+                         frame_timing_stage_name((frame_timing_stage_t)stage),
+                         (unsigned long)t.min_us, (unsigned long)t.avg_us,
+                         (unsigned long)t.p99_us, (unsigned long)t.max_us, (unsigned long)t.count);
+            }
         }
+        ESP_LOGI(TAG, "==================");
     }
 }
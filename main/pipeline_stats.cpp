@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+extern "C" {
+#include "esp_log.h"
+#include "esp_timer.h"
+}
+#include "pipeline_stats.h"
+
+static const char *TAG = "PIPELINE";
+
+uint32_t pipeline_counters[PIPELINE_COUNTER_COUNT];
+
+static uint32_t last_counts[PIPELINE_COUNTER_COUNT];
+static int64_t last_summary_us;
+
+void pipeline_stats_snapshot(uint32_t counts[PIPELINE_COUNTER_COUNT])
+{
+    for (int i = 0; i < PIPELINE_COUNTER_COUNT; i++)
+    {
+        counts[i] = __atomic_load_n(&pipeline_counters[i], __ATOMIC_RELAXED);
+    }
+}
+
+void pipeline_stats_log_summary(void)
+{
+    uint32_t now_counts[PIPELINE_COUNTER_COUNT];
+    int64_t now = esp_timer_get_time();
+    pipeline_stats_snapshot(now_counts);
+
+    // Rates in hundredths of a frame per second since the previous summary
+    // (since boot for the first one)
+    uint32_t elapsed_ms = (uint32_t)((now - last_summary_us) / 1000);
+    uint32_t rate[PIPELINE_COUNTER_COUNT] = {};
+    if (elapsed_ms)
+    {
+        for (int i = 0; i < PIPELINE_COUNTER_COUNT; i++)
+        {
+            rate[i] = (uint32_t)((uint64_t)(now_counts[i] - last_counts[i]) * 100000 / elapsed_ms);
+        }
+    }
+
+    ESP_LOGI(TAG, "captured=%lu (%lu.%02lu/s) validated=%lu dropped=%lu sent=%lu (%lu.%02lu/s) repeated=%lu errored=%lu trimmed=%lu KB",
+             (unsigned long)now_counts[PIPELINE_CAPTURED],
+             (unsigned long)(rate[PIPELINE_CAPTURED] / 100), (unsigned long)(rate[PIPELINE_CAPTURED] % 100),
+             (unsigned long)now_counts[PIPELINE_VALIDATED],
+             (unsigned long)now_counts[PIPELINE_DROPPED],
+             (unsigned long)now_counts[PIPELINE_SENT],
+             (unsigned long)(rate[PIPELINE_SENT] / 100), (unsigned long)(rate[PIPELINE_SENT] % 100),
+             (unsigned long)now_counts[PIPELINE_REPEATED],
+             (unsigned long)now_counts[PIPELINE_ERRORED],
+             (unsigned long)(now_counts[PIPELINE_TRIMMED_BYTES] / 1024));
+
+    for (int i = 0; i < PIPELINE_COUNTER_COUNT; i++)
+    {
+        last_counts[i] = now_counts[i];
+    }
+    last_summary_us = now;
+}
@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Per-frame trace lines. Compiled out entirely unless CONFIG_UVC_FRAME_TRACE
+// is set; the disabled form still type-checks the format arguments.
+#if CONFIG_UVC_FRAME_TRACE
+#define PIPELINE_TRACE(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#else
+#define PIPELINE_TRACE(tag, format, ...)                   \
+  do                                                       \
+  {                                                        \
+    if (0)                                                 \
+    {                                                      \
+      ESP_LOGI(tag, format, ##__VA_ARGS__);                \
+    }                                                      \
+  } while (0)
+#endif
+
+  typedef enum
+  {
+    PIPELINE_CAPTURED = 0,  // Frames returned by esp_camera_fb_get
+    PIPELINE_VALIDATED,     // Frames that passed validation and were queued for USB
+    PIPELINE_DROPPED,       // Good frames discarded: superseded, no slot, stale mode
+    PIPELINE_SENT,          // Frames whose USB transfer completed
+    PIPELINE_REPEATED,      // Transfers that resent the previous frame to hold the frame interval
+    PIPELINE_ERRORED,       // Capture failures, invalid frames, rejected transfers
+    PIPELINE_TRIMMED_BYTES, // Bytes of sensor padding after EOI not sent over USB
+    PIPELINE_COUNTER_COUNT,
+  } pipeline_counter_t;
+
+  extern uint32_t pipeline_counters[PIPELINE_COUNTER_COUNT];
+
+  // Lock-free, callable from any task or callback on either core
+  static inline void pipeline_count(pipeline_counter_t counter)
+  {
+    __atomic_fetch_add(&pipeline_counters[counter], 1, __ATOMIC_RELAXED);
+  }
+
+  static inline void pipeline_count_n(pipeline_counter_t counter, uint32_t n)
+  {
+    __atomic_fetch_add(&pipeline_counters[counter], n, __ATOMIC_RELAXED);
+  }
+
+  void pipeline_stats_snapshot(uint32_t counts[PIPELINE_COUNTER_COUNT]);
+
+  // Log counter totals and per-second rates since the previous call
+  void pipeline_stats_log_summary(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,167 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+}
+#include "pixel_pack.h"
+
+static const char *TAG = "PIXEL_PACK";
+
+void pixel_pack_swap16_scalar(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    // Two pixels' worth of bytes per step, memcpy keeps it alignment-safe
+    for (; i + 4 <= len; i += 4)
+    {
+        uint32_t w;
+        memcpy(&w, src + i, 4);
+        w = ((w & 0x00FF00FFu) << 8) | ((w >> 8) & 0x00FF00FFu);
+        memcpy(dst + i, &w, 4);
+    }
+    for (; i + 2 <= len; i += 2)
+    {
+        uint8_t b = src[i];
+        dst[i] = src[i + 1];
+        dst[i + 1] = b;
+    }
+}
+
+#if CONFIG_UVC_PIXEL_PACK_PIE
+// 32 bytes per iteration: de-interleave even/odd bytes into two Q registers,
+// then interleave them back in the opposite order. src and dst 16-byte aligned.
+#if __XTENSA__
+static void swap16_pie(uint8_t *dst, const uint8_t *src, size_t blocks)
+{
+    __asm__ volatile(
+        "1:\n"
+        "ee.vld.128.ip q0, %0, 16\n"
+        "ee.vld.128.ip q1, %0, 16\n"
+        "ee.vunzip.8 q0, q1\n"
+        "ee.vzip.8 q1, q0\n"
+        "ee.vst.128.ip q1, %1, 16\n"
+        "ee.vst.128.ip q0, %1, 16\n"
+        "addi %2, %2, -1\n"
+        "bnez %2, 1b\n"
+        : "+r"(src), "+r"(dst), "+r"(blocks)
+        :
+        : "memory");
+}
+#else
+// Host model of the loop above for the unit test: the same register steps,
+// and addresses lose their low four bits as on the vector unit, so a wrong
+// head split shows up as wrong bytes instead of passing by accident
+static void swap16_pie(uint8_t *dst, const uint8_t *src, size_t blocks)
+{
+    const uint8_t *s = (const uint8_t *)((uintptr_t)src & ~(uintptr_t)15);
+    uint8_t *d = (uint8_t *)((uintptr_t)dst & ~(uintptr_t)15);
+    for (; blocks; blocks--, s += 32, d += 32)
+    {
+        uint8_t q0[16], q1[16], even[16], odd[16];
+        memcpy(q0, s, 16);
+        memcpy(q1, s + 16, 16);
+        // ee.vunzip.8 q0, q1: even bytes of q0:q1 to q0, odd bytes to q1
+        for (int i = 0; i < 16; i++)
+        {
+            even[i] = i < 8 ? q0[2 * i] : q1[2 * i - 16];
+            odd[i] = i < 8 ? q0[2 * i + 1] : q1[2 * i - 15];
+        }
+        // ee.vzip.8 q1, q0: interleave them back, odd byte first
+        for (int i = 0; i < 16; i++)
+        {
+            uint8_t *out = i < 8 ? q1 : q0;
+            int k = (i % 8) * 2;
+            out[k] = odd[i];
+            out[k + 1] = even[i];
+        }
+        memcpy(d, q1, 16);
+        memcpy(d + 16, q0, 16);
+    }
+}
+#endif
+#endif
+
+void pixel_pack_swap16(uint8_t *dst, const uint8_t *src, size_t len)
+{
+#if CONFIG_UVC_PIXEL_PACK_PIE
+    // Vector loads/stores ignore the low four address bits, so both buffers
+    // must reach 16-byte alignment after the same (even) number of bytes
+    size_t head = (16 - ((uintptr_t)src & 15)) & 15;
+    if (((uintptr_t)src & 15) == ((uintptr_t)dst & 15) && (head & 1) == 0 && len >= head + 32)
+    {
+        pixel_pack_swap16_scalar(dst, src, head);
+        size_t blocks = (len - head) / 32;
+        swap16_pie(dst + head, src + head, blocks);
+
+        size_t done = head + blocks * 32;
+        dst += done;
+        src += done;
+        len -= done;
+    }
+#endif
+    pixel_pack_swap16_scalar(dst, src, len);
+}
+
+typedef void (*swap16_fn_t)(uint8_t *dst, const uint8_t *src, size_t len);
+
+static void benchmark_kernel(const char *name, swap16_fn_t fn, uint8_t *buf, size_t len)
+{
+    const int runs = 10;
+    uint32_t best = UINT32_MAX;
+
+    for (int i = 0; i < runs; i++)
+    {
+        uint32_t start = esp_cpu_get_cycle_count();
+        fn(buf, buf, len);
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        if (cycles < best)
+        {
+            best = cycles;
+        }
+    }
+
+    size_t pixels = len / 2;
+    ESP_LOGI(TAG, "%-7s %7lu cycles, %lu.%02lu cycles/pixel", name, (unsigned long)best,
+             (unsigned long)(best / pixels), (unsigned long)((best % pixels) * 100 / pixels));
+}
+
+void pixel_pack_benchmark(void)
+{
+    const size_t len = 320 * 240 * 2;
+    const struct
+    {
+        const char *name;
+        uint32_t caps;
+    } regions[] = {
+        {"PSRAM", MALLOC_CAP_SPIRAM},
+        {"SRAM", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+    };
+
+    for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); r++)
+    {
+        uint8_t *buf = (uint8_t *)heap_caps_aligned_alloc(16, len, regions[r].caps);
+        if (buf == NULL)
+        {
+            ESP_LOGW(TAG, "No %s memory for %zu byte benchmark buffer", regions[r].name, len);
+            continue;
+        }
+        for (size_t i = 0; i < len; i++)
+        {
+            buf[i] = (uint8_t)i;
+        }
+
+        ESP_LOGI(TAG, "swap16 on 320x240 YUV422 in %s:", regions[r].name);
+        benchmark_kernel("scalar", pixel_pack_swap16_scalar, buf, len);
+#if CONFIG_UVC_PIXEL_PACK_PIE
+        benchmark_kernel("pie", pixel_pack_swap16, buf, len);
+#endif
+        heap_caps_free(buf);
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Swap the two bytes of every 16-bit word, e.g. UYVY -> YUY2. len must be
+  // even; src and dst may be the same buffer. Uses the ESP32-S3 PIE vector
+  // unit on 16-byte aligned spans when enabled, the scalar path otherwise.
+  void pixel_pack_swap16(uint8_t *dst, const uint8_t *src, size_t len);
+
+  // Portable word-at-a-time implementation, also used for unaligned edges
+  void pixel_pack_swap16_scalar(uint8_t *dst, const uint8_t *src, size_t len);
+
+  // Log cycles per pixel of the available kernels on a QVGA YUV422 frame
+  void pixel_pack_benchmark(void);
+
+#ifdef __cplusplus
+}
+#endif
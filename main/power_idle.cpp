@@ -0,0 +1,192 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+#include "driver/ledc.h"
+}
+#include "power_idle.h"
+
+static const char *TAG = "POWER_IDLE";
+
+// OV2640 COM2 in the sensor bank (bit 8 of the address selects it in
+// esp32-camera's set_reg): bit 4 is soft standby, the other bits set the
+// output drive and stay as they are
+#define OV2640_REG_COM2 0x109
+#define OV2640_COM2_STANDBY 0x10
+
+static ledc_timer_t xclk_timer;
+static uint32_t resume_budget_us;
+static esp_pm_lock_handle_t cpu_lock;
+
+static power_idle_stats_t idle_stats;
+static int64_t idle_since_us;
+static int64_t resume_start_us;   // Non-zero until the first valid frame after a resume
+static portMUX_TYPE idle_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t power_idle_init(ledc_timer_t timer, uint32_t idle_cpu_mhz, uint32_t resume_budget_ms)
+{
+    xclk_timer = timer;
+    resume_budget_us = resume_budget_ms * 1000;
+    if (idle_cpu_mhz == 0)
+    {
+        return ESP_OK;
+    }
+
+    // No light sleep: the USB controller must answer the host at any time
+    esp_pm_config_t pm = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = (int)idle_cpu_mhz,
+        .light_sleep_enable = false,
+    };
+    esp_err_t err = esp_pm_configure(&pm);
+    if (err == ESP_OK)
+    {
+        err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "capture", &cpu_lock);
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_pm_lock_acquire(cpu_lock);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No frequency scaling (%s), the CPU stays at %d MHz while idle", esp_err_to_name(err),
+                 CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+        return err;
+    }
+    idle_stats.cpu_scaling = true;
+    return ESP_OK;
+}
+
+esp_err_t power_idle_enter(sensor_t *s)
+{
+    int64_t start = esp_timer_get_time();
+
+    // SCCB needs XCLK: standby first, then the clock
+    esp_err_t err = ESP_OK;
+    if (s == NULL || s->set_reg(s, OV2640_REG_COM2, OV2640_COM2_STANDBY, OV2640_COM2_STANDBY) != 0)
+    {
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK)
+    {
+        err = ledc_timer_pause(LEDC_LOW_SPEED_MODE, xclk_timer);
+    }
+    if (cpu_lock)
+    {
+        esp_pm_lock_release(cpu_lock);
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&idle_lock);
+    idle_stats.entries++;
+    idle_stats.failures += err != ESP_OK;
+    idle_stats.enter_last_us = (uint32_t)(now - start);
+    idle_stats.idle = true;
+    idle_since_us = now;
+    resume_start_us = 0;
+    portEXIT_CRITICAL(&idle_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Sensor standby failed, only the CPU is slowed down");
+    }
+    return err;
+}
+
+esp_err_t power_idle_exit(sensor_t *s)
+{
+    int64_t start = esp_timer_get_time();
+
+    if (cpu_lock)
+    {
+        esp_pm_lock_acquire(cpu_lock);
+    }
+    esp_err_t err = ledc_timer_resume(LEDC_LOW_SPEED_MODE, xclk_timer);
+    if (s == NULL || s->set_reg(s, OV2640_REG_COM2, OV2640_COM2_STANDBY, 0) != 0)
+    {
+        err = ESP_FAIL;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&idle_lock);
+    idle_stats.failures += err != ESP_OK;
+    idle_stats.wake_last_us = (uint32_t)(now - start);
+    idle_stats.idle_us += now - idle_since_us;
+    idle_stats.idle = false;
+    resume_start_us = start;
+    portEXIT_CRITICAL(&idle_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Sensor wake-up failed, capture recovery takes over");
+    }
+    return err;
+}
+
+bool power_idle_active(void)
+{
+    portENTER_CRITICAL(&idle_lock);
+    bool idle = idle_stats.idle;
+    portEXIT_CRITICAL(&idle_lock);
+    return idle;
+}
+
+bool power_idle_stale(int64_t capture_us)
+{
+    portENTER_CRITICAL(&idle_lock);
+    bool stale = resume_start_us && capture_us < resume_start_us;
+    idle_stats.stale += stale;
+    portEXIT_CRITICAL(&idle_lock);
+    return stale;
+}
+
+void power_idle_frame_ok(void)
+{
+    // Cheap check first: this runs once per frame
+    if (__atomic_load_n(&resume_start_us, __ATOMIC_RELAXED) == 0)
+    {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&idle_lock);
+    uint32_t resume_us = (uint32_t)(now - resume_start_us);
+    resume_start_us = 0;
+    idle_stats.resumes++;
+    idle_stats.resume_last_us = resume_us;
+    if (resume_us > idle_stats.resume_max_us)
+    {
+        idle_stats.resume_max_us = resume_us;
+    }
+    bool late = resume_budget_us && resume_us > resume_budget_us;
+    idle_stats.over_budget += late;
+    portEXIT_CRITICAL(&idle_lock);
+
+    if (late)
+    {
+        ESP_LOGW(TAG, "Resume took %lu us, over the %lu ms budget", (unsigned long)resume_us,
+                 (unsigned long)(resume_budget_us / 1000));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Resumed from idle, first frame after %lu us", (unsigned long)resume_us);
+    }
+}
+
+void power_idle_get_stats(power_idle_stats_t *stats)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&idle_lock);
+    *stats = idle_stats;
+    if (idle_stats.idle)
+    {
+        stats->idle_us += now - idle_since_us;
+    }
+    portEXIT_CRITICAL(&idle_lock);
+}
@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Low-power idle while nothing streams. camera_task stops the capture DMA
+  // and calls power_idle_enter, which puts the OV2640 into standby through
+  // COM2 (the board has no PWDN line), stops the LEDC timer that drives XCLK
+  // and releases the lock that holds the CPU at full speed, so esp_pm drops
+  // it to the idle frequency. power_idle_exit undoes this in reverse order;
+  // standby keeps every sensor register, so capture restarts without a
+  // reinit or another AEC settle. The resume is timed from the exit to the
+  // first valid frame.
+
+  typedef struct
+  {
+    uint32_t entries;         // Times the camera went idle
+    uint32_t resumes;         // ... and came back with a valid frame
+    uint32_t failures;        // Standby or clock writes that failed
+    uint64_t idle_us;         // Time spent idle, the current period included
+    uint32_t enter_last_us;   // Standby write, XCLK stop and CPU lock release
+    uint32_t wake_last_us;    // CPU lock, XCLK start and standby exit
+    uint32_t resume_last_us;  // power_idle_exit -> first valid frame
+    uint32_t resume_max_us;
+    uint32_t over_budget;     // Resumes slower than the budget
+    uint32_t stale;           // Frames dropped after a resume because they were captured before it
+    bool idle;
+    bool cpu_scaling;         // esp_pm lowers the CPU frequency while idle
+  } power_idle_stats_t;
+
+  // Configure frequency scaling between the default CPU frequency and
+  // idle_cpu_mhz (0 = keep the CPU at full speed) and hold it at full speed.
+  // xclk_timer is the LEDC timer the camera driver generates XCLK with;
+  // resumes slower than resume_budget_ms are counted.
+  esp_err_t power_idle_init(ledc_timer_t xclk_timer, uint32_t idle_cpu_mhz, uint32_t resume_budget_ms);
+
+  // Capture DMA already stopped
+  esp_err_t power_idle_enter(sensor_t *s);
+
+  // Sensor clocked and awake again; the capture DMA is restarted after this
+  esp_err_t power_idle_exit(sensor_t *s);
+
+  bool power_idle_active(void);
+
+  // The frame captured at capture_us was read out before the last resume:
+  // it waited in the driver's queue through the idle period
+  bool power_idle_stale(int64_t capture_us);
+
+  // A frame passed validation; the first one after a resume ends it
+  void power_idle_frame_ok(void);
+
+  void power_idle_get_stats(power_idle_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,199 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+}
+#include "rate_ctrl.h"
+#include "pipeline_stats.h"
+
+static const char *TAG = "RATE_CTRL";
+
+// The tuning options depend on UVC_RATE_CTRL and are not defined without it;
+// the controller then still tracks sizes and throughput for the status log
+#if CONFIG_UVC_RATE_CTRL
+#define RATE_CTRL_ENABLED true
+#else
+#define RATE_CTRL_ENABLED false
+#define CONFIG_UVC_RATE_CTRL_BITRATE_KBPS 0
+#define CONFIG_UVC_RATE_CTRL_MAX_FRAME_KB 0
+#define CONFIG_UVC_RATE_CTRL_QUALITY_BEST 0
+#define CONFIG_UVC_RATE_CTRL_QUALITY_WORST 63
+#define CONFIG_UVC_RATE_CTRL_HEADROOM_PCT 100
+#define CONFIG_UVC_RATE_CTRL_HYSTERESIS_PCT 0
+#endif
+
+// A new quality reaches the host a frame or two later (frames already in the
+// DMA keep the old one); wait this many frames before judging it
+#define RATE_CTRL_HOLDOFF_FRAMES 4
+
+// Frames this far above the budget step the quality faster
+#define RATE_CTRL_FAST_STEP_PCT 150
+#define RATE_CTRL_FAST_STEP 3
+
+static rate_ctrl_state_t ctrl;
+static uint32_t frames_since_change;
+static portMUX_TYPE ctrl_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Per-frame byte budget for the current target; 0 while still unknown
+static uint32_t compute_budget(void)
+{
+    const rate_ctrl_target_t *t = &ctrl.target;
+    uint64_t bps = t->bitrate_bps;
+    if (bps == 0)
+    {
+        bps = (uint64_t)ctrl.throughput_bps * CONFIG_UVC_RATE_CTRL_HEADROOM_PCT / 100;
+    }
+
+    uint32_t budget = (uint32_t)(bps / 8 * t->frame_interval_us / 1000000);
+    if (t->max_frame_bytes && (budget == 0 || budget > t->max_frame_bytes))
+    {
+        budget = t->max_frame_bytes;
+    }
+    return budget;
+}
+
+void rate_ctrl_init(uint8_t initial_quality)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.enabled = RATE_CTRL_ENABLED;
+    ctrl.quality = initial_quality;
+    ctrl.target.frame_interval_us = 1000000 / 30;
+    ctrl.target.bitrate_bps = CONFIG_UVC_RATE_CTRL_BITRATE_KBPS * 1000;
+    ctrl.target.max_frame_bytes = CONFIG_UVC_RATE_CTRL_MAX_FRAME_KB * 1024;
+    ctrl.target.quality_best = CONFIG_UVC_RATE_CTRL_QUALITY_BEST;
+    ctrl.target.quality_worst = CONFIG_UVC_RATE_CTRL_QUALITY_WORST;
+    frames_since_change = 0;
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+void rate_ctrl_set_target(const rate_ctrl_target_t *target)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    ctrl.target = *target;
+    if (ctrl.target.quality_worst < ctrl.target.quality_best)
+    {
+        ctrl.target.quality_worst = ctrl.target.quality_best;
+    }
+    ctrl.budget_bytes = compute_budget();
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+void rate_ctrl_set_frame_interval(uint32_t interval_us)
+{
+    if (interval_us == 0)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&ctrl_lock);
+    ctrl.target.frame_interval_us = interval_us;
+    ctrl.budget_bytes = compute_budget();
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+void rate_ctrl_get_state(rate_ctrl_state_t *state)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    *state = ctrl;
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+uint8_t rate_ctrl_quality(void)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    uint8_t quality = ctrl.quality;
+    portEXIT_CRITICAL(&ctrl_lock);
+    return quality;
+}
+
+void rate_ctrl_reset_stats(void)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    ctrl.avg_frame_bytes = 0;
+    frames_since_change = 0;
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+int rate_ctrl_on_frame(size_t jpeg_bytes)
+{
+    int new_quality = -1;
+    uint32_t budget;
+    uint32_t avg_bytes;
+
+    portENTER_CRITICAL(&ctrl_lock);
+    // Smooth over 4 frames so one busy frame does not trigger a change
+    int32_t avg = (int32_t)ctrl.avg_frame_bytes;
+    avg = avg ? avg + ((int32_t)jpeg_bytes - avg) / 4 : (int32_t)jpeg_bytes;
+    ctrl.avg_frame_bytes = (uint32_t)avg;
+    avg_bytes = ctrl.avg_frame_bytes;
+    frames_since_change++;
+
+    budget = ctrl.budget_bytes;
+    if (ctrl.quality < ctrl.target.quality_best || ctrl.quality > ctrl.target.quality_worst)
+    {
+        // The range moved past the current quality: follow it right away
+        int quality = ctrl.quality < ctrl.target.quality_best ? ctrl.target.quality_best : ctrl.target.quality_worst;
+        ctrl.quality = (uint8_t)quality;
+        ctrl.adjustments++;
+        frames_since_change = 0;
+        new_quality = quality;
+    }
+    else if (ctrl.enabled && budget && frames_since_change >= RATE_CTRL_HOLDOFF_FRAMES)
+    {
+        uint32_t high = (uint32_t)((uint64_t)budget * (100 + CONFIG_UVC_RATE_CTRL_HYSTERESIS_PCT) / 100);
+        uint32_t low = (uint32_t)((uint64_t)budget * (100 - CONFIG_UVC_RATE_CTRL_HYSTERESIS_PCT) / 100);
+        int quality = ctrl.quality;
+
+        // Higher quality values mean stronger compression
+        if (ctrl.avg_frame_bytes > high && quality < ctrl.target.quality_worst)
+        {
+            bool far_over = (uint64_t)ctrl.avg_frame_bytes * 100 > (uint64_t)budget * RATE_CTRL_FAST_STEP_PCT;
+            quality += far_over ? RATE_CTRL_FAST_STEP : 1;
+            if (quality > ctrl.target.quality_worst)
+            {
+                quality = ctrl.target.quality_worst;
+            }
+        }
+        else if (ctrl.avg_frame_bytes < low && quality > ctrl.target.quality_best)
+        {
+            quality--;
+        }
+
+        if (quality != ctrl.quality)
+        {
+            ctrl.quality = (uint8_t)quality;
+            ctrl.adjustments++;
+            frames_since_change = 0;
+            new_quality = quality;
+        }
+    }
+    portEXIT_CRITICAL(&ctrl_lock);
+
+    if (new_quality >= 0)
+    {
+        PIPELINE_TRACE(TAG, "avg frame %lu B, budget %lu B -> quality %d",
+                       (unsigned long)avg_bytes, (unsigned long)budget, new_quality);
+    }
+    return new_quality;
+}
+
+void rate_ctrl_on_transfer(size_t len, uint32_t duration_us)
+{
+    if (duration_us == 0)
+    {
+        return;
+    }
+    uint32_t bps = (uint32_t)((uint64_t)len * 8 * 1000000 / duration_us);
+
+    portENTER_CRITICAL(&ctrl_lock);
+    int32_t avg = (int32_t)ctrl.throughput_bps;
+    ctrl.throughput_bps = avg ? (uint32_t)(avg + ((int32_t)bps - avg) / 8) : bps;
+    ctrl.budget_bytes = compute_budget();
+    portEXIT_CRITICAL(&ctrl_lock);
+}
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Closed-loop JPEG quality control. The capture side reports compressed
+  // frame sizes, the USB side reports transfer durations; between frames the
+  // controller moves the sensor quality so the average frame fits the per-frame
+  // byte budget of the target frame rate (or bitrate), with a dead band and a
+  // hold-off so it does not oscillate.
+
+  typedef struct
+  {
+    uint32_t frame_interval_us; // Target frame period, from the committed dwFrameInterval
+    uint32_t bitrate_bps;       // Fixed bitrate target, 0 = use the measured USB throughput
+    uint32_t max_frame_bytes;   // Hard cap on the frame size budget, 0 = none
+    uint8_t quality_best;       // Lowest (best) quality value the controller may use
+    uint8_t quality_worst;      // Highest (worst) quality value the controller may use
+  } rate_ctrl_target_t;
+
+  typedef struct
+  {
+    bool enabled;
+    uint8_t quality;            // Value last applied with set_quality
+    uint32_t budget_bytes;      // Current per-frame byte budget
+    uint32_t avg_frame_bytes;   // Smoothed compressed frame size
+    uint32_t throughput_bps;    // Smoothed USB transfer throughput
+    uint32_t adjustments;       // Quality changes so far
+    rate_ctrl_target_t target;
+  } rate_ctrl_state_t;
+
+  // initial_quality is the value the sensor was configured with
+  void rate_ctrl_init(uint8_t initial_quality);
+
+  // A quality range that excludes the current quality moves it into the
+  // range with the next frame, without waiting for the budget; a range of
+  // one value pins it
+  void rate_ctrl_set_target(const rate_ctrl_target_t *target);
+  void rate_ctrl_set_frame_interval(uint32_t interval_us);
+  void rate_ctrl_get_state(rate_ctrl_state_t *state);
+
+  // Quality the sensor should currently use, e.g. after a camera restart
+  uint8_t rate_ctrl_quality(void);
+
+  // Capture side: size of a compressed frame about to be queued. Returns the
+  // quality to apply before the next frame, or -1 to leave it unchanged.
+  int rate_ctrl_on_frame(size_t jpeg_bytes);
+
+  // USB side: a frame of len bytes took duration_us on the endpoint
+  void rate_ctrl_on_transfer(size_t len, uint32_t duration_us);
+
+  // Forget measurements, e.g. after a mode switch changed the frame sizes
+  void rate_ctrl_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,195 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "nvs.h"
+}
+#include "sensor_state.h"
+
+static const char *TAG = "SENSOR_STATE";
+
+#define NVS_NAMESPACE "uvc_cam"
+#define NVS_KEY "sensor_state"
+
+// OV2640 sensor bank registers holding the AEC/AGC loop state (bit 8 selects
+// BANK_SENSOR for set_reg/get_reg)
+#define OV2640_REG_GAIN 0x100  // AGC[7:0]
+#define OV2640_REG_REG04 0x104 // AEC[1:0] in bits 1:0
+#define OV2640_REG_AEC 0x110   // AEC[9:2]
+#define OV2640_REG_REG45 0x145 // AGC[9:8] in bits 7:6, AEC[15:10] in bits 5:0
+
+// Frame-to-frame change still counted as settled, and change from the stored
+// state worth a flash write, in % (with a floor of a few codes near zero)
+#define SETTLE_TOLERANCE_PCT 3
+#define SAVE_TOLERANCE_PCT 10
+#define TOLERANCE_FLOOR 2
+
+#if CONFIG_UVC_SENSOR_STATE_NVS
+#define SENSOR_STATE_NVS_ENABLED 1
+#else
+#define SENSOR_STATE_NVS_ENABLED 0
+#endif
+
+// Versioned so a layout change never restores garbage
+typedef struct
+{
+    uint8_t version;
+    sensor_state_t state;
+} stored_state_t;
+
+#define STORED_STATE_VERSION 1
+
+static bool have_cached;
+static sensor_state_t cached;  // Last converged state, restored on every (re)init
+static sensor_state_t stored;  // What NVS holds
+static bool have_stored;
+
+static sensor_state_t settle_prev;
+static uint32_t settle_stable;
+static bool settle_have_prev;
+
+static bool within(uint16_t a, uint16_t b, int pct)
+{
+    int tolerance = (int)a * pct / 100;
+    if (tolerance < TOLERANCE_FLOOR)
+    {
+        tolerance = TOLERANCE_FLOOR;
+    }
+    return abs((int)a - (int)b) <= tolerance;
+}
+
+static bool state_within(const sensor_state_t *a, const sensor_state_t *b, int pct)
+{
+    return within(a->aec, b->aec, pct) && within(a->agc, b->agc, pct);
+}
+
+void sensor_state_init(void)
+{
+    if (!SENSOR_STATE_NVS_ENABLED)
+    {
+        return;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+    {
+        // The namespace does not exist before the first save
+        ESP_LOGI(TAG, "No stored sensor state (%s)", esp_err_to_name(err));
+        return;
+    }
+
+    stored_state_t blob;
+    size_t len = sizeof(blob);
+    err = nvs_get_blob(handle, NVS_KEY, &blob, &len);
+    nvs_close(handle);
+    if (err != ESP_OK || len != sizeof(blob) || blob.version != STORED_STATE_VERSION)
+    {
+        ESP_LOGI(TAG, "No usable stored sensor state (%s)", esp_err_to_name(err));
+        return;
+    }
+
+    cached = stored = blob.state;
+    have_cached = have_stored = true;
+    ESP_LOGI(TAG, "Stored sensor state: exposure %u lines, gain %u", cached.aec, cached.agc);
+}
+
+bool sensor_state_restore(sensor_t *s)
+{
+    if (s == NULL || !have_cached)
+    {
+        return false;
+    }
+
+    // Written while the loops run: they continue from these values
+    int err = s->set_reg(s, OV2640_REG_REG04, 0x03, cached.aec & 0x03);
+    err |= s->set_reg(s, OV2640_REG_AEC, 0xFF, (cached.aec >> 2) & 0xFF);
+    err |= s->set_reg(s, OV2640_REG_GAIN, 0xFF, cached.agc & 0xFF);
+    err |= s->set_reg(s, OV2640_REG_REG45, 0xFF, ((cached.agc >> 2) & 0xC0) | ((cached.aec >> 10) & 0x3F));
+    if (err)
+    {
+        ESP_LOGW(TAG, "Failed to restore sensor state");
+        return false;
+    }
+    return true;
+}
+
+bool sensor_state_read(sensor_t *s, sensor_state_t *state)
+{
+    if (s == NULL)
+    {
+        return false;
+    }
+
+    int reg04 = s->get_reg(s, OV2640_REG_REG04, 0x03);
+    int aec = s->get_reg(s, OV2640_REG_AEC, 0xFF);
+    int gain = s->get_reg(s, OV2640_REG_GAIN, 0xFF);
+    int reg45 = s->get_reg(s, OV2640_REG_REG45, 0xFF);
+    if (reg04 < 0 || aec < 0 || gain < 0 || reg45 < 0)
+    {
+        return false;
+    }
+
+    state->aec = (uint16_t)(((reg45 & 0x3F) << 10) | (aec << 2) | reg04);
+    state->agc = (uint16_t)(((reg45 & 0xC0) << 2) | gain);
+    return true;
+}
+
+void sensor_state_settle_start(void)
+{
+    settle_have_prev = false;
+    settle_stable = 0;
+}
+
+bool sensor_state_settle_update(const sensor_state_t *state)
+{
+    if (settle_have_prev && state_within(&settle_prev, state, SETTLE_TOLERANCE_PCT))
+    {
+        settle_stable++;
+    }
+    else
+    {
+        settle_stable = 0;
+    }
+    settle_prev = *state;
+    settle_have_prev = true;
+    return settle_stable >= CONFIG_UVC_SENSOR_SETTLE_FRAMES;
+}
+
+void sensor_state_save(const sensor_state_t *state)
+{
+    cached = *state;
+    have_cached = true;
+
+    if (!SENSOR_STATE_NVS_ENABLED || (have_stored && state_within(&stored, state, SAVE_TOLERANCE_PCT)))
+    {
+        return;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        stored_state_t blob = {.version = STORED_STATE_VERSION, .state = *state};
+        err = nvs_set_blob(handle, NVS_KEY, &blob, sizeof(blob));
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to store sensor state: %s", esp_err_to_name(err));
+        return;
+    }
+
+    stored = *state;
+    have_stored = true;
+    ESP_LOGI(TAG, "Stored sensor state: exposure %u lines, gain %u", state->aec, state->agc);
+}
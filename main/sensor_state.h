@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Converged automatic exposure state of the OV2640
+  typedef struct
+  {
+    uint16_t aec; // Exposure time, line periods
+    uint16_t agc; // Analog gain code
+  } sensor_state_t;
+
+  // Loads the state stored by a previous boot, if any
+  void sensor_state_init(void);
+
+  // Seeds the AEC/AGC loops with the last converged state so they start
+  // next to the scene instead of at the sensor defaults. Returns false when
+  // there is nothing to restore.
+  bool sensor_state_restore(sensor_t *s);
+
+  // Current AEC/AGC registers, false on an SCCB error
+  bool sensor_state_read(sensor_t *s, sensor_state_t *state);
+
+  // Readiness: feed the state read after every frame, returns true once it
+  // held still for CONFIG_UVC_SENSOR_SETTLE_FRAMES frames
+  void sensor_state_settle_start(void);
+  bool sensor_state_settle_update(const sensor_state_t *state);
+
+  // Remembers a converged state for the next (re)init and writes it to NVS
+  // when it moved noticeably from the stored one, to spare the flash
+  void sensor_state_save(const sensor_state_t *state);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,194 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+extern "C" {
+#include "freertos/FreeRTOS.h"
+}
+#include "sensor_window.h"
+
+// Field of each readout mode and its binning relative to UXGA, fastest first
+typedef struct
+{
+    sensor_readout_t readout;
+    uint16_t width;
+    uint16_t height;
+    uint8_t div;
+    uint8_t fps;
+} readout_mode_t;
+
+static const readout_mode_t readout_modes[] = {
+    {SENSOR_READOUT_CIF, 400, 296, 4, 60},
+    {SENSOR_READOUT_SVGA, 800, 600, 2, 30},
+    {SENSOR_READOUT_UXGA, 1600, 1200, 1, 15},
+};
+
+#define READOUT_MODE_COUNT (sizeof(readout_modes) / sizeof(readout_modes[0]))
+
+static int32_t roi_zoom = SENSOR_WINDOW_ZOOM_MIN;
+static int32_t roi_pan;
+static int32_t roi_tilt;
+static bool roi_changed;
+static sensor_window_stats_t window_stats;
+static portMUX_TYPE window_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int set_value(int32_t *value, int32_t v)
+{
+    portENTER_CRITICAL(&window_lock);
+    if (*value != v)
+    {
+        *value = v;
+        roi_changed = true;
+    }
+    portEXIT_CRITICAL(&window_lock);
+    return 0;
+}
+
+int sensor_window_set_zoom(int32_t zoom)
+{
+    return set_value(&roi_zoom, zoom);
+}
+
+int sensor_window_set_pan(int32_t pan)
+{
+    return set_value(&roi_pan, pan);
+}
+
+int sensor_window_set_tilt(int32_t tilt)
+{
+    return set_value(&roi_tilt, tilt);
+}
+
+bool sensor_window_changed(void)
+{
+    // Cheap check first: this runs once per frame
+    return __atomic_load_n(&roi_changed, __ATOMIC_RELAXED) && __atomic_exchange_n(&roi_changed, false, __ATOMIC_RELAXED);
+}
+
+// Window start for a position of -100..100 across the free travel
+static uint16_t window_offset(uint32_t field, uint32_t total, int32_t pos)
+{
+    uint32_t travel = field - total;
+    return (uint16_t)((travel * (uint32_t)(pos + SENSOR_WINDOW_PAN_MAX) / (2 * SENSOR_WINDOW_PAN_MAX)) & ~1u);
+}
+
+void sensor_window_get(uint16_t width, uint16_t height, sensor_window_t *win)
+{
+    portENTER_CRITICAL(&window_lock);
+    int32_t zoom = roi_zoom;
+    int32_t pan = roi_pan;
+    int32_t tilt = roi_tilt;
+    portEXIT_CRITICAL(&window_lock);
+
+    const readout_mode_t *full = &readout_modes[READOUT_MODE_COUNT - 1];
+    if (zoom < SENSOR_WINDOW_ZOOM_MIN)
+    {
+        zoom = SENSOR_WINDOW_ZOOM_MIN;
+    }
+
+    // Largest window of the output's aspect ratio in the full field, shrunk by the zoom
+    uint32_t base_w = full->width;
+    uint32_t base_h = full->height;
+    if ((uint32_t)width * full->height >= (uint32_t)height * full->width)
+    {
+        base_h = (uint32_t)full->width * height / width;
+    }
+    else
+    {
+        base_w = (uint32_t)full->height * width / height;
+    }
+    uint32_t w = base_w * SENSOR_WINDOW_ZOOM_MIN / zoom;
+    uint32_t h = base_h * SENSOR_WINDOW_ZOOM_MIN / zoom;
+
+    // The DSP only scales down: the fastest readout that fills the output,
+    // or the full resolution window of the output size beyond that
+    const readout_mode_t *mode = full;
+    uint32_t total_x = width;
+    uint32_t total_y = height;
+    for (size_t i = 0; i < READOUT_MODE_COUNT; i++)
+    {
+        const readout_mode_t *m = &readout_modes[i];
+        uint32_t tx = w / m->div < m->width ? w / m->div : m->width;
+        uint32_t ty = h / m->div < m->height ? h / m->div : m->height;
+        if (tx >= width && ty >= height)
+        {
+            mode = m;
+            total_x = tx;
+            total_y = ty;
+            break;
+        }
+    }
+
+    // HSIZE and VSIZE are in 8 pixel units; every frame size is a multiple of 8
+    total_x &= ~7u;
+    total_y &= ~7u;
+    total_x = total_x < width ? width : total_x;
+    total_y = total_y < height ? height : total_y;
+
+    win->readout = mode->readout;
+    win->total_x = (uint16_t)total_x;
+    win->total_y = (uint16_t)total_y;
+    win->offset_x = window_offset(mode->width, total_x, pan);
+    win->offset_y = window_offset(mode->height, total_y, tilt);
+    win->output_x = width;
+    win->output_y = height;
+    win->zoom = (uint16_t)(base_w * SENSOR_WINDOW_ZOOM_MIN / (total_x * mode->div));
+    win->zoom = win->zoom < SENSOR_WINDOW_ZOOM_MIN ? SENSOR_WINDOW_ZOOM_MIN : win->zoom;
+    win->cropped = zoom > SENSOR_WINDOW_ZOOM_MIN || pan != 0 || tilt != 0;
+    win->fps = mode->fps;
+}
+
+const char *sensor_window_readout_name(sensor_readout_t readout)
+{
+    switch (readout)
+    {
+    case SENSOR_READOUT_UXGA:
+        return "UXGA";
+    case SENSOR_READOUT_SVGA:
+        return "SVGA";
+    case SENSOR_READOUT_CIF:
+        return "CIF";
+    default:
+        return "?";
+    }
+}
+
+esp_err_t sensor_window_program(sensor_t *s, const sensor_window_t *win)
+{
+    // The OV2640 driver takes the readout mode in startX and ignores the
+    // other raw sensor coordinates
+    if (s == NULL || s->set_res_raw(s, win->readout, 0, 0, 0, win->offset_x, win->offset_y, win->total_x,
+                                    win->total_y, win->output_x, win->output_y, false, false) != 0)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void sensor_window_record_switch(uint32_t switch_us, uint32_t sccb_us)
+{
+    portENTER_CRITICAL(&window_lock);
+    window_stats.switches++;
+    window_stats.sccb_last_us = sccb_us;
+    window_stats.last_us = switch_us;
+    if (switch_us > window_stats.max_us)
+    {
+        window_stats.max_us = switch_us;
+    }
+    portEXIT_CRITICAL(&window_lock);
+}
+
+void sensor_window_count_torn(void)
+{
+    portENTER_CRITICAL(&window_lock);
+    window_stats.torn++;
+    portEXIT_CRITICAL(&window_lock);
+}
+
+void sensor_window_get_stats(sensor_window_stats_t *stats)
+{
+    portENTER_CRITICAL(&window_lock);
+    *stats = window_stats;
+    portEXIT_CRITICAL(&window_lock);
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Digital zoom in hundredths: 100 is the full field, 400 a quarter of its width
+#define SENSOR_WINDOW_ZOOM_MIN 100
+#define SENSOR_WINDOW_ZOOM_MAX 400
+
+// Pan and tilt move the window across the free travel, -100..100 percent
+#define SENSOR_WINDOW_PAN_MAX 100
+
+  // Region of interest: the OV2640 DSP crops a window out of the sensor
+  // readout and scales it to the committed output size, so the host keeps its
+  // stream format while the field of view narrows. The output is never
+  // upscaled: zoom stops where the window reaches the output size at the
+  // full UXGA resolution. The sensor reads out in one of three modes, UXGA
+  // (1600x1200, 15 fps), SVGA (binned to 800x600, 30 fps) or CIF (binned to
+  // 400x296, 60 fps); the fastest mode that still has as many pixels in the
+  // window as the output needs is used. A small output size therefore keeps
+  // a fast readout up to a higher zoom.
+
+  // esp32-camera's ov2640_sensor_mode_t, passed as set_res_raw's startX
+  typedef enum
+  {
+    SENSOR_READOUT_UXGA = 0,
+    SENSOR_READOUT_SVGA,
+    SENSOR_READOUT_CIF,
+  } sensor_readout_t;
+
+  typedef struct
+  {
+    sensor_readout_t readout;
+    uint16_t offset_x;  // Window in readout mode pixels
+    uint16_t offset_y;
+    uint16_t total_x;
+    uint16_t total_y;
+    uint16_t output_x;
+    uint16_t output_y;
+    uint16_t zoom;      // Zoom the window gives, after clamping and alignment
+    bool cropped;       // Zoom, pan or tilt away from the default full field
+    uint32_t fps;       // Frame rate of the readout mode at the default clock
+  } sensor_window_t;
+
+  typedef struct
+  {
+    uint32_t switches;      // Windows programmed for a control change
+    uint32_t torn;          // Frames dropped because their readout began before a switch
+    uint32_t sccb_last_us;  // set_res_raw and clock divider writes
+    uint32_t last_us;       // Switch start -> first frame read out with the new window
+    uint32_t max_us;
+  } sensor_window_stats_t;
+
+  // Control side, from uvc_controls_apply_pending in camera_task: store the
+  // host's values. The window is programmed once for all of them.
+  int sensor_window_set_zoom(int32_t zoom);
+  int sensor_window_set_pan(int32_t pan);
+  int sensor_window_set_tilt(int32_t tilt);
+
+  // Zoom, pan or tilt changed since the last call
+  bool sensor_window_changed(void);
+
+  // Window for an output size at the current zoom, pan and tilt
+  void sensor_window_get(uint16_t width, uint16_t height, sensor_window_t *win);
+
+  const char *sensor_window_readout_name(sensor_readout_t readout);
+
+  // Write the window to the sensor; resets the sensor clock divider
+  esp_err_t sensor_window_program(sensor_t *s, const sensor_window_t *win);
+
+  // Capture side: the first frame with the new window was read out switch_us
+  // after the switch began, torn frames before it were dropped
+  void sensor_window_record_switch(uint32_t switch_us, uint32_t sccb_us);
+  void sensor_window_count_torn(void);
+
+  void sensor_window_get_stats(sensor_window_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
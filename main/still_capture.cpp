@@ -0,0 +1,373 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "tusb.h"
+}
+#include "still_capture.h"
+
+static const char *TAG = "UVC_STILL";
+
+// GET_INFO: supports GET and SET
+#define STILL_CONTROL_INFO_GET_SET 0x03
+
+// Pre-allocated so a trigger never waits on (or fails) a 300 KB allocation
+static uint8_t *still_buf;
+static size_t still_capacity;
+static size_t still_len;
+static int64_t still_capture_us;
+
+static uint8_t still_format;      // bFormatIndex offering stills, 0 = none
+static uint8_t still_frame_count;
+static uint32_t still_payload_size;
+static uint8_t streaming_format;  // Committed video format, 0 = not streaming
+
+static still_probe_commit_t probe;
+static still_probe_commit_t commit;
+static still_state_t state;
+static int64_t trigger_us;
+static int64_t submit_us;
+static still_capture_stats_t stats;
+static portMUX_TYPE still_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void default_params(still_probe_commit_t *p, uint8_t frame_index)
+{
+    p->bFormatIndex = still_format;
+    p->bFrameIndex = frame_index;
+    p->bCompressionIndex = 1;
+    p->dwMaxVideoFrameSize = (uint32_t)still_capacity;
+    p->dwMaxPayloadTransferSize = still_payload_size;
+}
+
+esp_err_t still_capture_init(uint8_t format_index, uint8_t frame_count, size_t max_frame_size,
+                             uint32_t payload_size)
+{
+    still_buf = (uint8_t *)heap_caps_malloc(max_frame_size, MALLOC_CAP_SPIRAM);
+    if (still_buf == NULL)
+    {
+        ESP_LOGE(TAG, "No PSRAM for a %zu byte still buffer, still capture disabled", max_frame_size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&still_lock);
+    still_capacity = max_frame_size;
+    still_format = format_index;
+    still_frame_count = frame_count;
+    still_payload_size = payload_size;
+    default_params(&probe, 1);
+    default_params(&commit, 1);
+    state = STILL_IDLE;
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&still_lock);
+    return ESP_OK;
+}
+
+video_error_code_t still_capture_get(uint8_t selector, uint8_t request, uint8_t *buf, uint16_t *len)
+{
+    uint8_t answer[sizeof(still_probe_commit_t)];
+    uint16_t answer_len = sizeof(still_probe_commit_t);
+    video_error_code_t err = VIDEO_ERROR_NONE;
+
+    portENTER_CRITICAL(&still_lock);
+    if (selector == UVC_VS_STILL_PROBE_CONTROL || selector == UVC_VS_STILL_COMMIT_CONTROL)
+    {
+        still_probe_commit_t p = {};
+        switch (request)
+        {
+        case VIDEO_REQUEST_GET_CUR:
+            p = selector == UVC_VS_STILL_PROBE_CONTROL ? probe : commit;
+            break;
+        case VIDEO_REQUEST_GET_MIN:
+        case VIDEO_REQUEST_GET_DEF:
+            default_params(&p, 1);
+            break;
+        case VIDEO_REQUEST_GET_MAX:
+            default_params(&p, still_frame_count);
+            break;
+        case VIDEO_REQUEST_GET_LEN:
+            answer_len = 2;
+            answer[0] = sizeof(still_probe_commit_t);
+            answer[1] = 0;
+            break;
+        case VIDEO_REQUEST_GET_INFO:
+            answer_len = 1;
+            answer[0] = STILL_CONTROL_INFO_GET_SET;
+            break;
+        default:
+            err = VIDEO_ERROR_INVALID_REQUEST;
+            break;
+        }
+        if (answer_len == sizeof(p))
+        {
+            memcpy(answer, &p, sizeof(p));
+        }
+    }
+    else if (selector == UVC_VS_STILL_IMAGE_TRIGGER_CONTROL)
+    {
+        answer_len = 1;
+        if (request == VIDEO_REQUEST_GET_CUR)
+        {
+            // Goes back to normal by itself once the still is on its way
+            answer[0] = state == STILL_IDLE ? UVC_STILL_TRIGGER_NORMAL : UVC_STILL_TRIGGER_TRANSMIT;
+        }
+        else if (request == VIDEO_REQUEST_GET_INFO)
+        {
+            answer[0] = STILL_CONTROL_INFO_GET_SET;
+        }
+        else
+        {
+            err = VIDEO_ERROR_INVALID_REQUEST;
+        }
+    }
+    else
+    {
+        err = VIDEO_ERROR_INVALID_CONTROL;
+    }
+    portEXIT_CRITICAL(&still_lock);
+
+    if (err == VIDEO_ERROR_NONE)
+    {
+        *len = answer_len < *len ? answer_len : *len;
+        memcpy(buf, answer, *len);
+    }
+    return err;
+}
+
+static video_error_code_t set_trigger(uint8_t value)
+{
+    // Called with still_lock held
+    switch (value)
+    {
+    case UVC_STILL_TRIGGER_NORMAL:
+        return VIDEO_ERROR_NONE;
+    case UVC_STILL_TRIGGER_TRANSMIT:
+        if (still_buf == NULL || still_format == 0 || streaming_format != still_format || state != STILL_IDLE)
+        {
+            return VIDEO_ERROR_WRONG_STATE;
+        }
+        state = STILL_TRIGGERED;
+        trigger_us = esp_timer_get_time();
+        stats.triggers++;
+        return VIDEO_ERROR_NONE;
+    case UVC_STILL_TRIGGER_ABORT:
+        // A still already on the pipe has to finish, its payloads are framed
+        if (state != STILL_IDLE && state != STILL_SENDING)
+        {
+            state = STILL_IDLE;
+            stats.aborted++;
+        }
+        return VIDEO_ERROR_NONE;
+    default:
+        // Method 3 (dedicated bulk pipe) is not offered
+        return VIDEO_ERROR_OUT_OF_RANGE;
+    }
+}
+
+video_error_code_t still_capture_set(uint8_t selector, const uint8_t *buf, uint16_t len)
+{
+    video_error_code_t err = VIDEO_ERROR_NONE;
+
+    portENTER_CRITICAL(&still_lock);
+    if (selector == UVC_VS_STILL_PROBE_CONTROL || selector == UVC_VS_STILL_COMMIT_CONTROL)
+    {
+        still_probe_commit_t p;
+        if (len < 3 || len > sizeof(p))
+        {
+            err = VIDEO_ERROR_INVALID_REQUEST;
+        }
+        else
+        {
+            // The device decides the sizes, only the indexes are the host's
+            default_params(&p, 1);
+            memcpy(&p, buf, 3);
+            if (p.bFormatIndex != still_format || p.bFrameIndex < 1 || p.bFrameIndex > still_frame_count ||
+                p.bCompressionIndex > 1)
+            {
+                err = VIDEO_ERROR_OUT_OF_RANGE;
+            }
+            else
+            {
+                p.bCompressionIndex = 1;
+                probe = p;
+                if (selector == UVC_VS_STILL_COMMIT_CONTROL)
+                {
+                    commit = p;
+                }
+            }
+        }
+    }
+    else if (selector == UVC_VS_STILL_IMAGE_TRIGGER_CONTROL)
+    {
+        err = len == 1 ? set_trigger(buf[0]) : VIDEO_ERROR_INVALID_REQUEST;
+    }
+    else
+    {
+        err = VIDEO_ERROR_INVALID_CONTROL;
+    }
+    portEXIT_CRITICAL(&still_lock);
+
+    ESP_LOGD(TAG, "SET_CUR selector %u (%u bytes): %d", selector, len, err);
+    return err;
+}
+
+void still_capture_stream_start(uint8_t format_index)
+{
+    portENTER_CRITICAL(&still_lock);
+    streaming_format = format_index;
+    portEXIT_CRITICAL(&still_lock);
+}
+
+void still_capture_stream_stop(void)
+{
+    portENTER_CRITICAL(&still_lock);
+    streaming_format = 0;
+    // The stack dropped a still in flight along with the stream
+    if (state != STILL_IDLE)
+    {
+        state = STILL_IDLE;
+        stats.aborted++;
+    }
+    portEXIT_CRITICAL(&still_lock);
+}
+
+bool still_capture_pending(void)
+{
+    return __atomic_load_n(&state, __ATOMIC_RELAXED) == STILL_TRIGGERED;
+}
+
+uint8_t still_capture_begin(void)
+{
+    uint8_t frame_index = 0;
+
+    portENTER_CRITICAL(&still_lock);
+    if (state == STILL_TRIGGERED)
+    {
+        state = STILL_CAPTURING;
+        frame_index = commit.bFrameIndex;
+    }
+    portEXIT_CRITICAL(&still_lock);
+    return frame_index;
+}
+
+bool still_capture_finish(const uint8_t *data, size_t len, int64_t capture_us)
+{
+    // CAPTURING belongs to the capture side: the buffer is not read until
+    // READY, an abort only moves the state away under the lock
+    bool fits = data != NULL && len <= still_capacity;
+    if (fits)
+    {
+        memcpy(still_buf, data, len);
+    }
+
+    bool ok = false;
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - trigger_us);
+    portENTER_CRITICAL(&still_lock);
+    if (state == STILL_CAPTURING)
+    {
+        if (fits)
+        {
+            state = STILL_READY;
+            still_len = len;
+            still_capture_us = capture_us;
+            stats.last_bytes = (uint32_t)len;
+            stats.capture_last_us = elapsed;
+            if (elapsed > stats.capture_max_us)
+            {
+                stats.capture_max_us = elapsed;
+            }
+            ok = true;
+        }
+        else
+        {
+            state = STILL_IDLE;
+            stats.failed++;
+        }
+    }
+    portEXIT_CRITICAL(&still_lock);
+
+    if (data != NULL && !fits)
+    {
+        ESP_LOGW(TAG, "Still of %zu bytes does not fit the %zu byte buffer", len, still_capacity);
+    }
+    return ok;
+}
+
+void still_capture_record_gap(uint32_t gap_us, uint32_t frame_interval_us)
+{
+    uint32_t frames = frame_interval_us ? (gap_us + frame_interval_us / 2) / frame_interval_us : 0;
+
+    portENTER_CRITICAL(&still_lock);
+    stats.gap_last_us = gap_us;
+    stats.gap_last_frames = frames;
+    if (gap_us > stats.gap_max_us)
+    {
+        stats.gap_max_us = gap_us;
+        stats.gap_max_frames = frames;
+    }
+    portEXIT_CRITICAL(&still_lock);
+}
+
+const uint8_t *still_capture_acquire(size_t *len, int64_t *capture_us)
+{
+    const uint8_t *buf = NULL;
+
+    portENTER_CRITICAL(&still_lock);
+    if (state == STILL_READY)
+    {
+        state = STILL_SENDING;
+        submit_us = esp_timer_get_time();
+        *len = still_len;
+        *capture_us = still_capture_us;
+        buf = still_buf;
+    }
+    portEXIT_CRITICAL(&still_lock);
+    return buf;
+}
+
+bool still_capture_release(bool delivered)
+{
+    bool was_sending = false;
+
+    portENTER_CRITICAL(&still_lock);
+    if (state == STILL_SENDING)
+    {
+        was_sending = true;
+        state = STILL_IDLE;
+        if (delivered)
+        {
+            stats.sent++;
+            stats.send_last_us = (uint32_t)(esp_timer_get_time() - submit_us);
+        }
+        else
+        {
+            stats.failed++;
+        }
+    }
+    portEXIT_CRITICAL(&still_lock);
+    return was_sending;
+}
+
+bool still_capture_ready(void)
+{
+    return __atomic_load_n(&state, __ATOMIC_RELAXED) == STILL_READY;
+}
+
+bool still_capture_in_flight(void)
+{
+    return __atomic_load_n(&state, __ATOMIC_RELAXED) == STILL_SENDING;
+}
+
+void still_capture_get_stats(still_capture_stats_t *out)
+{
+    portENTER_CRITICAL(&still_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&still_lock);
+}
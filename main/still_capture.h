@@ -0,0 +1,120 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "class/video/video.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// VideoStreaming interface control selectors of the still image (UVC 1.5 Table A-9)
+#define UVC_VS_STILL_PROBE_CONTROL 0x03
+#define UVC_VS_STILL_COMMIT_CONTROL 0x04
+#define UVC_VS_STILL_IMAGE_TRIGGER_CONTROL 0x05
+
+// VS_STILL_IMAGE_TRIGGER_CONTROL values
+#define UVC_STILL_TRIGGER_NORMAL 0
+#define UVC_STILL_TRIGGER_TRANSMIT 1
+#define UVC_STILL_TRIGGER_TRANSMIT_BULK 2 // Method 3 only
+#define UVC_STILL_TRIGGER_ABORT 3
+
+// bmHeaderInfo STI bit: the payload belongs to a still image
+#define UVC_PAYLOAD_HEADER_STI (1u << 5)
+
+  // Still probe and commit controls (UVC 1.5 Table 4-77)
+  typedef struct __attribute__((packed))
+  {
+    uint8_t bFormatIndex;
+    uint8_t bFrameIndex;              // Image size pattern of the still image frame descriptor
+    uint8_t bCompressionIndex;
+    uint32_t dwMaxVideoFrameSize;
+    uint32_t dwMaxPayloadTransferSize;
+  } still_probe_commit_t;
+
+  // Still image method 2: the host triggers, the next frame on the video pipe
+  // is a full resolution image with the STI bit set in its payload headers.
+  // IDLE -> TRIGGERED (host) -> CAPTURING (camera task) -> READY -> SENDING (USB) -> IDLE
+  typedef enum
+  {
+    STILL_IDLE = 0,
+    STILL_TRIGGERED,
+    STILL_CAPTURING,
+    STILL_READY,
+    STILL_SENDING,
+  } still_state_t;
+
+  typedef struct
+  {
+    uint32_t triggers;      // Triggers accepted from the host
+    uint32_t sent;          // Stills delivered
+    uint32_t failed;        // No valid frame at still resolution within the frame budget
+    uint32_t aborted;       // Cancelled by the host or by the stream stopping
+    uint32_t last_bytes;
+    uint32_t capture_last_us; // Trigger -> still in the buffer
+    uint32_t capture_max_us;
+    uint32_t gap_last_us;     // Preview frames: last one before the switch -> first one after
+    uint32_t gap_max_us;
+    uint32_t gap_last_frames; // ... in frame periods of the stream
+    uint32_t gap_max_frames;
+    uint32_t send_last_us;    // Still transfer, submit -> complete
+  } still_capture_stats_t;
+
+  // Allocates the still buffer in PSRAM for the largest still frame; stills
+  // are offered for format_index with frame_count image sizes, sent in
+  // payloads of up to payload_size bytes
+  esp_err_t still_capture_init(uint8_t format_index, uint8_t frame_count, size_t max_frame_size,
+                               uint32_t payload_size);
+
+  // USB side, from the control request callback, same contract as
+  // uvc_controls_get/set
+  video_error_code_t still_capture_get(uint8_t selector, uint8_t request, uint8_t *buf, uint16_t *len);
+  video_error_code_t still_capture_set(uint8_t selector, const uint8_t *buf, uint16_t len);
+
+  // Stream committed with format_index, or stopped: triggers are only
+  // accepted while a format with stills is streaming, stopping drops a still
+  // that was not delivered yet
+  void still_capture_stream_start(uint8_t format_index);
+  void still_capture_stream_stop(void);
+
+  // Capture side: a trigger is waiting. Cheap, called once per frame.
+  bool still_capture_pending(void);
+
+  // Capture side: claim the trigger. Returns the committed bFrameIndex, 0 if
+  // the trigger was withdrawn meanwhile.
+  uint8_t still_capture_begin(void);
+
+  // Capture side: copy the image, captured at capture_us, into the still
+  // buffer (data NULL: no usable frame). Returns false if it did not fit or
+  // the still was aborted meanwhile.
+  bool still_capture_finish(const uint8_t *data, size_t len, int64_t capture_us);
+
+  // Capture side: preview frames resumed gap_us after the last one before the
+  // switch to the still resolution; frame_interval_us is the stream's period
+  void still_capture_record_gap(uint32_t gap_us, uint32_t frame_interval_us);
+
+  // USB side: claim the finished still for transfer, with its capture time.
+  // NULL if none is ready.
+  const uint8_t *still_capture_acquire(size_t *len, int64_t *capture_us);
+
+  // USB side: transfer completed (or was rejected). Returns false if no still
+  // was in flight, the completion belongs to a preview frame then.
+  bool still_capture_release(bool delivered);
+
+  bool still_capture_ready(void);
+  bool still_capture_in_flight(void);
+  void still_capture_get_stats(still_capture_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
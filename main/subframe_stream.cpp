@@ -0,0 +1,495 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+}
+#include "sdkconfig.h"
+#include "subframe_stream.h"
+#include "jpeg_scan.h"
+#include "usb_bounce.h"
+
+static const char *TAG = "SUBFRAME";
+
+typedef enum
+{
+    STREAM_IDLE = 0,
+    STREAM_OPEN,   // Chunks go out as they land
+    STREAM_ENDED,  // EOI seen, the rest of the frame is on its way
+    STREAM_FAILED, // Ending with the error bit
+} stream_state_t;
+
+// The streamed frame. It is on the bus until xfer_done; its buffer is the
+// driver's until camera_task claims it, then the ring's (handed) or ours
+// (held) until the transfer is over. fb_done: nothing left to follow.
+typedef struct
+{
+    stream_state_t state;
+    const uint8_t *base;
+    size_t landed;        // Bytes the DMA copied into the buffer so far
+    size_t data_start;    // EOI search starts here, past the tables
+    size_t len;           // Up to and including the EOI, once ended
+    int64_t start_us;
+    int64_t eoi_us;
+    int64_t xfer_done_us;
+    camera_fb_t *held;    // Back to the driver when the transfer is over
+    bool claimed;
+    bool handed;
+    bool fb_done;
+    bool xfer_done;
+} stream_frame_t;
+
+// A frame read out while the endpoint or the record is busy: it opens with a
+// later chunk once both are free, everything landed so far going out at once
+typedef struct
+{
+    const uint8_t *base;
+    size_t landed;
+    int64_t readout_us;   // First chunk landed, the frame's PTS
+} stream_pending_t;
+
+static stream_frame_t cur;
+static stream_pending_t pend;
+static bool armed;
+static void (*started_cb)(void);
+static subframe_stream_stats_t stream_stats;
+static portMUX_TYPE stream_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t subframe_stream_init(void (*started)(void))
+{
+    started_cb = started;
+    ESP_LOGI(TAG, "Frames stream to USB as the camera DMA lands them");
+    return ESP_OK;
+}
+
+void subframe_stream_arm(bool arm)
+{
+    __atomic_store_n(&armed, arm, __ATOMIC_RELAXED);
+}
+
+// Caller holds stream_lock: forget the frame once both halves are over.
+// Returns a buffer to give back to the driver, if we held one.
+static camera_fb_t *settle(void)
+{
+    if (cur.state == STREAM_IDLE || !cur.xfer_done || !cur.fb_done)
+    {
+        return NULL;
+    }
+    camera_fb_t *fb = cur.held;
+    memset(&cur, 0, sizeof(cur));
+    return fb;
+}
+
+void subframe_stream_cancel(void)
+{
+    subframe_stream_arm(false);
+
+    portENTER_CRITICAL(&stream_lock);
+    bool fail = cur.state == STREAM_OPEN;
+    if (fail)
+    {
+        cur.state = STREAM_FAILED;
+    }
+    pend.base = NULL;
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (fail)
+    {
+        usb_bounce_fail();
+    }
+}
+
+void subframe_stream_reset(void)
+{
+    portENTER_CRITICAL(&stream_lock);
+    pend.base = NULL;
+    if (cur.state != STREAM_IDLE && cur.xfer_done && !cur.claimed)
+    {
+        memset(&cur, 0, sizeof(cur));
+        stream_stats.dropped++;
+    }
+    portEXIT_CRITICAL(&stream_lock);
+}
+
+bool subframe_stream_busy(void)
+{
+    portENTER_CRITICAL(&stream_lock);
+    bool busy = cur.state != STREAM_IDLE && !cur.xfer_done;
+    portEXIT_CRITICAL(&stream_lock);
+    return busy;
+}
+
+// The next chunk of the streamed frame, from offset from on
+static void stream_chunk(const uint8_t *base, size_t from, size_t len, int64_t start)
+{
+    portENTER_CRITICAL(&stream_lock);
+    size_t data_start = cur.data_start;
+    portEXIT_CRITICAL(&stream_lock);
+
+    size_t eoi = jpeg_scan_eoi(base, from > data_start ? from : data_start, from + len);
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stream_lock);
+    bool ours = cur.state == STREAM_OPEN && cur.base == base;
+    if (ours)
+    {
+        cur.landed = from + len;
+        if (eoi)
+        {
+            cur.state = STREAM_ENDED;
+            cur.len = eoi;
+            cur.eoi_us = now;
+        }
+    }
+    stream_stats.scan_us += now - start;
+    portEXIT_CRITICAL(&stream_lock);
+
+    // Failed or aborted meanwhile: the bounce stage is done with it
+    if (ours)
+    {
+        usb_bounce_extend(eoi ? eoi : from + len, eoi != 0);
+    }
+}
+
+// The pending frame at base, landed bytes of it so far, opens if the record
+// and the endpoint are free
+static void stream_open(const uint8_t *base, size_t landed, int64_t start)
+{
+    portENTER_CRITICAL(&stream_lock);
+    bool free = __atomic_load_n(&armed, __ATOMIC_RELAXED) && cur.state == STREAM_IDLE && pend.base == base;
+    pend.landed = landed;
+    int64_t readout_us = pend.readout_us;
+    portEXIT_CRITICAL(&stream_lock);
+    // Not yet while a whole frame or still image is on the bus
+    if (!free || !usb_bounce_open(base, readout_us))
+    {
+        return;
+    }
+
+    // The header sits in the first chunk
+    size_t data_start = jpeg_scan_data_start(base, landed);
+    portENTER_CRITICAL(&stream_lock);
+    bool ours = pend.base == base;
+    pend.base = NULL;
+    cur.base = base;
+    if (ours)
+    {
+        cur.state = STREAM_OPEN;
+        cur.data_start = data_start ? data_start : 2;
+        cur.start_us = start;
+        stream_stats.started++;
+    }
+    else
+    {
+        // Cancelled meanwhile: end what was opened, nothing follows
+        cur.state = STREAM_FAILED;
+        cur.fb_done = true;
+    }
+    portEXIT_CRITICAL(&stream_lock);
+    if (!ours)
+    {
+        usb_bounce_fail();
+        return;
+    }
+    if (started_cb)
+    {
+        started_cb();
+    }
+    stream_chunk(base, 0, landed, start);
+}
+
+// A chunk that continues neither the streamed nor the pending frame: a new
+// readout
+static void stream_start(const uint8_t *dst, size_t len, int64_t start)
+{
+    bool soi = len >= 4 && dst[0] == 0xFF && dst[1] == 0xD8;
+    bool fail = false;
+
+    portENTER_CRITICAL(&stream_lock);
+    if (cur.state == STREAM_OPEN)
+    {
+        // The driver moved on before the streamed frame's EOI: it dropped
+        // the frame (no EOI, overflow) or the DMA was restarted
+        cur.state = STREAM_FAILED;
+        cur.fb_done = true;
+        stream_stats.dropped++;
+        fail = true;
+    }
+    else if (cur.state != STREAM_IDLE && !cur.claimed && !cur.fb_done && dst == cur.base)
+    {
+        // Its buffer is written again, camera_task never got it
+        cur.fb_done = true;
+        stream_stats.dropped++;
+        if (!cur.xfer_done && cur.state == STREAM_ENDED)
+        {
+            cur.state = STREAM_FAILED;
+            fail = true;
+        }
+    }
+    if (pend.base != NULL)
+    {
+        // Busy for all of it, the frame goes whole
+        stream_stats.busy++;
+    }
+    pend.base = soi && __atomic_load_n(&armed, __ATOMIC_RELAXED) ? dst : NULL;
+    pend.readout_us = start;
+    camera_fb_t *fb = settle();
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (fail)
+    {
+        usb_bounce_fail();
+    }
+    if (fb != NULL)
+    {
+        esp_camera_fb_return(fb);
+    }
+    if (soi)
+    {
+        stream_open(dst, len, start);
+    }
+}
+
+void subframe_stream_landed(const uint8_t *dst, size_t len)
+{
+    // Cheap check first: this runs for every DMA chunk of every frame
+    if (!__atomic_load_n(&armed, __ATOMIC_RELAXED) && __atomic_load_n(&cur.state, __ATOMIC_RELAXED) == STREAM_IDLE)
+    {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+
+    // The driver copies the chunks of a frame back to back
+    portENTER_CRITICAL(&stream_lock);
+    bool next = cur.state == STREAM_OPEN && dst == cur.base + cur.landed;
+    bool pending = pend.base != NULL && dst == pend.base + pend.landed;
+    const uint8_t *base = next ? cur.base : pend.base;
+    size_t from = next ? cur.landed : pend.landed;
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (next)
+    {
+        stream_chunk(base, from, len, start);
+    }
+    else if (pending)
+    {
+        stream_open(base, from + len, start);
+    }
+    else
+    {
+        stream_start(dst, len, start);
+    }
+}
+
+// Caller holds stream_lock: fb is the streamed frame, fetched by camera_task
+static bool claim(camera_fb_t *fb)
+{
+    if (cur.state == STREAM_IDLE || cur.claimed || cur.fb_done || fb->buf != cur.base)
+    {
+        return false;
+    }
+    cur.claimed = true;
+    return true;
+}
+
+bool subframe_stream_accept(camera_fb_t *fb, size_t *len, int64_t *start_us)
+{
+    bool finish = false;
+
+    portENTER_CRITICAL(&stream_lock);
+    if (!claim(fb))
+    {
+        portEXIT_CRITICAL(&stream_lock);
+        return false;
+    }
+    if (cur.state == STREAM_OPEN)
+    {
+        // The search missed the EOI camera_task found: trust the latter
+        cur.state = STREAM_ENDED;
+        cur.len = *len;
+        cur.eoi_us = esp_timer_get_time();
+        finish = true;
+    }
+    else if (cur.state == STREAM_ENDED)
+    {
+        *len = cur.len;
+    }
+    *start_us = cur.start_us;
+    // Ours until the handoff says the ring took it
+    cur.held = fb;
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (finish)
+    {
+        usb_bounce_extend(*len, true);
+    }
+    return true;
+}
+
+// Caller holds stream_lock: how a frame that is over on the bus ended for
+// the ring
+static subframe_xfer_t result(void)
+{
+    if (cur.handed)
+    {
+        return cur.state == STREAM_ENDED ? SUBFRAME_XFER_DELIVERED : SUBFRAME_XFER_FAILED;
+    }
+    return cur.fb_done ? SUBFRAME_XFER_DROPPED : SUBFRAME_XFER_PENDING;
+}
+
+subframe_xfer_t subframe_stream_handoff(bool in_ring, int64_t *done_us)
+{
+    subframe_xfer_t res = SUBFRAME_XFER_PENDING;
+
+    portENTER_CRITICAL(&stream_lock);
+    if (in_ring)
+    {
+        cur.handed = true;
+        cur.held = NULL;
+    }
+    cur.fb_done = true;
+    if (cur.xfer_done)
+    {
+        res = result();
+        *done_us = cur.xfer_done_us;
+    }
+    camera_fb_t *fb = settle();
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (fb != NULL)
+    {
+        esp_camera_fb_return(fb);
+    }
+    return res;
+}
+
+bool subframe_stream_reject(camera_fb_t *fb)
+{
+    portENTER_CRITICAL(&stream_lock);
+    if (!claim(fb))
+    {
+        portEXIT_CRITICAL(&stream_lock);
+        return false;
+    }
+    bool fail = !cur.xfer_done && cur.state != STREAM_FAILED;
+    bool late = cur.xfer_done && cur.state == STREAM_ENDED;
+    stream_state_t prev = cur.state;
+    if (fail)
+    {
+        cur.state = STREAM_FAILED;
+    }
+    cur.held = fb;
+    cur.fb_done = true;
+    camera_fb_t *done = settle();
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (fail && !usb_bounce_fail())
+    {
+        // The end of frame payload was already on the bus
+        portENTER_CRITICAL(&stream_lock);
+        if (cur.state == STREAM_FAILED && cur.base == fb->buf)
+        {
+            cur.state = prev;
+        }
+        portEXIT_CRITICAL(&stream_lock);
+        late = true;
+    }
+    if (late)
+    {
+        portENTER_CRITICAL(&stream_lock);
+        stream_stats.late_rejects++;
+        portEXIT_CRITICAL(&stream_lock);
+    }
+    if (done != NULL)
+    {
+        esp_camera_fb_return(done);
+    }
+    return true;
+}
+
+subframe_xfer_t subframe_stream_xfer_done(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stream_lock);
+    if (cur.state == STREAM_IDLE || cur.xfer_done)
+    {
+        portEXIT_CRITICAL(&stream_lock);
+        return SUBFRAME_XFER_NONE;
+    }
+    cur.xfer_done = true;
+    cur.xfer_done_us = now;
+    if (cur.state == STREAM_ENDED)
+    {
+        uint32_t tail = (uint32_t)(now - cur.eoi_us);
+        stream_stats.delivered++;
+        stream_stats.tail_last_us = tail;
+        stream_stats.tail_sum_us += tail;
+        if (tail > stream_stats.tail_max_us)
+        {
+            stream_stats.tail_max_us = tail;
+        }
+    }
+    else
+    {
+        stream_stats.failed++;
+    }
+    subframe_xfer_t res = result();
+    camera_fb_t *fb = settle();
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (fb != NULL)
+    {
+        esp_camera_fb_return(fb);
+    }
+    return res;
+}
+
+void subframe_stream_abort(void)
+{
+    portENTER_CRITICAL(&stream_lock);
+    pend.base = NULL;
+    if (cur.state != STREAM_IDLE && !cur.xfer_done)
+    {
+        cur.xfer_done = true;
+        cur.state = STREAM_FAILED;
+        stream_stats.aborted++;
+    }
+    camera_fb_t *fb = settle();
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (fb != NULL)
+    {
+        esp_camera_fb_return(fb);
+    }
+}
+
+void subframe_stream_get_stats(subframe_stream_stats_t *stats)
+{
+    portENTER_CRITICAL(&stream_lock);
+    *stats = stream_stats;
+    portEXIT_CRITICAL(&stream_lock);
+}
+
+#if CONFIG_UVC_SUBFRAME_STREAM
+// esp32-camera's task copies each DMA half-buffer into the frame buffer
+// with ll_cam_memcpy, back to back from the start of the buffer, and hands
+// the frame over only after the last one. The EOI search reads what the
+// copy just wrote, mostly from the cache. This is a driver internal of the
+// esp32-camera version pinned in idf_component.yml, and its PSRAM DMA mode
+// (16 MHz XCLK) bypasses it; main.cpp asserts the clock.
+extern "C" size_t __real_ll_cam_memcpy(void *cam, uint8_t *out, const uint8_t *in, size_t len);
+
+extern "C" size_t __wrap_ll_cam_memcpy(void *cam, uint8_t *out, const uint8_t *in, size_t len)
+{
+    size_t copied = __real_ll_cam_memcpy(cam, out, in, len);
+    subframe_stream_landed(out, copied);
+    return copied;
+}
+#endif
@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Sub-frame streaming: a JPEG frame goes to the host while the camera DMA
+  // is still writing it. esp32-camera copies each DMA half-buffer into the
+  // frame buffer in its own task; the link wraps that copy (ll_cam_memcpy,
+  // see CMakeLists.txt), so every chunk is reported here as it lands. A
+  // chunk starting with SOI opens a frame in the bounce stage, later chunks
+  // extend it, and the first EOI after the scan header gives its length and
+  // with it the end of frame bit. A streamed frame that never reaches its
+  // EOI (the driver dropped it, the DMA restarted) or that camera_task
+  // rejects goes out with the error bit instead, which makes the host drop
+  // it. Only one frame streams at a time. A frame starting while the
+  // endpoint is busy opens with a later chunk once it is free, everything
+  // landed so far going out at once, or else takes the whole-frame path.
+  //
+  // The buffer of a streamed frame belongs to the driver until camera_task
+  // fetches it, then to the frame ring as its in-flight frame. Whichever
+  // comes last of the handoff and the end of the transfer completes it.
+
+  typedef enum
+  {
+    SUBFRAME_XFER_NONE = 0,  // Not a streamed frame, complete it as usual
+    SUBFRAME_XFER_PENDING,   // The other half (transfer or handoff) is still outstanding
+    SUBFRAME_XFER_DELIVERED, // Delivered, the ring's in-flight frame
+    SUBFRAME_XFER_FAILED,    // Ended with the error bit, the ring's in-flight frame
+    SUBFRAME_XFER_DROPPED,   // Over, and the ring never had it
+  } subframe_xfer_t;
+
+  typedef struct
+  {
+    uint32_t started;      // Frames whose transfer began with their first DMA chunk
+    uint32_t delivered;    // ... ended with the end of frame bit after their EOI
+    uint32_t failed;       // ... ended with the error bit (corrupt, dropped, cancelled)
+    uint32_t aborted;      // ... cut short by a stream stop
+    uint32_t dropped;      // Streamed frames the driver never handed to camera_task
+    uint32_t late_rejects; // Rejected by camera_task after the host had them whole
+    uint32_t busy;         // Frames left to the whole-frame path, the endpoint was busy all along
+    uint32_t tail_last_us; // EOI landed -> last payload delivered
+    uint32_t tail_max_us;
+    uint64_t tail_sum_us;
+    uint64_t scan_us;      // EOI search, in the driver's task
+  } subframe_stream_stats_t;
+
+  // started runs in the driver's task each time a frame starts streaming
+  esp_err_t subframe_stream_init(void (*started)(void));
+
+  // camera_task: frames starting from now on may stream. Off while anything
+  // could still reject a frame after its EOI (mode or window switch, still
+  // capture, recovery) or while the stream is not MJPEG through the bounce
+  // stage.
+  void subframe_stream_arm(bool armed);
+
+  // Disarm, and end a frame still being read out with the error bit, e.g.
+  // before the driver frees its buffers
+  void subframe_stream_cancel(void);
+
+  // The driver is about to free its buffers: forget a streamed frame that
+  // is off the bus but was never fetched. Call after cancel and once busy
+  // is false.
+  void subframe_stream_reset(void);
+
+  // A streamed frame is on the bus
+  bool subframe_stream_busy(void);
+
+  // A DMA chunk of len bytes landed at dst; called from the ll_cam_memcpy wrap
+  void subframe_stream_landed(const uint8_t *dst, size_t len);
+
+  // camera_task fetched fb and found it valid, len bytes long. Returns false
+  // if it was not streamed. Otherwise *len becomes what the host gets, and
+  // *start_us when it started; the caller hands it over with
+  // frame_ring_push_sent and reports the result to subframe_stream_handoff.
+  bool subframe_stream_accept(camera_fb_t *fb, size_t *len, int64_t *start_us);
+
+  // in_ring: frame_ring_push_sent took the accepted frame; otherwise its
+  // buffer stays here until the transfer is over. Returns PENDING while the
+  // transfer runs, else how it ended and, in *done_us, when.
+  subframe_xfer_t subframe_stream_handoff(bool in_ring, int64_t *done_us);
+
+  // camera_task rejects fb. Returns false if it was not streamed; otherwise
+  // the frame is ended with the error bit if the host does not have it whole
+  // yet, and fb goes back to the driver once the bounce stage is done with it.
+  bool subframe_stream_reject(camera_fb_t *fb);
+
+  // Bounce stage frame_done, in the USB device task
+  subframe_xfer_t subframe_stream_xfer_done(void);
+
+  // Stream stopped and usb_bounce_abort dropped the transfer
+  void subframe_stream_abort(void);
+
+  void subframe_stream_get_stats(subframe_stream_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,516 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_intr_alloc.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+}
+#include "task_plan.h"
+
+static const char *TAG = "TASK_PLAN";
+
+#if CONFIG_UVC_TASK_PLAN_LOW_LATENCY
+#define TASK_PLAN_NAME "lowest latency"
+#elif CONFIG_UVC_TASK_PLAN_THROUGHPUT
+#define TASK_PLAN_NAME "max throughput"
+#elif CONFIG_UVC_TASK_PLAN_CUSTOM
+#define TASK_PLAN_NAME "custom"
+#else
+#define TASK_PLAN_NAME "balanced"
+#endif
+
+// Core of the camera driver's own task, which moves each DMA chunk into the
+// frame buffer; esp32-camera's CAMERA_TASK_PINNED_TO_CORE follows the preset
+#if CONFIG_CAMERA_CORE1
+#define TASK_PLAN_CAMERA_DRIVER_CORE 1
+#elif CONFIG_CAMERA_NO_AFFINITY
+#define TASK_PLAN_CAMERA_DRIVER_CORE -1
+#else
+#define TASK_PLAN_CAMERA_DRIVER_CORE 0
+#endif
+
+// Kconfig's -1 ("either core") is FreeRTOS' tskNO_AFFINITY
+#define TASK_PLAN_CORE(core) ((core) < 0 ? tskNO_AFFINITY : (BaseType_t)(core))
+
+static const task_plan_entry_t plan[TASK_PLAN_TASK_COUNT] = {
+    {"usb_device_task", TASK_PLAN_CORE(CONFIG_UVC_TASK_USB_CORE), CONFIG_UVC_TASK_USB_PRIORITY,
+     CONFIG_UVC_TASK_USB_STACK},
+    {"uvc_task", TASK_PLAN_CORE(CONFIG_UVC_TASK_UVC_CORE), CONFIG_UVC_TASK_UVC_PRIORITY, CONFIG_UVC_TASK_UVC_STACK},
+    {"camera_task", TASK_PLAN_CORE(CONFIG_UVC_TASK_CAMERA_CORE), CONFIG_UVC_TASK_CAMERA_PRIORITY,
+     CONFIG_UVC_TASK_CAMERA_STACK},
+};
+
+// Planned core per interrupt owner, -1 = where it is allocated
+static const int isr_plan[TASK_PLAN_ISR_COUNT] = {-1, CONFIG_UVC_ISR_USB_CORE, CONFIG_UVC_ISR_CAMERA_CORE};
+static const char *const isr_names[TASK_PLAN_ISR_COUNT] = {"other", "usb", "camera"};
+
+// Helper task that allocates an owner's interrupts on its planned core;
+// esp_camera_init probes the sensor over SCCB from it
+#define TASK_PLAN_ISR_CALL_STACK 6144
+
+static portMUX_TYPE isr_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Task inside each owner's scope, NULL for none
+static TaskHandle_t scope_tasks[TASK_PLAN_ISR_COUNT];
+
+// Interrupts the calling task allocates from now on belong to owner, for the
+// load breakdown; TASK_PLAN_ISR_OTHER ends the scope
+static void isr_scope(task_plan_isr_t owner)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    portENTER_CRITICAL(&isr_lock);
+    for (int i = 1; i < TASK_PLAN_ISR_COUNT; i++)
+    {
+        if (scope_tasks[i] == self)
+        {
+            scope_tasks[i] = NULL;
+        }
+    }
+    if (owner != TASK_PLAN_ISR_OTHER && owner < TASK_PLAN_ISR_COUNT)
+    {
+        scope_tasks[owner] = self;
+    }
+    portEXIT_CRITICAL(&isr_lock);
+}
+
+#if CONFIG_UVC_TASK_PLAN_ISR_TIMING
+// Interrupt handlers behind the timing stub; allocations beyond these run
+// their handler directly and are not counted
+#define TASK_PLAN_ISR_SLOTS 32
+
+typedef struct
+{
+    intr_handler_t handler;
+    void *arg;
+    intr_handle_t handle;
+    bool used;
+    uint8_t owner;
+    int8_t core;
+    // Only the core that services the interrupt writes the counters: seq is
+    // odd while it does, so a reader on the other core retries instead of
+    // taking a lock in the handler's path
+    uint32_t seq;
+    uint32_t calls;
+    uint64_t ns;
+} isr_slot_t;
+
+// Internal RAM (.bss), so IRAM interrupts reach it with the cache disabled
+static isr_slot_t isr_slots[TASK_PLAN_ISR_SLOTS];
+static uint32_t isr_overflows;
+
+// Counts of freed handlers, so the totals never go back
+static uint64_t retired_ns[portNUM_PROCESSORS][TASK_PLAN_ISR_COUNT];
+static uint32_t retired_calls[portNUM_PROCESSORS][TASK_PLAN_ISR_COUNT];
+
+extern "C" esp_err_t __real_esp_intr_alloc_intrstatus_bind(int source, int flags, uint32_t intrstatusreg,
+                                                           uint32_t intrstatusmask, intr_handler_t handler,
+                                                           void *arg, intr_handle_t shared_handle,
+                                                           intr_handle_t *ret_handle);
+extern "C" esp_err_t __real_esp_intr_free(intr_handle_t handle);
+
+typedef struct
+{
+    int source;
+    int flags;
+    uint32_t status_reg;
+    uint32_t status_mask;
+    intr_handler_t handler;
+    void *arg;
+    intr_handle_t shared_handle;
+    intr_handle_t *ret_handle;
+} isr_alloc_t;
+
+static void IRAM_ATTR isr_stub(void *arg)
+{
+    isr_slot_t *slot = (isr_slot_t *)arg;
+    // Cycles at the frequency the handler runs at: power management scales
+    // it, so they are converted here rather than when the load is read
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    uint32_t start = esp_cpu_get_cycle_count();
+    slot->handler(slot->arg);
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    uint64_t ns = ticks_per_us ? (uint64_t)cycles * 1000 / ticks_per_us : 0;
+
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->calls++;
+    slot->ns += ns;
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Counters of a slot, consistent with each other
+static void isr_slot_read(const isr_slot_t *slot, uint32_t *calls, uint64_t *ns)
+{
+    uint32_t seq;
+    do
+    {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        *calls = slot->calls;
+        *ns = slot->ns;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&slot->seq, __ATOMIC_RELAXED));
+}
+
+static task_plan_isr_t current_scope(void)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    task_plan_isr_t owner = TASK_PLAN_ISR_OTHER;
+    if (self == NULL)
+    {
+        return owner;
+    }
+    portENTER_CRITICAL(&isr_lock);
+    for (int i = 1; i < TASK_PLAN_ISR_COUNT; i++)
+    {
+        if (scope_tasks[i] == self)
+        {
+            owner = (task_plan_isr_t)i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&isr_lock);
+    return owner;
+}
+
+// Allocate with the timing stub in front of the handler. The interrupt stays
+// where it is allocated: task_plan_isr_call puts the USB and camera ones on
+// their planned core. Handlers the stub cannot stand in for go through
+// unchanged.
+static esp_err_t isr_alloc(const isr_alloc_t *a)
+{
+    if (a->handler == NULL || (a->flags & ESP_INTR_FLAG_HIGH))
+    {
+        return __real_esp_intr_alloc_intrstatus_bind(a->source, a->flags, a->status_reg, a->status_mask, a->handler,
+                                                     a->arg, a->shared_handle, a->ret_handle);
+    }
+
+    // An interrupt is serviced by the core that allocated it, or with a
+    // shared handle by that handle's core
+    int core = a->shared_handle ? esp_intr_get_cpu(a->shared_handle) : (int)esp_cpu_get_core_id();
+    task_plan_isr_t owner = current_scope();
+
+    isr_slot_t *slot = NULL;
+    uint32_t overflows = 0;
+    portENTER_CRITICAL(&isr_lock);
+    for (int i = 0; i < TASK_PLAN_ISR_SLOTS; i++)
+    {
+        if (!isr_slots[i].used)
+        {
+            slot = &isr_slots[i];
+            memset(slot, 0, sizeof(*slot));
+            slot->used = true;
+            slot->handler = a->handler;
+            slot->arg = a->arg;
+            slot->owner = (uint8_t)owner;
+            slot->core = (int8_t)core;
+            break;
+        }
+    }
+    if (slot == NULL)
+    {
+        overflows = ++isr_overflows;
+    }
+    portEXIT_CRITICAL(&isr_lock);
+    if (slot == NULL)
+    {
+        ESP_LOGW(TAG, "Interrupt source %d not timed, all %d slots in use (%lu so far)", a->source,
+                 TASK_PLAN_ISR_SLOTS, (unsigned long)overflows);
+        return __real_esp_intr_alloc_intrstatus_bind(a->source, a->flags, a->status_reg, a->status_mask, a->handler,
+                                                     a->arg, a->shared_handle, a->ret_handle);
+    }
+
+    esp_err_t err = __real_esp_intr_alloc_intrstatus_bind(a->source, a->flags, a->status_reg, a->status_mask,
+                                                          isr_stub, slot, a->shared_handle, &slot->handle);
+    if (err != ESP_OK)
+    {
+        portENTER_CRITICAL(&isr_lock);
+        slot->used = false;
+        portEXIT_CRITICAL(&isr_lock);
+        return err;
+    }
+    if (a->ret_handle)
+    {
+        *a->ret_handle = slot->handle;
+    }
+    return ESP_OK;
+}
+
+// All four allocation calls end up in isr_alloc; inside esp_hw_support they
+// call each other unwrapped
+extern "C" esp_err_t __wrap_esp_intr_alloc_intrstatus_bind(int source, int flags, uint32_t intrstatusreg,
+                                                           uint32_t intrstatusmask, intr_handler_t handler,
+                                                           void *arg, intr_handle_t shared_handle,
+                                                           intr_handle_t *ret_handle)
+{
+    isr_alloc_t a = {source, flags, intrstatusreg, intrstatusmask, handler, arg, shared_handle, ret_handle};
+    return isr_alloc(&a);
+}
+
+extern "C" esp_err_t __wrap_esp_intr_alloc_intrstatus(int source, int flags, uint32_t intrstatusreg,
+                                                      uint32_t intrstatusmask, intr_handler_t handler, void *arg,
+                                                      intr_handle_t *ret_handle)
+{
+    isr_alloc_t a = {source, flags, intrstatusreg, intrstatusmask, handler, arg, NULL, ret_handle};
+    return isr_alloc(&a);
+}
+
+extern "C" esp_err_t __wrap_esp_intr_alloc_bind(int source, int flags, intr_handler_t handler, void *arg,
+                                                intr_handle_t shared_handle, intr_handle_t *ret_handle)
+{
+    isr_alloc_t a = {source, flags, 0, 0, handler, arg, shared_handle, ret_handle};
+    return isr_alloc(&a);
+}
+
+extern "C" esp_err_t __wrap_esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg,
+                                           intr_handle_t *ret_handle)
+{
+    isr_alloc_t a = {source, flags, 0, 0, handler, arg, NULL, ret_handle};
+    return isr_alloc(&a);
+}
+
+extern "C" esp_err_t __wrap_esp_intr_free(intr_handle_t handle)
+{
+    esp_err_t err = __real_esp_intr_free(handle);
+    if (err != ESP_OK || handle == NULL)
+    {
+        return err;
+    }
+    portENTER_CRITICAL(&isr_lock);
+    for (int i = 0; i < TASK_PLAN_ISR_SLOTS; i++)
+    {
+        isr_slot_t *slot = &isr_slots[i];
+        if (slot->used && slot->handle == handle)
+        {
+            // Freed: the handler no longer runs
+            retired_ns[slot->core][slot->owner] += slot->ns;
+            retired_calls[slot->core][slot->owner] += slot->calls;
+            slot->used = false;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&isr_lock);
+    return err;
+}
+#endif  // CONFIG_UVC_TASK_PLAN_ISR_TIMING
+
+const char *task_plan_name(void)
+{
+    return TASK_PLAN_NAME;
+}
+
+const task_plan_entry_t *task_plan_get(task_plan_task_t task)
+{
+    return task < TASK_PLAN_TASK_COUNT ? &plan[task] : NULL;
+}
+
+BaseType_t task_plan_create(task_plan_task_t task, TaskFunction_t fn, void *arg, TaskHandle_t *handle)
+{
+    const task_plan_entry_t *e = task_plan_get(task);
+    if (e == NULL)
+    {
+        return pdFAIL;
+    }
+    return xTaskCreatePinnedToCore(fn, e->name, e->stack_size, arg, e->priority, handle, e->core);
+}
+
+typedef struct
+{
+    task_plan_isr_t owner;
+    esp_err_t (*fn)(void *arg);
+    void *arg;
+    esp_err_t err;
+    SemaphoreHandle_t done;
+} isr_call_t;
+
+static void isr_call_task(void *arg)
+{
+    isr_call_t *c = (isr_call_t *)arg;
+    isr_scope(c->owner);
+    c->err = c->fn(c->arg);
+    isr_scope(TASK_PLAN_ISR_OTHER);
+    xSemaphoreGive(c->done);
+    vTaskDelete(NULL);
+}
+
+esp_err_t task_plan_isr_call(task_plan_isr_t owner, esp_err_t (*fn)(void *arg), void *arg)
+{
+    if (owner >= TASK_PLAN_ISR_COUNT || isr_plan[owner] < 0)
+    {
+        isr_scope(owner);
+        esp_err_t err = fn(arg);
+        isr_scope(TASK_PLAN_ISR_OTHER);
+        return err;
+    }
+
+    // The caller waits on a semaphore of its own: its task notifications
+    // may be in use
+    isr_call_t c = {owner, fn, arg, ESP_FAIL, xSemaphoreCreateBinary()};
+    if (c.done == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(isr_call_task, "isr_call", TASK_PLAN_ISR_CALL_STACK, &c, uxTaskPriorityGet(NULL),
+                                NULL, (BaseType_t)isr_plan[owner]) != pdPASS)
+    {
+        vSemaphoreDelete(c.done);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(c.done, portMAX_DELAY);
+    vSemaphoreDelete(c.done);
+    return c.err;
+}
+
+const char *task_plan_isr_name(task_plan_isr_t owner)
+{
+    return owner < TASK_PLAN_ISR_COUNT ? isr_names[owner] : "?";
+}
+
+static int plan_core(BaseType_t core)
+{
+    return core == tskNO_AFFINITY ? -1 : (int)core;
+}
+
+void task_plan_log(void)
+{
+    ESP_LOGI(TAG, "Plan %s: %s %d/%u/%lu, %s %d/%u/%lu, %s %d/%u/%lu (core/priority/stack); interrupts usb %d, "
+                  "camera %d; camera driver task %d",
+             TASK_PLAN_NAME, plan[TASK_PLAN_USB].name, plan_core(plan[TASK_PLAN_USB].core),
+             (unsigned)plan[TASK_PLAN_USB].priority, (unsigned long)plan[TASK_PLAN_USB].stack_size,
+             plan[TASK_PLAN_UVC].name, plan_core(plan[TASK_PLAN_UVC].core), (unsigned)plan[TASK_PLAN_UVC].priority,
+             (unsigned long)plan[TASK_PLAN_UVC].stack_size, plan[TASK_PLAN_CAMERA].name,
+             plan_core(plan[TASK_PLAN_CAMERA].core), (unsigned)plan[TASK_PLAN_CAMERA].priority,
+             (unsigned long)plan[TASK_PLAN_CAMERA].stack_size, isr_plan[TASK_PLAN_ISR_USB],
+             isr_plan[TASK_PLAN_ISR_CAMERA], TASK_PLAN_CAMERA_DRIVER_CORE);
+}
+
+void task_plan_sample(task_plan_sample_t *sample)
+{
+    sample->at_us = esp_timer_get_time();
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    sample->task_count = uxTaskGetSystemState(sample->tasks, TASK_PLAN_MAX_TASKS, &sample->run_time);
+#else
+    sample->task_count = 0;
+    sample->run_time = 0;
+#endif
+
+#if CONFIG_UVC_TASK_PLAN_ISR_TIMING
+    portENTER_CRITICAL(&isr_lock);
+    memcpy(sample->isr_ns, retired_ns, sizeof(sample->isr_ns));
+    memcpy(sample->isr_calls, retired_calls, sizeof(sample->isr_calls));
+    for (int i = 0; i < TASK_PLAN_ISR_SLOTS; i++)
+    {
+        const isr_slot_t *slot = &isr_slots[i];
+        if (slot->used)
+        {
+            uint32_t calls;
+            uint64_t ns;
+            isr_slot_read(slot, &calls, &ns);
+            sample->isr_ns[slot->core][slot->owner] += ns;
+            sample->isr_calls[slot->core][slot->owner] += calls;
+        }
+    }
+    portEXIT_CRITICAL(&isr_lock);
+#else
+    memset(sample->isr_ns, 0, sizeof(sample->isr_ns));
+    memset(sample->isr_calls, 0, sizeof(sample->isr_calls));
+#endif
+}
+
+// Core a task is pinned to, -1 if none
+static int task_core(const TaskStatus_t *t)
+{
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+    return t->xCoreID >= 0 && t->xCoreID < portNUM_PROCESSORS ? (int)t->xCoreID : -1;
+#else
+    (void)t;
+    return -1;
+#endif
+}
+
+static uint16_t permille(uint64_t part, uint64_t whole)
+{
+    return whole ? (uint16_t)(part * 1000 / whole) : 0;
+}
+
+void task_plan_load(const task_plan_sample_t *from, const task_plan_sample_t *to, task_plan_load_t *load)
+{
+    memset(load, 0, sizeof(*load));
+    load->elapsed_us = (uint32_t)(to->at_us - from->at_us);
+
+    // Tasks, against the run time counter; a task created since the first
+    // sample counts from 0
+    uint32_t elapsed = to->run_time - from->run_time;
+    uint64_t busy = 0;
+    uint64_t pinned[portNUM_PROCESSORS] = {};
+    uint64_t idle[portNUM_PROCESSORS] = {};
+    bool has_idle[portNUM_PROCESSORS] = {};
+    for (UBaseType_t i = 0; i < to->task_count; i++)
+    {
+        const TaskStatus_t *t = &to->tasks[i];
+        uint32_t prev = 0;
+        for (UBaseType_t j = 0; j < from->task_count; j++)
+        {
+            if (from->tasks[j].xHandle == t->xHandle)
+            {
+                prev = from->tasks[j].ulRunTimeCounter;
+                break;
+            }
+        }
+        uint32_t used = t->ulRunTimeCounter - prev;
+        int c = task_core(t);
+
+        task_plan_task_load_t *tl = &load->tasks[load->task_count++];
+        tl->name = t->pcTaskName;
+        tl->core = c;
+        tl->permille = permille(used, elapsed);
+        tl->stack_free = (uint32_t)(t->usStackHighWaterMark * sizeof(StackType_t));
+
+        if (strncmp(t->pcTaskName, "IDLE", 4) == 0 && c >= 0)
+        {
+            idle[c] += used;
+            has_idle[c] = true;
+            continue;
+        }
+        busy += used;
+        if (c >= 0)
+        {
+            pinned[c] += used;
+        }
+    }
+    load->busy = permille(busy, elapsed);
+    for (int c = 0; c < portNUM_PROCESSORS; c++)
+    {
+        uint64_t used = has_idle[c] ? (idle[c] < elapsed ? elapsed - idle[c] : 0) : pinned[c];
+        load->core_busy[c] = permille(used, elapsed);
+    }
+
+    // Interrupts, against wall time
+    for (int c = 0; c < portNUM_PROCESSORS; c++)
+    {
+        uint64_t total_us = 0;
+        uint64_t total_calls = 0;
+        for (int o = 0; o < TASK_PLAN_ISR_COUNT; o++)
+        {
+            uint64_t us = (to->isr_ns[c][o] - from->isr_ns[c][o]) / 1000;
+            uint32_t calls = to->isr_calls[c][o] - from->isr_calls[c][o];
+            load->isr[c][o] = permille(us, load->elapsed_us);
+            load->isr_rate[c][o] = load->elapsed_us ? (uint32_t)((uint64_t)calls * 1000000 / load->elapsed_us) : 0;
+            total_us += us;
+            total_calls += calls;
+        }
+        load->isr_total[c] = permille(total_us, load->elapsed_us);
+        load->isr_rate_total[c] = load->elapsed_us ? (uint32_t)(total_calls * 1000000 / load->elapsed_us) : 0;
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Tasks a load sample can hold
+#define TASK_PLAN_MAX_TASKS 24
+
+  // Task plan: where the pipeline tasks and interrupts run, from the
+  // UVC_TASK_PLAN preset in menuconfig (or its custom entries), and what that
+  // costs each core. The USB and camera interrupts are placed by allocating
+  // them on their planned core, see task_plan_isr_call. With
+  // UVC_TASK_PLAN_ISR_TIMING every interrupt handler allocated through
+  // esp_intr_alloc also runs through a timing stub, see
+  // __wrap_esp_intr_alloc, so the load of a core splits into its tasks and
+  // its interrupts; handler time is measured in CPU cycles and converted at
+  // the frequency each call ran at, so it stays right across frequency
+  // scaling. High-priority (level 4+) interrupts have no C handler and are
+  // not counted. Without the option the interrupt figures stay 0. FreeRTOS
+  // charges interrupt time to the task it interrupted, so task shares
+  // include it.
+
+  typedef enum
+  {
+    TASK_PLAN_USB = 0,  // usb_device_task: tud_task
+    TASK_PLAN_UVC,      // uvc_task: frames to the endpoint
+    TASK_PLAN_CAMERA,   // camera_task: capture and checks
+    TASK_PLAN_TASK_COUNT,
+  } task_plan_task_t;
+
+  // Owner of an interrupt, for its placement and the load breakdown
+  typedef enum
+  {
+    TASK_PLAN_ISR_OTHER = 0,  // System, Wi-Fi and anything allocated outside a scope
+    TASK_PLAN_ISR_USB,        // USB controller and bounce stage GDMA
+    TASK_PLAN_ISR_CAMERA,     // Camera VSYNC and DMA
+    TASK_PLAN_ISR_COUNT,
+  } task_plan_isr_t;
+
+  typedef struct
+  {
+    const char *name;
+    BaseType_t core;  // tskNO_AFFINITY for either
+    UBaseType_t priority;
+    uint32_t stack_size;
+  } task_plan_entry_t;
+
+  // One reading of the counters; two of them give a task_plan_load_t
+  typedef struct
+  {
+    int64_t at_us;
+    uint32_t run_time;  // FreeRTOS run time counter
+    UBaseType_t task_count;
+    TaskStatus_t tasks[TASK_PLAN_MAX_TASKS];
+    uint64_t isr_ns[portNUM_PROCESSORS][TASK_PLAN_ISR_COUNT];
+    uint32_t isr_calls[portNUM_PROCESSORS][TASK_PLAN_ISR_COUNT];
+  } task_plan_sample_t;
+
+  typedef struct
+  {
+    const char *name;
+    int core;             // -1 if not pinned
+    uint16_t permille;    // Share of one core
+    uint32_t stack_free;  // High-water mark, bytes
+  } task_plan_task_load_t;
+
+  // Load between two samples, in permille of one core
+  typedef struct
+  {
+    uint32_t elapsed_us;
+    uint16_t busy;  // Every task but the idle tasks, up to 1000 per core
+    // What each core's idle task left, or without one what the tasks pinned
+    // to it used
+    uint16_t core_busy[portNUM_PROCESSORS];
+    uint16_t isr[portNUM_PROCESSORS][TASK_PLAN_ISR_COUNT];
+    uint16_t isr_total[portNUM_PROCESSORS];
+    // Interrupts per second
+    uint32_t isr_rate[portNUM_PROCESSORS][TASK_PLAN_ISR_COUNT];
+    uint32_t isr_rate_total[portNUM_PROCESSORS];
+    UBaseType_t task_count;
+    task_plan_task_load_t tasks[TASK_PLAN_MAX_TASKS];
+  } task_plan_load_t;
+
+  const char *task_plan_name(void);
+  const task_plan_entry_t *task_plan_get(task_plan_task_t task);
+
+  // Create task with the core, priority and stack of its plan entry
+  BaseType_t task_plan_create(task_plan_task_t task, TaskFunction_t fn, void *arg, TaskHandle_t *handle);
+
+  // Run fn, which allocates owner's interrupts, on owner's planned core
+  // (an interrupt is serviced by the core that allocates it) and return its
+  // result. fn runs in a short-lived task there at the caller's priority while
+  // the caller waits, or in the caller if the owner has no planned core.
+  // Interrupts allocated elsewhere are not moved.
+  esp_err_t task_plan_isr_call(task_plan_isr_t owner, esp_err_t (*fn)(void *arg), void *arg);
+
+  const char *task_plan_isr_name(task_plan_isr_t owner);
+
+  // Log the plan once, at boot
+  void task_plan_log(void);
+
+  void task_plan_sample(task_plan_sample_t *sample);
+  void task_plan_load(const task_plan_sample_t *from, const task_plan_sample_t *to, task_plan_load_t *load);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,649 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tusb.h"
+}
+#include "change_gate.h"
+#include "event_recorder.h"
+#include "pipeline_stats.h"
+#include "rate_ctrl.h"
+#include "task_plan.h"
+#include "uvc_controls.h"
+#include "telemetry.h"
+
+static const char *TAG = "TELEMETRY";
+
+// Below everything on the video path, the network included
+#define TELEMETRY_TASK_PRIORITY 2
+
+#define TELEMETRY_MIN_PERIOD_MS 100
+#define TELEMETRY_LINE_MAX 160
+
+// Bit 0 of the task notification: the host sent something
+#define TELEMETRY_EVENT_RX (1UL << 0)
+// Bit 1: a transfer to the host completed, the TX FIFO has room again
+#define TELEMETRY_EVENT_TX (1UL << 1)
+
+// A recorder dump is given up when the host takes nothing for this long
+#define TELEMETRY_DUMP_STALL_MS 1000
+
+static uint32_t size_hist[TELEMETRY_SIZE_BUCKETS];
+static uint64_t frame_bytes;
+
+static telemetry_stats_t stats;
+static portMUX_TYPE telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void telemetry_record_frame(size_t len)
+{
+    size_t bound = 4096;
+    int bucket = 0;
+    while (bucket < TELEMETRY_SIZE_BUCKETS - 1 && len >= bound)
+    {
+        bound <<= 1;
+        bucket++;
+    }
+    __atomic_fetch_add(&size_hist[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&frame_bytes, (uint64_t)len, __ATOMIC_RELAXED);
+}
+
+void telemetry_get_stats(telemetry_stats_t *out)
+{
+    portENTER_CRITICAL(&telemetry_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&telemetry_lock);
+}
+
+#if CFG_TUD_CDC
+static TaskHandle_t telemetry_task_handle;
+static uint32_t period_ms;
+
+// Built and sent by the telemetry task only; a sample goes out whole or not at all
+static char sample_buf[CFG_TUD_CDC_TX_BUFSIZE];
+
+// Load counters at the last two samples, to report shares per interval;
+// the first sample compares against the zeroed one, so since boot
+static task_plan_sample_t cpu_samples[2];
+static int cpu_newest = 1;
+static task_plan_load_t cpu_load;
+
+// Queue len bytes for the host if they fit whole, never waiting for room.
+// Nothing is counted while no terminal has the port open.
+static bool telemetry_send(const char *data, size_t len)
+{
+    if (!tud_cdc_connected())
+    {
+        return false;
+    }
+    if (tud_cdc_write_available() < len)
+    {
+        portENTER_CRITICAL(&telemetry_lock);
+        stats.dropped++;
+        portEXIT_CRITICAL(&telemetry_lock);
+        return false;
+    }
+    tud_cdc_write(data, len);
+    tud_cdc_write_flush();
+    return true;
+}
+
+#if CONFIG_UVC_EVENT_RECORDER
+// Queue all len bytes, waiting for the host to take what does not fit; only
+// for the recorder dump, which the host asked for and reads to the end.
+// false if the port closed or the host took nothing for the stall time.
+static bool telemetry_send_all(const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    int64_t progress_us = esp_timer_get_time();
+    while (len)
+    {
+        if (!tud_cdc_connected())
+        {
+            return false;
+        }
+        uint32_t n = tud_cdc_write(p, len);
+        int64_t now = esp_timer_get_time();
+        if (n)
+        {
+            p += n;
+            len -= n;
+            progress_us = now;
+            continue;
+        }
+        int64_t left_ms = TELEMETRY_DUMP_STALL_MS - (now - progress_us) / 1000;
+        if (left_ms <= 0)
+        {
+            return false;
+        }
+        // FIFO full: the transfer that drains it wakes this task, see
+        // tud_cdc_tx_complete_cb. Other bits stay for the task loop.
+        tud_cdc_write_flush();
+        xTaskNotifyWait(0, TELEMETRY_EVENT_TX, NULL, pdMS_TO_TICKS(left_ms));
+    }
+    return true;
+}
+#endif
+
+static void telemetry_reply(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void telemetry_reply(const char *format, ...)
+{
+    char line[TELEMETRY_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (len < 0)
+    {
+        return;
+    }
+    len = len < (int)sizeof(line) - 2 ? len : (int)sizeof(line) - 2;
+    line[len++] = '\n';
+    telemetry_send(line, len);
+}
+
+// Append to the sample buffer, leaving it unchanged if the text does not fit
+static void sample_append(size_t *pos, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void sample_append(size_t *pos, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(sample_buf + *pos, sizeof(sample_buf) - *pos, format, args);
+    va_end(args);
+    if (len > 0 && *pos + len < sizeof(sample_buf))
+    {
+        *pos += len;
+    }
+    else
+    {
+        sample_buf[*pos] = '\0';
+    }
+}
+
+static void sample_tasks(size_t *pos)
+{
+    int prev = cpu_newest;
+    cpu_newest = prev ? 0 : 1;
+    task_plan_sample(&cpu_samples[cpu_newest]);
+    task_plan_load(&cpu_samples[prev], &cpu_samples[cpu_newest], &cpu_load);
+    for (UBaseType_t i = 0; i < cpu_load.task_count; i++)
+    {
+        const task_plan_task_load_t *t = &cpu_load.tasks[i];
+        sample_append(pos, "T %s %d %u.%u %lu\n", t->name, t->core, t->permille / 10, t->permille % 10,
+                      (unsigned long)t->stack_free);
+    }
+    for (int c = 0; c < portNUM_PROCESSORS; c++)
+    {
+        sample_append(pos, "C %d %u.%u %u.%u %lu\n", c, cpu_load.core_busy[c] / 10, cpu_load.core_busy[c] % 10,
+                      cpu_load.isr_total[c] / 10, cpu_load.isr_total[c] % 10,
+                      (unsigned long)cpu_load.isr_rate_total[c]);
+    }
+}
+
+static void telemetry_sample(void)
+{
+    static uint32_t counts_prev[PIPELINE_COUNTER_COUNT];
+    static uint64_t bytes_prev;
+    static int64_t sample_prev_us;
+
+    int64_t now = esp_timer_get_time();
+    uint32_t counts[PIPELINE_COUNTER_COUNT];
+    pipeline_stats_snapshot(counts);
+    uint64_t bytes = __atomic_load_n(&frame_bytes, __ATOMIC_RELAXED);
+    uint32_t hist[TELEMETRY_SIZE_BUCKETS];
+    for (int i = 0; i < TELEMETRY_SIZE_BUCKETS; i++)
+    {
+        hist[i] = __atomic_exchange_n(&size_hist[i], 0, __ATOMIC_RELAXED);
+    }
+
+    uint32_t elapsed_ms = sample_prev_us ? (uint32_t)((now - sample_prev_us) / 1000) : 0;
+    uint32_t frames = (counts[PIPELINE_SENT] - counts_prev[PIPELINE_SENT]) +
+                      (counts[PIPELINE_REPEATED] - counts_prev[PIPELINE_REPEATED]);
+    uint32_t fps10 = elapsed_ms ? frames * 10000 / elapsed_ms : 0;
+    uint32_t kbps = elapsed_ms ? (uint32_t)((bytes - bytes_prev) * 8 / elapsed_ms) : 0;
+    telemetry_stats_t st;
+    telemetry_get_stats(&st);
+
+    size_t pos = 0;
+    sample_buf[0] = '\0';
+    sample_append(&pos, "S %lu fps=%lu.%lu kbps=%lu sent=%lu rep=%lu drop=%lu err=%lu heap=%u,%u psram=%u,%u lost=%lu\n",
+                  (unsigned long)(now / 1000), (unsigned long)(fps10 / 10), (unsigned long)(fps10 % 10),
+                  (unsigned long)kbps, (unsigned long)(counts[PIPELINE_SENT] - counts_prev[PIPELINE_SENT]),
+                  (unsigned long)(counts[PIPELINE_REPEATED] - counts_prev[PIPELINE_REPEATED]),
+                  (unsigned long)(counts[PIPELINE_DROPPED] - counts_prev[PIPELINE_DROPPED]),
+                  (unsigned long)(counts[PIPELINE_ERRORED] - counts_prev[PIPELINE_ERRORED]),
+                  (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                  (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+                  (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+                  (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM), (unsigned long)st.dropped);
+    sample_append(&pos, "H");
+    for (int i = 0; i < TELEMETRY_SIZE_BUCKETS; i++)
+    {
+        sample_append(&pos, " %lu", (unsigned long)hist[i]);
+    }
+    sample_append(&pos, "\n");
+    sample_tasks(&pos);
+
+    // The interval restarts either way, so a dropped sample's counts are lost
+    // rather than piling into the next one
+    memcpy(counts_prev, counts, sizeof(counts));
+    bytes_prev = bytes;
+    sample_prev_us = now;
+    if (telemetry_send(sample_buf, pos))
+    {
+        portENTER_CRITICAL(&telemetry_lock);
+        stats.samples++;
+        portEXIT_CRITICAL(&telemetry_lock);
+    }
+}
+
+static bool parse_u32(const char *s, uint32_t *value)
+{
+    if (s == NULL)
+    {
+        return false;
+    }
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+    if (end == s || *end != '\0')
+    {
+        return false;
+    }
+    *value = (uint32_t)v;
+    return true;
+}
+
+static bool parse_i32(const char *s, int32_t *value)
+{
+    if (s == NULL)
+    {
+        return false;
+    }
+    char *end;
+    long v = strtol(s, &end, 0);
+    if (end == s || *end != '\0')
+    {
+        return false;
+    }
+    *value = (int32_t)v;
+    return true;
+}
+
+#if CONFIG_UVC_EVENT_RECORDER
+static const char *record_state_name(event_recorder_state_t state)
+{
+    switch (state)
+    {
+    case EVENT_RECORDER_RECORDING:
+        return "recording";
+    case EVENT_RECORDER_TRIGGERED:
+        return "triggered";
+    case EVENT_RECORDER_FROZEN:
+        return "frozen";
+    default:
+        return "off";
+    }
+}
+
+// Send the frozen ring: the reply line, then every record (header and JPEG
+// data) back to back, as fast as the host reads them; thin_stream leaves it
+// most of the bus
+static bool record_dump(bool thin_stream)
+{
+    event_recorder_cursor_t cursor;
+    event_recorder_info_t info;
+    if (!event_recorder_dump_begin(&cursor, &info, thin_stream))
+    {
+        telemetry_reply("ERR record %s, not frozen", record_state_name(info.state));
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    char line[TELEMETRY_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "OK dump %lu %lu\n", (unsigned long)info.frames,
+                       (unsigned long)info.bytes);
+    uint32_t sent = 0;
+    bool ok = telemetry_send_all(line, len);
+    const event_recorder_frame_t *record;
+    while (ok && (record = event_recorder_dump_next(&cursor)) != NULL)
+    {
+        // Straight from the ring; TinyUSB copies into its FIFO
+        ok = telemetry_send_all(record, sizeof(*record)) && telemetry_send_all(record + 1, record->len);
+        if (ok)
+        {
+            sent += sizeof(*record) + record->len;
+        }
+    }
+    tud_cdc_write_flush();
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+    event_recorder_dump_end(&cursor, sent, elapsed_us);
+    if (!ok)
+    {
+        // The host cannot tell the rest of a cut dump from later lines
+        ESP_LOGW(TAG, "Recorder dump aborted after %lu of %lu bytes", (unsigned long)sent,
+                 (unsigned long)info.bytes);
+        return false;
+    }
+    ESP_LOGI(TAG, "Recorder dump: %lu frames, %lu KB in %lu ms", (unsigned long)info.frames,
+             (unsigned long)(sent / 1024), (unsigned long)(elapsed_us / 1000));
+    return true;
+}
+
+static bool record_command(const char *sub, const char *arg)
+{
+    uint32_t ms;
+    if (sub == NULL)
+    {
+        event_recorder_info_t info;
+        event_recorder_get_info(&info);
+        telemetry_reply("OK record %s %lu %lu %lu", record_state_name(info.state), (unsigned long)info.frames,
+                        (unsigned long)info.bytes,
+                        (unsigned long)(info.frames ? (info.newest_us - info.oldest_us) / 1000 : 0));
+        return true;
+    }
+    if (strcmp(sub, "trigger") == 0 && (arg == NULL || parse_u32(arg, &ms)))
+    {
+        if (arg == NULL)
+        {
+            ms = event_recorder_post_ms();
+        }
+        if (!event_recorder_trigger(ms))
+        {
+            telemetry_reply("ERR record trigger, not recording");
+            return false;
+        }
+        telemetry_reply("OK record trigger %lu", (unsigned long)ms);
+        return true;
+    }
+    if (strcmp(sub, "arm") == 0 && arg == NULL)
+    {
+        if (!event_recorder_arm())
+        {
+            telemetry_reply("ERR record arm");
+            return false;
+        }
+        telemetry_reply("OK record arm");
+        return true;
+    }
+    if (strcmp(sub, "dump") == 0 && (arg == NULL || strcmp(arg, "thin") == 0))
+    {
+        return record_dump(arg != NULL);
+    }
+    telemetry_reply("ERR record %s", sub);
+    return false;
+}
+#endif
+
+// Run one command line; true if it was understood and applied
+static bool telemetry_command(char *line)
+{
+    char *save = NULL;
+    const char *cmd = strtok_r(line, " \t", &save);
+    const char *arg1 = strtok_r(NULL, " \t", &save);
+    const char *arg2 = strtok_r(NULL, " \t", &save);
+    const char *arg3 = strtok_r(NULL, " \t", &save);
+    if (cmd == NULL)
+    {
+        return true;
+    }
+
+    uint32_t a, b;
+    int32_t v;
+    if (strcmp(cmd, "period") == 0 && parse_u32(arg1, &a))
+    {
+        if (a != 0 && a < TELEMETRY_MIN_PERIOD_MS)
+        {
+            telemetry_reply("ERR period below %d ms", TELEMETRY_MIN_PERIOD_MS);
+            return false;
+        }
+        __atomic_store_n(&period_ms, a, __ATOMIC_RELAXED);
+        telemetry_reply("OK period %lu", (unsigned long)a);
+        return true;
+    }
+    if (strcmp(cmd, "sample") == 0)
+    {
+        telemetry_sample();
+        return true;
+    }
+    if (strcmp(cmd, "ctrl") == 0 && parse_u32(arg1, &a) && parse_u32(arg2, &b) && parse_i32(arg3, &v))
+    {
+        // The control's length comes from its current value; the sensor is
+        // written by camera_task between frames, as for the host's requests
+        uint8_t buf[UVC_CONTROL_MAX_LEN];
+        uint16_t len = sizeof(buf);
+        video_error_code_t err = uvc_controls_get((uint8_t)a, (uint8_t)b, VIDEO_REQUEST_GET_CUR, buf, &len);
+        if (err == VIDEO_ERROR_NONE)
+        {
+            for (uint16_t i = 0; i < len; i++)
+            {
+                buf[i] = (uint8_t)((uint32_t)v >> (8 * i));
+            }
+            err = uvc_controls_set((uint8_t)a, (uint8_t)b, buf, len);
+        }
+        if (err != VIDEO_ERROR_NONE)
+        {
+            telemetry_reply("ERR ctrl %lu %lu: error %d", (unsigned long)a, (unsigned long)b, (int)err);
+            return false;
+        }
+        telemetry_reply("OK ctrl %lu %lu %ld", (unsigned long)a, (unsigned long)b, (long)v);
+        return true;
+    }
+    if (strcmp(cmd, "bitrate") == 0 && parse_u32(arg1, &a))
+    {
+        rate_ctrl_state_t rc;
+        rate_ctrl_get_state(&rc);
+        rc.target.bitrate_bps = a * 1000;
+        rate_ctrl_set_target(&rc.target);
+        telemetry_reply("OK bitrate %lu", (unsigned long)a);
+        return true;
+    }
+    if (strcmp(cmd, "quality") == 0 && parse_u32(arg1, &a) && parse_u32(arg2, &b) && a >= 1 && b <= 63 && a <= b)
+    {
+        rate_ctrl_state_t rc;
+        rate_ctrl_get_state(&rc);
+        rc.target.quality_best = (uint8_t)a;
+        rc.target.quality_worst = (uint8_t)b;
+        rate_ctrl_set_target(&rc.target);
+        telemetry_reply("OK quality %lu %lu", (unsigned long)a, (unsigned long)b);
+        return true;
+    }
+#if CONFIG_UVC_CHANGE_GATE
+    if (strcmp(cmd, "gate") == 0 && arg1 && arg2 && (strcmp(arg2, "on") == 0 || strcmp(arg2, "off") == 0) &&
+        (arg3 == NULL || (parse_u32(arg3, &b) && b > 0)))
+    {
+        change_gate_stream_t stream;
+        if (strcmp(arg1, "usb") == 0)
+        {
+            stream = CHANGE_GATE_USB;
+        }
+        else if (strcmp(arg1, "http") == 0)
+        {
+            stream = CHANGE_GATE_HTTP;
+        }
+        else
+        {
+            telemetry_reply("ERR gate %s", arg1);
+            return false;
+        }
+        change_gate_config_t gate;
+        change_gate_get_config(stream, &gate);
+        gate.enabled = strcmp(arg2, "on") == 0;
+        if (arg3)
+        {
+            gate.keepalive_ms = b;
+        }
+        change_gate_set_config(stream, &gate);
+        telemetry_reply("OK gate %s %s %lu", arg1, arg2, (unsigned long)gate.keepalive_ms);
+        return true;
+    }
+#endif
+#if CONFIG_UVC_EVENT_RECORDER
+    if (strcmp(cmd, "record") == 0)
+    {
+        return record_command(arg1, arg2);
+    }
+#endif
+    if (strcmp(cmd, "help") == 0)
+    {
+        telemetry_reply("OK period <ms> | sample | ctrl <entity> <selector> <value> | bitrate <kbps> | quality <best> <worst> | gate <usb|http> <on|off> [ms]");
+#if CONFIG_UVC_EVENT_RECORDER
+        telemetry_reply("OK record [trigger [ms] | arm | dump [thin]]");
+#endif
+        return true;
+    }
+    telemetry_reply("ERR %s", cmd);
+    return false;
+}
+
+// Collect command lines from whatever the host sent
+static void telemetry_poll_rx(void)
+{
+    static char line[TELEMETRY_LINE_MAX];
+    static size_t line_len;
+    static bool overflow;
+
+    char chunk[64];
+    uint32_t n;
+    while ((n = tud_cdc_read(chunk, sizeof(chunk))) > 0)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            char c = chunk[i];
+            if (c != '\r' && c != '\n')
+            {
+                if (line_len < sizeof(line) - 1)
+                {
+                    line[line_len++] = c;
+                }
+                else
+                {
+                    overflow = true;
+                }
+                continue;
+            }
+            if (line_len == 0 && !overflow)
+            {
+                continue;
+            }
+            line[line_len] = '\0';
+            bool ok = !overflow && telemetry_command(line);
+            if (overflow)
+            {
+                telemetry_reply("ERR line too long");
+            }
+            portENTER_CRITICAL(&telemetry_lock);
+            if (ok)
+            {
+                stats.commands++;
+            }
+            else
+            {
+                stats.rejected++;
+            }
+            portEXIT_CRITICAL(&telemetry_lock);
+            line_len = 0;
+            overflow = false;
+        }
+    }
+}
+
+static void telemetry_task(void *arg)
+{
+    (void)arg;
+    int64_t next_us = esp_timer_get_time();
+    for (;;)
+    {
+        uint32_t period = __atomic_load_n(&period_ms, __ATOMIC_RELAXED);
+        TickType_t wait = portMAX_DELAY;
+        if (period)
+        {
+            int64_t remaining_ms = (next_us - esp_timer_get_time()) / 1000;
+            wait = remaining_ms > 0 ? pdMS_TO_TICKS(remaining_ms) : 0;
+        }
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, wait);
+
+        if (events & TELEMETRY_EVENT_RX)
+        {
+            telemetry_poll_rx();
+        }
+        period = __atomic_load_n(&period_ms, __ATOMIC_RELAXED);
+        int64_t now = esp_timer_get_time();
+        if (period && now >= next_us)
+        {
+            if (tud_cdc_connected())
+            {
+                telemetry_sample();
+            }
+            // Fixed rate; after a pause or a long stall, start over from now
+            next_us += (int64_t)period * 1000;
+            if (next_us <= now)
+            {
+                next_us = now + (int64_t)period * 1000;
+            }
+        }
+    }
+}
+
+// TinyUSB CDC callback, in the USB device task: only wake the telemetry task
+extern "C" void tud_cdc_rx_cb(uint8_t itf)
+{
+    (void)itf;
+    if (telemetry_task_handle)
+    {
+        xTaskNotify(telemetry_task_handle, TELEMETRY_EVENT_RX, eSetBits);
+    }
+}
+
+#if CONFIG_UVC_EVENT_RECORDER
+// TinyUSB CDC callback, in the USB device task: a dump waiting for room
+extern "C" void tud_cdc_tx_complete_cb(uint8_t itf)
+{
+    (void)itf;
+    if (telemetry_task_handle)
+    {
+        xTaskNotify(telemetry_task_handle, TELEMETRY_EVENT_TX, eSetBits);
+    }
+}
+#endif
+
+esp_err_t telemetry_start(uint32_t period)
+{
+    if (period != 0 && period < TELEMETRY_MIN_PERIOD_MS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    period_ms = period;
+    if (xTaskCreatePinnedToCore(telemetry_task, "telemetry", 3072, NULL, TELEMETRY_TASK_PRIORITY,
+                                &telemetry_task_handle, tskNO_AFFINITY) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create the telemetry task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "CDC telemetry every %lu ms", (unsigned long)period);
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t telemetry_start(uint32_t period)
+{
+    (void)period;
+    ESP_LOGW(TAG, "TinyUSB built without CDC, no telemetry port");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif // CFG_TUD_CDC
@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Frame size histogram: bucket n counts frames below 4 KB << n, the last one
+// everything from 256 KB up
+#define TELEMETRY_SIZE_BUCKETS 8
+
+  // Telemetry and control over the CDC-ACM interface, one text line each.
+  // Every period_ms, while a terminal has the port open (DTR set):
+  //   S <ms> fps=<x.y> kbps=<n> sent=<n> rep=<n> drop=<n> err=<n> heap=<free>,<min> psram=<free>,<min> lost=<n>
+  //   H <count below 4 KB> <8 KB> ... <256 KB> <above>
+  //   T <task> <core> <cpu %> <stack high-water mark, bytes>     one per task
+  //   C <core> <busy %> <interrupt %> <interrupts/s>              one per core;
+  //                                        interrupts 0 without UVC_TASK_PLAN_ISR_TIMING
+  // Counts are since the previous sample, lost counts samples dropped
+  // because the host did not read. Commands, answered with OK or ERR:
+  //   period <ms>                    sample period, 0 pauses
+  //   sample                         send a sample now, as the answer
+  //   ctrl <entity> <selector> <v>   set a UVC control, as a SET_CUR would
+  //   bitrate <kbps>                 rate control target, 0 follows the USB throughput
+  //   quality <best> <worst>         rate control quality range
+  //   gate <usb|http> <on|off> [ms]  change gate of a stream, optional keepalive
+  //   record                         pre-event recorder: OK record <state> <frames> <bytes> <span ms>
+  //   record trigger [ms]            freeze the recorder after ms, default from menuconfig
+  //   record arm                     drop the recording and record again
+  //   record dump [thin]             send the frozen recording, see below; thin
+  //                                  cuts the UVC stream to a frame a second meanwhile
+  //   help
+  // Nothing here waits on the host: a sample or reply that does not fit in
+  // the CDC transmit buffer whole is dropped. The exception is a dump, which
+  // answers "OK dump <frames> <bytes>" and then sends exactly that many
+  // bytes: each frame as an event_recorder_frame_t header (little-endian)
+  // followed by its JPEG data, oldest first, as fast as the host reads.
+  // A host that stops reading for a second cuts the dump short.
+
+  typedef struct
+  {
+    uint32_t samples;   // Samples sent
+    uint32_t dropped;   // Samples and replies dropped for lack of room
+    uint32_t commands;  // Command lines accepted
+    uint32_t rejected;  // Command lines refused
+  } telemetry_stats_t;
+
+  // Start the telemetry task. Call after tud_init.
+  esp_err_t telemetry_start(uint32_t period_ms);
+
+  // USB side: a frame of len bytes was delivered. Lock-free.
+  void telemetry_record_frame(size_t len);
+
+  void telemetry_get_stats(telemetry_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,561 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+}
+#include "usb_bench.h"
+#include "frame_pacer.h"
+#include "rate_ctrl.h"
+#include "task_plan.h"
+#include "usb_bounce.h"
+#include "uvc_controls.h"
+
+static const char *TAG = "USB_BENCH";
+
+// The sweep options depend on UVC_USB_BENCHMARK and are not defined without
+// it; the module then only answers that it is not configured
+#if CONFIG_UVC_USB_BENCHMARK
+#define USB_BENCH_ENABLED true
+#else
+#define USB_BENCH_ENABLED false
+#define CONFIG_UVC_USB_BENCH_PAYLOADS ""
+#define CONFIG_UVC_USB_BENCH_FPS ""
+#define CONFIG_UVC_USB_BENCH_STEP_MS 0
+#endif
+#if CONFIG_UVC_USB_BENCH_COLORBAR
+#define USB_BENCH_SOURCE_NAME "colorbar"
+#define USB_BENCH_FRAMES CONFIG_UVC_USB_BENCH_QUALITY
+#define USB_BENCH_FRAME_UNIT "q"
+#else
+#define USB_BENCH_SOURCE_NAME "embedded"
+#define USB_BENCH_FRAME_UNIT "K"
+#if CONFIG_UVC_USB_BENCH_EMBEDDED
+#define USB_BENCH_FRAMES CONFIG_UVC_USB_BENCH_FRAME_KB
+#else
+#define USB_BENCH_FRAMES ""
+#endif
+#endif
+
+// Values per sweep axis
+#define USB_BENCH_AXIS_MAX 8
+
+// Time a step's settings get before its measurement starts: the frame built
+// for the previous step leaves the ring, the pacer anchors its new grid
+#define USB_BENCH_SETTLE_MS 500
+
+// Embedded frames in circulation: the ring's slots plus the one being built
+#define USB_BENCH_POOL (CONFIG_UVC_FRAME_RING_DEPTH + 1)
+
+// Sweep task: below the pipeline tasks, it only waits and prints
+#define USB_BENCH_TASK_PRIORITY 2
+
+static TaskHandle_t bench_task;
+static void (*reconfigured_cb)(void);
+
+// Stream state, set by the commit callback
+static portMUX_TYPE bench_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool streaming;
+static uint32_t stream_gen;       // Bumped by every commit
+static uint32_t stream_interval;  // Committed dwFrameInterval
+static uint32_t stream_payload;   // Committed dwMaxPayloadTransferSize
+
+static usb_bench_stats_t bench_stats;
+
+// Delivered frames, written by the USB side
+static uint32_t delivered_frames;
+static uint32_t delivered_repeats;
+static uint64_t delivered_bytes;
+
+typedef struct
+{
+    camera_fb_t fb;
+    size_t capacity;
+    size_t built_len;  // Frame size the contents were built for, 0 = none
+    bool held;         // Handed out, not returned yet
+} bench_frame_t;
+
+static bench_frame_t pool[USB_BENCH_POOL];
+static TaskHandle_t source_task;
+static size_t source_len;          // Size of the current step's frames
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct
+{
+    int64_t at_us;
+    uint32_t frames;
+    uint32_t repeats;
+    uint64_t bytes;
+    task_plan_sample_t cpu;
+} bench_sample_t;
+
+static bench_sample_t sample_start;
+static bench_sample_t sample_end;
+static task_plan_load_t cpu_load;
+
+// Comma-separated unsigned values from a Kconfig string; returns how many
+static size_t parse_list(const char *text, uint32_t *values, size_t max)
+{
+    size_t n = 0;
+    const char *p = text;
+    while (*p && n < max)
+    {
+        char *end;
+        unsigned long v = strtoul(p, &end, 10);
+        if (end == p)
+        {
+            p++;
+            continue;
+        }
+        values[n++] = (uint32_t)v;
+        p = end;
+    }
+    return n;
+}
+
+// Gray baseline JPEG of width x height, padded with comment segments to
+// about target bytes. One Huffman table per class with a single code ("0"
+// for DC difference 0, "0" for end of block) makes every 8x8 block two
+// bits: the scan is all zero bytes. Returns the length, or 0 if the frame
+// does not fit in cap.
+static size_t build_jpeg(uint8_t *buf, size_t cap, uint16_t width, uint16_t height, size_t target)
+{
+    static const uint8_t dqt[] = {0xFF, 0xDB, 0x00, 0x43, 0x00};
+    static const uint8_t dht[] = {0xFF, 0xC4, 0x00, 0x14};
+    static const uint8_t sos[] = {0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x00, 0x3F, 0x00};
+    size_t blocks = (size_t)((width + 7) / 8) * ((height + 7) / 8) * 3;
+    size_t scan_len = (blocks * 2 + 7) / 8;
+    size_t header_len = 2 + sizeof(dqt) + 64 + 19 + 2 * (sizeof(dht) + 18) + sizeof(sos);
+    size_t len = header_len + scan_len + 2;
+    if (target > len)
+    {
+        len = target;
+    }
+    if (len > cap)
+    {
+        return 0;
+    }
+
+    uint8_t *p = buf;
+    *p++ = 0xFF;
+    *p++ = 0xD8;
+    // Quantization table 0, all ones: the coefficients are zero anyway
+    memcpy(p, dqt, sizeof(dqt));
+    p += sizeof(dqt);
+    memset(p, 1, 64);
+    p += 64;
+    // Baseline, 3 components without subsampling, all on table 0
+    const uint8_t sof[] = {0xFF, 0xC0, 0x00, 0x11, 0x08, (uint8_t)(height >> 8), (uint8_t)height,
+                           (uint8_t)(width >> 8), (uint8_t)width, 0x03, 0x01, 0x11, 0x00,
+                           0x02, 0x11, 0x00, 0x03, 0x11, 0x00};
+    memcpy(p, sof, sizeof(sof));
+    p += sizeof(sof);
+    for (uint8_t table_class = 0; table_class < 2; table_class++)
+    {
+        memcpy(p, dht, sizeof(dht));
+        p += sizeof(dht);
+        *p++ = (uint8_t)(table_class << 4);
+        // One code of length 1 for symbol 0
+        memset(p, 0, 16);
+        p[0] = 1;
+        p += 16;
+        *p++ = 0x00;
+    }
+
+    // Comment segments take what the scan does not fill, up to 65533 bytes
+    // of text each; none shorter than its 4-byte marker and length
+    size_t pad = len - header_len - scan_len - 2;
+    while (pad >= 4)
+    {
+        size_t seg = pad < 65537 ? pad : 65537;
+        if (pad - seg > 0 && pad - seg < 4)
+        {
+            seg -= 4;
+        }
+        p[0] = 0xFF;
+        p[1] = 0xFE;
+        p[2] = (uint8_t)((seg - 2) >> 8);
+        p[3] = (uint8_t)(seg - 2);
+        memset(p + 4, 0, seg - 4);
+        p += seg;
+        pad -= seg;
+    }
+
+    memcpy(p, sos, sizeof(sos));
+    p += sizeof(sos);
+    memset(p, 0, scan_len);
+    if (blocks * 2 % 8)
+    {
+        // Pad the last byte with one bits
+        p[scan_len - 1] = (uint8_t)((1 << (8 - blocks * 2 % 8)) - 1);
+    }
+    p += scan_len;
+    *p++ = 0xFF;
+    *p++ = 0xD9;
+    return (size_t)(p - buf);
+}
+
+camera_fb_t *usb_bench_fb_get(pixformat_t format, uint16_t width, uint16_t height, uint32_t timeout_ms)
+{
+    source_task = xTaskGetCurrentTaskHandle();
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+    bench_frame_t *f = NULL;
+    while (f == NULL)
+    {
+        portENTER_CRITICAL(&pool_lock);
+        for (int i = 0; i < USB_BENCH_POOL; i++)
+        {
+            if (!pool[i].held)
+            {
+                f = &pool[i];
+                f->held = true;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&pool_lock);
+        int64_t left = deadline - esp_timer_get_time();
+        if (f == NULL && (left <= 0 || ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(left / 1000) + 1) == 0))
+        {
+            return NULL;
+        }
+    }
+
+    // Built once per step and mode, then sent as it is
+    size_t target = format == PIXFORMAT_JPEG ? __atomic_load_n(&source_len, __ATOMIC_RELAXED) : (size_t)width * height * 2;
+    if (f->built_len != target || f->fb.format != format || f->fb.width != width || f->fb.height != height)
+    {
+        // Reallocated only when a step needs more: headers and scan of the
+        // smallest JPEG stay below 1 KB plus 3 bytes per 256 pixels
+        size_t need = target;
+        if (format == PIXFORMAT_JPEG && need < 1024 + (size_t)width * height * 3 / 256)
+        {
+            need = 1024 + (size_t)width * height * 3 / 256;
+        }
+        if (f->capacity < need)
+        {
+            heap_caps_free(f->fb.buf);
+            f->fb.buf = (uint8_t *)heap_caps_malloc(need, MALLOC_CAP_SPIRAM);
+            f->capacity = f->fb.buf ? need : 0;
+        }
+        f->built_len = 0;
+        f->fb.len = 0;
+        if (f->fb.buf && format == PIXFORMAT_JPEG)
+        {
+            f->fb.len = build_jpeg(f->fb.buf, f->capacity, width, height, target);
+        }
+        else if (f->fb.buf)
+        {
+            // Y, U and V at mid level: gray
+            memset(f->fb.buf, 0x80, target);
+            f->fb.len = target;
+        }
+        if (f->fb.len == 0)
+        {
+            ESP_LOGE(TAG, "No PSRAM for a %zu byte %ux%u frame", need, width, height);
+            portENTER_CRITICAL(&pool_lock);
+            f->held = false;
+            portEXIT_CRITICAL(&pool_lock);
+            return NULL;
+        }
+        f->built_len = target;
+        f->fb.format = format;
+        f->fb.width = width;
+        f->fb.height = height;
+    }
+
+    int64_t now = esp_timer_get_time();
+    f->fb.timestamp.tv_sec = now / 1000000;
+    f->fb.timestamp.tv_usec = now % 1000000;
+    return &f->fb;
+}
+
+bool usb_bench_fb_return(camera_fb_t *fb)
+{
+    for (int i = 0; i < USB_BENCH_POOL; i++)
+    {
+        if (fb == &pool[i].fb)
+        {
+            portENTER_CRITICAL(&pool_lock);
+            pool[i].held = false;
+            portEXIT_CRITICAL(&pool_lock);
+            if (source_task)
+            {
+                xTaskNotifyGive(source_task);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+#if CONFIG_UVC_USB_BENCH_EMBEDDED
+// The frame ring and the capture path return frames to the driver; those
+// of the embedded source come back here instead (see CMakeLists.txt)
+extern "C" void __real_esp_camera_fb_return(camera_fb_t *fb);
+
+extern "C" void __wrap_esp_camera_fb_return(camera_fb_t *fb)
+{
+    if (!usb_bench_fb_return(fb))
+    {
+        __real_esp_camera_fb_return(fb);
+    }
+}
+#endif
+
+void usb_bench_record_frame(size_t len, bool repeat)
+{
+    __atomic_fetch_add(repeat ? &delivered_repeats : &delivered_frames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&delivered_bytes, (uint64_t)len, __ATOMIC_RELAXED);
+}
+
+static void take_sample(bench_sample_t *s)
+{
+    s->at_us = esp_timer_get_time();
+    s->frames = __atomic_load_n(&delivered_frames, __ATOMIC_RELAXED);
+    s->repeats = __atomic_load_n(&delivered_repeats, __ATOMIC_RELAXED);
+    s->bytes = __atomic_load_n(&delivered_bytes, __ATOMIC_RELAXED);
+    task_plan_sample(&s->cpu);
+}
+
+// Stream still the one the sweep started on
+static bool stream_current(uint32_t gen)
+{
+    portENTER_CRITICAL(&bench_lock);
+    bool current = streaming && stream_gen == gen;
+    portEXIT_CRITICAL(&bench_lock);
+    return current;
+}
+
+// Sleep ms unless the stream stops or is committed again; false if it did
+static bool bench_wait(uint32_t ms, uint32_t gen)
+{
+    int64_t until = esp_timer_get_time() + ms * 1000LL;
+    while (stream_current(gen))
+    {
+        int64_t left = until - esp_timer_get_time();
+        if (left <= 0)
+        {
+            return true;
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(left / 1000) + 1);
+    }
+    return false;
+}
+
+static void apply_frame_setting(uint32_t value)
+{
+#if CONFIG_UVC_USB_BENCH_COLORBAR
+    rate_ctrl_state_t rc;
+    rate_ctrl_get_state(&rc);
+    rc.target.quality_best = (uint8_t)value;
+    rc.target.quality_worst = (uint8_t)value;
+    rate_ctrl_set_target(&rc.target);
+#else
+    __atomic_store_n(&source_len, (size_t)value * 1024, __ATOMIC_RELAXED);
+#endif
+}
+
+#if CONFIG_UVC_USB_BENCH_COLORBAR
+static void set_colorbar(uint8_t on)
+{
+    uvc_controls_set(UVC_ENTITY_EXTENSION_UNIT, UVC_XU_COLORBAR_CONTROL, &on, 1);
+}
+#endif
+
+static void run_sweep(uint32_t gen, uint32_t interval, uint32_t committed_payload)
+{
+    uint32_t frames[USB_BENCH_AXIS_MAX];
+    uint32_t payloads[USB_BENCH_AXIS_MAX];
+    uint32_t rates[USB_BENCH_AXIS_MAX];
+    size_t frame_count = parse_list(USB_BENCH_FRAMES, frames, USB_BENCH_AXIS_MAX);
+    size_t payload_count = parse_list(CONFIG_UVC_USB_BENCH_PAYLOADS, payloads, USB_BENCH_AXIS_MAX);
+    size_t rate_count = parse_list(CONFIG_UVC_USB_BENCH_FPS, rates, USB_BENCH_AXIS_MAX);
+    // Only the bounce stage sends payloads below the committed size
+    bool bounce = usb_bounce_enabled();
+    if (!bounce || payload_count == 0)
+    {
+        payloads[0] = 0;
+        payload_count = 1;
+    }
+    if (frame_count == 0 || rate_count == 0)
+    {
+        ESP_LOGE(TAG, "Nothing to sweep: frame sizes \"%s\", pacing \"%s\"", USB_BENCH_FRAMES,
+                 CONFIG_UVC_USB_BENCH_FPS);
+        return;
+    }
+
+#if CONFIG_UVC_USB_BENCH_COLORBAR
+    rate_ctrl_state_t saved;
+    rate_ctrl_get_state(&saved);
+    set_colorbar(1);
+#endif
+    portENTER_CRITICAL(&bench_lock);
+    bench_stats.running = true;
+    portEXIT_CRITICAL(&bench_lock);
+    ESP_LOGI(TAG, "Sweep: %zu frame sizes x %zu payload sizes x %zu rates, %d ms each", frame_count, payload_count,
+             rate_count, CONFIG_UVC_USB_BENCH_STEP_MS);
+    printf("BENCH,step,source,frame,payload,pacing_fps,frames,repeats,fps,frame_bytes,bytes_per_s,cpu_pct,core0_pct,"
+           "core1_pct,core0_isr_pct,core1_isr_pct\n");
+
+    bool complete = true;
+    uint32_t step = 0;
+    for (size_t fi = 0; fi < frame_count && complete; fi++)
+    {
+        for (size_t pi = 0; pi < payload_count && complete; pi++)
+        {
+            for (size_t ri = 0; ri < rate_count && complete; ri++)
+            {
+                apply_frame_setting(frames[fi]);
+                usb_bounce_set_payload_limit(payloads[pi]);
+                frame_pacer_start(rates[ri] ? 10000000 / rates[ri] : 0);
+                if (reconfigured_cb)
+                {
+                    reconfigured_cb();
+                }
+                complete = bench_wait(USB_BENCH_SETTLE_MS, gen);
+                take_sample(&sample_start);
+                complete = complete && bench_wait(CONFIG_UVC_USB_BENCH_STEP_MS, gen);
+                if (!complete)
+                {
+                    break;
+                }
+                take_sample(&sample_end);
+
+                uint32_t elapsed_ms = (uint32_t)((sample_end.at_us - sample_start.at_us) / 1000);
+                uint32_t sent = sample_end.frames - sample_start.frames;
+                uint32_t repeats = sample_end.repeats - sample_start.repeats;
+                uint64_t bytes = sample_end.bytes - sample_start.bytes;
+                uint32_t fps100 = elapsed_ms ? (uint32_t)((uint64_t)sent * 100000 / elapsed_ms) : 0;
+                task_plan_load(&sample_start.cpu, &sample_end.cpu, &cpu_load);
+                const task_plan_load_t *l = &cpu_load;
+                uint32_t payload = payloads[pi] == 0 ? committed_payload
+                                   : payloads[pi] < committed_payload ? payloads[pi]
+                                                                       : committed_payload;
+                printf("BENCH,%lu,%s,%lu" USB_BENCH_FRAME_UNIT ",%lu,%lu,%lu,%lu,%lu.%02lu,%lu,%lu,%u.%u,%u.%u,%u.%u,%u.%u,%u.%u\n",
+                       (unsigned long)++step, USB_BENCH_SOURCE_NAME, (unsigned long)frames[fi], (unsigned long)payload, (unsigned long)rates[ri],
+                       (unsigned long)sent, (unsigned long)repeats, (unsigned long)(fps100 / 100),
+                       (unsigned long)(fps100 % 100), (unsigned long)(sent + repeats ? bytes / (sent + repeats) : 0),
+                       (unsigned long)(elapsed_ms ? bytes * 1000 / elapsed_ms : 0), l->busy / 10, l->busy % 10,
+                       l->core_busy[0] / 10, l->core_busy[0] % 10, l->core_busy[1] / 10, l->core_busy[1] % 10,
+                       l->isr_total[0] / 10, l->isr_total[0] % 10, l->isr_total[1] / 10, l->isr_total[1] % 10);
+                fflush(stdout);
+                portENTER_CRITICAL(&bench_lock);
+                bench_stats.steps++;
+                portEXIT_CRITICAL(&bench_lock);
+            }
+        }
+    }
+
+    // Back to what the host committed, for the rest of the stream
+    usb_bounce_set_payload_limit(0);
+#if CONFIG_UVC_USB_BENCH_COLORBAR
+    rate_ctrl_set_target(&saved.target);
+    set_colorbar(0);
+#endif
+    if (stream_current(gen))
+    {
+        frame_pacer_start(interval);
+        if (reconfigured_cb)
+        {
+            reconfigured_cb();
+        }
+    }
+    portENTER_CRITICAL(&bench_lock);
+    bench_stats.running = false;
+    if (complete)
+    {
+        bench_stats.sweeps++;
+    }
+    else
+    {
+        bench_stats.aborted++;
+    }
+    portEXIT_CRITICAL(&bench_lock);
+    ESP_LOGI(TAG, "Sweep %s after %lu steps", complete ? "done" : "aborted", (unsigned long)step);
+}
+
+static void usb_bench_task(void *pvParameters)
+{
+    uint32_t done_gen = 0;
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&bench_lock);
+        bool start = streaming && stream_gen != done_gen;
+        uint32_t gen = stream_gen;
+        uint32_t interval = stream_interval;
+        uint32_t payload = stream_payload;
+        portEXIT_CRITICAL(&bench_lock);
+        if (start)
+        {
+            done_gen = gen;
+            run_sweep(gen, interval, payload);
+            // A commit during the sweep starts the next one
+            xTaskNotifyGive(bench_task);
+        }
+    }
+}
+
+esp_err_t usb_bench_start(void (*reconfigured)(void))
+{
+    if (!USB_BENCH_ENABLED)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    reconfigured_cb = reconfigured;
+    uint32_t first;
+    if (parse_list(USB_BENCH_FRAMES, &first, 1))
+    {
+        apply_frame_setting(first);
+    }
+    if (xTaskCreatePinnedToCore(usb_bench_task, "usb_bench", 4096, NULL, USB_BENCH_TASK_PRIORITY, &bench_task,
+                                tskNO_AFFINITY) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create the benchmark task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "USB benchmark with the %s source, sweeps start with the stream", USB_BENCH_SOURCE_NAME);
+    return ESP_OK;
+}
+
+void usb_bench_stream_start(uint32_t frame_interval, uint32_t payload_size)
+{
+    portENTER_CRITICAL(&bench_lock);
+    streaming = true;
+    stream_gen++;
+    stream_interval = frame_interval;
+    stream_payload = payload_size;
+    portEXIT_CRITICAL(&bench_lock);
+    if (bench_task)
+    {
+        xTaskNotifyGive(bench_task);
+    }
+}
+
+void usb_bench_stream_stop(void)
+{
+    portENTER_CRITICAL(&bench_lock);
+    streaming = false;
+    portEXIT_CRITICAL(&bench_lock);
+    if (bench_task)
+    {
+        xTaskNotifyGive(bench_task);
+    }
+}
+
+void usb_bench_get_stats(usb_bench_stats_t *stats)
+{
+    portENTER_CRITICAL(&bench_lock);
+    *stats = bench_stats;
+    portEXIT_CRITICAL(&bench_lock);
+}
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // USB throughput benchmark (CONFIG_UVC_USB_BENCHMARK). Each stream the host
+  // commits runs one sweep over frame size, payload size and pacing: every
+  // step applies its settings, lets the pipeline settle, then measures for
+  // CONFIG_UVC_USB_BENCH_STEP_MS and prints one CSV row on the console:
+  //   BENCH,step,source,frame,payload,pacing_fps,frames,repeats,fps,frame_bytes,bytes_per_s,cpu_pct,core0_pct,core1_pct,core0_isr_pct,core1_isr_pct
+  // frame is the source's size setting (KB of an embedded frame, or the JPEG
+  // quality of the colour bars), frame_bytes what the frames measured.
+  // payload 0 is the committed payload through the video driver, pacing 0 is
+  // unpaced. CPU shares are of one core and come from task_plan_load:
+  // cpu_pct sums every task but the idle tasks, a core's share is what its
+  // idle task left, the ISR columns the part of it spent in interrupt
+  // handlers. Run the sweep under each task plan to compare placements.
+  //
+  // Frames come from the same place as in the camera firmware, through the
+  // frame ring and uvc_task. The embedded source stands in for the camera:
+  // gray JPEGs (YUY2 frames for an uncompressed stream) of the committed
+  // size, built once per step in PSRAM and padded to the step's frame size,
+  // with one always waiting so only the USB side sets the pace. The colour
+  // bar source runs the camera on the sensor's test pattern and steps the
+  // JPEG quality instead.
+
+  typedef struct
+  {
+    uint32_t sweeps;   // Sweeps completed
+    uint32_t steps;    // Rows printed
+    uint32_t aborted;  // Sweeps cut short by a stream stop or a new commit
+    bool running;
+  } usb_bench_stats_t;
+
+  // Start the sweep task. reconfigured runs after each step changed the
+  // pacing and should wake the USB task. ESP_ERR_NOT_SUPPORTED if the
+  // benchmark is not configured.
+  esp_err_t usb_bench_start(void (*reconfigured)(void));
+
+  // Stream committed with dwFrameInterval and dwMaxPayloadTransferSize: a
+  // sweep starts, one in progress starts over
+  void usb_bench_stream_start(uint32_t frame_interval, uint32_t payload_size);
+  void usb_bench_stream_stop(void);
+
+  // USB side: a frame of len bytes reached the host; repeat if the pacer
+  // sent it again. Lock-free.
+  void usb_bench_record_frame(size_t len, bool repeat);
+
+  // Embedded source, in the capture task: a frame of the given format and
+  // size, once a buffer is free. NULL after timeout_ms, or without memory.
+  camera_fb_t *usb_bench_fb_get(pixformat_t format, uint16_t width, uint16_t height, uint32_t timeout_ms);
+
+  // Takes fb back if it came from usb_bench_fb_get. Frame buffers reach it
+  // through esp_camera_fb_return, see __wrap_esp_camera_fb_return.
+  bool usb_bench_fb_return(camera_fb_t *fb);
+
+  void usb_bench_get_stats(usb_bench_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
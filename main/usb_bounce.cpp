@@ -0,0 +1,512 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_async_memcpy.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+}
+#include "frame_timing.h"
+#include "usb_bounce.h"
+
+static const char *TAG = "USB_BOUNCE";
+
+// Payload header with the presentation time and the source clock, see
+// frame_timing_put_clock. The still image bit is added on the way to the
+// endpoint like for the video driver's payloads.
+#define UVC_PAYLOAD_HEADER_LEN USB_BOUNCE_HEADER_LEN
+#define UVC_PAYLOAD_HEADER_FID (1u << 0)
+#define UVC_PAYLOAD_HEADER_EOF (1u << 1)
+#define UVC_PAYLOAD_HEADER_ERR (1u << 6)
+#define UVC_PAYLOAD_HEADER_EOH (1u << 7)
+
+// How long an abort waits for copies still reading the frame
+#define BOUNCE_ABORT_WAIT_MS 20
+
+typedef enum
+{
+    BOUNCE_FREE = 0,
+    BOUNCE_COPYING, // GDMA writing the chunk
+    BOUNCE_READY,   // Chunk landed, waiting for the endpoint
+    BOUNCE_SENDING, // Owned by the endpoint
+} bounce_state_t;
+
+typedef struct
+{
+    uint8_t *payload;      // Header, then the chunk's data
+    uint32_t bytes;        // Data bytes of the chunk
+    int64_t copy_start_us;
+    bounce_state_t state;
+} bounce_buf_t;
+
+static async_memcpy_handle_t dma;
+static uint8_t ep_in;
+static bounce_buf_t bufs[USB_BOUNCE_MAX_BUFFERS];
+static uint8_t buf_count;
+static size_t payload_size;
+static size_t payload_limit;   // Smaller payloads asked for, 0 = payload_size
+static void (*done_cb)(void);
+static bool enabled;
+
+// Frame in progress: chunk n goes through bufs[n % buf_count], copies run
+// up to buf_count chunks ahead of the endpoint. An open frame is still
+// arriving: frame_len and frame_chunks cover what has landed so far.
+static const uint8_t *frame_src;
+static size_t frame_payload;   // Payload size of this frame, header included
+static uint32_t frame_pts;     // Capture time in dwClockFrequency units
+static size_t frame_len;
+static uint32_t frame_chunks;
+static bool frame_open;
+static bool frame_err;     // Ends with an empty payload carrying the error bit
+static uint32_t next_copy;
+static uint32_t next_send;
+static bool frame_active;
+static bool ep_busy;
+static bool waiting;       // Endpoint idle on a chunk still being copied, counted once
+static uint8_t fid;
+
+static usb_bounce_stats_t stats;
+static portMUX_TYPE bounce_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void bounce_kick(void);
+
+static void bounce_kick_deferred(void *param)
+{
+    (void)param;
+    int64_t start = esp_timer_get_time();
+    bounce_kick();
+    portENTER_CRITICAL(&bounce_lock);
+    stats.cpu_us += esp_timer_get_time() - start;
+    portEXIT_CRITICAL(&bounce_lock);
+}
+
+// GDMA done, in interrupt context: the endpoint is fed from the USB task
+static bool bounce_copy_done(async_memcpy_handle_t mcp, async_memcpy_event_t *event, void *cb_args)
+{
+    (void)mcp, (void)event;
+    bounce_buf_t *b = (bounce_buf_t *)cb_args;
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - b->copy_start_us);
+
+    portENTER_CRITICAL_ISR(&bounce_lock);
+    b->state = BOUNCE_READY;
+    if (elapsed > stats.copy_max_us)
+    {
+        stats.copy_max_us = elapsed;
+    }
+    portEXIT_CRITICAL_ISR(&bounce_lock);
+    usbd_defer_func(bounce_kick_deferred, NULL, true);
+    return false;
+}
+
+// Start copying the next chunk of the frame into its buffer, if any is left
+static void bounce_copy_next(void)
+{
+    portENTER_CRITICAL(&bounce_lock);
+    if (!frame_active || next_copy >= frame_chunks || next_copy - next_send >= buf_count)
+    {
+        portEXIT_CRITICAL(&bounce_lock);
+        return;
+    }
+    uint32_t chunk = next_copy++;
+    bounce_buf_t *b = &bufs[chunk % buf_count];
+    size_t data_per_chunk = frame_payload - UVC_PAYLOAD_HEADER_LEN;
+    size_t offset = chunk * data_per_chunk;
+    b->bytes = (uint32_t)(frame_len - offset < data_per_chunk ? frame_len - offset : data_per_chunk);
+    if (b->bytes == 0)
+    {
+        // Header-only tail of a failed or short open frame
+        b->state = BOUNCE_READY;
+        portEXIT_CRITICAL(&bounce_lock);
+        return;
+    }
+    b->copy_start_us = esp_timer_get_time();
+    b->state = BOUNCE_COPYING;
+    portEXIT_CRITICAL(&bounce_lock);
+
+    uint8_t *dst = b->payload + UVC_PAYLOAD_HEADER_LEN;
+    if (esp_async_memcpy(dma, dst, (void *)(uintptr_t)(frame_src + offset), b->bytes, bounce_copy_done, b) == ESP_OK)
+    {
+        portENTER_CRITICAL(&bounce_lock);
+        stats.dma_copies++;
+        portEXIT_CRITICAL(&bounce_lock);
+        return;
+    }
+
+    // Backlog full or buffer refused: the data still has to go out
+    memcpy(dst, frame_src + offset, b->bytes);
+    portENTER_CRITICAL(&bounce_lock);
+    b->state = BOUNCE_READY;
+    stats.cpu_copies++;
+    portEXIT_CRITICAL(&bounce_lock);
+}
+
+// Hand the next chunk to the endpoint if it is idle and the chunk has landed
+static void bounce_kick(void)
+{
+    portENTER_CRITICAL(&bounce_lock);
+    if (!frame_active || ep_busy || next_send >= frame_chunks)
+    {
+        portEXIT_CRITICAL(&bounce_lock);
+        return;
+    }
+    bounce_buf_t *b = &bufs[next_send % buf_count];
+    if (b->state != BOUNCE_READY)
+    {
+        if (!waiting)
+        {
+            waiting = true;
+            stats.copy_waits++;
+        }
+        portEXIT_CRITICAL(&bounce_lock);
+        return;
+    }
+    waiting = false;
+    b->state = BOUNCE_SENDING;
+    ep_busy = true;
+    bool last = !frame_open && next_send + 1 == frame_chunks;
+    bool err = last && frame_err;
+    uint32_t pts = frame_pts;
+    portEXIT_CRITICAL(&bounce_lock);
+
+    b->payload[0] = UVC_PAYLOAD_HEADER_LEN;
+    b->payload[1] = UVC_PAYLOAD_HEADER_EOH | fid | (last ? UVC_PAYLOAD_HEADER_EOF : 0) |
+                    (err ? UVC_PAYLOAD_HEADER_ERR : 0);
+    frame_timing_put_clock(b->payload, pts);
+    bool ok = usbd_edpt_xfer(BOARD_TUD_RHPORT, ep_in, b->payload, (uint16_t)(b->bytes + UVC_PAYLOAD_HEADER_LEN));
+
+    portENTER_CRITICAL(&bounce_lock);
+    if (!ok)
+    {
+        // Endpoint closed under us: the stream is stopping, the abort
+        // releases the frame
+        b->state = BOUNCE_READY;
+        ep_busy = false;
+    }
+    portEXIT_CRITICAL(&bounce_lock);
+}
+
+// New chunks to copy: start as many as there are free buffers, then feed the
+// endpoint. Chunks the CPU copied are ready now, the GDMA ones kick from its
+// callback.
+static void bounce_feed(int64_t start)
+{
+    for (uint8_t i = 0; i < buf_count; i++)
+    {
+        bounce_copy_next();
+    }
+    bounce_kick();
+    portENTER_CRITICAL(&bounce_lock);
+    stats.cpu_us += esp_timer_get_time() - start;
+    portEXIT_CRITICAL(&bounce_lock);
+}
+
+esp_err_t usb_bounce_init(uint8_t ep_addr, size_t chunk, uint8_t buffers, void (*frame_done)(void))
+{
+    if (chunk <= UVC_PAYLOAD_HEADER_LEN || chunk > UINT16_MAX || buffers < 2 || buffers > USB_BOUNCE_MAX_BUFFERS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint8_t i = 0; i < buffers; i++)
+    {
+        bufs[i].payload = (uint8_t *)heap_caps_aligned_alloc(4, chunk, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        if (bufs[i].payload == NULL)
+        {
+            ESP_LOGE(TAG, "No internal DMA memory for %u x %zu byte bounce buffers", buffers, chunk);
+            for (uint8_t j = 0; j < i; j++)
+            {
+                heap_caps_free(bufs[j].payload);
+                bufs[j].payload = NULL;
+            }
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    async_memcpy_config_t config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+    config.backlog = buffers;
+    esp_err_t err = esp_async_memcpy_install(&config, &dma);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Async memcpy unavailable: %s", esp_err_to_name(err));
+        for (uint8_t i = 0; i < buffers; i++)
+        {
+            heap_caps_free(bufs[i].payload);
+            bufs[i].payload = NULL;
+        }
+        return err;
+    }
+
+    ep_in = ep_addr;
+    buf_count = buffers;
+    payload_size = chunk;
+    done_cb = frame_done;
+    ESP_LOGI(TAG, "%u x %zu byte bounce buffers in internal SRAM", buffers, chunk);
+    return ESP_OK;
+}
+
+uint32_t usb_bounce_payload_size(void)
+{
+    return (uint32_t)payload_size;
+}
+
+void usb_bounce_set_payload_limit(size_t size)
+{
+    __atomic_store_n(&payload_limit, size, __ATOMIC_RELAXED);
+}
+
+void usb_bounce_set_enabled(bool enable)
+{
+    __atomic_store_n(&enabled, enable && payload_size != 0, __ATOMIC_RELAXED);
+}
+
+bool usb_bounce_enabled(void)
+{
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+// Payload size, header included, of a frame starting now
+static size_t frame_payload_size(void)
+{
+    size_t limit = __atomic_load_n(&payload_limit, __ATOMIC_RELAXED);
+    if (limit == 0 || limit > payload_size)
+    {
+        return payload_size;
+    }
+    return limit > UVC_PAYLOAD_HEADER_LEN ? limit : UVC_PAYLOAD_HEADER_LEN + 1;
+}
+
+bool usb_bounce_xfer(const uint8_t *buf, size_t len, int64_t capture_us)
+{
+    if (!usb_bounce_enabled() || len == 0)
+    {
+        return false;
+    }
+    int64_t start = esp_timer_get_time();
+
+    portENTER_CRITICAL(&bounce_lock);
+    if (frame_active)
+    {
+        portEXIT_CRITICAL(&bounce_lock);
+        return false;
+    }
+    frame_payload = frame_payload_size();
+    size_t data_per_chunk = frame_payload - UVC_PAYLOAD_HEADER_LEN;
+    frame_pts = frame_timing_to_uvc_clock(capture_us);
+    frame_src = buf;
+    frame_len = len;
+    frame_chunks = (uint32_t)((len + data_per_chunk - 1) / data_per_chunk);
+    frame_open = false;
+    frame_err = false;
+    next_copy = 0;
+    next_send = 0;
+    waiting = false;
+    frame_active = true;
+    portEXIT_CRITICAL(&bounce_lock);
+
+    bounce_feed(start);
+    return true;
+}
+
+bool usb_bounce_open(const uint8_t *buf, int64_t capture_us)
+{
+    if (!usb_bounce_enabled())
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL(&bounce_lock);
+    if (frame_active)
+    {
+        portEXIT_CRITICAL(&bounce_lock);
+        return false;
+    }
+    frame_src = buf;
+    frame_payload = frame_payload_size();
+    frame_pts = frame_timing_to_uvc_clock(capture_us);
+    frame_len = 0;
+    frame_chunks = 0;
+    frame_open = true;
+    frame_err = false;
+    next_copy = 0;
+    next_send = 0;
+    waiting = false;
+    frame_active = true;
+    stats.open_frames++;
+    portEXIT_CRITICAL(&bounce_lock);
+    return true;
+}
+
+// Caller holds bounce_lock: the open frame ends after the chunks already
+// issued, with one more payload of frame_len - next_copy * chunk bytes
+static void bounce_close(size_t data_per_chunk)
+{
+    frame_open = false;
+    if (frame_chunks <= next_copy)
+    {
+        // Everything that landed is already on its way: the end of frame
+        // bit needs a payload of its own
+        frame_len = (size_t)next_copy * data_per_chunk;
+        frame_chunks = next_copy + 1;
+    }
+}
+
+void usb_bounce_extend(size_t len, bool final)
+{
+    int64_t start = esp_timer_get_time();
+
+    portENTER_CRITICAL(&bounce_lock);
+    if (!frame_active || !frame_open || len < frame_len)
+    {
+        portEXIT_CRITICAL(&bounce_lock);
+        return;
+    }
+    size_t data_per_chunk = frame_payload - UVC_PAYLOAD_HEADER_LEN;
+    frame_len = len;
+    if (final)
+    {
+        frame_chunks = (uint32_t)((len + data_per_chunk - 1) / data_per_chunk);
+        bounce_close(data_per_chunk);
+    }
+    else
+    {
+        // Whole chunks only, and never the last byte: the payload carrying
+        // it needs the end of frame bit, which waits for the final length
+        frame_chunks = len ? (uint32_t)((len - 1) / data_per_chunk) : 0;
+    }
+    portEXIT_CRITICAL(&bounce_lock);
+
+    bounce_feed(start);
+}
+
+bool usb_bounce_fail(void)
+{
+    int64_t start = esp_timer_get_time();
+
+    portENTER_CRITICAL(&bounce_lock);
+    bool eof_on_bus = !frame_open && ep_busy && next_send + 1 == frame_chunks;
+    if (!frame_active || frame_err || eof_on_bus)
+    {
+        // Nothing in progress, already failing, or the end of frame payload
+        // is on the bus: too late for the error bit
+        portEXIT_CRITICAL(&bounce_lock);
+        return false;
+    }
+    size_t data_per_chunk = frame_payload - UVC_PAYLOAD_HEADER_LEN;
+    frame_err = true;
+    frame_chunks = next_copy;
+    bounce_close(data_per_chunk);
+    portEXIT_CRITICAL(&bounce_lock);
+
+    bounce_feed(start);
+    return true;
+}
+
+bool usb_bounce_xfer_cb(xfer_result_t result, uint32_t xferred_bytes)
+{
+    int64_t start = esp_timer_get_time();
+
+    portENTER_CRITICAL(&bounce_lock);
+    if (!ep_busy)
+    {
+        portEXIT_CRITICAL(&bounce_lock);
+        return false;
+    }
+    ep_busy = false;
+    bufs[next_send % buf_count].state = BOUNCE_FREE;
+    next_send++;
+    stats.payloads++;
+    if (xferred_bytes > UVC_PAYLOAD_HEADER_LEN)
+    {
+        stats.bytes += xferred_bytes - UVC_PAYLOAD_HEADER_LEN;
+    }
+    bool done = !frame_open && next_send >= frame_chunks;
+    if (done)
+    {
+        frame_active = false;
+        fid ^= UVC_PAYLOAD_HEADER_FID;
+        if (frame_err)
+        {
+            stats.errors++;
+        }
+        else
+        {
+            stats.frames++;
+        }
+    }
+    portEXIT_CRITICAL(&bounce_lock);
+
+    if (result != XFER_RESULT_SUCCESS)
+    {
+        ESP_LOGD(TAG, "Payload transfer result %d", result);
+    }
+    if (done)
+    {
+        if (done_cb)
+        {
+            done_cb();
+        }
+    }
+    else
+    {
+        bounce_copy_next();
+        bounce_kick();
+    }
+
+    portENTER_CRITICAL(&bounce_lock);
+    stats.cpu_us += esp_timer_get_time() - start;
+    portEXIT_CRITICAL(&bounce_lock);
+    return true;
+}
+
+bool usb_bounce_abort(void)
+{
+    // Copies cannot be cancelled; the frame buffer must outlive them
+    for (int waited = 0; waited < BOUNCE_ABORT_WAIT_MS; waited++)
+    {
+        bool copying = false;
+        portENTER_CRITICAL(&bounce_lock);
+        for (uint8_t i = 0; i < buf_count; i++)
+        {
+            copying |= bufs[i].state == BOUNCE_COPYING;
+        }
+        portEXIT_CRITICAL(&bounce_lock);
+        if (!copying)
+        {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+
+    portENTER_CRITICAL(&bounce_lock);
+    bool was_active = frame_active;
+    if (was_active)
+    {
+        stats.aborted++;
+        // The host drops the partial frame, the next one starts fresh
+        fid ^= UVC_PAYLOAD_HEADER_FID;
+    }
+    frame_active = false;
+    ep_busy = false;
+    for (uint8_t i = 0; i < buf_count; i++)
+    {
+        bufs[i].state = BOUNCE_FREE;
+    }
+    portEXIT_CRITICAL(&bounce_lock);
+    return was_active;
+}
+
+void usb_bounce_get_stats(usb_bounce_stats_t *out)
+{
+    portENTER_CRITICAL(&bounce_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&bounce_lock);
+}
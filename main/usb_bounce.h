@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "frame_timing.h"
+#include "tusb.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define USB_BOUNCE_MAX_BUFFERS 4
+
+// Payload header of the stage, with the presentation time and the source
+// clock (PTS and SCR)
+#define USB_BOUNCE_HEADER_LEN FRAME_TIMING_HEADER_LEN
+
+  typedef struct
+  {
+    uint32_t frames;      // Frames sent in full through the bounce buffers
+    uint32_t aborted;     // Frames cut short by a stream stop
+    uint32_t errors;      // Open frames ended with the error bit
+    uint32_t open_frames; // Frames started before their length was known
+    uint64_t bytes;       // Frame bytes sent
+    uint32_t payloads;    // Endpoint transfers, one payload each
+    uint32_t dma_copies;  // Chunks copied from PSRAM by the GDMA
+    uint32_t cpu_copies;  // Chunks the CPU had to copy because the GDMA refused them
+    uint32_t copy_waits;  // Endpoint free before the next chunk had landed
+    uint32_t copy_max_us; // Longest chunk copy, issue to completion
+    uint64_t cpu_us;      // CPU time spent in the stage, outside the copy interrupt
+  } usb_bounce_stats_t;
+
+  // Allocate buffers chunk-byte buffers in internal DMA-capable SRAM and
+  // install the async memcpy engine. Frames then go to the streaming
+  // endpoint ep_addr as payloads of exactly chunk bytes (header included),
+  // each filled from PSRAM by the GDMA while the previous ones are on the
+  // bus. frame_done runs in the USB device task once the last payload of a
+  // frame is delivered.
+  esp_err_t usb_bounce_init(uint8_t ep_addr, size_t chunk, uint8_t buffers, void (*frame_done)(void));
+
+  // dwMaxPayloadTransferSize the stage needs, 0 if it is not initialized
+  uint32_t usb_bounce_payload_size(void);
+
+  // Send payloads of at most size bytes (header included) from the next
+  // frame on, down from the chunk size: the committed payload size is only
+  // a maximum. 0 goes back to whole chunks. For the USB benchmark.
+  void usb_bounce_set_payload_limit(size_t size);
+
+  // Commit: the stage sends the following frames only if the host committed
+  // its payload size, the video driver does otherwise
+  void usb_bounce_set_enabled(bool enabled);
+  bool usb_bounce_enabled(void);
+
+  // Start sending a frame captured at capture_us (esp_timer time), the
+  // PTS of all its payloads. buf must stay valid until frame_done or
+  // usb_bounce_abort. Returns false if a frame is already in progress or the
+  // stage is not enabled.
+  bool usb_bounce_xfer(const uint8_t *buf, size_t len, int64_t capture_us);
+
+  // Start a frame whose data is still landing in buf (sub-frame streaming).
+  // Nothing is sent until usb_bounce_extend reports data; the end of frame
+  // bit waits for the final length. Returns false like usb_bounce_xfer.
+  bool usb_bounce_open(const uint8_t *buf, int64_t capture_us);
+
+  // The first len bytes of the open frame are in memory; final: the frame
+  // is len bytes long. Calls for a frame that is not open are ignored.
+  void usb_bounce_extend(size_t len, bool final);
+
+  // The open (or still sending) frame turned out bad: payloads already
+  // copied go out, then an empty one with the error and end of frame bits,
+  // and frame_done runs as usual. Returns false if its end of frame payload
+  // is already on the bus, or nothing is in progress.
+  bool usb_bounce_fail(void);
+
+  // Endpoint completion from the class driver, in the USB device task.
+  // Returns false if the transfer was not one of the stage's.
+  bool usb_bounce_xfer_cb(xfer_result_t result, uint32_t xferred_bytes);
+
+  // Stream stopped, the stack dropped the transfer in progress: wait for
+  // copies still reading the frame, then forget it. Returns true if a frame
+  // was in progress.
+  bool usb_bounce_abort(void);
+
+  void usb_bounce_get_stats(usb_bounce_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
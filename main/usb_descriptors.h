@@ -8,6 +8,9 @@
 
 #include "tusb.h"
 #include "class/video/video.h"
+#include "sdkconfig.h"
+#include "frame_timing.h"
+#include "uvc_controls.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -17,37 +20,195 @@ extern "C"
 // Video streaming endpoint
 #define EPNUM_VIDEO_IN 0x81
 
+// CDC-ACM telemetry endpoints
+#define EPNUM_CDC_NOTIF 0x82
+#define EPNUM_CDC_OUT 0x03
+#define EPNUM_CDC_IN 0x83
+
 // Video Interface numbers
 #define ITF_NUM_VIDEO_CONTROL 0
 #define ITF_NUM_VIDEO_STREAMING 1
+#if CONFIG_UVC_CDC_TELEMETRY
+#define ITF_NUM_CDC 2
+#define ITF_NUM_CDC_DATA 3
+#define ITF_NUM_TOTAL 4
+#else
 #define ITF_NUM_TOTAL 2
+#endif
+
+// Frame interval in 100 ns units
+#define UVC_FPS_TO_INTERVAL(fps) (10000000 / (fps))
+
+// Streaming formats, in descriptor order
+#define UVC_FORMAT_INDEX_MJPEG 1
+#define UVC_FORMAT_INDEX_YUY2 2
+#define UVC_FORMAT_COUNT 2
+
+// Frames offered to the host for each format:
+// X(frame index, FRAMESIZE_ suffix, width, height, interval fps...)
+// MJPEG rates start at the native rate of the OV2640 mode (CIF/SVGA/UXGA)
+// used for that size, lower rates are reached through the sensor clock divider.
+// The small frames at the end suit a zoomed region of interest: their window
+// stays in the 60 fps CIF readout up to 2x (QCIF) or 1.6x (HQVGA) zoom and in
+// the 30 fps SVGA readout up to 4x or 3.3x, where VGA drops to the 15 fps UXGA
+// readout beyond 1.25x (see sensor_window.h). They follow the others so the
+// existing frame indices stay.
+#define UVC_MJPEG_FRAME_LIST(X)           \
+  X(1, QQVGA, 160, 120, 60, 30, 15)       \
+  X(2, QVGA, 320, 240, 60, 30, 15)        \
+  X(3, CIF, 400, 296, 60, 30, 15)         \
+  X(4, VGA, 640, 480, 30, 15, 10)         \
+  X(5, SVGA, 800, 600, 30, 15, 10)        \
+  X(6, XGA, 1024, 768, 15, 10, 5)         \
+  X(7, HD, 1280, 720, 15, 10, 5)          \
+  X(8, SXGA, 1280, 1024, 15, 10, 5)       \
+  X(9, UXGA, 1600, 1200, 15, 10, 5)       \
+  X(10, QCIF, 176, 144, 60, 30, 15)       \
+  X(11, HQVGA, 240, 176, 60, 30, 15)
+
+#define UVC_MJPEG_DEFAULT_FRAME_INDEX 4
+
+// Uncompressed YUY2 is limited by the ~1 MB/s full-speed bulk budget, or the
+// 1023 bytes per 1 ms of the largest isochronous alternate setting
+#define UVC_YUY2_FRAME_LIST(X)            \
+  X(1, QQVGA, 160, 120, 15, 10, 5)        \
+  X(2, QVGA, 320, 240, 5, 2, 1)
+
+#define UVC_YUY2_DEFAULT_FRAME_INDEX 1
+
+// Still image sizes of the MJPEG format (still image method 2):
+// X(size pattern index, FRAMESIZE_ suffix, width, height)
+// The sensor switches to the size for one frame, whatever the stream's size.
+#define UVC_STILL_FRAME_LIST(X)           \
+  X(1, UXGA, 1600, 1200)
+
+// Frame descriptor with three discrete frame intervals, shared layout of
+// MJPEG (UVC MJPEG 1.5 Table 3-2) and uncompressed (UVC Uncompressed 1.5 Table 3-2) frames
+#define UVC_DESC_CS_VS_FRM_DISC3_LEN (26 + 3 * 4)
+#define UVC_DESC_CS_VS_FRM_DISC3(_subtype, _frmidx, _width, _height, _maxfbsz, _fps0, _fps1, _fps2)            \
+  UVC_DESC_CS_VS_FRM_DISC3_LEN, TUSB_DESC_CS_INTERFACE, _subtype,                                             \
+      _frmidx, 0, U16_TO_U8S_LE(_width), U16_TO_U8S_LE(_height),                                              \
+      U32_TO_U8S_LE((_width) * (_height) * 16 * (_fps2)), U32_TO_U8S_LE((_width) * (_height) * 16 * (_fps0)), \
+      U32_TO_U8S_LE(_maxfbsz), U32_TO_U8S_LE(UVC_FPS_TO_INTERVAL(_fps0)), 3,                                  \
+      U32_TO_U8S_LE(UVC_FPS_TO_INTERVAL(_fps0)), U32_TO_U8S_LE(UVC_FPS_TO_INTERVAL(_fps1)),                   \
+      U32_TO_U8S_LE(UVC_FPS_TO_INTERVAL(_fps2))
+
+#define UVC_MJPEG_FRAME_DESC(_idx, _fs, _w, _h, _fps0, _fps1, _fps2) \
+  UVC_DESC_CS_VS_FRM_DISC3(VIDEO_CS_ITF_VS_FRAME_MJPEG, _idx, _w, _h, (_w) * (_h) / 2, _fps0, _fps1, _fps2),
+#define UVC_YUY2_FRAME_DESC(_idx, _fs, _w, _h, _fps0, _fps1, _fps2) \
+  UVC_DESC_CS_VS_FRM_DISC3(VIDEO_CS_ITF_VS_FRAME_UNCOMPRESSED, _idx, _w, _h, (_w) * (_h) * 2, _fps0, _fps1, _fps2),
+#define UVC_FRAME_LEN(_idx, _fs, _w, _h, _fps0, _fps1, _fps2) +UVC_DESC_CS_VS_FRM_DISC3_LEN
+#define UVC_FRAME_COUNT_ONE(_idx, _fs, _w, _h, _fps0, _fps1, _fps2) +1
+
+#define UVC_MJPEG_FRAME_COUNT (0 UVC_MJPEG_FRAME_LIST(UVC_FRAME_COUNT_ONE))
+#define UVC_YUY2_FRAME_COUNT (0 UVC_YUY2_FRAME_LIST(UVC_FRAME_COUNT_ONE))
+
+// Still Image Frame descriptor without compression patterns (UVC 1.5 Table 3-18);
+// bEndpointAddress is 0 for method 2, stills share the video endpoint
+#define UVC_STILL_SIZE_COUNT_ONE(_idx, _fs, _w, _h) +1
+#define UVC_STILL_SIZE(_idx, _fs, _w, _h) U16_TO_U8S_LE(_w), U16_TO_U8S_LE(_h),
+#define UVC_STILL_FRAME_COUNT (0 UVC_STILL_FRAME_LIST(UVC_STILL_SIZE_COUNT_ONE))
+#if CONFIG_UVC_STILL_CAPTURE
+#define UVC_STILL_CAPTURE_METHOD 2 // bStillCaptureMethod of the VS input header
+#define UVC_DESC_CS_VS_STILL_FRAME_LEN (5 + 4 * UVC_STILL_FRAME_COUNT + 1)
+#define UVC_DESC_CS_VS_STILL_FRAME()                                                              \
+  UVC_DESC_CS_VS_STILL_FRAME_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VS_STILL_IMAGE_FRAME, 0,   \
+      UVC_STILL_FRAME_COUNT, UVC_STILL_FRAME_LIST(UVC_STILL_SIZE) 0,
+#else
+#define UVC_STILL_CAPTURE_METHOD 0
+#define UVC_DESC_CS_VS_STILL_FRAME_LEN 0
+#define UVC_DESC_CS_VS_STILL_FRAME()
+#endif
+
+// Isochronous streaming: the streaming interface's alternate setting 0 has no
+// endpoint, settings 1..N each reserve one packet per 1 ms frame of the size
+// listed, up to the full-speed isochronous limit of 1023 bytes. The host picks
+// the smallest one that carries the committed dwMaxPayloadTransferSize.
+// X(alternate setting, wMaxPacketSize)
+#define UVC_ISO_ALT_LIST(X) \
+  X(1, 128)                 \
+  X(2, 256)                 \
+  X(3, 512)                 \
+  X(4, 768)                 \
+  X(5, 1023)
+
+#define UVC_ISO_ALT_COUNT_ONE(_alt, _size) +1
+#define UVC_ISO_ALT_COUNT (0 UVC_ISO_ALT_LIST(UVC_ISO_ALT_COUNT_ONE))
+#define UVC_ISO_MAX_PACKET 1023
+
+// Endpoint part of the streaming interface: one bulk endpoint in alternate
+// setting 0, or one isochronous endpoint per bandwidth alternate setting
+#if CONFIG_UVC_USB_ISO
+#define UVC_ISO_ALT_DESC(_alt, _size) \
+  TUD_VIDEO_DESC_STD_VS(ITF_NUM_VIDEO_STREAMING, _alt, 1, 0), TUD_VIDEO_DESC_EP_ISO(EPNUM_VIDEO_IN, _size, 1),
+#define UVC_VS_ENDPOINTS_LEN (UVC_ISO_ALT_COUNT * (TUD_VIDEO_DESC_STD_VS_LEN + 7))
+#define UVC_VS_ENDPOINTS(epin, epsize) UVC_ISO_ALT_LIST(UVC_ISO_ALT_DESC)
+#else
+#define UVC_VS_ENDPOINTS_LEN 7
+#define UVC_VS_ENDPOINTS(epin, epsize) TUD_VIDEO_DESC_EP_BULK(epin, epsize, 1),
+#endif
+
+// Processing Unit with a 2-byte bmControls (UVC 1.1 Table 3-8)
+#define UVC_DESC_PROCESSING_UNIT_LEN (10 + 2)
+#define UVC_DESC_PROCESSING_UNIT(_uid, _srcid, _ctls, _stridx)                                      \
+  UVC_DESC_PROCESSING_UNIT_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VC_PROCESSING_UNIT, _uid, _srcid, \
+      U16_TO_U8S_LE(0), 2, U16_TO_U8S_LE(_ctls), _stridx, 0
+
+// Extension Unit with one input pin and a 3-byte bmControls (UVC 1.1 Table 3-10)
+#define UVC_DESC_EXTENSION_UNIT_LEN (24 + 1 + 3)
+#define UVC_DESC_EXTENSION_UNIT(_uid, _guid, _nctls, _srcid, _ctls, _stridx)                        \
+  UVC_DESC_EXTENSION_UNIT_LEN, TUSB_DESC_CS_INTERFACE, VIDEO_CS_ITF_VC_EXTENSION_UNIT, _uid, _guid,    \
+      _nctls, 1, _srcid, 3, TU_U24_TO_U8S_LE(_ctls), _stridx
+
+// guidExtensionCode of the vendor controls, {5ccfd21f-1a3e-374b-9a1b-7c0e5f3d2a61}
+#define UVC_XU_GUID 0x1f, 0xd2, 0xcf, 0x5c, 0x3e, 0x1a, 0x4b, 0x37, 0x9a, 0x1b, 0x7c, 0x0e, 0x5f, 0x3d, 0x2a, 0x61
+
+// Class-specific VC descriptors following the header
+#define UVC_VC_UNITS_LEN (                             \
+    TUD_VIDEO_DESC_CAMERA_TERM_LEN +                   \
+    UVC_DESC_PROCESSING_UNIT_LEN +                     \
+    UVC_DESC_EXTENSION_UNIT_LEN +                      \
+    TUD_VIDEO_DESC_OUTPUT_TERM_LEN)
+
+// Class-specific VS descriptors following the input header
+#define UVC_VS_FORMATS_LEN (                          \
+    TUD_VIDEO_DESC_CS_VS_FMT_MJPEG_LEN +              \
+    (0 UVC_MJPEG_FRAME_LIST(UVC_FRAME_LEN)) +         \
+    UVC_DESC_CS_VS_STILL_FRAME_LEN +                  \
+    TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING_LEN +         \
+    TUD_VIDEO_DESC_CS_VS_FMT_UNCOMPR_LEN +            \
+    (0 UVC_YUY2_FRAME_LIST(UVC_FRAME_LEN)) +          \
+    TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING_LEN)
 
 // UVC descriptor for USB Video Class
-#define TUD_VIDEO_CAPTURE_DESC_UNCOMPR_LEN (  \
-    TUD_VIDEO_DESC_IAD_LEN +                  \
-    TUD_VIDEO_DESC_STD_VC_LEN +               \
-    TUD_VIDEO_DESC_CS_VC_LEN +                \
-    TUD_VIDEO_DESC_CAMERA_TERM_LEN +          \
-    TUD_VIDEO_DESC_OUTPUT_TERM_LEN +          \
-    TUD_VIDEO_DESC_STD_VS_LEN +               \
-    TUD_VIDEO_DESC_CS_VS_IN_LEN +             \
-    TUD_VIDEO_DESC_CS_VS_FMT_MJPEG_LEN +      \
-    TUD_VIDEO_DESC_CS_VS_FRM_MJPEG_CONT_LEN + \
-    TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING_LEN + \
-    7)
-
-#define TUD_VIDEO_CAPTURE_DESC_UNCOMPR(itfnum, stridx, epin, epsize)                                                                                    \
-  TUD_VIDEO_DESC_IAD(itfnum, 2, stridx),\
-  TUD_VIDEO_DESC_STD_VC(itfnum, 0, stridx),                                                                                                             \
-      TUD_VIDEO_DESC_CS_VC(0x0110, (TUD_VIDEO_DESC_CS_VC_LEN + TUD_VIDEO_DESC_CAMERA_TERM_LEN + TUD_VIDEO_DESC_OUTPUT_TERM_LEN), 48000000, itfnum + 1), \
-      TUD_VIDEO_DESC_CAMERA_TERM(1, 0, stridx, 0, 0, 0, 0),                                                                                             \
-      TUD_VIDEO_DESC_OUTPUT_TERM(2, VIDEO_TT_STREAMING, 0, 1, stridx),                                                                                  \
+#define TUD_VIDEO_CAPTURE_DESC_LEN (           \
+    TUD_VIDEO_DESC_IAD_LEN +                   \
+    TUD_VIDEO_DESC_STD_VC_LEN +                \
+    (TUD_VIDEO_DESC_CS_VC_LEN + 1) + /* bInCollection */ \
+    UVC_VC_UNITS_LEN +                         \
+    TUD_VIDEO_DESC_STD_VS_LEN +                \
+    (TUD_VIDEO_DESC_CS_VS_IN_LEN + UVC_FORMAT_COUNT) + /* bNumFormats x bControlSize */ \
+    UVC_VS_FORMATS_LEN +                       \
+    UVC_VS_ENDPOINTS_LEN)
+
+#define TUD_VIDEO_CAPTURE_DESC(itfnum, stridx, epin, epsize)                                                                                            \
+  TUD_VIDEO_DESC_IAD(itfnum, 2, stridx),                                                                                                                \
+      TUD_VIDEO_DESC_STD_VC(itfnum, 0, stridx),                                                                                                         \
+      TUD_VIDEO_DESC_CS_VC(0x0110, UVC_VC_UNITS_LEN, UVC_CLOCK_FREQUENCY_HZ, itfnum + 1),                                                               \
+      TUD_VIDEO_DESC_CAMERA_TERM(UVC_ENTITY_CAP_INPUT_TERMINAL, 0, stridx, 0, 0, 0, UVC_CT_CONTROLS),                                                   \
+      UVC_DESC_PROCESSING_UNIT(UVC_ENTITY_PROCESSING_UNIT, UVC_ENTITY_CAP_INPUT_TERMINAL, UVC_PU_CONTROLS, 0),                                          \
+      UVC_DESC_EXTENSION_UNIT(UVC_ENTITY_EXTENSION_UNIT, UVC_XU_GUID, UVC_XU_CONTROL_COUNT, UVC_ENTITY_PROCESSING_UNIT, UVC_XU_CONTROLS, 0),            \
+      TUD_VIDEO_DESC_OUTPUT_TERM(UVC_ENTITY_CAP_OUTPUT_TERMINAL, VIDEO_TT_STREAMING, 0, UVC_ENTITY_EXTENSION_UNIT, stridx),                             \
       TUD_VIDEO_DESC_STD_VS(itfnum + 1, 0, 0, stridx),                                                                                                  \
-      TUD_VIDEO_DESC_CS_VS_INPUT(1, TUD_VIDEO_DESC_CS_VS_IN_LEN, epin, 0, 2, 0, 0, 0, 1),                                                               \
-      TUD_VIDEO_DESC_CS_VS_FMT_MJPEG(1, 1, 1, 1, 0, 0, 0, 0),                                                                                           \
-      TUD_VIDEO_DESC_CS_VS_FRM_MJPEG_CONT(1, 0, 640, 480, 640 * 480 * 3, 640 * 480 * 16 * 10, 640 * 480 / 2, 1000000, 1000000, 3333333, 0),             \
+      TUD_VIDEO_DESC_CS_VS_INPUT(UVC_FORMAT_COUNT, UVC_VS_FORMATS_LEN, epin, 0, UVC_ENTITY_CAP_OUTPUT_TERMINAL, UVC_STILL_CAPTURE_METHOD, 0, 0, 0, 0), \
+      TUD_VIDEO_DESC_CS_VS_FMT_MJPEG(UVC_FORMAT_INDEX_MJPEG, UVC_MJPEG_FRAME_COUNT, 1, UVC_MJPEG_DEFAULT_FRAME_INDEX, 0, 0, 0, 0),                       \
+      UVC_MJPEG_FRAME_LIST(UVC_MJPEG_FRAME_DESC)                                                                                                        \
+      UVC_DESC_CS_VS_STILL_FRAME()                                                                                                                      \
       TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING(1, 1, 4),                                                                                                     \
-      TUD_VIDEO_DESC_EP_BULK(epin, epsize, 1)
+      TUD_VIDEO_DESC_CS_VS_FMT_YUY2(UVC_FORMAT_INDEX_YUY2, UVC_YUY2_FRAME_COUNT, UVC_YUY2_DEFAULT_FRAME_INDEX, 0, 0, 0, 0),                              \
+      UVC_YUY2_FRAME_LIST(UVC_YUY2_FRAME_DESC)                                                                                                          \
+      TUD_VIDEO_DESC_CS_VS_COLOR_MATCHING(1, 1, 4),                                                                                                     \
+      UVC_VS_ENDPOINTS(epin, epsize)
 
   // USB Device Descriptor
   static const tusb_desc_device_t desc_device = {
@@ -66,28 +227,35 @@ extern "C"
       .iSerialNumber = 0x03,
       .bNumConfigurations = 0x01};
 
+// CDC-ACM function after the camera, with its own interface association
+#if CONFIG_UVC_CDC_TELEMETRY
+#define UVC_CDC_DESC_LEN TUD_CDC_DESC_LEN
+#define UVC_CDC_DESC(_stridx) \
+  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, _stridx, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+#else
+#define UVC_CDC_DESC_LEN 0
+#define UVC_CDC_DESC(_stridx)
+#endif
+
+// wTotalLength counts the configuration descriptor itself as well
+#define UVC_CONFIG_TOTAL_LEN (9 + TUD_VIDEO_CAPTURE_DESC_LEN + UVC_CDC_DESC_LEN)
+
   // Configuration Descriptor
   static const uint8_t desc_configuration[] = {
       // Configuration descriptor (9 bytes)
       9, TUSB_DESC_CONFIGURATION,
-      TUD_VIDEO_CAPTURE_DESC_UNCOMPR_LEN & 0xFF, (TUD_VIDEO_CAPTURE_DESC_UNCOMPR_LEN >> 8) & 0xFF, // Total length (low byte, high byte)
+      UVC_CONFIG_TOTAL_LEN & 0xFF, (UVC_CONFIG_TOTAL_LEN >> 8) & 0xFF,                             // Total length (low byte, high byte)
       ITF_NUM_TOTAL,                                                                               // Number of interfaces
       1,                                                                                           // Configuration value
       0,                                                                                           // Configuration string index
       TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP,                                                          // Attributes
       250,                                                                                         // Max power (500mA / 2)
 
-      // UVC Descriptor (BULK endpoint, FS max packet 64)
-      TUD_VIDEO_CAPTURE_DESC_UNCOMPR(ITF_NUM_VIDEO_CONTROL, 4, EPNUM_VIDEO_IN, 64)};
-
-  // String Descriptors
-  static const char *string_desc_arr[] = {
-      (const char[]){0x09, 0x04}, // 0: is supported language is English (0x0409)
-      "Espressif",                // 1: Manufacturer
-      "ESP32-S3 UVC Camera",      // 2: Product
-      "123456",                   // 3: Serials
-      "UVC",                      // 4: UVC Interface
-  };
+      // UVC Descriptor (bulk endpoint with FS max packet 64, or isochronous alternate settings)
+      TUD_VIDEO_CAPTURE_DESC(ITF_NUM_VIDEO_CONTROL, 4, EPNUM_VIDEO_IN, 64)
+
+      // CDC-ACM telemetry, if enabled
+      UVC_CDC_DESC(5)};
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,337 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+}
+#include "uvc_controls.h"
+#include "pipeline_stats.h"
+#include "sensor_window.h"
+
+static const char *TAG = "UVC_CTRL";
+
+// GET_INFO: supports GET and SET
+#define UVC_CONTROL_INFO_GET_SET 0x03
+
+typedef struct
+{
+    uint8_t entity;
+    uint8_t selector;
+    uint8_t size;     // wLength of the control
+    bool bitmap;      // GET_RES is the bitmap of allowed values, no GET_MIN/GET_MAX
+    int32_t min;
+    int32_t max;
+    int32_t res;
+    int32_t def;      // Image tuning applied at boot
+    int (*apply)(sensor_t *s, int32_t value); // Host units to the sensor setter
+} uvc_control_t;
+
+// Listed in the order the sensor is programmed after an init; enabling an
+// automatic mode comes before the manual value it overrides
+static const uvc_control_t controls[] = {
+    {UVC_ENTITY_PROCESSING_UNIT, UVC_PU_BRIGHTNESS_CONTROL, 2, false, -2, 2, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_brightness(s, v); }},
+    {UVC_ENTITY_PROCESSING_UNIT, UVC_PU_CONTRAST_CONTROL, 2, false, 0, 4, 1, 2,
+     [](sensor_t *s, int32_t v) { return s->set_contrast(s, v - 2); }},
+    {UVC_ENTITY_PROCESSING_UNIT, UVC_PU_SATURATION_CONTROL, 2, false, 0, 4, 1, 2,
+     [](sensor_t *s, int32_t v) { return s->set_saturation(s, v - 2); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_SPECIAL_EFFECT_CONTROL, 1, false, 0, 6, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_special_effect(s, v); }},
+    {UVC_ENTITY_PROCESSING_UNIT, UVC_PU_WHITE_BALANCE_TEMPERATURE_AUTO_CONTROL, 1, false, 0, 1, 1, 1,
+     [](sensor_t *s, int32_t v) { return s->set_whitebal(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_AWB_GAIN_CONTROL, 1, false, 0, 1, 1, 1,
+     [](sensor_t *s, int32_t v) { return s->set_awb_gain(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_WB_MODE_CONTROL, 1, false, 0, 4, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_wb_mode(s, v); }},
+    {UVC_ENTITY_CAP_INPUT_TERMINAL, UVC_CT_AE_MODE_CONTROL, 1, true, 0, 0, UVC_AE_MODE_MANUAL | UVC_AE_MODE_AUTO, UVC_AE_MODE_AUTO,
+     [](sensor_t *s, int32_t v) { return s->set_exposure_ctrl(s, v == UVC_AE_MODE_AUTO); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_AEC_DSP_CONTROL, 1, false, 0, 1, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_aec2(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_AE_LEVEL_CONTROL, 1, false, 0, 4, 1, 2,
+     [](sensor_t *s, int32_t v) { return s->set_ae_level(s, v - 2); }},
+    // In sensor line periods rather than the 100 us units of the spec
+    {UVC_ENTITY_CAP_INPUT_TERMINAL, UVC_CT_EXPOSURE_TIME_ABSOLUTE_CONTROL, 4, false, 0, 1200, 1, 300,
+     [](sensor_t *s, int32_t v) { return s->set_aec_value(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_AGC_CONTROL, 1, false, 0, 1, 1, 1,
+     [](sensor_t *s, int32_t v) { return s->set_gain_ctrl(s, v); }},
+    {UVC_ENTITY_PROCESSING_UNIT, UVC_PU_GAIN_CONTROL, 2, false, 0, 30, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_agc_gain(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_GAIN_CEILING_CONTROL, 1, false, 0, 6, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_gainceiling(s, (gainceiling_t)v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_BPC_CONTROL, 1, false, 0, 1, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_bpc(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_WPC_CONTROL, 1, false, 0, 1, 1, 1,
+     [](sensor_t *s, int32_t v) { return s->set_wpc(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_RAW_GAMMA_CONTROL, 1, false, 0, 1, 1, 1,
+     [](sensor_t *s, int32_t v) { return s->set_raw_gma(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_LENS_CORRECTION_CONTROL, 1, false, 0, 1, 1, 1,
+     [](sensor_t *s, int32_t v) { return s->set_lenc(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_HMIRROR_CONTROL, 1, false, 0, 1, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_hmirror(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_VFLIP_CONTROL, 1, false, 0, 1, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_vflip(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_DCW_CONTROL, 1, false, 0, 1, 1, 1,
+     [](sensor_t *s, int32_t v) { return s->set_dcw(s, v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_COLORBAR_CONTROL, 1, false, 0, 1, 1, 0,
+     [](sensor_t *s, int32_t v) { return s->set_colorbar(s, v); }},
+    // Region of interest: stored here, camera_task programs the window once
+    // for all three
+    {UVC_ENTITY_CAP_INPUT_TERMINAL, UVC_CT_ZOOM_ABSOLUTE_CONTROL, 2, false, SENSOR_WINDOW_ZOOM_MIN, SENSOR_WINDOW_ZOOM_MAX, 1,
+     SENSOR_WINDOW_ZOOM_MIN, [](sensor_t *s, int32_t v) { (void)s; return sensor_window_set_zoom(v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_ROI_PAN_CONTROL, 2, false, -SENSOR_WINDOW_PAN_MAX, SENSOR_WINDOW_PAN_MAX, 1, 0,
+     [](sensor_t *s, int32_t v) { (void)s; return sensor_window_set_pan(v); }},
+    {UVC_ENTITY_EXTENSION_UNIT, UVC_XU_ROI_TILT_CONTROL, 2, false, -SENSOR_WINDOW_PAN_MAX, SENSOR_WINDOW_PAN_MAX, 1, 0,
+     [](sensor_t *s, int32_t v) { (void)s; return sensor_window_set_tilt(v); }},
+};
+
+#define CONTROL_COUNT (sizeof(controls) / sizeof(controls[0]))
+static_assert(CONTROL_COUNT <= 32, "dirty mask holds 32 controls");
+
+// Shadow registers: the value the host last set, answered without SCCB
+static int32_t shadow[CONTROL_COUNT];
+static uint32_t dirty_mask;
+static uvc_controls_stats_t ctrl_stats;
+static portMUX_TYPE ctrl_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int find_control(uint8_t entity, uint8_t selector)
+{
+    for (int i = 0; i < (int)CONTROL_COUNT; i++)
+    {
+        if (controls[i].entity == entity && controls[i].selector == selector)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void count_rejected(void)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    ctrl_stats.rejected++;
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+static void put_le(uint8_t *buf, int32_t value, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; i++)
+    {
+        buf[i] = (uint8_t)((uint32_t)value >> (8 * i));
+    }
+}
+
+static int32_t get_le(const uint8_t *buf, uint8_t size, bool is_signed)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < size; i++)
+    {
+        value |= (uint32_t)buf[i] << (8 * i);
+    }
+    if (is_signed && size < 4 && (value & (1u << (8 * size - 1))))
+    {
+        value |= ~0u << (8 * size);
+    }
+    return (int32_t)value;
+}
+
+void uvc_controls_init(void)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    for (size_t i = 0; i < CONTROL_COUNT; i++)
+    {
+        shadow[i] = controls[i].def;
+    }
+    dirty_mask = 0;
+    memset(&ctrl_stats, 0, sizeof(ctrl_stats));
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+video_error_code_t uvc_controls_get(uint8_t entity, uint8_t selector, uint8_t request, uint8_t *buf, uint16_t *len)
+{
+    int idx = find_control(entity, selector);
+    if (idx < 0)
+    {
+        count_rejected();
+        return VIDEO_ERROR_INVALID_CONTROL;
+    }
+    const uvc_control_t *c = &controls[idx];
+
+    uint8_t answer[UVC_CONTROL_MAX_LEN];
+    uint16_t answer_len = c->size;
+    video_error_code_t err = VIDEO_ERROR_NONE;
+
+    portENTER_CRITICAL(&ctrl_lock);
+    switch (request)
+    {
+    case VIDEO_REQUEST_GET_CUR:
+        put_le(answer, shadow[idx], c->size);
+        break;
+    case VIDEO_REQUEST_GET_MIN:
+    case VIDEO_REQUEST_GET_MAX:
+        if (c->bitmap)
+        {
+            err = VIDEO_ERROR_INVALID_REQUEST;
+        }
+        put_le(answer, request == VIDEO_REQUEST_GET_MIN ? c->min : c->max, c->size);
+        break;
+    case VIDEO_REQUEST_GET_RES:
+        put_le(answer, c->res, c->size);
+        break;
+    case VIDEO_REQUEST_GET_DEF:
+        put_le(answer, c->def, c->size);
+        break;
+    case VIDEO_REQUEST_GET_LEN:
+        answer_len = 2;
+        put_le(answer, c->size, 2);
+        break;
+    case VIDEO_REQUEST_GET_INFO:
+        answer_len = 1;
+        answer[0] = UVC_CONTROL_INFO_GET_SET;
+        break;
+    default:
+        err = VIDEO_ERROR_INVALID_REQUEST;
+        break;
+    }
+    if (err == VIDEO_ERROR_NONE)
+    {
+        ctrl_stats.get_requests++;
+    }
+    else
+    {
+        ctrl_stats.rejected++;
+    }
+    portEXIT_CRITICAL(&ctrl_lock);
+
+    if (err == VIDEO_ERROR_NONE)
+    {
+        *len = answer_len < *len ? answer_len : *len;
+        memcpy(buf, answer, *len);
+    }
+    return err;
+}
+
+video_error_code_t uvc_controls_set(uint8_t entity, uint8_t selector, const uint8_t *buf, uint16_t len)
+{
+    int idx = find_control(entity, selector);
+    if (idx < 0)
+    {
+        count_rejected();
+        return VIDEO_ERROR_INVALID_CONTROL;
+    }
+    const uvc_control_t *c = &controls[idx];
+
+    int32_t value = len == c->size ? get_le(buf, c->size, c->min < 0) : 0;
+    video_error_code_t err = VIDEO_ERROR_NONE;
+    if (len != c->size)
+    {
+        err = VIDEO_ERROR_INVALID_REQUEST;
+    }
+    else if (c->bitmap ? (value & (value - 1)) != 0 || (value & ~c->res) != 0 || value == 0
+                       : value < c->min || value > c->max)
+    {
+        err = VIDEO_ERROR_OUT_OF_RANGE;
+    }
+
+    portENTER_CRITICAL(&ctrl_lock);
+    if (err == VIDEO_ERROR_NONE)
+    {
+        if (dirty_mask & (1u << idx))
+        {
+            ctrl_stats.coalesced++;
+        }
+        shadow[idx] = value;
+        dirty_mask |= 1u << idx;
+        ctrl_stats.set_requests++;
+    }
+    else
+    {
+        ctrl_stats.rejected++;
+    }
+    portEXIT_CRITICAL(&ctrl_lock);
+
+    PIPELINE_TRACE(TAG, "SET_CUR entity %u selector %u = %ld: %d", entity, selector, (long)value, err);
+    return err;
+}
+
+// Writes the controls in mask, in table order
+static void apply_controls(sensor_t *s, uint32_t mask, const int32_t *values)
+{
+    int64_t start = esp_timer_get_time();
+    uint32_t applied = 0;
+    uint32_t failed = 0;
+
+    for (size_t i = 0; i < CONTROL_COUNT; i++)
+    {
+        if (!(mask & (1u << i)))
+        {
+            continue;
+        }
+        if (controls[i].apply(s, values[i]) != 0)
+        {
+            failed++;
+            ESP_LOGW(TAG, "Sensor rejected entity %u selector %u = %ld",
+                     controls[i].entity, controls[i].selector, (long)values[i]);
+        }
+        applied++;
+    }
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    portENTER_CRITICAL(&ctrl_lock);
+    ctrl_stats.applied += applied;
+    ctrl_stats.failed += failed;
+    if (elapsed > ctrl_stats.apply_max_us)
+    {
+        ctrl_stats.apply_max_us = elapsed;
+    }
+    portEXIT_CRITICAL(&ctrl_lock);
+}
+
+void uvc_controls_apply_pending(sensor_t *s)
+{
+    int32_t values[CONTROL_COUNT];
+
+    // Cheap check first: this runs once per frame
+    if (s == NULL || __atomic_load_n(&dirty_mask, __ATOMIC_RELAXED) == 0)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&ctrl_lock);
+    uint32_t mask = dirty_mask;
+    dirty_mask = 0;
+    memcpy(values, shadow, sizeof(values));
+    portEXIT_CRITICAL(&ctrl_lock);
+
+    // SCCB writes block for a while, never inside the critical section
+    apply_controls(s, mask, values);
+}
+
+void uvc_controls_apply_all(sensor_t *s)
+{
+    int32_t values[CONTROL_COUNT];
+
+    if (s == NULL)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&ctrl_lock);
+    dirty_mask = 0;
+    memcpy(values, shadow, sizeof(values));
+    portEXIT_CRITICAL(&ctrl_lock);
+
+    apply_controls(s, (uint32_t)((1ull << CONTROL_COUNT) - 1), values);
+}
+
+void uvc_controls_get_stats(uvc_controls_stats_t *stats)
+{
+    portENTER_CRITICAL(&ctrl_lock);
+    *stats = ctrl_stats;
+    portEXIT_CRITICAL(&ctrl_lock);
+}
@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_camera.h"
+#include "class/video/video.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Entity IDs of the video function: camera terminal -> processing unit ->
+// extension unit -> streaming output terminal
+#define UVC_ENTITY_CAP_INPUT_TERMINAL 1
+#define UVC_ENTITY_CAP_OUTPUT_TERMINAL 2
+#define UVC_ENTITY_PROCESSING_UNIT 3
+#define UVC_ENTITY_EXTENSION_UNIT 4
+
+// Camera Terminal control selectors (UVC 1.5 Table A-12)
+#define UVC_CT_AE_MODE_CONTROL 0x02
+#define UVC_CT_EXPOSURE_TIME_ABSOLUTE_CONTROL 0x04
+#define UVC_CT_ZOOM_ABSOLUTE_CONTROL 0x0B // Digital zoom, 100-400 for 1x..4x
+
+// CT_AE_MODE_CONTROL values
+#define UVC_AE_MODE_MANUAL 0x01
+#define UVC_AE_MODE_AUTO 0x02
+
+// Processing Unit control selectors (UVC 1.5 Table A-13)
+#define UVC_PU_BRIGHTNESS_CONTROL 0x02
+#define UVC_PU_CONTRAST_CONTROL 0x03
+#define UVC_PU_GAIN_CONTROL 0x04
+#define UVC_PU_SATURATION_CONTROL 0x07
+#define UVC_PU_WHITE_BALANCE_TEMPERATURE_AUTO_CONTROL 0x0B
+
+// Vendor Extension Unit control selectors, one byte each
+#define UVC_XU_SPECIAL_EFFECT_CONTROL 0x01 // 0-6: none, negative, grayscale, red, green, blue, sepia
+#define UVC_XU_AWB_GAIN_CONTROL 0x02       // 0/1
+#define UVC_XU_WB_MODE_CONTROL 0x03        // 0-4: auto, sunny, cloudy, office, home
+#define UVC_XU_AEC_DSP_CONTROL 0x04        // 0/1, AEC in the DSP (aec2)
+#define UVC_XU_AE_LEVEL_CONTROL 0x05       // 0-4 for -2..+2
+#define UVC_XU_AGC_CONTROL 0x06            // 0/1, automatic gain
+#define UVC_XU_GAIN_CEILING_CONTROL 0x07   // 0-6 for 2x..128x
+#define UVC_XU_BPC_CONTROL 0x08            // 0/1, black pixel correction
+#define UVC_XU_WPC_CONTROL 0x09            // 0/1, white pixel correction
+#define UVC_XU_RAW_GAMMA_CONTROL 0x0A      // 0/1
+#define UVC_XU_LENS_CORRECTION_CONTROL 0x0B // 0/1
+#define UVC_XU_HMIRROR_CONTROL 0x0C        // 0/1
+#define UVC_XU_VFLIP_CONTROL 0x0D          // 0/1
+#define UVC_XU_DCW_CONTROL 0x0E            // 0/1, downsize in the DSP
+#define UVC_XU_COLORBAR_CONTROL 0x0F       // 0/1, test pattern
+#define UVC_XU_ROI_PAN_CONTROL 0x10        // 2 bytes, -100..100 % of the zoomed window's horizontal travel
+#define UVC_XU_ROI_TILT_CONTROL 0x11       // 2 bytes, -100..100 % of its vertical travel
+#define UVC_XU_CONTROL_COUNT 17
+
+// bmControls of the units, matching the tables in uvc_controls.cpp
+#define UVC_CT_CONTROLS ((1u << 1) | (1u << 3) | (1u << 9))                       // AE mode, exposure time, zoom
+#define UVC_PU_CONTROLS ((1u << 0) | (1u << 1) | (1u << 3) | (1u << 9) | (1u << 12)) // Brightness, contrast, saturation, gain, WB auto
+#define UVC_XU_CONTROLS ((1u << UVC_XU_CONTROL_COUNT) - 1)
+
+// Largest control value, in bytes
+#define UVC_CONTROL_MAX_LEN 4
+
+  typedef struct
+  {
+    uint32_t get_requests;  // GET_* answered from the shadow registers
+    uint32_t set_requests;  // SET_CUR accepted
+    uint32_t rejected;      // Requests refused (unknown control, bad length, out of range)
+    uint32_t applied;       // Sensor writes made at frame boundaries
+    uint32_t coalesced;     // SET_CURs superseded before reaching the sensor
+    uint32_t failed;        // Sensor setter errors
+    uint32_t apply_max_us;  // Longest batch of sensor writes
+  } uvc_controls_stats_t;
+
+  // Shadow registers start at the image tuning defaults
+  void uvc_controls_init(void);
+
+  // USB side, from the control request callback: never touches the sensor.
+  // GET requests fill buf (at most *len bytes) and set *len to the size of
+  // the answer. Returns a VIDEO_ERROR_* code for the request error control.
+  video_error_code_t uvc_controls_get(uint8_t entity, uint8_t selector, uint8_t request, uint8_t *buf, uint16_t *len);
+  video_error_code_t uvc_controls_set(uint8_t entity, uint8_t selector, const uint8_t *buf, uint16_t len);
+
+  // Capture side, between frames: write the controls the host changed since
+  // the last call, each once however often it was set
+  void uvc_controls_apply_pending(sensor_t *s);
+
+  // After a sensor (re)initialization: write every control
+  void uvc_controls_apply_all(sensor_t *s);
+
+  void uvc_controls_get_stats(uvc_controls_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,89 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+
+extern "C" {
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+}
+#include "wifi_sta.h"
+
+static const char *TAG = "WIFI_STA";
+
+static void wifi_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    if (base == WIFI_EVENT && id == WIFI_EVENT_STA_START)
+    {
+        esp_wifi_connect();
+    }
+    else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        // No retry limit: the camera is headless, and the server keeps
+        // listening across reconnects
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)data;
+        ESP_LOGW(TAG, "Disconnected (reason %d), reconnecting", event->reason);
+        esp_wifi_connect();
+    }
+    else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)data;
+        ESP_LOGI(TAG, "Connected, address " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+esp_err_t wifi_sta_start(const char *ssid, const char *password)
+{
+    if (ssid == NULL || ssid[0] == '\0')
+    {
+        ESP_LOGW(TAG, "No Wi-Fi SSID configured");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = esp_netif_init();
+    if (err == ESP_OK)
+    {
+        err = esp_event_loop_create_default();
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Network stack init failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+    err = esp_wifi_init(&init_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Wi-Fi init failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL, NULL);
+    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, NULL, NULL);
+
+    wifi_config_t config;
+    memset(&config, 0, sizeof(config));
+    strlcpy((char *)config.sta.ssid, ssid, sizeof(config.sta.ssid));
+    strlcpy((char *)config.sta.password, password, sizeof(config.sta.password));
+    config.sta.threshold.authmode = password[0] ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+    // Modem sleep holds frames back until the next DTIM beacon, 100 ms or
+    // more, which a video stream cannot hide
+    esp_wifi_set_ps(WIFI_PS_NONE);
+    err = esp_wifi_start();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Wi-Fi start failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Joining \"%s\"", ssid);
+    return ESP_OK;
+}
@@ -0,0 +1,23 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Join the access point as a station and stay joined: disconnects are
+  // retried in the background and the address is logged when assigned.
+  // Returns without waiting for the connection; NVS must be initialized.
+  esp_err_t wifi_sta_start(const char *ssid, const char *password);
+
+#ifdef __cplusplus
+}
+#endif
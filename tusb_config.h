@@ -26,6 +26,8 @@
 #ifndef _TUSB_CONFIG_H_
 #define _TUSB_CONFIG_H_
 
+#include "sdkconfig.h"
+
 #ifdef __cplusplus
  extern "C" {
 #endif
@@ -97,11 +99,37 @@
 // The number of video streaming interfaces
 #define CFG_TUD_VIDEO_STREAMING  1
 
+#if CONFIG_UVC_USB_ISO
+// video streaming endpoint size: one payload per 1 ms frame, up to the
+// largest isochronous alternate setting (FS limit 1023)
+#define CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE  1023
+
+// use isochronous endpoints for streaming interface
+#define CFG_TUD_VIDEO_STREAMING_BULK 0
+#else
 // video streaming endpoint size (FS bulk max packet 64; buffer can be larger)
-#define CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE  256
+#define CFG_TUD_VIDEO_STREAMING_EP_BUFSIZE  CONFIG_UVC_USB_EP_BUFSIZE
 
 // use bulk endpoint for streaming interface
 #define CFG_TUD_VIDEO_STREAMING_BULK 1
+#endif
+
+#if CONFIG_UVC_CDC_TELEMETRY
+// CDC-ACM telemetry and control port; a whole sample must fit in the TX FIFO
+#define CFG_TUD_CDC              1
+#define CFG_TUD_CDC_RX_BUFSIZE   256
+#if CONFIG_UVC_EVENT_RECORDER
+// Recorder dumps: several packets per transfer, and enough queued that the
+// bus does not wait on the low-priority telemetry task
+#define CFG_TUD_CDC_TX_BUFSIZE   4096
+#define CFG_TUD_CDC_EP_BUFSIZE   512
+#else
+#define CFG_TUD_CDC_TX_BUFSIZE   2048
+#define CFG_TUD_CDC_EP_BUFSIZE   64
+#endif
+#else
+#define CFG_TUD_CDC              0
+#endif
 
 #ifdef __cplusplus
  }